@@ -40,24 +40,37 @@ typedef struct _zs_fmetadata_t zs_fmetadata_t;
 zs_fmetadata_t *
     zs_fmetadata_new ();
 
+// Constructor, creates new zs file meta data in arena, which owns it and
+// its strings
+zs_fmetadata_t *
+    zs_fmetadata_new_arena (zsync_arena_t *arena);
+
 // Destructor, destroys file meta data
 void
     zs_fmetadata_destroy (zs_fmetadata_t **self_p);
 
-// getter/setter file path
+// getter/setter file path, the getter returns a copy the caller frees
 void
     zs_fmetadata_set_path (zs_fmetadata_t *self, char* format, ...);
 
 char *
     zs_fmetadata_path (zs_fmetadata_t *self);
 
-// getter/setter renamed file path
+// returns the path without a copy, valid until it's set again
+const char *
+    zs_fmetadata_path_ref (zs_fmetadata_t *self);
+
+// getter/setter renamed file path, the getter returns a copy the caller frees
 void
     zs_fmetadata_set_renamed_path (zs_fmetadata_t *self, char* format, ...);
 
 char *
     zs_fmetadata_renamed_path (zs_fmetadata_t *self);
 
+// returns the renamed path without a copy, valid until it's set again
+const char *
+    zs_fmetadata_renamed_path_ref (zs_fmetadata_t *self);
+
 
 // getter/setter file operation
 void
@@ -87,6 +100,17 @@ void
 uint64_t
     zs_fmetadata_checksum (zs_fmetadata_t *self);
 
+// getter/setter digest, the getter returns the struct's own buffer
+void
+    zs_fmetadata_set_digest (zs_fmetadata_t *self, byte *digest);
+
+byte *
+    zs_fmetadata_digest (zs_fmetadata_t *self);
+
+// Duplicates file meta data onto the heap
+zs_fmetadata_t *
+    zs_fmetadata_dup (zs_fmetadata_t *self);
+
 // Self test this class
 int
     zs_fmetadata_test ();
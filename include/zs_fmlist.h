@@ -0,0 +1,91 @@
+/* =========================================================================
+    zs_fmlist - list of file meta data stored as arrays
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZS_FMLIST_H_INCLUDED__
+#define __ZS_FMLIST_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zs_fmlist_t zs_fmlist_t;
+
+// @interface
+// Creates an empty list of file meta data
+zs_fmlist_t *
+    zs_fmlist_new ();
+
+// Destroys the list and its file meta data
+void
+    zs_fmlist_destroy (zs_fmlist_t **self_p);
+
+// Appends a copy of the file meta data, returns its index
+size_t
+    zs_fmlist_append (zs_fmlist_t *self, zs_fmetadata_t *fmetadata);
+
+// Returns the number of file meta data in the list
+size_t
+    zs_fmlist_size (zs_fmlist_t *self);
+
+// Getters of the file meta data at index, the paths and digest are owned
+// by the list and valid until it's destroyed
+const char *
+    zs_fmlist_path (zs_fmlist_t *self, size_t index);
+
+const char *
+    zs_fmlist_renamed_path (zs_fmlist_t *self, size_t index);
+
+int
+    zs_fmlist_operation (zs_fmlist_t *self, size_t index);
+
+uint64_t
+    zs_fmlist_file_size (zs_fmlist_t *self, size_t index);
+
+uint64_t
+    zs_fmlist_timestamp (zs_fmlist_t *self, size_t index);
+
+uint64_t
+    zs_fmlist_checksum (zs_fmlist_t *self, size_t index);
+
+byte *
+    zs_fmlist_digest (zs_fmlist_t *self, size_t index);
+
+// Returns a copy of the file meta data at index, in the arena if any
+zs_fmetadata_t *
+    zs_fmlist_fmetadata (zs_fmlist_t *self, size_t index, zsync_arena_t *arena);
+
+// Returns the number of bytes held by the list
+size_t
+    zs_fmlist_memory (zs_fmlist_t *self);
+
+// Self test this class
+void
+    zs_fmlist_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,24 @@ extern "C" {
 #define ZS_CMD_GIVE_CREDIT 0x5
 #define ZS_CMD_SEND_CHUNK 0x6 
 #define ZS_CMD_ABORT 0x7
+#define ZS_CMD_REQUEST_DELTA 0x8
+#define ZS_CMD_SEND_DELTA 0x9
+#define ZS_CMD_REQUEST_MANIFEST 0xA
+#define ZS_CMD_SEND_MANIFEST 0xB
+#define ZS_CMD_REQUEST_RANGES 0xC
+#define ZS_CMD_UPDATE_PART 0xD
+
+// UPDATE encodings, GREET announces the best one a peer supports. Only
+// the compact encoding carries file digests, the plain one is the format
+// every peer understands.
+#define ZS_ENCODING_PLAIN 0x0
+#define ZS_ENCODING_COMPACT 0x1
+
+// Protocol features a peer announces in GREET
+#define ZS_FEATURE_UPDATE_PARTS 0x1 // accepts UPDATEs in parts
+
+// Largest UPDATE frame sent at once, longer file lists are split
+#define ZS_UPDATE_BATCH_SIZE (256 * 1024)
 
 // Opaque class structure
 typedef struct _zs_msg_t zs_msg_t;
@@ -59,9 +77,15 @@ void
 zs_msg_t *
     zs_msg_unpack (zmsg_t *input);
 
+// receive messages into an arena, the message and its file meta data are
+// valid until the arena is reset
+zs_msg_t *
+    zs_msg_unpack_arena (zmsg_t *input, zsync_arena_t *arena);
+
 // pack GREET
 int 
-    zs_msg_pack_greet (zmsg_t *output, byte *uuid,  uint64_t state);
+    zs_msg_pack_greet (zmsg_t *output, byte *uuid,  uint64_t state, uint64_t chunk_size,
+        byte encoding, byte features);
  
 // pack LAST_STATE
 int 
@@ -70,11 +94,36 @@ int
 // pack FILE_LIST
 int
     zs_msg_pack_update (zmsg_t *output, uint64_t state, zlist_t *filemeta_list);
+
+// pack FILE_LIST part, further parts follow
+int
+    zs_msg_pack_update_part (zmsg_t *output, uint64_t state, zlist_t *filemeta_list);
+
+// pack FILE_LIST or a part of it (ZS_CMD_UPDATE or ZS_CMD_UPDATE_PART) in
+// the given encoding
+int
+    zs_msg_pack_update_encoded (zmsg_t *output, int cmd, byte encoding, uint64_t state, zlist_t *filemeta_list);
+
+// removes a batch of at most max_size bytes from the head of filemeta_list
+zlist_t *
+    zs_msg_update_batch (zlist_t *filemeta_list, size_t max_size);
  
 // pack REQUEST_FILES
 int
     zs_msg_pack_request_files (zmsg_t *output, zlist_t *fpaths);
 
+// pack REQUEST_FILES with resume offsets and checksums
+int
+    zs_msg_pack_request_resume (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums);
+
+// pack REQUEST_FILES with resume offsets, checksums and an initial credit
+int
+    zs_msg_pack_request_credit (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums, uint64_t credit);
+
+// pack REQUEST_FILES with resume offsets, checksums, an initial credit and a priority
+int
+    zs_msg_pack_request_priority (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums, uint64_t credit, byte priority);
+
 // pack GIVE CREDIT
 int
     zs_msg_pack_give_credit (zmsg_t *output, uint64_t credit);
@@ -83,6 +132,26 @@ int
 int
     zs_msg_pack_chunk (zmsg_t *output, uint64_t sequence, char *file_path, uint64_t offset, zframe_t *chunk);
 
+// pack REQUEST_DELTA
+int
+    zs_msg_pack_request_delta (zmsg_t *output, char *file_path, zframe_t *signature);
+
+// pack SEND_DELTA
+int
+    zs_msg_pack_delta (zmsg_t *output, uint64_t sequence, char *file_path, uint64_t offset, zframe_t *delta);
+
+// pack REQUEST_MANIFEST, takes ownership of fpaths
+int
+    zs_msg_pack_request_manifest (zmsg_t *output, zlist_t *fpaths);
+
+// pack SEND_MANIFEST
+int
+    zs_msg_pack_manifest (zmsg_t *output, char *file_path, zframe_t *manifest);
+
+// pack REQUEST_RANGES
+int
+    zs_msg_pack_request_ranges (zmsg_t *output, char *file_path, zframe_t *ranges);
+
 // pack NO_UPDATE
 int
     zs_msg_pack_abort (zmsg_t *output);
@@ -146,6 +215,30 @@ char *
 void
     zs_msg_fpaths_append (zs_msg_t *self, char *format, ...);
 
+// getter/setter resume offset and checksum of a requested file
+void
+    zs_msg_set_resume (zs_msg_t *self, char *path, uint64_t offset, uint64_t checksum);
+
+uint64_t
+    zs_msg_resume_offset (zs_msg_t *self, char *path);
+
+uint64_t
+    zs_msg_resume_checksum (zs_msg_t *self, char *path);
+
+// getter/setter UPDATE encoding
+void
+    zs_msg_set_encoding (zs_msg_t *self, byte encoding);
+
+byte
+    zs_msg_encoding (zs_msg_t *self);
+
+// getter/setter protocol features, a set of ZS_FEATURE_* flags
+void
+    zs_msg_set_features (zs_msg_t *self, byte features);
+
+byte
+    zs_msg_features (zs_msg_t *self);
+
 // getter/setter message credit
 void
     zs_msg_set_credit (zs_msg_t *self, uint64_t credit);
@@ -153,6 +246,20 @@ void
 uint64_t
     zs_msg_get_credit (zs_msg_t *self);
 
+// getter/setter priority of REQUEST_FILES
+void
+    zs_msg_set_priority (zs_msg_t *self, byte priority);
+
+byte
+    zs_msg_get_priority (zs_msg_t *self);
+
+// getter/setter max chunk size
+void
+    zs_msg_set_chunk_size (zs_msg_t *self, uint64_t chunk_size);
+
+uint64_t
+    zs_msg_get_chunk_size (zs_msg_t *self);
+
 // getter/setter message chunk
 void
     zs_msg_set_chunk (zs_msg_t *self, zframe_t *chunk);
@@ -160,6 +267,15 @@ void
 zframe_t *
     zs_msg_get_chunk (zs_msg_t *self);
 
+// detach file meta data list, caller takes ownership. Items of a message
+// unpacked into an arena are still owned by the arena
+zlist_t *
+    zs_msg_detach_fmetadata (zs_msg_t *self);
+
+// detach message chunk, caller takes ownership
+zframe_t *
+    zs_msg_detach_chunk (zs_msg_t *self);
+
 // getter/setter message sequence
 void
     zs_msg_set_sequence (zs_msg_t *self, uint64_t seq);
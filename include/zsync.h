@@ -42,9 +42,20 @@ extern "C" {
 
 //  Classes in the API
 
+#include "zsync_hash.h"
+#include "zsync_delta.h"
+#include "zsync_cdc.h"
+#include "zsync_chunkstore.h"
+#include "zsync_arena.h"
+#include "zsync_bucket.h"
 #include "zs_fmetadata.h"
+#include "zs_fmlist.h"
 #include "zs_msg.h"
 #include "zsync_peer.h"
+#include "zsync_recordlog.h"
+#include "zsync_changelog.h"
+#include "zsync_scanner.h"
+#include "zsync_watcher.h"
 #include "zsync_ftmanager.h"
 #include "zsync_credit.h"
 #include "zsync_node.h"
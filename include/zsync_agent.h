@@ -31,6 +31,10 @@ extern "C" {
 // Opaque class structure
 typedef struct _zsync_t zsync_t;
 
+// Priorities of requested files, values in between may be used as well
+#define ZSYNC_PRIORITY_BULK 0
+#define ZSYNC_PRIORITY_INTERACTIVE 255
+
 // Create a new zsync
 zsync_t *
     zsync_new ();
@@ -50,12 +54,104 @@ void
 void 
     zsync_send_request_files (zsync_t *agent, char *sender, zlist_t *list, uint64_t total_bytes);
 
+// Requests files which are sent before files with a lower priority
+void 
+    zsync_send_request_files_priority (zsync_t *agent, char *sender, zlist_t *list, uint64_t total_bytes, byte priority);
+
+// Sends the changes since state to peers, long lists are split into
+// parts. Takes ownership of list.
 void 
     zsync_send_update (zsync_t *agent, uint64_t state, zlist_t *list);
 
+// Answers a REQ_UPDATE with the changes since the requested state, long
+// lists are split into parts. Takes ownership of list.
+void
+    zsync_reply_update (zsync_t *self, uint64_t state, zlist_t *list);
+
+// Sends a part of the changes, the last part is sent with
+// zsync_send_update. Takes ownership of list.
+void
+    zsync_send_update_part (zsync_t *self, uint64_t state, zlist_t *list);
+
+// Requests the changes of a file relative to the local copy described by
+// signature, see zsync_delta_signature. Takes ownership of signature.
+void
+    zsync_send_request_delta (zsync_t *self, char *receiver, char *path, zframe_t **signature_p, uint64_t size);
+
+// Requests the chunk manifests of files, see zsync_cdc_manifest
+void
+    zsync_send_request_manifest (zsync_t *self, char *receiver, zlist_t *files);
+
+// Answers a manifest request. Takes ownership of manifest.
+void
+    zsync_send_manifest (zsync_t *self, char *receiver, char *path, zframe_t **manifest_p);
+
+// Requests the byte ranges of a file which are not available locally, see
+// zsync_chunkstore_assemble. Takes ownership of ranges.
+void
+    zsync_send_request_ranges (zsync_t *self, char *receiver, char *path, zframe_t **ranges_p);
+
 void 
     zsync_send_abort (zsync_t *agent, char *sender, char *fileToAbort);
 
+// Sets the chunk size offered to peers, before the protocol is started
+void
+    zsync_set_chunk_size (zsync_t *self, uint64_t chunk_size);
+
+// Returns the chunk size offered to peers
+uint64_t
+    zsync_chunk_size (zsync_t *self);
+
+// Enables chunks to grow up to the chunk size depending on throughput
+void
+    zsync_set_adaptive_chunks (zsync_t *self, bool adaptive);
+
+// Returns whether adaptive chunks are enabled
+bool
+    zsync_adaptive_chunks (zsync_t *self);
+
+// Delivers received chunks as CHUNK_FRAME without copying instead of CHUNK
+void
+    zsync_set_zero_copy_chunks (zsync_t *self, bool zero_copy);
+
+// Returns whether received chunks are delivered as CHUNK_FRAME
+bool
+    zsync_zero_copy_chunks (zsync_t *self);
+
+// Enables credit windows sized to each peer's bandwidth-delay product
+void
+    zsync_set_adaptive_credit (zsync_t *self, bool adaptive);
+
+// Returns whether adaptive credit is enabled
+bool
+    zsync_adaptive_credit (zsync_t *self);
+
+// Enables credit to follow the bytes written to disk instead of the bytes
+// received, see zsync_persisted
+void
+    zsync_set_write_backpressure (zsync_t *self, bool backpressure);
+
+// Returns whether write backpressure is enabled
+bool
+    zsync_write_backpressure (zsync_t *self);
+
+// Reports bytes of a received chunk or delta written to disk at offset
+// of path, transfers resume after them
+void
+    zsync_persisted (zsync_t *self, char *path, uint64_t offset, uint64_t bytes);
+
+// Sets the share of bandwidth a peer gets relative to other peers
+void
+    zsync_set_peer_weight (zsync_t *self, char *peer, uint32_t weight);
+
+// Limits the bytes per second sent to a peer, or to all peers if NULL
+void
+    zsync_set_upload_rate (zsync_t *self, char *peer, uint64_t rate);
+
+// Limits the bytes per second received from a peer, or from all peers if NULL
+void
+    zsync_set_download_rate (zsync_t *self, char *peer, uint64_t rate);
+
 bool
     zsync_running (zsync_t *self);
 
@@ -0,0 +1,73 @@
+/* =========================================================================
+    zsync_arena - region allocator for decoded messages
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_ARENA_H_INCLUDED__
+#define __ZSYNC_ARENA_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_arena_t zsync_arena_t;
+
+
+// @interface
+
+// Creates an arena which allocates in blocks of block_size bytes, 0 uses
+// the default size
+zsync_arena_t *
+    zsync_arena_new (size_t block_size);
+
+// Frees the arena and everything allocated from it
+void
+    zsync_arena_destroy (zsync_arena_t **self_p);
+
+// Allocates size bytes of zeroed memory, aligned for any type. The memory
+// lives until the arena is reset or destroyed.
+void *
+    zsync_arena_alloc (zsync_arena_t *self, size_t size);
+
+// Copies size bytes of string into the arena and terminates them
+char *
+    zsync_arena_strndup (zsync_arena_t *self, const char *string, size_t size);
+
+// Frees everything allocated from the arena at once, the first block is
+// kept for further allocations
+void
+    zsync_arena_reset (zsync_arena_t *self);
+
+// Returns the number of bytes allocated from the arena
+size_t
+    zsync_arena_size (zsync_arena_t *self);
+
+// Selftest
+void
+    zsync_arena_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/* =========================================================================
+    zsync_bucket - token bucket for rate limits
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_BUCKET_H_INCLUDED__
+#define __ZSYNC_BUCKET_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_bucket_t zsync_bucket_t;
+
+
+// @interface
+
+// Creates a token bucket which lets rate bytes per second pass, 0 lets
+// everything pass
+zsync_bucket_t *
+    zsync_bucket_new (uint64_t rate);
+
+// Destroys the bucket
+void
+    zsync_bucket_destroy (zsync_bucket_t **self_p);
+
+// Sets the rate in bytes per second, 0 lets everything pass. The bucket
+// holds at most a quarter of a second's worth of bytes.
+void
+    zsync_bucket_set_rate (zsync_bucket_t *self, uint64_t rate);
+
+// Returns the rate in bytes per second
+uint64_t
+    zsync_bucket_rate (zsync_bucket_t *self);
+
+// Returns the bytes which may pass at time now in msecs, 0 if none.
+// Unlimited buckets return UINT64_MAX.
+uint64_t
+    zsync_bucket_available (zsync_bucket_t *self, int64_t now);
+
+// Takes bytes from the bucket. More than available may be taken, e.g. a
+// whole chunk, the bucket then stays empty until the debt is paid off.
+void
+    zsync_bucket_consume (zsync_bucket_t *self, uint64_t bytes, int64_t now);
+
+// Returns the msecs until bytes may pass again, 0 if they may now
+int64_t
+    zsync_bucket_wait (zsync_bucket_t *self, int64_t now);
+
+// Selftest
+void
+    zsync_bucket_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
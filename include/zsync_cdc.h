@@ -0,0 +1,98 @@
+/* =========================================================================
+    zsync_cdc - content-defined chunking
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_CDC_H_INCLUDED__
+#define __ZSYNC_CDC_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_cdc_t zsync_cdc_t;
+
+
+// @interface
+
+// Constructs a chunker. Chunks are at least min_size and at most max_size
+// bytes and avg_size on average, 0 selects the default for each size.
+zsync_cdc_t *
+    zsync_cdc_new (uint32_t min_size, uint32_t avg_size, uint32_t max_size);
+
+// Destroys the chunker
+void
+    zsync_cdc_destroy (zsync_cdc_t **self_p);
+
+// Returns the length of the first chunk of data. If there is no boundary
+// within size bytes and size is less than the maximum chunk size, size is
+// returned and the chunk is only complete at the end of the file.
+size_t
+    zsync_cdc_cut (zsync_cdc_t *self, const byte *data, size_t size);
+
+// Splits the file at path into chunks and returns its manifest, the length
+// and SHA-256 of every chunk. Returns NULL if the file could not be read.
+zframe_t *
+    zsync_cdc_manifest (zsync_cdc_t *self, const char *path);
+
+// Returns the size of the file a manifest describes, or -1 if the
+// manifest is malformed
+int64_t
+    zsync_cdc_manifest_size (zframe_t *manifest);
+
+// Returns the number of chunks in a well-formed manifest
+size_t
+    zsync_cdc_manifest_count (zframe_t *manifest);
+
+// Gets length and digest of the chunk at index of a well-formed manifest.
+// The digest points into the manifest.
+void
+    zsync_cdc_manifest_chunk (zframe_t *manifest, size_t index,
+        uint32_t *length, byte **digest);
+
+// Encodes count byte ranges of a file as a frame
+zframe_t *
+    zsync_cdc_ranges_new (uint64_t *offsets, uint64_t *lengths, size_t count);
+
+// Returns the number of ranges in a frame, or -1 if it is malformed
+int64_t
+    zsync_cdc_ranges_count (zframe_t *ranges);
+
+// Gets offset and length of the range at index of a well-formed frame
+void
+    zsync_cdc_ranges_get (zframe_t *ranges, size_t index,
+        uint64_t *offset, uint64_t *length);
+
+// Returns the number of bytes the ranges of a well-formed frame cover
+uint64_t
+    zsync_cdc_ranges_size (zframe_t *ranges);
+
+// Selftest
+void
+    zsync_cdc_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
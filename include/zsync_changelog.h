@@ -0,0 +1,94 @@
+/* =========================================================================
+    zsync_changelog - persistent index of file changes by state
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_CHANGELOG_H_INCLUDED__
+#define __ZSYNC_CHANGELOG_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_changelog_t zsync_changelog_t;
+
+
+// @interface
+
+// Opens the change log at path and replays the changes recorded in it
+zsync_changelog_t *
+    zsync_changelog_new (const char *path);
+
+// Flushes pending changes and closes the change log
+void
+    zsync_changelog_destroy (zsync_changelog_t **self_p);
+
+// Records a copy of the file meta data as changed at state, superseding
+// earlier changes of the same path. States must not decrease. The change
+// is written on the next flush. Returns 0 on success, -1 if state is
+// older than the last recorded one.
+int
+    zsync_changelog_append (zsync_changelog_t *self, uint64_t state, zs_fmetadata_t *fmetadata);
+
+// Returns a list of zs_fmetadata_t for all files that changed after
+// from_state in the order they changed, or NULL if nothing changed. A
+// full update from state 0 leaves out deleted files. Caller owns list
+// and entries.
+zlist_t *
+    zsync_changelog_update (zsync_changelog_t *self, uint64_t from_state);
+
+// Writes all pending changes to disk and syncs them. Compacts the log if
+// it holds many superseded records. Returns 0 on success, -1 on failure.
+int
+    zsync_changelog_flush (zsync_changelog_t *self);
+
+// Rewrites the log with the last change of every path and atomically
+// replaces the old file. Returns 0 on success, -1 on failure.
+int
+    zsync_changelog_compact (zsync_changelog_t *self);
+
+// Returns true if there are changes that have not been flushed yet
+bool
+    zsync_changelog_dirty (zsync_changelog_t *self);
+
+// Returns the state of the last recorded change, 0 if there is none
+uint64_t
+    zsync_changelog_state (zsync_changelog_t *self);
+
+// Returns the number of paths in the index, including deleted ones
+size_t
+    zsync_changelog_size (zsync_changelog_t *self);
+
+// Returns the number of records in the log file
+size_t
+    zsync_changelog_records (zsync_changelog_t *self);
+
+// Selftest
+void
+    zsync_changelog_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
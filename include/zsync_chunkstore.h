@@ -0,0 +1,106 @@
+/* =========================================================================
+    zsync_chunkstore - local store of chunks by digest
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_CHUNKSTORE_H_INCLUDED__
+#define __ZSYNC_CHUNKSTORE_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_chunkstore_t zsync_chunkstore_t;
+
+
+// @interface
+
+// Constructs a chunk store for the files below root and loads its index
+zsync_chunkstore_t *
+    zsync_chunkstore_new (const char *root);
+
+// Saves the index if it changed and destroys the chunk store
+void
+    zsync_chunkstore_destroy (zsync_chunkstore_t **self_p);
+
+// Splits the file at path, relative to root, into chunks and adds them to
+// the index. Returns the number of chunks or -1 if the file could not be
+// read.
+int
+    zsync_chunkstore_add_file (zsync_chunkstore_t *self, const char *path);
+
+// Adds the chunks of a file, which has been written according to its
+// manifest, to the index without reading it again
+void
+    zsync_chunkstore_add_manifest (zsync_chunkstore_t *self, const char *path,
+        zframe_t *manifest);
+
+// Returns true if a chunk with digest is known
+bool
+    zsync_chunkstore_has (zsync_chunkstore_t *self, byte *digest);
+
+// Reads the chunk with digest. Returns NULL if it is unknown or its file
+// changed meanwhile, in which case it is dropped from the index.
+zframe_t *
+    zsync_chunkstore_read (zsync_chunkstore_t *self, byte *digest);
+
+// Writes all chunks of a manifest which are known locally to the partial
+// file of path, relative to root. Chunks of the current version of path
+// are reused at any offset, the file at path stays untouched until the
+// partial file is completed. Returns the byte ranges that still have to
+// be transferred, or NULL if the manifest is malformed or the partial
+// file could not be written.
+zframe_t *
+    zsync_chunkstore_assemble (zsync_chunkstore_t *self, zframe_t *manifest,
+        const char *path);
+
+// Writes received bytes at offset to the partial file of path. Returns 0
+// on success, -1 on failure.
+int
+    zsync_chunkstore_write (zsync_chunkstore_t *self, const char *path,
+        uint64_t offset, byte *data, size_t size);
+
+// Replaces the file at path with its partial file once every chunk of the
+// manifest is in place, and indexes its chunks. Returns 0 on success, -1
+// if ranges are still missing or the file could not be replaced.
+int
+    zsync_chunkstore_complete (zsync_chunkstore_t *self, zframe_t *manifest,
+        const char *path);
+
+// Returns the number of chunks in the index
+size_t
+    zsync_chunkstore_size (zsync_chunkstore_t *self);
+
+// Writes the index to disk. Returns 0 on success, -1 on failure.
+int
+    zsync_chunkstore_save (zsync_chunkstore_t *self);
+
+// Selftest
+void
+    zsync_chunkstore_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
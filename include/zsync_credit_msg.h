@@ -41,6 +41,7 @@
     REQUEST - Bytes requested from other peer
         sender              string      
         req_bytes           number 8    
+        chunk_size          number 8    Largest chunk the other peer may send
 
     UPDATE - Bytes received from other peer
         sender              string      
@@ -51,8 +52,29 @@
         credit              msg         
 
     ABORT - Abort sending credit to other peer
+        sender              string      
 
     TERMINATE - Terminate the worker thread
+
+    WEIGHT - Sets the weight of the sender when sharing credit
+        sender              string      UUID that identifies the sender
+        weight              number 4    Share of the credit relative to other peers
+
+    PERSISTED - Bytes of received chunks written to disk by the agent
+        persisted_bytes     number 8    Bytes written to disk
+
+    REQUEST_CREDIT - Bytes requested from other peer, answered right away with INITIAL_CREDIT
+        sender              string      
+        req_bytes           number 8    
+        chunk_size          number 8    Largest chunk the other peer may send
+
+    INITIAL_CREDIT - Answers REQUEST_CREDIT with the credit for the receiver
+        receiver            string      
+        initial_credit      number 8    Credit to send along with the request, may be 0
+
+    RATE - Sets the download rate limit of the sender, or of all peers if empty
+        sender              string      
+        rate                number 8    Bytes per second, 0 for unlimited
 */
 
 #define ZSYNC_CREDIT_MSG_VERSION            1
@@ -62,6 +84,11 @@
 #define ZSYNC_CREDIT_MSG_GIVE_CREDIT        3
 #define ZSYNC_CREDIT_MSG_ABORT              4
 #define ZSYNC_CREDIT_MSG_TERMINATE          5
+#define ZSYNC_CREDIT_MSG_WEIGHT             6
+#define ZSYNC_CREDIT_MSG_PERSISTED          7
+#define ZSYNC_CREDIT_MSG_REQUEST_CREDIT     8
+#define ZSYNC_CREDIT_MSG_INITIAL_CREDIT     9
+#define ZSYNC_CREDIT_MSG_RATE               10
 
 #ifdef __cplusplus
 extern "C" {
@@ -112,7 +139,8 @@ int
 int
     zsync_credit_msg_send_request (void *output,
         char *sender,
-        uint64_t req_bytes);
+        uint64_t req_bytes,
+        uint64_t chunk_size);
     
 //  Send the UPDATE to the output in one step
 int
@@ -128,12 +156,43 @@ int
     
 //  Send the ABORT to the output in one step
 int
-    zsync_credit_msg_send_abort (void *output);
+    zsync_credit_msg_send_abort (void *output,
+        char *sender);
     
 //  Send the TERMINATE to the output in one step
 int
     zsync_credit_msg_send_terminate (void *output);
     
+//  Send the WEIGHT to the output in one step
+int
+    zsync_credit_msg_send_weight (void *output,
+        char *sender,
+        uint32_t weight);
+    
+//  Send the PERSISTED to the output in one step
+int
+    zsync_credit_msg_send_persisted (void *output,
+        uint64_t persisted_bytes);
+    
+//  Send the REQUEST_CREDIT to the output in one step
+int
+    zsync_credit_msg_send_request_credit (void *output,
+        char *sender,
+        uint64_t req_bytes,
+        uint64_t chunk_size);
+    
+//  Send the INITIAL_CREDIT to the output in one step
+int
+    zsync_credit_msg_send_initial_credit (void *output,
+        char *receiver,
+        uint64_t initial_credit);
+    
+//  Send the RATE to the output in one step
+int
+    zsync_credit_msg_send_rate (void *output,
+        char *sender,
+        uint64_t rate);
+    
 //  Duplicate the zsync_credit_msg message
 zsync_credit_msg_t *
     zsync_credit_msg_dup (zsync_credit_msg_t *self);
@@ -168,6 +227,12 @@ uint64_t
 void
     zsync_credit_msg_set_req_bytes (zsync_credit_msg_t *self, uint64_t req_bytes);
 
+//  Get/set the chunk_size field
+uint64_t
+    zsync_credit_msg_chunk_size (zsync_credit_msg_t *self);
+void
+    zsync_credit_msg_set_chunk_size (zsync_credit_msg_t *self, uint64_t chunk_size);
+
 //  Get/set the recv_bytes field
 uint64_t
     zsync_credit_msg_recv_bytes (zsync_credit_msg_t *self);
@@ -186,6 +251,30 @@ zmsg_t *
 void
     zsync_credit_msg_set_credit (zsync_credit_msg_t *self, zmsg_t *msg);
 
+//  Get/set the weight field
+uint32_t
+    zsync_credit_msg_weight (zsync_credit_msg_t *self);
+void
+    zsync_credit_msg_set_weight (zsync_credit_msg_t *self, uint32_t weight);
+
+//  Get/set the persisted_bytes field
+uint64_t
+    zsync_credit_msg_persisted_bytes (zsync_credit_msg_t *self);
+void
+    zsync_credit_msg_set_persisted_bytes (zsync_credit_msg_t *self, uint64_t persisted_bytes);
+
+//  Get/set the initial_credit field
+uint64_t
+    zsync_credit_msg_initial_credit (zsync_credit_msg_t *self);
+void
+    zsync_credit_msg_set_initial_credit (zsync_credit_msg_t *self, uint64_t initial_credit);
+
+//  Get/set the rate field
+uint64_t
+    zsync_credit_msg_rate (zsync_credit_msg_t *self);
+void
+    zsync_credit_msg_set_rate (zsync_credit_msg_t *self, uint64_t rate);
+
 //  Self test of this class
 int
     zsync_credit_msg_test (bool verbose);
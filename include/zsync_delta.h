@@ -0,0 +1,93 @@
+/* =========================================================================
+    zsync_delta - block level delta encoding
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_DELTA_H_INCLUDED__
+#define __ZSYNC_DELTA_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_delta_t zsync_delta_t;
+
+
+// @interface
+
+// Computes the block signatures of the file at path, which the sending
+// peer uses to find the blocks the requester already has. If block_size
+// is 0 it is chosen from the file size. Returns NULL if the file could
+// not be read.
+zframe_t *
+    zsync_delta_signature (const char *path, uint32_t block_size);
+
+// Constructs a delta encoder from the signatures of the requester's copy
+zsync_delta_t *
+    zsync_delta_new (zframe_t *signature);
+
+// Destroys the delta encoder
+void
+    zsync_delta_destroy (zsync_delta_t **self_p);
+
+// Encodes the next size bytes of the new file. Returns a frame of copy
+// and literal instructions for the part of the input that has been
+// resolved, bytes that might still start a matching block are held back
+// until more data or the last part arrives.
+zframe_t *
+    zsync_delta_feed (zsync_delta_t *self, byte *data, size_t size, bool last);
+
+// Returns the number of bytes of the new file that were fed so far
+uint64_t
+    zsync_delta_consumed (zsync_delta_t *self);
+
+// Returns the offset in the new file at which the next frame of
+// instructions starts
+uint64_t
+    zsync_delta_offset (zsync_delta_t *self);
+
+// Returns the number of bytes sent as literals so far
+uint64_t
+    zsync_delta_literal_bytes (zsync_delta_t *self);
+
+// Returns the number of bytes of the new file a frame of instructions
+// describes, or -1 if the frame is malformed
+int64_t
+    zsync_delta_target_size (zframe_t *delta);
+
+// Applies a frame of instructions to target_path at offset, copying
+// blocks from basis_path. Target and basis must be different files.
+// Returns 0 on success, -1 on failure.
+int
+    zsync_delta_apply (zframe_t *delta, const char *basis_path,
+        const char *target_path, uint64_t offset);
+
+// Selftest
+void
+    zsync_delta_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -41,6 +41,10 @@
     REQUEST - Sends a list of files requested by sender
         sender              string      UUID that identifies the sender
         paths               strings     
+        chunk_size          number 8    Initial size of chunks in bytes
+        max_chunk_size      number 8    Size chunks may grow to in bytes
+        priority            number 1    Priority of the files, higher is sent first
+        sizes               frame       Sizes of the files as 8-byte host integers, 0 if unknown
 
     CREDIT - Sends an approved credit amount by sender
         sender              string      UUID that identifies the sender
@@ -58,6 +62,20 @@
         path                string      
 
     TERMINATE - Terminate the worker thread
+
+    WEIGHT - Sets the weight of the sender when scheduling chunks
+        sender              string      UUID that identifies the sender
+        weight              number 4    Share of the bandwidth relative to other peers
+
+    RANGES - Requests only some byte ranges of a file
+        sender              string      UUID that identifies the sender
+        path                string      Path of the file
+        priority            number 1    Priority of the file, higher is sent first
+        ranges              frame       Byte ranges of the file to transfer
+
+    RATE - Sets the upload rate limit of the sender or of all peers
+        sender              string      UUID that identifies the sender, empty for all peers
+        rate                number 8    Bytes per second, 0 for unlimited
 */
 
 #define ZSYNC_FTM_MSG_VERSION               1
@@ -67,6 +85,9 @@
 #define ZSYNC_FTM_MSG_CHUNK                 3
 #define ZSYNC_FTM_MSG_ABORT                 4
 #define ZSYNC_FTM_MSG_TERMINATE             5
+#define ZSYNC_FTM_MSG_WEIGHT                6
+#define ZSYNC_FTM_MSG_RANGES                7
+#define ZSYNC_FTM_MSG_RATE                  8
 
 #ifdef __cplusplus
 extern "C" {
@@ -117,7 +138,11 @@ int
 int
     zsync_ftm_msg_send_request (void *output,
         char *sender,
-        zlist_t *paths);
+        zlist_t *paths,
+        uint64_t chunk_size,
+        uint64_t max_chunk_size,
+        byte priority,
+        zframe_t *sizes);
     
 //  Send the CREDIT to the output in one step
 int
@@ -144,6 +169,26 @@ int
 int
     zsync_ftm_msg_send_terminate (void *output);
     
+//  Send the WEIGHT to the output in one step
+int
+    zsync_ftm_msg_send_weight (void *output,
+        char *sender,
+        uint32_t weight);
+    
+//  Send the RANGES to the output in one step
+int
+    zsync_ftm_msg_send_ranges (void *output,
+        char *sender,
+        char *path,
+        byte priority,
+        zframe_t *ranges);
+    
+//  Send the RATE to the output in one step
+int
+    zsync_ftm_msg_send_rate (void *output,
+        char *sender,
+        uint64_t rate);
+    
 //  Duplicate the zsync_ftm_msg message
 zsync_ftm_msg_t *
     zsync_ftm_msg_dup (zsync_ftm_msg_t *self);
@@ -212,6 +257,24 @@ uint64_t
 void
     zsync_ftm_msg_set_sequence (zsync_ftm_msg_t *self, uint64_t sequence);
 
+//  Get/set the max_chunk_size field
+uint64_t
+    zsync_ftm_msg_max_chunk_size (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_max_chunk_size (zsync_ftm_msg_t *self, uint64_t max_chunk_size);
+
+//  Get/set the priority field
+byte
+    zsync_ftm_msg_priority (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_priority (zsync_ftm_msg_t *self, byte priority);
+
+//  Get/set the sizes field
+zframe_t *
+    zsync_ftm_msg_sizes (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_sizes (zsync_ftm_msg_t *self, zframe_t *frame);
+
 //  Get/set the chunk_size field
 uint64_t
     zsync_ftm_msg_chunk_size (zsync_ftm_msg_t *self);
@@ -224,6 +287,24 @@ uint64_t
 void
     zsync_ftm_msg_set_offset (zsync_ftm_msg_t *self, uint64_t offset);
 
+//  Get/set the weight field
+uint32_t
+    zsync_ftm_msg_weight (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_weight (zsync_ftm_msg_t *self, uint32_t weight);
+
+//  Get/set the ranges field
+zframe_t *
+    zsync_ftm_msg_ranges (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_ranges (zsync_ftm_msg_t *self, zframe_t *frame);
+
+//  Get/set the rate field
+uint64_t
+    zsync_ftm_msg_rate (zsync_ftm_msg_t *self);
+void
+    zsync_ftm_msg_set_rate (zsync_ftm_msg_t *self, uint64_t rate);
+
 //  Self test of this class
 int
     zsync_ftm_msg_test (bool verbose);
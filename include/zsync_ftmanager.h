@@ -28,7 +28,10 @@
 extern "C" {
 #endif
 
+// Default and smallest size of a chunk in bytes
 #define CHUNK_SIZE 30000
+// Largest size of a chunk in bytes
+#define CHUNK_SIZE_MAX (1024 * 1024 * 4)
 
 // Start the file transfer manager as thread and provide a pipe to comminicate
 // back and forth. The file transfer manager expects a zsync_agent as arguments.
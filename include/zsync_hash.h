@@ -0,0 +1,98 @@
+/* =========================================================================
+    zsync_hash - content checksums and digests
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_HASH_H_INCLUDED__
+#define __ZSYNC_HASH_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of a SHA-256 digest in bytes
+#define ZSYNC_DIGEST_SIZE 32
+
+// Opaque class structure
+typedef struct _zsync_hash_t zsync_hash_t;
+
+
+// @interface
+
+// Constructs a streaming hash. The XXH64 checksum is always computed,
+// the SHA-256 digest only if strong is true.
+zsync_hash_t *
+    zsync_hash_new (bool strong);
+
+// Destroys the hash
+void
+    zsync_hash_destroy (zsync_hash_t **self_p);
+
+// Adds data to the hash
+void
+    zsync_hash_update (zsync_hash_t *self, const void *data, size_t size);
+
+// Returns the XXH64 checksum of the data added so far
+uint64_t
+    zsync_hash_checksum (zsync_hash_t *self);
+
+// Writes the SHA-256 digest of the data added so far to digest, which
+// must hold ZSYNC_DIGEST_SIZE bytes
+void
+    zsync_hash_digest (zsync_hash_t *self, byte *digest);
+
+// Returns the XXH64 checksum of a block, e.g. a chunk
+uint64_t
+    zsync_hash_xxh64 (const void *data, size_t size, uint64_t seed);
+
+// Writes the SHA-256 digest of a block to digest
+void
+    zsync_hash_sha256 (const void *data, size_t size, byte *digest);
+
+// Hashes a file. The digest is skipped if digest is NULL.
+// Returns 0 on success, -1 if the file could not be read.
+int
+    zsync_hash_file (const char *path, uint64_t *checksum, byte *digest);
+
+// Hashes count files below root with a pool of threads. Stores the
+// checksums and, unless digests is NULL, ZSYNC_DIGEST_SIZE bytes of digest
+// per file. A file that could not be read gets checksum 0 and a zeroed
+// digest. Returns the number of files that could not be read.
+int
+    zsync_hash_paths (const char *root, char **paths, size_t count,
+        uint64_t *checksums, byte *digests, int threads);
+
+// Sets checksum and digest of every ZS_FILE_OP_UPD entry in a list of
+// zs_fmetadata_t with paths relative to root. Returns the number of files
+// that could not be read.
+int
+    zsync_hash_fmetadata (const char *root, zlist_t *fmetadata, int threads);
+
+// Selftest
+void
+    zsync_hash_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
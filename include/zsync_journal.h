@@ -0,0 +1,84 @@
+/* =========================================================================
+    zsync_journal - append-only journal of peer states
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_JOURNAL_H_INCLUDED__
+#define __ZSYNC_JOURNAL_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_journal_t zsync_journal_t;
+
+
+// @interface
+
+// Opens the journal at path and replays the states recorded in it
+zsync_journal_t *
+    zsync_journal_new (const char *path);
+
+// Flushes pending states and closes the journal
+void
+    zsync_journal_destroy (zsync_journal_t **self_p);
+
+// Records the state of a peer, the record is written on the next flush
+void
+    zsync_journal_append (zsync_journal_t *self, char *uuid, uint64_t state);
+
+// Writes all pending states to disk and syncs them. Compacts the journal
+// if it has grown too large. Returns 0 on success, -1 on failure.
+int
+    zsync_journal_flush (zsync_journal_t *self);
+
+// Rewrites the journal with one record per peer and atomically replaces
+// the old file. Returns 0 on success, -1 on failure.
+int
+    zsync_journal_compact (zsync_journal_t *self);
+
+// Returns true if there are states that have not been flushed yet
+bool
+    zsync_journal_dirty (zsync_journal_t *self);
+
+// Returns the uuids of all known peers, caller must destroy the list
+zlist_t *
+    zsync_journal_uuids (zsync_journal_t *self);
+
+// Returns the last recorded state of a peer or 0 if the peer is unknown
+uint64_t
+    zsync_journal_state (zsync_journal_t *self, char *uuid);
+
+// Returns the number of records in the journal file
+size_t
+    zsync_journal_records (zsync_journal_t *self);
+
+// Selftest
+void
+    zsync_journal_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -54,14 +54,18 @@
         receiver            string      UUID that identifies the receiver
         files               strings     List of file names
         size                number 8    Total size of all files in bytes
+        priority            number 1    Priority of the files, higher is sent first
 
-    REQ_CHUNK - Requests a chunk of 'chunk_size' data from 'path' at 'offset'.
+    REQ_CHUNK - Requests a chunk of 'chunk_size' data from 'path' at 'offset'. Several
+requests may be outstanding, responses are matched by 'sequence'.
         path                string      Path of file that the 'chunk' belongs to 
         chunk_size          number 8    Size of the requested chunk in bytes
         offset              number 8    File offset for for the chunk in bytes
+        sequence            number 8    Identifies the request, must be sent back with the response
 
     RES_CHUNK - Responds with the requested chunk.
         chunk               chunk       Requested chunk
+        sequence            number 8    Sequence of the answered REQ_CHUNK
 
     CHUNK - Sends one 'chunk' of data of a file at the 'path'.
         chunk               chunk       This chunk is part of the file at 'path'
@@ -74,6 +78,69 @@
         path                string      
 
     TERMINATE - Terminate all worker threads.
+
+    CHUNK_FRAME - Sends one chunk of data of a file at the 'path'. Unlike CHUNK the data is
+not serialized, the frame received from the network is handed on as is.
+        path                string      Path of file that the 'frame' belongs to
+        sequence            number 8    Defines which chunk of the file at 'path' this is!
+        offset              number 8    Offset for this 'frame' in bytes
+        frame               frame       Chunk data as received from the remote peer
+
+    RES_CHUNK_FRAME - Responds with the requested chunk as frame which is whispered to the remote
+peer without copying. Use zframe_new_zero_copy to hand over a memory region
+together with a free callback.
+        sequence            number 8    Sequence of the answered REQ_CHUNK
+        frame               frame       Requested chunk
+
+    WEIGHT - Sets the weight of a remote peer when sending it chunks, defaults to 1
+        receiver            string      UUID that identifies the receiver
+        weight              number 4    Share of the bandwidth relative to other peers
+
+    REQ_DELTA - Requests the changes of a file from receiver relative to the local copy
+which is described by its block signatures.
+        receiver            string      UUID that identifies the receiver
+        path                string      Path of the requested file
+        size                number 8    Size of the file in bytes
+        frame               frame       Block signatures of the local copy, see zsync_delta_signature
+
+    DELTA - Sends delta instructions which rebuild a part of the file at 'path' from
+the local copy and literal data.
+        path                string      Path of file that the instructions belong to
+        sequence            number 8    Defines which part of the file at 'path' this is
+        offset              number 8    Offset in the file at which the instructions start
+        frame               frame       Copy and literal instructions, see zsync_delta_apply
+
+    REQ_MANIFEST - Requests the chunk manifests of files, sent by the node when a peer requests them
+        receiver            string      UUID that identifies the receiver
+        files               strings     List of file names
+
+    MANIFEST - Passes the chunk manifest of a file, sent by the node when a peer sent it
+        receiver            string      UUID that identifies the receiver
+        path                string      Path of the file
+        frame               frame       Manifest of the file
+
+    REQ_RANGES - Requests the byte ranges of a file which are not available locally
+        receiver            string      UUID that identifies the receiver
+        path                string      Path of the file
+        size                number 8    Total size of the ranges
+        frame               frame       Byte ranges of the file
+
+    PERSISTED - Reports bytes of a received chunk or delta written to disk
+        path                string      Path of the file
+        offset              number 8    Offset of the written bytes in the file
+        size                number 8    Bytes written to disk
+
+    UPLOAD_RATE - Limits the rate chunks are sent to a remote peer or to all peers
+        receiver            string      UUID that identifies the receiver, empty for all peers
+        rate                number 8    Bytes per second, 0 for unlimited
+
+    DOWNLOAD_RATE - Limits the rate chunks are received from a remote peer or from all peers
+        receiver            string      UUID that identifies the receiver, empty for all peers
+        rate                number 8    Bytes per second, 0 for unlimited
+
+    RES_UPDATE - Responds to REQ_UPDATE with a list of updated files.
+        sender              string      UUID that identifies the sender
+        update_msg          msg         List of updated files and their metadata
 */
 
 #define ZSYNC_MSG_VERSION                   1
@@ -88,6 +155,18 @@
 #define ZSYNC_MSG_CHUNK                     8
 #define ZSYNC_MSG_ABORT                     9
 #define ZSYNC_MSG_TERMINATE                 10
+#define ZSYNC_MSG_CHUNK_FRAME               11
+#define ZSYNC_MSG_RES_CHUNK_FRAME           12
+#define ZSYNC_MSG_WEIGHT                    13
+#define ZSYNC_MSG_REQ_DELTA                 14
+#define ZSYNC_MSG_DELTA                     15
+#define ZSYNC_MSG_REQ_MANIFEST              16
+#define ZSYNC_MSG_MANIFEST                  17
+#define ZSYNC_MSG_REQ_RANGES                18
+#define ZSYNC_MSG_PERSISTED                 19
+#define ZSYNC_MSG_UPLOAD_RATE               20
+#define ZSYNC_MSG_DOWNLOAD_RATE             21
+#define ZSYNC_MSG_RES_UPDATE                22
 
 #ifdef __cplusplus
 extern "C" {
@@ -159,19 +238,22 @@ int
     zsync_msg_send_req_files (void *output,
         char *receiver,
         zlist_t *files,
-        uint64_t size);
+        uint64_t size,
+        byte priority);
     
 //  Send the REQ_CHUNK to the output in one step
 int
     zsync_msg_send_req_chunk (void *output,
         char *path,
         uint64_t chunk_size,
-        uint64_t offset);
+        uint64_t offset,
+        uint64_t sequence);
     
 //  Send the RES_CHUNK to the output in one step
 int
     zsync_msg_send_res_chunk (void *output,
-        zchunk_t *chunk);
+        zchunk_t *chunk,
+        uint64_t sequence);
     
 //  Send the CHUNK to the output in one step
 int
@@ -191,6 +273,90 @@ int
 int
     zsync_msg_send_terminate (void *output);
     
+//  Send the CHUNK_FRAME to the output in one step, takes ownership of the
+//  frame so that its data is not copied
+int
+    zsync_msg_send_chunk_frame (void *output,
+        char *path,
+        uint64_t sequence,
+        uint64_t offset,
+        zframe_t **frame_p);
+    
+//  Send the RES_CHUNK_FRAME to the output in one step, takes ownership of
+//  the frame so that its data is not copied
+int
+    zsync_msg_send_res_chunk_frame (void *output,
+        uint64_t sequence,
+        zframe_t **frame_p);
+    
+//  Send the WEIGHT to the output in one step
+int
+    zsync_msg_send_weight (void *output,
+        char *receiver,
+        uint32_t weight);
+    
+//  Send the REQ_DELTA to the output in one step
+int
+    zsync_msg_send_req_delta (void *output,
+        char *receiver,
+        char *path,
+        uint64_t size,
+        zframe_t *frame);
+    
+//  Send the DELTA to the output in one step
+int
+    zsync_msg_send_delta (void *output,
+        char *path,
+        uint64_t sequence,
+        uint64_t offset,
+        zframe_t *frame);
+    
+//  Send the REQ_MANIFEST to the output in one step
+int
+    zsync_msg_send_req_manifest (void *output,
+        char *receiver,
+        zlist_t *files);
+    
+//  Send the MANIFEST to the output in one step
+int
+    zsync_msg_send_manifest (void *output,
+        char *receiver,
+        char *path,
+        zframe_t *frame);
+    
+//  Send the REQ_RANGES to the output in one step
+int
+    zsync_msg_send_req_ranges (void *output,
+        char *receiver,
+        char *path,
+        uint64_t size,
+        zframe_t *frame);
+    
+//  Send the PERSISTED to the output in one step
+int
+    zsync_msg_send_persisted (void *output,
+        char *path,
+        uint64_t offset,
+        uint64_t size);
+    
+//  Send the UPLOAD_RATE to the output in one step
+int
+    zsync_msg_send_upload_rate (void *output,
+        char *receiver,
+        uint64_t rate);
+    
+//  Send the DOWNLOAD_RATE to the output in one step
+int
+    zsync_msg_send_download_rate (void *output,
+        char *receiver,
+        uint64_t rate);
+    
+//  Send the RES_UPDATE to the output in one step
+int
+    zsync_msg_send_res_update (void *output,
+        char *sender,
+        zmsg_t *update_msg);
+    
 //  Duplicate the zsync_msg message
 zsync_msg_t *
     zsync_msg_dup (zsync_msg_t *self);
@@ -259,6 +425,12 @@ uint64_t
 void
     zsync_msg_set_size (zsync_msg_t *self, uint64_t size);
 
+//  Get/set the priority field
+byte
+    zsync_msg_priority (zsync_msg_t *self);
+void
+    zsync_msg_set_priority (zsync_msg_t *self, byte priority);
+
 //  Get/set the path field
 char *
     zsync_msg_path (zsync_msg_t *self);
@@ -289,6 +461,27 @@ uint64_t
 void
     zsync_msg_set_sequence (zsync_msg_t *self, uint64_t sequence);
 
+//  Get/set the frame field
+zframe_t *
+    zsync_msg_frame (zsync_msg_t *self);
+//  Get the frame field and transfer ownership to caller
+zframe_t *
+    zsync_msg_get_frame (zsync_msg_t *self);
+void
+    zsync_msg_set_frame (zsync_msg_t *self, zframe_t *frame);
+
+//  Get/set the weight field
+uint32_t
+    zsync_msg_weight (zsync_msg_t *self);
+void
+    zsync_msg_set_weight (zsync_msg_t *self, uint32_t weight);
+
+//  Get/set the rate field
+uint64_t
+    zsync_msg_rate (zsync_msg_t *self);
+void
+    zsync_msg_set_rate (zsync_msg_t *self, uint64_t rate);
+
 //  Self test of this class
 int
     zsync_msg_test (bool verbose);
@@ -61,6 +61,30 @@ void
 // Gets the zyre connection state
 int
     zsync_peer_zyre_state (zsync_peer_t *self);
+
+// Returns the chunk size negotiated with this peer
+uint64_t
+    zsync_peer_chunk_size (zsync_peer_t *self);
+
+// Sets the chunk size negotiated with this peer
+void
+    zsync_peer_set_chunk_size (zsync_peer_t *self, uint64_t chunk_size);
+
+// Returns the UPDATE encoding negotiated with this peer
+byte
+    zsync_peer_encoding (zsync_peer_t *self);
+
+// Sets the UPDATE encoding negotiated with this peer
+void
+    zsync_peer_set_encoding (zsync_peer_t *self, byte encoding);
+
+// Returns whether this peer accepts UPDATEs in parts
+bool
+    zsync_peer_update_parts (zsync_peer_t *self);
+
+// Sets whether this peer accepts UPDATEs in parts
+void
+    zsync_peer_set_update_parts (zsync_peer_t *self, bool update_parts);
 // @end
 
 #ifdef __cplusplus
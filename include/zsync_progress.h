@@ -0,0 +1,98 @@
+/* =========================================================================
+    zsync_progress - progress of file transfers
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_PROGRESS_H_INCLUDED__
+#define __ZSYNC_PROGRESS_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_progress_t zsync_progress_t;
+
+
+// @interface
+
+// Loads the progress stored at path. If path is NULL the progress is only
+// kept in memory.
+zsync_progress_t *
+    zsync_progress_new (const char *path);
+
+// Flushes changes and destroys the progress
+void
+    zsync_progress_destroy (zsync_progress_t **self_p);
+
+// Sets the version of a file, identified by its checksum and size. The
+// offset is kept if the version didn't change, otherwise it starts at 0.
+void
+    zsync_progress_set (zsync_progress_t *self, char *key, uint64_t checksum, uint64_t size);
+
+// Advances the offset of a file by size if data at offset continues it.
+// Data at offset 0 starts the file over. A file is removed once its
+// offset reaches its size. Returns true if the offset advanced.
+bool
+    zsync_progress_advance (zsync_progress_t *self, char *key, uint64_t offset, uint64_t size);
+
+// Gets version and offset of a file, any of the results may be NULL.
+// Returns false if the file is unknown.
+bool
+    zsync_progress_lookup (zsync_progress_t *self, char *key,
+        uint64_t *checksum, uint64_t *size, uint64_t *offset);
+
+// Removes a file
+void
+    zsync_progress_remove (zsync_progress_t *self, char *key);
+
+// Returns the keys of all files, caller must destroy the list
+zlist_t *
+    zsync_progress_keys (zsync_progress_t *self);
+
+// Returns true if there are changes which haven't been flushed
+bool
+    zsync_progress_dirty (zsync_progress_t *self);
+
+// Writes the changed files to disk and syncs them, compacts the log if it
+// has grown too large. Returns 0 on success, -1 on failure.
+int
+    zsync_progress_flush (zsync_progress_t *self);
+
+// Rewrites the log with one record per file and atomically replaces the
+// old file. Returns 0 on success, -1 on failure.
+int
+    zsync_progress_compact (zsync_progress_t *self);
+
+// Returns the number of records in the log file
+size_t
+    zsync_progress_records (zsync_progress_t *self);
+
+// Selftest
+void
+    zsync_progress_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+/* =========================================================================
+    zsync_recordlog - append-only file of checksummed records
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_RECORDLOG_H_INCLUDED__
+#define __ZSYNC_RECORDLOG_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the magic header
+#define ZSYNC_RECORDLOG_MAGIC_SIZE 4
+
+// A log is worth compacting once it holds more than this many records
+// and at least twice as many records as live entries
+#define ZSYNC_RECORDLOG_COMPACT_MIN 1024
+
+// Opaque class structure
+typedef struct _zsync_recordlog_t zsync_recordlog_t;
+
+// Called with the payload of every record during replay. Returns 0 to
+// continue or -1 if the payload is corrupt, which stops the replay.
+typedef int (zsync_recordlog_fn) (byte *payload, size_t size, void *arg);
+
+
+// @interface
+
+// Opens the log at path, which must start with the given magic header,
+// and passes the payload of every record to handler. Records with a
+// payload larger than payload_max are corrupt. A torn or corrupt record
+// and everything after it are truncated.
+zsync_recordlog_t *
+    zsync_recordlog_new (const char *path, const char *magic, size_t payload_max,
+                         zsync_recordlog_fn *handler, void *arg);
+
+// Closes the log, records that have not been synced may be lost
+void
+    zsync_recordlog_destroy (zsync_recordlog_t **self_p);
+
+// Appends a record with payload, during a rewrite to the new file.
+// Returns 0 on success, -1 on failure.
+int
+    zsync_recordlog_append (zsync_recordlog_t *self, byte *payload, size_t size);
+
+// Writes appended records to disk and syncs them. Returns 0 on success,
+// -1 on failure.
+int
+    zsync_recordlog_sync (zsync_recordlog_t *self);
+
+// Starts writing a new file, appends go there until the rewrite is
+// committed. Returns 0 on success, -1 on failure, then there is nothing
+// to commit.
+int
+    zsync_recordlog_rewrite (zsync_recordlog_t *self);
+
+// Syncs the new file and atomically replaces the log with it. On failure
+// the new file is dropped and the log is kept. Returns 0 on success, -1
+// on failure.
+int
+    zsync_recordlog_commit (zsync_recordlog_t *self);
+
+// Returns true if the log holds many records superseded by later ones,
+// live is the number of records a rewrite would keep
+bool
+    zsync_recordlog_bloated (zsync_recordlog_t *self, size_t live);
+
+// Returns the number of records in the log file
+size_t
+    zsync_recordlog_records (zsync_recordlog_t *self);
+
+// Selftest
+void
+    zsync_recordlog_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
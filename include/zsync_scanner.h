@@ -0,0 +1,90 @@
+/* =========================================================================
+    zsync_scanner - cached, parallel directory scanner
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_SCANNER_H_INCLUDED__
+#define __ZSYNC_SCANNER_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_scanner_t zsync_scanner_t;
+
+
+// @interface
+
+// Constructs a scanner for the tree below root which continues from
+// state, the last state persisted by the caller or 0 for a new tree
+zsync_scanner_t *
+    zsync_scanner_new (const char *root, uint64_t state);
+
+// Destroys the scanner and its cache
+void
+    zsync_scanner_destroy (zsync_scanner_t **self_p);
+
+// Sets the number of threads walking the tree, default 4
+void
+    zsync_scanner_set_threads (zsync_scanner_t *self, int threads);
+
+// Records changes in changelog and answers updates from it. The cache
+// is filled with the files in the log and continues from its state. The
+// scanner doesn't take ownership of the change log.
+void
+    zsync_scanner_set_changelog (zsync_scanner_t *self, zsync_changelog_t *changelog);
+
+// Walks the tree and compares it against the cache. Returns the state
+// after the scan, which is only incremented if anything changed.
+uint64_t
+    zsync_scanner_scan (zsync_scanner_t *self);
+
+// Applies changes captured by a zsync_watcher_t to the cache without
+// walking the tree. Updated files must carry their checksum and digest.
+// Returns the state after the changes, which is only incremented if
+// anything changed.
+uint64_t
+    zsync_scanner_apply (zsync_scanner_t *self, zlist_t *fmetadata_list);
+
+// Returns the state of the last scan
+uint64_t
+    zsync_scanner_state (zsync_scanner_t *self);
+
+// Returns a list of zs_fmetadata_t for all files that changed after
+// from_state, or NULL if nothing changed. Caller owns list and entries.
+zlist_t *
+    zsync_scanner_update (zsync_scanner_t *self, uint64_t from_state);
+
+// Returns the number of files in the cache
+size_t
+    zsync_scanner_size (zsync_scanner_t *self);
+
+// Selftest
+void
+    zsync_scanner_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
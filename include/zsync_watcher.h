@@ -0,0 +1,78 @@
+/* =========================================================================
+    zsync_watcher - captures file changes as they happen
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+#ifndef __ZSYNC_WATCHER_H_INCLUDED__
+#define __ZSYNC_WATCHER_H_INCLUDED__
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque class structure
+typedef struct _zsync_watcher_t zsync_watcher_t;
+
+
+// @interface
+
+// Watches the tree below root for changes. Returns NULL if the platform
+// can't watch files, then the tree has to be scanned. The caller feeds
+// the changes to zsync_scanner_apply and zsync_send_update.
+zsync_watcher_t *
+    zsync_watcher_new (const char *root);
+
+// Stops watching and destroys the watcher
+void
+    zsync_watcher_destroy (zsync_watcher_t **self_p);
+
+// Sets the time in ms a batch waits for further changes, default 50
+void
+    zsync_watcher_set_debounce (zsync_watcher_t *self, int debounce);
+
+// Returns a file descriptor which is readable when changes are waiting,
+// e.g. to poll it together with sockets
+int
+    zsync_watcher_fd (zsync_watcher_t *self);
+
+// Waits up to timeout ms for changes, -1 waits forever. A batch ends
+// once no change followed within the debounce time. Changes of a path
+// are coalesced into one zs_fmetadata_t with ZS_FILE_OP_UPD, DEL or REN,
+// updated files are hashed. Returns NULL if nothing changed. Caller owns
+// list and entries.
+zlist_t *
+    zsync_watcher_changes (zsync_watcher_t *self, int timeout);
+
+// Returns true once if changes were lost because the kernel queue
+// overflowed, the tree has to be scanned again
+bool
+    zsync_watcher_overflowed (zsync_watcher_t *self);
+
+// Selftest
+void
+    zsync_watcher_test ();
+// @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
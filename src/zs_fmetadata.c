@@ -26,6 +26,9 @@
     ZeroSync file meta data module
     
 @discuss
+    Paths take only the space they need, on the heap or in the arena the
+    meta data was created in. Use the _ref getters to read them without a
+    copy. Large lists of meta data are better kept in a zs_fmlist.
 @end
 */
 
@@ -37,7 +40,9 @@ struct _zs_fmetadata_t {
     int operation;
     uint64_t size;          // file size in bytes
     uint64_t timestamp;     // UNIX timestamp
-    uint64_t checksum;      // SHA-3 512
+    uint64_t checksum;      // XXH64 of the content
+    byte digest [ZSYNC_DIGEST_SIZE];    // SHA-256 of the content
+    zsync_arena_t *arena;   // arena holding object and strings, if any
 };
 
 
@@ -53,6 +58,19 @@ zs_fmetadata_new ()
     return self;
 }
 
+// --------------------------------------------------------------------------
+// Create a new zs_fmetadata in an arena. Object and strings are freed with
+// the arena, strings take only the space they need.
+
+zs_fmetadata_t *
+zs_fmetadata_new_arena (zsync_arena_t *arena)
+{
+    assert (arena);
+    zs_fmetadata_t *self = (zs_fmetadata_t *) zsync_arena_alloc (arena, sizeof (zs_fmetadata_t));
+    self->arena = arena;
+    return self;
+}
+
 // --------------------------------------------------------------------------
 // Destroy the zs_fmetadata
 
@@ -63,6 +81,11 @@ zs_fmetadata_destroy (zs_fmetadata_t **self_p)
 
     if (*self_p) {
         zs_fmetadata_t *self = *self_p;
+        if (self->arena) {
+            // Freed with the arena
+            *self_p = NULL;
+            return;
+        }
         
         free (self->path);
         free (self->path_renamed);
@@ -82,16 +105,42 @@ zs_fmetadata_dup (zs_fmetadata_t *self)
 
     zs_fmetadata_t *self_dup = zs_fmetadata_new ();
     
-    zs_fmetadata_set_path (self_dup, "%s", self->path);
-    zs_fmetadata_set_renamed_path (self_dup, "%s", self->path_renamed);
+    if (self->path)
+        zs_fmetadata_set_path (self_dup, "%s", self->path);
+    if (self->path_renamed)
+        zs_fmetadata_set_renamed_path (self_dup, "%s", self->path_renamed);
     zs_fmetadata_set_operation (self_dup, self->operation);
     zs_fmetadata_set_size (self_dup, self->size);
     zs_fmetadata_set_timestamp (self_dup, self->timestamp);
     zs_fmetadata_set_checksum (self_dup, self->checksum);
+    zs_fmetadata_set_digest (self_dup, self->digest);
 
     return self_dup;
 }
 
+// --------------------------------------------------------------------------
+// Formats a string of exactly the size it needs, in the arena of self if
+// any. Strings are cut at STRING_MAX - 1 characters.
+
+static char *
+s_format (zs_fmetadata_t *self, char *format, va_list argptr)
+{
+    va_list size_argptr;
+    va_copy (size_argptr, argptr);
+    int size = vsnprintf (NULL, 0, format, size_argptr);
+    va_end (size_argptr);
+    if (size < 0)
+        size = 0;
+    if (size > STRING_MAX - 1)
+        size = STRING_MAX - 1;
+    char *string = self->arena?
+        (char *) zsync_arena_alloc (self->arena, size + 1):
+        (char *) malloc (size + 1);
+    assert (string);
+    vsnprintf (string, size + 1, format, argptr);
+    return string;
+}
+
 // --------------------------------------------------------------------------
 // Get/Set the file meta data path
 
@@ -102,11 +151,11 @@ zs_fmetadata_set_path (zs_fmetadata_t *self, char *format, ...)
     // Format into newly allocated string
     va_list argptr;
     va_start (argptr, format);
-    free (self->path);
-    self->path = (char *) malloc (STRING_MAX + 1);
-    assert (self->path);
-    vsnprintf (self->path, STRING_MAX, format, argptr);
+    char *string = s_format (self, format, argptr);
     va_end (argptr);
+    if (!self->arena)
+        free (self->path);
+    self->path = string;
 }
 
 char *
@@ -121,6 +170,13 @@ zs_fmetadata_path (zs_fmetadata_t *self)
     return path;
 }    
 
+const char *
+zs_fmetadata_path_ref (zs_fmetadata_t *self)
+{
+    assert (self);
+    return self->path;
+}
+
 // --------------------------------------------------------------------------
 // Get/Set the renamed file meta data path
 
@@ -131,11 +187,11 @@ zs_fmetadata_set_renamed_path (zs_fmetadata_t *self, char *format, ...)
     // Format into newly allocated string
     va_list argptr;
     va_start (argptr, format);
-    free (self->path_renamed);
-    self->path_renamed = (char *) malloc (STRING_MAX + 1);
-    assert (self->path_renamed);
-    vsnprintf (self->path_renamed, STRING_MAX, format, argptr);
+    char *string = s_format (self, format, argptr);
     va_end (argptr);
+    if (!self->arena)
+        free (self->path_renamed);
+    self->path_renamed = string;
 }
 
 char *
@@ -150,6 +206,13 @@ zs_fmetadata_renamed_path (zs_fmetadata_t *self)
     return path;
 }    
 
+const char *
+zs_fmetadata_renamed_path_ref (zs_fmetadata_t *self)
+{
+    assert (self);
+    return self->path_renamed;
+}
+
 
 // --------------------------------------------------------------------------
 // Get/Set the file operation
@@ -219,12 +282,68 @@ zs_fmetadata_checksum (zs_fmetadata_t *self)
     return self->checksum;
 }
 
+// --------------------------------------------------------------------------
+// Get/Set the file meta data digest, ZSYNC_DIGEST_SIZE bytes
+
+void
+zs_fmetadata_set_digest (zs_fmetadata_t *self, byte *digest)
+{
+    assert (self);
+    assert (digest);
+    memcpy (self->digest, digest, ZSYNC_DIGEST_SIZE);
+}
+
+byte *
+zs_fmetadata_digest (zs_fmetadata_t *self)
+{
+    assert (self);
+    return self->digest;
+}
+
 // --------------------------------------------------------------------------
 // Self test this class
 
 int 
 zs_fmetadata_test () 
 {
+    printf (" * zs_fmetadata: ");
+    zs_fmetadata_t *self = zs_fmetadata_new ();
+    assert (zs_fmetadata_path_ref (self) == NULL);
+    zs_fmetadata_set_path (self, "dir/%s-%d.txt", "file", 1);
+    assert (streq (zs_fmetadata_path_ref (self), "dir/file-1.txt"));
+    // Setting again replaces the path
+    zs_fmetadata_set_path (self, "%s", "a");
+    assert (streq (zs_fmetadata_path_ref (self), "a"));
+    char *path = zs_fmetadata_path (self);
+    assert (streq (path, "a"));
+    assert (path != zs_fmetadata_path_ref (self));
+    free (path);
+    zs_fmetadata_set_operation (self, ZS_FILE_OP_REN);
+    zs_fmetadata_set_renamed_path (self, "b");
+
+    zs_fmetadata_t *copy = zs_fmetadata_dup (self);
+    assert (streq (zs_fmetadata_path_ref (copy), "a"));
+    assert (streq (zs_fmetadata_renamed_path_ref (copy), "b"));
+    zs_fmetadata_destroy (&copy);
+    zs_fmetadata_set_renamed_path (self, "%s", "");
+    copy = zs_fmetadata_dup (self);
+    assert (streq (zs_fmetadata_renamed_path_ref (copy), ""));
+    zs_fmetadata_destroy (&copy);
+    zs_fmetadata_destroy (&self);
+    assert (self == NULL);
+
+    // Meta data in an arena
+    zsync_arena_t *arena = zsync_arena_new (0);
+    self = zs_fmetadata_new_arena (arena);
+    zs_fmetadata_set_path (self, "dir/%s", "file");
+    assert (streq (zs_fmetadata_path_ref (self), "dir/file"));
+    copy = zs_fmetadata_dup (self);
+    zs_fmetadata_destroy (&self);
+    zsync_arena_destroy (&arena);
+    assert (streq (zs_fmetadata_path_ref (copy), "dir/file"));
+    assert (zs_fmetadata_renamed_path_ref (copy) == NULL);
+    zs_fmetadata_destroy (&copy);
+    printf ("OK\n");
     return 0;
 }
 
@@ -0,0 +1,312 @@
+/* =========================================================================
+    zs_fmlist - list of file meta data stored as arrays
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    A list of file meta data kept as one array per field and all paths
+    back to back in one buffer.
+
+@discuss
+    A zlist of zs_fmetadata_t costs a list node, an object and two string
+    allocations per file. For the index of a large tree that overhead is
+    larger than the data itself, a zs_fmlist holds the same data in a
+    handful of allocations that grow by doubling.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define FMLIST_INITIAL_SIZE 64
+
+struct _zs_fmlist_t {
+    size_t size;                // number of file meta data
+    size_t max;                 // capacity of the arrays
+    size_t *paths;              // offsets of the paths into strings
+    size_t *renamed_paths;      // offsets of the renamed paths, 0 if none
+    byte *operations;
+    uint64_t *file_sizes;
+    uint64_t *timestamps;
+    uint64_t *checksums;
+    byte *digests;              // ZSYNC_DIGEST_SIZE bytes per file
+    char *strings;              // paths, each terminated by a null byte
+    size_t strings_size;
+    size_t strings_max;
+};
+
+
+// --------------------------------------------------------------------------
+// Creates an empty list
+
+zs_fmlist_t *
+zs_fmlist_new ()
+{
+    zs_fmlist_t *self = (zs_fmlist_t *) zmalloc (sizeof (zs_fmlist_t));
+    // Offset 0 is the empty string, which marks a missing renamed path
+    self->strings_max = FMLIST_INITIAL_SIZE * 32;
+    self->strings = (char *) zmalloc (self->strings_max);
+    self->strings_size = 1;
+    return self;
+}
+
+// --------------------------------------------------------------------------
+// Destroys the list
+
+void
+zs_fmlist_destroy (zs_fmlist_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zs_fmlist_t *self = *self_p;
+        free (self->paths);
+        free (self->renamed_paths);
+        free (self->operations);
+        free (self->file_sizes);
+        free (self->timestamps);
+        free (self->checksums);
+        free (self->digests);
+        free (self->strings);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Grows the arrays to hold one more file meta data
+
+static void
+s_grow (zs_fmlist_t *self)
+{
+    if (self->size < self->max)
+        return;
+    self->max = self->max? self->max * 2: FMLIST_INITIAL_SIZE;
+    self->paths = (size_t *) realloc (self->paths, self->max * sizeof (size_t));
+    self->renamed_paths = (size_t *) realloc (self->renamed_paths, self->max * sizeof (size_t));
+    self->operations = (byte *) realloc (self->operations, self->max);
+    self->file_sizes = (uint64_t *) realloc (self->file_sizes, self->max * sizeof (uint64_t));
+    self->timestamps = (uint64_t *) realloc (self->timestamps, self->max * sizeof (uint64_t));
+    self->checksums = (uint64_t *) realloc (self->checksums, self->max * sizeof (uint64_t));
+    self->digests = (byte *) realloc (self->digests, self->max * ZSYNC_DIGEST_SIZE);
+    assert (self->paths && self->renamed_paths && self->operations && self->file_sizes
+         && self->timestamps && self->checksums && self->digests);
+}
+
+// --------------------------------------------------------------------------
+// Copies a string into the strings buffer, returns its offset
+
+static size_t
+s_put_string (zs_fmlist_t *self, const char *string)
+{
+    size_t length = strlen (string) + 1;
+    if (self->strings_size + length > self->strings_max) {
+        while (self->strings_size + length > self->strings_max)
+            self->strings_max *= 2;
+        self->strings = (char *) realloc (self->strings, self->strings_max);
+        assert (self->strings);
+    }
+    size_t offset = self->strings_size;
+    memcpy (self->strings + offset, string, length);
+    self->strings_size += length;
+    return offset;
+}
+
+// --------------------------------------------------------------------------
+// Appends a copy of the file meta data, returns its index
+
+size_t
+zs_fmlist_append (zs_fmlist_t *self, zs_fmetadata_t *fmetadata)
+{
+    assert (self);
+    assert (fmetadata);
+    s_grow (self);
+    size_t index = self->size++;
+    const char *path = zs_fmetadata_path_ref (fmetadata);
+    const char *renamed_path = zs_fmetadata_renamed_path_ref (fmetadata);
+    self->paths [index] = s_put_string (self, path? path: "");
+    self->renamed_paths [index] = renamed_path? s_put_string (self, renamed_path): 0;
+    self->operations [index] = (byte) zs_fmetadata_operation (fmetadata);
+    self->file_sizes [index] = zs_fmetadata_size (fmetadata);
+    self->timestamps [index] = zs_fmetadata_timestamp (fmetadata);
+    self->checksums [index] = zs_fmetadata_checksum (fmetadata);
+    memcpy (self->digests + index * ZSYNC_DIGEST_SIZE,
+            zs_fmetadata_digest (fmetadata), ZSYNC_DIGEST_SIZE);
+    return index;
+}
+
+// --------------------------------------------------------------------------
+// Returns the number of file meta data in the list
+
+size_t
+zs_fmlist_size (zs_fmlist_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+// --------------------------------------------------------------------------
+// Getters of the file meta data at index
+
+const char *
+zs_fmlist_path (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->strings + self->paths [index];
+}
+
+const char *
+zs_fmlist_renamed_path (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    if (!self->renamed_paths [index])
+        return NULL;
+    return self->strings + self->renamed_paths [index];
+}
+
+int
+zs_fmlist_operation (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->operations [index];
+}
+
+uint64_t
+zs_fmlist_file_size (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->file_sizes [index];
+}
+
+uint64_t
+zs_fmlist_timestamp (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->timestamps [index];
+}
+
+uint64_t
+zs_fmlist_checksum (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->checksums [index];
+}
+
+byte *
+zs_fmlist_digest (zs_fmlist_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->size);
+    return self->digests + index * ZSYNC_DIGEST_SIZE;
+}
+
+// --------------------------------------------------------------------------
+// Returns a copy of the file meta data at index, in the arena if any
+
+zs_fmetadata_t *
+zs_fmlist_fmetadata (zs_fmlist_t *self, size_t index, zsync_arena_t *arena)
+{
+    assert (self);
+    assert (index < self->size);
+    zs_fmetadata_t *fmetadata = arena? zs_fmetadata_new_arena (arena): zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "%s", zs_fmlist_path (self, index));
+    if (self->renamed_paths [index])
+        zs_fmetadata_set_renamed_path (fmetadata, "%s", zs_fmlist_renamed_path (self, index));
+    zs_fmetadata_set_operation (fmetadata, self->operations [index]);
+    zs_fmetadata_set_size (fmetadata, self->file_sizes [index]);
+    zs_fmetadata_set_timestamp (fmetadata, self->timestamps [index]);
+    zs_fmetadata_set_checksum (fmetadata, self->checksums [index]);
+    zs_fmetadata_set_digest (fmetadata, zs_fmlist_digest (self, index));
+    return fmetadata;
+}
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes held by the list
+
+size_t
+zs_fmlist_memory (zs_fmlist_t *self)
+{
+    assert (self);
+    size_t per_file = 2 * sizeof (size_t) + 1 + 3 * sizeof (uint64_t) + ZSYNC_DIGEST_SIZE;
+    return sizeof (zs_fmlist_t) + self->max * per_file + self->strings_max;
+}
+
+// --------------------------------------------------------------------------
+// Selftest
+
+void
+zs_fmlist_test ()
+{
+    printf (" * zs_fmlist: ");
+    zs_fmlist_t *self = zs_fmlist_new ();
+    assert (zs_fmlist_size (self) == 0);
+
+    byte digest [ZSYNC_DIGEST_SIZE];
+    memset (digest, 0xAB, ZSYNC_DIGEST_SIZE);
+    size_t index;
+    for (index = 0; index < 1000; index++) {
+        zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
+        zs_fmetadata_set_path (fmetadata, "dir/file%zu.txt", index);
+        zs_fmetadata_set_operation (fmetadata, index % 2? ZS_FILE_OP_REN: ZS_FILE_OP_UPD);
+        if (index % 2)
+            zs_fmetadata_set_renamed_path (fmetadata, "dir/renamed%zu.txt", index);
+        zs_fmetadata_set_size (fmetadata, index * 10);
+        zs_fmetadata_set_timestamp (fmetadata, index + 1);
+        zs_fmetadata_set_checksum (fmetadata, index + 2);
+        zs_fmetadata_set_digest (fmetadata, digest);
+        assert (zs_fmlist_append (self, fmetadata) == index);
+        zs_fmetadata_destroy (&fmetadata);
+    }
+    assert (zs_fmlist_size (self) == 1000);
+    assert (streq (zs_fmlist_path (self, 0), "dir/file0.txt"));
+    assert (zs_fmlist_renamed_path (self, 0) == NULL);
+    assert (streq (zs_fmlist_path (self, 999), "dir/file999.txt"));
+    assert (streq (zs_fmlist_renamed_path (self, 999), "dir/renamed999.txt"));
+    assert (zs_fmlist_operation (self, 999) == ZS_FILE_OP_REN);
+    assert (zs_fmlist_file_size (self, 999) == 9990);
+    assert (zs_fmlist_timestamp (self, 999) == 1000);
+    assert (zs_fmlist_checksum (self, 999) == 1001);
+    assert (memcmp (zs_fmlist_digest (self, 999), digest, ZSYNC_DIGEST_SIZE) == 0);
+    assert (zs_fmlist_memory (self) > 1000 * ZSYNC_DIGEST_SIZE);
+
+    // Copies on the heap and in an arena
+    zs_fmetadata_t *fmetadata = zs_fmlist_fmetadata (self, 5, NULL);
+    assert (streq (zs_fmetadata_path_ref (fmetadata), "dir/file5.txt"));
+    assert (streq (zs_fmetadata_renamed_path_ref (fmetadata), "dir/renamed5.txt"));
+    assert (zs_fmetadata_checksum (fmetadata) == 7);
+    zs_fmetadata_destroy (&fmetadata);
+    zsync_arena_t *arena = zsync_arena_new (0);
+    fmetadata = zs_fmlist_fmetadata (self, 4, arena);
+    assert (streq (zs_fmetadata_path_ref (fmetadata), "dir/file4.txt"));
+    assert (zs_fmetadata_renamed_path_ref (fmetadata) == NULL);
+    assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_UPD);
+    zs_fmetadata_destroy (&fmetadata);
+    zsync_arena_destroy (&arena);
+
+    zs_fmlist_destroy (&self);
+    assert (self == NULL);
+    printf ("OK\n");
+}
@@ -49,12 +49,27 @@ struct _zs_msg_t {
     zframe_t *chunk;
     zlist_t *fmetadata;     // zlist of file meta data list
     zlist_t *fpaths;        // zlist of file paths
+    zhash_t *fresume;       // resume offset and checksum by file path
     uint64_t credit;        // given credit for RP 
+    byte priority;          // priority of REQUEST_FILES, higher is sent first
+    uint64_t chunk_size;    // max chunk size supported by RP
+    byte encoding;          // UPDATE encoding, the best one supported in GREET
+    byte features;          // protocol features announced in GREET
+    zsync_arena_t *arena;   // arena holding message and meta data, if any
+    zs_fmetadata_t **fitems;    // file meta data in the arena
+    size_t fitems_size;     // number of file meta data in the arena
+    size_t fitems_max;      // capacity of fitems
+    size_t fitems_cursor;   // iterator of fitems
 };
 
 // ZeroSync Sigature
 #define SIGNATURE 0x5A53
 
+// Commands of compact encoded UPDATEs, they are unpacked as ZS_CMD_UPDATE
+// and ZS_CMD_UPDATE_PART
+#define ZS_CMD_UPDATE_COMPACT 0xE
+#define ZS_CMD_UPDATE_PART_COMPACT 0xF
+
 // --------------------------------------------------------------------------
 // Network data encoding macros
 
@@ -121,13 +136,352 @@ struct _zs_msg_t {
         goto malformed; \
 }
 
-// Get a string from the frame
+// Get a string from the frame, it's allocated in the arena if any
 #define GET_STRING(host) { \
-    host = zframe_get_string (frame); \
+    host = s_get_string (self, frame); \
     if (host == NULL) \
         goto malformed; \
 }
 
+// Free a string got from the frame
+#define FREE_STRING(host) { \
+    if (!self->arena) \
+        free (host); \
+}
+
+// Formats into a newly allocated string of the exact size, strings are
+// cut at STRING_MAX characters
+static char *
+s_vformat (char *format, va_list argptr)
+{
+    va_list measure;
+    va_copy (measure, argptr);
+    int size = vsnprintf (NULL, 0, format, measure);
+    va_end (measure);
+    if (size < 0)
+        size = 0;
+    if (size > STRING_MAX)
+        size = STRING_MAX;
+    char *string = (char *) malloc (size + 1);
+    assert (string);
+    vsnprintf (string, size + 1, format, argptr);
+    return string;
+}
+
+// Appends a path to the fpaths list, which keeps its own copy
+static void
+s_fpaths_append (zs_msg_t *self, char *path)
+{
+    if (!self->fpaths) {
+        self->fpaths = zlist_new ();
+        zlist_autofree (self->fpaths);
+    }
+    zlist_append (self->fpaths, path);
+}
+
+// --------------------------------------------------------------------------
+// Arena support. Messages unpacked into an arena take the message, its
+// strings and its file meta data from the arena, file meta data are kept
+// in an array instead of a list.
+
+static char *
+s_get_string (zs_msg_t *self, zframe_t *frame)
+{
+    if (!self->arena)
+        return zframe_get_string (frame);
+    string_size_t string_size;
+    if (zframe_get_uint16 (frame, &string_size) == -1)
+        return NULL;
+    char *string = (char *) zsync_arena_alloc (self->arena, string_size + 1);
+    if (zframe_get_block (frame, (byte *) string, string_size) == -1)
+        return NULL;
+    string [string_size] = 0;
+    return string;
+}
+
+static zs_fmetadata_t *
+s_fmetadata_new (zs_msg_t *self)
+{
+    if (self->arena)
+        return zs_fmetadata_new_arena (self->arena);
+    return zs_fmetadata_new ();
+}
+
+//  Makes room for count file meta data in the arena
+static void
+s_fitems_reserve (zs_msg_t *self, size_t count)
+{
+    if (self->fitems_size + count <= self->fitems_max)
+        return;
+    size_t max = self->fitems_max? self->fitems_max * 2: 16;
+    if (max < self->fitems_size + count)
+        max = self->fitems_size + count;
+    zs_fmetadata_t **fitems = (zs_fmetadata_t **) 
+        zsync_arena_alloc (self->arena, max * sizeof (zs_fmetadata_t *));
+    if (self->fitems_size)
+        memcpy (fitems, self->fitems, self->fitems_size * sizeof (zs_fmetadata_t *));
+    self->fitems = fitems;
+    self->fitems_max = max;
+}
+
+//  Returns the file meta data in the arena as list of borrowed items
+static zlist_t *
+s_fitems_list (zs_msg_t *self)
+{
+    zlist_t *list = zlist_new ();
+    size_t index;
+    for (index = 0; index < self->fitems_size; index++)
+        zlist_append (list, self->fitems [index]);
+    return list;
+}
+
+// --------------------------------------------------------------------------
+// Compact UPDATE encoding. Paths are front coded against the previous path
+// and numbers are LEB128 varints, timestamps as zigzag delta to the
+// previous timestamp. Checksums and digests don't compress and are copied.
+
+typedef struct {
+    byte *data;
+    size_t size;
+    size_t max_size;
+} s_buffer_t;
+
+typedef struct {
+    byte *data;
+    size_t size;
+    size_t cursor;
+} s_reader_t;
+
+static void
+s_put_bytes (s_buffer_t *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->max_size) {
+        while (buffer->size + size > buffer->max_size)
+            buffer->max_size = buffer->max_size? buffer->max_size * 2: 4096;
+        buffer->data = (byte *) realloc (buffer->data, buffer->max_size);
+        assert (buffer->data);
+    }
+    memcpy (buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void
+s_put_varint (s_buffer_t *buffer, uint64_t value)
+{
+    byte varint [10];
+    size_t size = 0;
+    while (value >= 0x80) {
+        varint [size++] = (byte) (value | 0x80);
+        value >>= 7;
+    }
+    varint [size++] = (byte) value;
+    s_put_bytes (buffer, varint, size);
+}
+
+static void
+s_put_uint64 (s_buffer_t *buffer, uint64_t value)
+{
+    byte number [8];
+    int index;
+    for (index = 7; index >= 0; index--) {
+        number [index] = (byte) value;
+        value >>= 8;
+    }
+    s_put_bytes (buffer, number, 8);
+}
+
+//  Puts the length of the prefix path shares with previous and the rest
+static void
+s_put_path (s_buffer_t *buffer, const char *path, const char *previous)
+{
+    size_t prefix = 0;
+    if (previous)
+        while (path [prefix] && path [prefix] == previous [prefix])
+            prefix++;
+    size_t rest = strlen (path + prefix);
+    s_put_varint (buffer, prefix);
+    s_put_varint (buffer, rest);
+    s_put_bytes (buffer, path + prefix, rest);
+}
+
+static int
+s_get_bytes (s_reader_t *reader, void *data, size_t size)
+{
+    if (reader->size - reader->cursor < size)
+        return -1;
+    memcpy (data, reader->data + reader->cursor, size);
+    reader->cursor += size;
+    return 0;
+}
+
+static int
+s_get_varint (s_reader_t *reader, uint64_t *value)
+{
+    *value = 0;
+    int shift;
+    for (shift = 0; shift < 64; shift += 7) {
+        if (reader->cursor >= reader->size)
+            return -1;
+        byte next = reader->data [reader->cursor++];
+        *value |= (uint64_t) (next & 0x7F) << shift;
+        if (!(next & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+static int
+s_get_uint64 (s_reader_t *reader, uint64_t *value)
+{
+    byte number [8];
+    if (s_get_bytes (reader, number, 8) == -1)
+        return -1;
+    *value = 0;
+    int index;
+    for (index = 0; index < 8; index++)
+        *value = (*value << 8) | number [index];
+    return 0;
+}
+
+//  Gets a front coded path into path, which holds max + 1 bytes. Previous
+//  may be the same buffer as path.
+static int
+s_get_path (s_reader_t *reader, char *path, const char *previous, size_t max)
+{
+    uint64_t prefix, rest;
+    if (s_get_varint (reader, &prefix) == -1
+    ||  s_get_varint (reader, &rest) == -1
+    ||  prefix > strlen (previous)
+    ||  rest > max - prefix)
+        return -1;
+    memmove (path, previous, prefix);
+    if (s_get_bytes (reader, path + prefix, rest) == -1)
+        return -1;
+    path [prefix + rest] = 0;
+    return 0;
+}
+
+//  Encodes state and file meta data of an UPDATE
+static zframe_t *
+s_encode_compact (zs_msg_t *self)
+{
+    s_buffer_t buffer = { NULL, 0, 0 };
+    s_put_varint (&buffer, self->state);
+    s_put_varint (&buffer, self->fmetadata? zlist_size (self->fmetadata): 0);
+    const char *previous = NULL;
+    uint64_t timestamp = 0;
+    zs_fmetadata_t *fmetadata_item = zs_msg_fmetadata_first (self);
+    while (fmetadata_item) {
+        const char *path = zs_fmetadata_path_ref (fmetadata_item);
+        s_put_path (&buffer, path, previous);
+        byte operation = (byte) zs_fmetadata_operation (fmetadata_item);
+        s_put_bytes (&buffer, &operation, 1);
+        int64_t delta = (int64_t) (zs_fmetadata_timestamp (fmetadata_item) - timestamp);
+        s_put_varint (&buffer, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+        timestamp = zs_fmetadata_timestamp (fmetadata_item);
+        if (operation == ZS_FILE_OP_UPD) {
+            s_put_varint (&buffer, zs_fmetadata_size (fmetadata_item));
+            s_put_uint64 (&buffer, zs_fmetadata_checksum (fmetadata_item));
+            s_put_bytes (&buffer, zs_fmetadata_digest (fmetadata_item), ZSYNC_DIGEST_SIZE);
+        }
+        else
+        if (operation == ZS_FILE_OP_REN) {
+            // Renamed paths mostly share the directory of their origin
+            s_put_path (&buffer, zs_fmetadata_renamed_path_ref (fmetadata_item), path);
+        }
+        previous = path;
+        fmetadata_item = zs_msg_fmetadata_next (self);
+    }
+    zframe_t *frame = zframe_new (buffer.data, buffer.size);
+    free (buffer.data);
+    return frame;
+}
+
+//  Decodes state and file meta data of an UPDATE. Returns 0 if OK, -1 if
+//  the data is malformed.
+static int
+s_decode_compact (zs_msg_t *self, byte *data, size_t size)
+{
+    s_reader_t reader = { data, size, 0 };
+    uint64_t count, timestamp = 0;
+    if (s_get_varint (&reader, &self->state) == -1
+    ||  s_get_varint (&reader, &count) == -1)
+        return -1;
+    // A path is never longer than all the data
+    size_t max = size < STRING_MAX? size: STRING_MAX;
+    char *path, *renamed;
+    if (self->arena) {
+        path = (char *) zsync_arena_alloc (self->arena, max + 1);
+        renamed = (char *) zsync_arena_alloc (self->arena, max + 1);
+        // Every file takes at least 4 bytes
+        s_fitems_reserve (self, count < size / 4? count: size / 4);
+    }
+    else {
+        path = (char *) malloc (max + 1);
+        renamed = (char *) malloc (max + 1);
+    }
+    path [0] = 0;
+    while (count--) {
+        byte operation;
+        uint64_t delta;
+        if (s_get_path (&reader, path, path, max) == -1
+        ||  s_get_bytes (&reader, &operation, 1) == -1
+        ||  s_get_varint (&reader, &delta) == -1)
+            goto malformed;
+        timestamp += (delta >> 1) ^ -(delta & 1);
+        zs_fmetadata_t *fmetadata_item = s_fmetadata_new (self);
+        zs_fmetadata_set_path (fmetadata_item, "%s", path);
+        zs_fmetadata_set_operation (fmetadata_item, operation);
+        zs_fmetadata_set_timestamp (fmetadata_item, timestamp);
+        zs_msg_fmetadata_append (self, fmetadata_item);
+        if (operation == ZS_FILE_OP_UPD) {
+            uint64_t file_size, checksum;
+            byte digest [ZSYNC_DIGEST_SIZE];
+            if (s_get_varint (&reader, &file_size) == -1
+            ||  s_get_uint64 (&reader, &checksum) == -1
+            ||  s_get_bytes (&reader, digest, ZSYNC_DIGEST_SIZE) == -1)
+                goto malformed;
+            zs_fmetadata_set_size (fmetadata_item, file_size);
+            zs_fmetadata_set_checksum (fmetadata_item, checksum);
+            zs_fmetadata_set_digest (fmetadata_item, digest);
+        }
+        else
+        if (operation == ZS_FILE_OP_REN) {
+            if (s_get_path (&reader, renamed, path, max) == -1)
+                goto malformed;
+            zs_fmetadata_set_renamed_path (fmetadata_item, "%s", renamed);
+        }
+        else
+        if (operation != ZS_FILE_OP_DEL)
+            goto malformed;
+    }
+    if (!self->arena) {
+        free (path);
+        free (renamed);
+    }
+    return 0;
+
+    malformed:
+        if (!self->arena) {
+            free (path);
+            free (renamed);
+        }
+        return -1;
+}
+
+//  Returns the command put on the wire
+static uint8_t
+s_wire_cmd (zs_msg_t *self)
+{
+    if (self->encoding == ZS_ENCODING_COMPACT) {
+        if (self->cmd == ZS_CMD_UPDATE)
+            return ZS_CMD_UPDATE_COMPACT;
+        if (self->cmd == ZS_CMD_UPDATE_PART)
+            return ZS_CMD_UPDATE_PART_COMPACT;
+    }
+    return self->cmd;
+}
+
 // --------------------------------------------------------------------------
 // Create a new zs_msg
 
@@ -175,10 +529,12 @@ zs_msg_destroy (zs_msg_t **self_p)
         if (self->fpaths) {
             zlist_destroy (&self->fpaths); 
         }
+        zhash_destroy (&self->fresume);
         zframe_destroy(&self->chunk);
     
-        // Free object itself
-        free (self);
+        // Free object itself, unless the arena owns it
+        if (!self->arena)
+            free (self);
         *self_p = NULL;
     }
 }
@@ -189,9 +545,26 @@ zs_msg_destroy (zs_msg_t **self_p)
 
 zs_msg_t *
 zs_msg_unpack (zmsg_t *input) 
+{
+    return zs_msg_unpack_arena (input, NULL);
+}
+
+// --------------------------------------------------------------------------
+// Parse a zs_msg into an arena, which holds the message, its strings and
+// its file meta data until the arena is reset. Returns NULL if error.
+
+zs_msg_t *
+zs_msg_unpack_arena (zmsg_t *input, zsync_arena_t *arena)
 {
     assert (input);
-    zs_msg_t *self = zs_msg_new (0);
+    zs_msg_t *self;
+    if (arena) {
+        self = (zs_msg_t *) zsync_arena_alloc (arena, sizeof (zs_msg_t));
+        self->arena = arena;
+        self->uuid = (byte *) zsync_arena_alloc (arena, 16);
+    }
+    else
+        self = zs_msg_new (0);
     zframe_t *frame = NULL;
     uint64_t list_size;
     string_size_t string_size;
@@ -214,21 +587,57 @@ zs_msg_unpack (zmsg_t *input)
             case ZS_CMD_GREET:
                 GET_BLOCK (self->uuid, 16);
                 GET_NUMBER8(self->state);
+                // Peers which don't announce a chunk size use the default
+                if (zframe_get_uint64 (frame, &self->chunk_size) == -1)
+                    self->chunk_size = CHUNK_SIZE;
+                // Peers which don't announce an encoding use the plain one
+                if (zframe_get_uint8 (frame, &self->encoding) == -1)
+                    self->encoding = ZS_ENCODING_PLAIN;
+                // Peers which don't announce features have none
+                if (zframe_get_uint8 (frame, &self->features) == -1)
+                    self->features = 0;
                 break;
             case ZS_CMD_LAST_STATE:
                 GET_NUMBER8 (self->state);
                 break;
+            case ZS_CMD_UPDATE_COMPACT:
+            case ZS_CMD_UPDATE_PART_COMPACT: {
+                uint64_t body_size;
+                GET_NUMBER8 (body_size);
+                if (body_size > zframe_size (frame))
+                    goto malformed;
+                byte *body = self->arena?
+                    (byte *) zsync_arena_alloc (self->arena, body_size + 1):
+                    (byte *) malloc (body_size + 1);
+                rc = zframe_get_block (frame, body, body_size);
+                if (rc != -1)
+                    rc = s_decode_compact (self, body, body_size);
+                if (!self->arena)
+                    free (body);
+                if (rc == -1)
+                    goto malformed;
+                self->encoding = ZS_ENCODING_COMPACT;
+                self->cmd = self->cmd == ZS_CMD_UPDATE_COMPACT? ZS_CMD_UPDATE: ZS_CMD_UPDATE_PART;
+                break;
+            }
             case ZS_CMD_UPDATE:
+            case ZS_CMD_UPDATE_PART:
                 GET_NUMBER8(self->state);
                 char *path, *path_renamed;
                 uint8_t operation;
                 uint64_t timestamp, size, checksum;
                 // file meta data count
                 GET_NUMBER8(list_size);
+                // Every file takes at least 11 bytes
+                if (self->arena)
+                    s_fitems_reserve (self, list_size < zframe_size (frame) / 11?
+                                            list_size: zframe_size (frame) / 11);
                 while (list_size--) {
-                    zs_fmetadata_t *fmetadata_item = zs_fmetadata_new ();
+                    zs_fmetadata_t *fmetadata_item = s_fmetadata_new (self);
+                    zs_msg_fmetadata_append (self, fmetadata_item);
                     GET_STRING (path);
                     zs_fmetadata_set_path (fmetadata_item, "%s", path);
+                    FREE_STRING (path);
                     GET_NUMBER1 (operation);
                     zs_fmetadata_set_operation (fmetadata_item, operation);
                     GET_NUMBER8 (timestamp);
@@ -247,11 +656,11 @@ zs_msg_unpack (zmsg_t *input)
                             //
                             GET_STRING (path_renamed);
                             zs_fmetadata_set_renamed_path (fmetadata_item, "%s", path_renamed);
+                            FREE_STRING (path_renamed);
                             break;
                         default:
                             goto malformed;
                     }
-                    zs_msg_fmetadata_append (self, fmetadata_item);
                 }
                 break;
             case ZS_CMD_REQUEST_FILES:
@@ -259,7 +668,35 @@ zs_msg_unpack (zmsg_t *input)
                 while (list_size--) {
                     char *path;
                     GET_STRING(path);
-                    zs_msg_fpaths_append (self, "%s", path); 
+                    s_fpaths_append (self, path);
+                    FREE_STRING (path);
+                }
+                // Peers which don't send an initial credit wait for GIVE_CREDIT
+                if (zframe_get_uint64 (frame, &self->credit) == -1)
+                    self->credit = 0;
+                // Peers which don't send a priority request bulk transfers
+                if (zframe_get_uint8 (frame, &self->priority) == -1)
+                    self->priority = 0;
+                // Peers which don't send resume offsets request whole files
+                if (zframe_get_uint64 (frame, &list_size) == -1)
+                    list_size = 0;
+                while (list_size--) {
+                    char *path;
+                    uint64_t offset, checksum;
+                    GET_STRING (path);
+                    GET_NUMBER8 (offset);
+                    GET_NUMBER8 (checksum);
+                    zs_msg_set_resume (self, path, offset, checksum);
+                    FREE_STRING (path);
+                }
+                break;
+            case ZS_CMD_REQUEST_MANIFEST:
+                GET_NUMBER8(list_size);
+                while (list_size--) {
+                    char *path;
+                    GET_STRING(path);
+                    s_fpaths_append (self, path);
+                    FREE_STRING (path);
                 }
                 break;
             case ZS_CMD_GIVE_CREDIT:
@@ -271,6 +708,22 @@ zs_msg_unpack (zmsg_t *input)
                 GET_NUMBER8 (self->offset);
                 self->chunk = zmsg_pop (input);
                 break;
+            case ZS_CMD_REQUEST_DELTA:
+            case ZS_CMD_SEND_MANIFEST:
+            case ZS_CMD_REQUEST_RANGES:
+                GET_STRING (self->file_path);
+                self->chunk = zmsg_pop (input);
+                if (!self->chunk)
+                    goto malformed;
+                break;
+            case ZS_CMD_SEND_DELTA:
+                GET_NUMBER8 (self->sequence);
+                GET_STRING (self->file_path);
+                GET_NUMBER8 (self->offset);
+                self->chunk = zmsg_pop (input);
+                if (!self->chunk)
+                    goto malformed;
+                break;
             case ZS_CMD_ABORT:
                 // noting to get
                 break;
@@ -315,24 +768,34 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
     
     /* Add data to frame */
     PUT_NUMBER2 (SIGNATURE);
-    PUT_NUMBER1 (self->cmd);
+    PUT_NUMBER1 (s_wire_cmd (self));
 
     switch(self->cmd) {
         case ZS_CMD_GREET:
             PUT_BLOCK (self->uuid, 16);
             PUT_NUMBER8 (self->state);
+            PUT_NUMBER8 (self->chunk_size);
+            PUT_NUMBER1 (self->encoding);
+            PUT_NUMBER1 (self->features);
             break;
         case ZS_CMD_LAST_STATE:
             PUT_NUMBER8 (self->state);
             break;
         case ZS_CMD_UPDATE:
+        case ZS_CMD_UPDATE_PART:
+            if (self->encoding == ZS_ENCODING_COMPACT) {
+                // State and file meta data have been encoded into chunk
+                PUT_NUMBER8 (zframe_size (self->chunk));
+                PUT_BLOCK (zframe_data (self->chunk), zframe_size (self->chunk));
+                break;
+            }
             PUT_NUMBER8 (self->state);
             // put trailing size of list
             PUT_NUMBER8 (zlist_size (self->fmetadata));
             // get first element from list
             zs_fmetadata_t *fmetadata_item = zs_msg_fmetadata_first (self);
             while (fmetadata_item) {
-                PUT_STRING (zs_fmetadata_path (fmetadata_item));
+                PUT_STRING ((char *) zs_fmetadata_path_ref (fmetadata_item));
                 PUT_NUMBER1 (zs_fmetadata_operation (fmetadata_item));
                 PUT_NUMBER8 (zs_fmetadata_timestamp (fmetadata_item));
                 switch (zs_fmetadata_operation (fmetadata_item)) {
@@ -344,7 +807,7 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
                         // noting to do here
                         break;
                     case ZS_FILE_OP_REN:
-                        PUT_STRING (zs_fmetadata_renamed_path (fmetadata_item));
+                        PUT_STRING ((char *) zs_fmetadata_renamed_path_ref (fmetadata_item));
                         break;
                     default:
                         goto malformed;
@@ -354,6 +817,7 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
             }
             break;
         case ZS_CMD_REQUEST_FILES:
+        case ZS_CMD_REQUEST_MANIFEST:
             // put trailing size of list
             PUT_NUMBER8 (zlist_size (self->fpaths));
             // get first element from list
@@ -363,6 +827,28 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
                 // next element
                 path = zs_msg_fpaths_next (self);
             }
+            if (self->cmd == ZS_CMD_REQUEST_FILES) {
+                // Optional fields follow the list, older peers stop before
+                PUT_NUMBER8 (self->credit);
+                PUT_NUMBER1 (self->priority);
+                uint64_t resume_size = 0;
+                path = zs_msg_fpaths_first (self);
+                while (path) {
+                    if (zs_msg_resume_offset (self, path) > 0)
+                        resume_size++;
+                    path = zs_msg_fpaths_next (self);
+                }
+                PUT_NUMBER8 (resume_size);
+                path = zs_msg_fpaths_first (self);
+                while (path) {
+                    if (zs_msg_resume_offset (self, path) > 0) {
+                        PUT_STRING (path);
+                        PUT_NUMBER8 (zs_msg_resume_offset (self, path));
+                        PUT_NUMBER8 (zs_msg_resume_checksum (self, path));
+                    }
+                    path = zs_msg_fpaths_next (self);
+                }
+            }
             break;
         case ZS_CMD_GIVE_CREDIT:
             PUT_NUMBER8 (self->credit);
@@ -372,6 +858,17 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
             PUT_STRING (self->file_path);
             PUT_NUMBER8 (self->offset);
             frame_flags = ZFRAME_MORE;
+            break;
+        case ZS_CMD_REQUEST_DELTA:
+        case ZS_CMD_SEND_MANIFEST:
+        case ZS_CMD_REQUEST_RANGES:
+            PUT_STRING (self->file_path);
+            break;
+        case ZS_CMD_SEND_DELTA:
+            PUT_NUMBER8 (self->sequence);
+            PUT_STRING (self->file_path);
+            PUT_NUMBER8 (self->offset);
+            break;
         case ZS_CMD_ABORT:
             // no data to put
             break;
@@ -386,7 +883,11 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
     }
 
     /* Send frames */
-    if (self->cmd == ZS_CMD_SEND_CHUNK) {
+    if (self->cmd == ZS_CMD_SEND_CHUNK
+    ||  self->cmd == ZS_CMD_REQUEST_DELTA
+    ||  self->cmd == ZS_CMD_SEND_DELTA
+    ||  self->cmd == ZS_CMD_SEND_MANIFEST
+    ||  self->cmd == ZS_CMD_REQUEST_RANGES) {
         
         /* Append the chunk frame */
         if (zmsg_append (output, &self->chunk)) {
@@ -413,13 +914,20 @@ zs_msg_pack (zs_msg_t **self_p, zmsg_t *output, size_t frame_size)
 // Send the GREET to the RP in one step
 
 int 
-zs_msg_pack_greet (zmsg_t *output, byte *uuid, uint64_t state) 
+zs_msg_pack_greet (zmsg_t *output, byte *uuid, uint64_t state, uint64_t chunk_size,
+                   byte encoding, byte features) 
 {
     zs_msg_t *self = zs_msg_new (ZS_CMD_GREET);
     zs_msg_set_uuid (self, uuid);
     zs_msg_set_state (self, state);
+    zs_msg_set_chunk_size (self, chunk_size);
+    zs_msg_set_encoding (self, encoding);
+    zs_msg_set_features (self, features);
     size_t frame_size = 16; // 16-byte uuid
     frame_size += 8;        // 8-byte state
+    frame_size += 8;        // 8-byte chunk size
+    frame_size += 1;        // 1-byte encoding
+    frame_size += 1;        // 1-byte features
     return zs_msg_pack (&self, output, frame_size);
 }
 
@@ -436,57 +944,167 @@ zs_msg_pack_last_state (zmsg_t *output, uint64_t last_state)
 }
 
 // --------------------------------------------------------------------------
-// Send the FILE_LIST to the RP in one step
+// Returns the number of bytes a file meta data takes in a plain UPDATE.
+// With digest the size of its digest is added, which bounds its size in
+// every encoding.
+
+static size_t
+s_fmetadata_size (zs_fmetadata_t *fmetadata, bool digest)
+{
+    size_t size = sizeof (string_size_t); // string size
+    size += strlen (zs_fmetadata_path_ref (fmetadata)); // string length
+    size += 8;   // 8-byte time stamp
+    size += 1;   // 1-byte file operation
+    switch (zs_fmetadata_operation (fmetadata)) {
+        case ZS_FILE_OP_UPD:
+            size += 8; // 8-byte file size
+            size += 8; // 8-byte checksum
+            if (digest)
+                size += ZSYNC_DIGEST_SIZE;
+            break;
+        case ZS_FILE_OP_REN:
+            size += sizeof (string_size_t); // string size
+            size += strlen (zs_fmetadata_renamed_path_ref (fmetadata)); // string len
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
+// --------------------------------------------------------------------------
+// Send the FILE_LIST or a part of it in the given encoding. Command is
+// ZS_CMD_UPDATE or ZS_CMD_UPDATE_PART.
 
 int
-zs_msg_pack_update (zmsg_t *output, uint64_t state, zlist_t *fmetadata) 
+zs_msg_pack_update_encoded (zmsg_t *output, int cmd, byte encoding, uint64_t state, zlist_t *fmetadata)
 {
-    zs_msg_t *self = zs_msg_new (ZS_CMD_UPDATE);   
+    assert (cmd == ZS_CMD_UPDATE || cmd == ZS_CMD_UPDATE_PART);
+    zs_msg_t *self = zs_msg_new (cmd);   
     zs_msg_set_state (self, state);
     zs_msg_set_fmetadata (self, fmetadata);
+    if (encoding == ZS_ENCODING_COMPACT) {
+        zs_msg_set_encoding (self, encoding);
+        self->chunk = s_encode_compact (self);
+        // 8-byte size of the encoded data
+        return zs_msg_pack (&self, output, 8 + zframe_size (self->chunk));
+    }
    
     // calculate frame size
     size_t frame_size = 8; // 8-byte state
     frame_size += 8;       // 8-byte list size
     zs_fmetadata_t *filemeta_data = zs_msg_fmetadata_first (self);
     while (filemeta_data) {
-        frame_size += sizeof (string_size_t); // string size
-        frame_size += strlen (zs_fmetadata_path (filemeta_data)); // string length
-        frame_size += 8;   // 8-byte time stamp
-        frame_size += 1;   // 1-byte file operation
-        switch (zs_fmetadata_operation (filemeta_data)) {
-            case ZS_FILE_OP_UPD:
-                frame_size += 8; // 8-byte file size
-                frame_size += 8; // 8-byte checksum
-                break;
-            case ZS_FILE_OP_REN:
-                frame_size += sizeof (string_size_t); // string size
-                frame_size += strlen (zs_fmetadata_renamed_path (filemeta_data)); // string len
-                break;
-            default:
-                break;
-        }
+        frame_size += s_fmetadata_size (filemeta_data, false);
         // next list entry
         filemeta_data = zs_msg_fmetadata_next (self);
     }
     return zs_msg_pack (&self, output, frame_size); 
 }
 
+// --------------------------------------------------------------------------
+// Send the FILE_LIST to the RP in one step
+
+int
+zs_msg_pack_update (zmsg_t *output, uint64_t state, zlist_t *fmetadata) 
+{
+    return zs_msg_pack_update_encoded (output, ZS_CMD_UPDATE, ZS_ENCODING_PLAIN, state, fmetadata);
+}
+
+// --------------------------------------------------------------------------
+// Send a part of the FILE_LIST which is followed by further parts. The
+// last part is sent with zs_msg_pack_update.
+
+int
+zs_msg_pack_update_part (zmsg_t *output, uint64_t state, zlist_t *fmetadata) 
+{
+    return zs_msg_pack_update_encoded (output, ZS_CMD_UPDATE_PART, ZS_ENCODING_PLAIN, state, fmetadata);
+}
+
+// --------------------------------------------------------------------------
+// Removes file meta data from the head of fmetadata until the UPDATE of
+// the removed entries would exceed max_size bytes. At least one entry is
+// removed if fmetadata isn't empty. Caller owns the returned list.
+
+zlist_t *
+zs_msg_update_batch (zlist_t *fmetadata, size_t max_size)
+{
+    assert (fmetadata);
+    zlist_t *batch = zlist_new ();
+    size_t batch_size = 8 + 8;  // 8-byte state, 8-byte list size
+    zs_fmetadata_t *item = zlist_first (fmetadata);
+    while (item) {
+        size_t item_size = s_fmetadata_size (item, true);
+        if (zlist_size (batch) > 0 && batch_size + item_size > max_size)
+            break;
+        batch_size += item_size;
+        zlist_append (batch, zlist_pop (fmetadata));
+        item = zlist_first (fmetadata);
+    }
+    return batch;
+}
+
 // -------------------------------------------------------------------------
 // Send the REQUEST FILES to the RP in one step 
 
 int
 zs_msg_pack_request_files (zmsg_t *output, zlist_t *fpaths)
+{
+    return zs_msg_pack_request_resume (output, fpaths, NULL, NULL);
+}
+
+// -------------------------------------------------------------------------
+// Send the REQUEST FILES to the RP in one step. For every file the offset
+// to resume at and the checksum of the file version which has been
+// received up to that offset are sent. Offsets and checksums may be NULL
+// to request the whole files.
+
+int
+zs_msg_pack_request_resume (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums)
+{
+    return zs_msg_pack_request_credit (output, fpaths, offsets, checksums, 0);
+}
+
+// -------------------------------------------------------------------------
+// Send the REQUEST FILES with an initial credit, which lets the SP start
+// sending before a GIVE_CREDIT arrives. Older peers ignore the credit.
+
+int
+zs_msg_pack_request_credit (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums, uint64_t credit)
+{
+    return zs_msg_pack_request_priority (output, fpaths, offsets, checksums, credit, 0);
+}
+
+// -------------------------------------------------------------------------
+// Send the REQUEST FILES with a priority. The SP sends files with a higher
+// priority first, e.g. files a user waits for before bulk transfers. Older
+// peers ignore the priority.
+
+int
+zs_msg_pack_request_priority (zmsg_t *output, zlist_t *fpaths, uint64_t *offsets, uint64_t *checksums, uint64_t credit, byte priority)
 {
     zs_msg_t *self = zs_msg_new (ZS_CMD_REQUEST_FILES);
     
     zs_msg_set_fpaths (self, fpaths);
+    zs_msg_set_credit (self, credit);
+    zs_msg_set_priority (self, priority);
 
-    size_t frame_size = 8; // 8-byte list size
+    // 8-byte list size, 8-byte initial credit, 1-byte priority, 8-byte
+    // size of the resume list
+    size_t frame_size = 8 + 8 + 1 + 8;
+    size_t index = 0;
     char* path = zs_msg_fpaths_first (self);
     while (path) {
         frame_size += sizeof (string_size_t);
         frame_size += strlen (path);
+        if (offsets && offsets [index] > 0) {
+            zs_msg_set_resume (self, path, offsets [index], checksums [index]);
+            frame_size += sizeof (string_size_t);
+            frame_size += strlen (path);
+            frame_size += 8;    // 8-byte resume offset
+            frame_size += 8;    // 8-byte checksum
+        }
+        index++;
         // next
         path = zs_msg_fpaths_next (self);
     }
@@ -533,6 +1151,116 @@ zs_msg_pack_chunk (zmsg_t *output, uint64_t sequence, char *file_path, uint64_t
     return zs_msg_pack (&msg, output, frame_size);
 }
 
+// -------------------------------------------------------------------------
+// Send REQUEST_DELTA to a SP, the signature describes the blocks of the
+// requester's copy of the file
+
+int
+zs_msg_pack_request_delta (zmsg_t *output, char *file_path, zframe_t *signature)
+{
+    assert (output);
+    assert (signature);
+
+    zs_msg_t *msg = zs_msg_new (ZS_CMD_REQUEST_DELTA);
+    zs_msg_set_chunk (msg, signature);
+    zs_msg_set_file_path (msg, "%s", file_path);
+
+    size_t frame_size = 0;
+    frame_size += sizeof (string_size_t);   // size of string
+    frame_size += strlen (file_path);       // length of string
+
+    return zs_msg_pack (&msg, output, frame_size);
+}
+
+// -------------------------------------------------------------------------
+// Send SEND_DELTA to a RP, the delta instructions rebuild the file from
+// 'offset' onwards
+
+int
+zs_msg_pack_delta (zmsg_t *output, uint64_t sequence, char *file_path, uint64_t offset, zframe_t *delta)
+{
+    assert (output);
+    assert (delta);
+
+    zs_msg_t *msg = zs_msg_new (ZS_CMD_SEND_DELTA);
+    zs_msg_set_chunk (msg, delta);
+    zs_msg_set_sequence (msg, sequence);
+    zs_msg_set_file_path (msg, "%s", file_path);
+    zs_msg_set_offset (msg, offset);
+
+    size_t frame_size = 0;
+    frame_size += sizeof (string_size_t);   // size of string
+    frame_size += strlen (file_path);       // length of string
+    frame_size += 8;    // 8-byte sequence
+    frame_size += 8;    // 8-byte offset
+
+    return zs_msg_pack (&msg, output, frame_size);
+}
+
+// -------------------------------------------------------------------------
+// Send REQUEST_MANIFEST to a SP, which answers with the chunk manifest of
+// every file
+
+int
+zs_msg_pack_request_manifest (zmsg_t *output, zlist_t *fpaths)
+{
+    zs_msg_t *self = zs_msg_new (ZS_CMD_REQUEST_MANIFEST);
+    
+    zs_msg_set_fpaths (self, fpaths);
+
+    size_t frame_size = 8; // 8-byte list size
+    char* path = zs_msg_fpaths_first (self);
+    while (path) {
+        frame_size += sizeof (string_size_t);
+        frame_size += strlen (path);
+        // next
+        path = zs_msg_fpaths_next (self);
+    }
+
+    return zs_msg_pack (&self, output, frame_size);
+}
+
+// -------------------------------------------------------------------------
+// Send SEND_MANIFEST to a RP, the manifest lists the chunks of the file
+
+int
+zs_msg_pack_manifest (zmsg_t *output, char *file_path, zframe_t *manifest)
+{
+    assert (output);
+    assert (manifest);
+
+    zs_msg_t *msg = zs_msg_new (ZS_CMD_SEND_MANIFEST);
+    zs_msg_set_chunk (msg, manifest);
+    zs_msg_set_file_path (msg, "%s", file_path);
+
+    size_t frame_size = 0;
+    frame_size += sizeof (string_size_t);   // size of string
+    frame_size += strlen (file_path);       // length of string
+
+    return zs_msg_pack (&msg, output, frame_size);
+}
+
+// -------------------------------------------------------------------------
+// Send REQUEST_RANGES to a SP, the ranges are the parts of the file the
+// requester doesn't have locally
+
+int
+zs_msg_pack_request_ranges (zmsg_t *output, char *file_path, zframe_t *ranges)
+{
+    assert (output);
+    assert (ranges);
+
+    zs_msg_t *msg = zs_msg_new (ZS_CMD_REQUEST_RANGES);
+    zs_msg_set_chunk (msg, ranges);
+    zs_msg_set_file_path (msg, "%s", file_path);
+
+    size_t frame_size = 0;
+    frame_size += sizeof (string_size_t);   // size of string
+    frame_size += strlen (file_path);       // length of string
+
+    return zs_msg_pack (&msg, output, frame_size);
+}
+
 // -------------------------------------------------------------------------
 // Send ABORT to the RP in one step 
 
@@ -595,6 +1323,20 @@ zs_msg_get_state (zs_msg_t *self)
 // --------------------------------------------------------------------------
 // Get/Set the file meta data list
 
+// Detaches the file meta data list, caller takes ownership
+
+zlist_t *
+zs_msg_detach_fmetadata (zs_msg_t *self)
+{
+    assert (self);
+    // The arena keeps owning its file meta data
+    if (self->arena)
+        return s_fitems_list (self);
+    zlist_t *fmetadata = self->fmetadata;
+    self->fmetadata = NULL;
+    return fmetadata;
+}
+
 // Greedy method takes ownership of fmetadata.
 void 
 zs_msg_set_fmetadata (zs_msg_t *self, zlist_t *fmetadata) 
@@ -611,6 +1353,8 @@ zlist_t *
 zs_msg_get_fmetadata (zs_msg_t *self) 
 {
     assert (self);
+    if (self->arena && !self->fmetadata)
+        self->fmetadata = s_fitems_list (self);
     return self->fmetadata;
 }
 
@@ -620,6 +1364,10 @@ zs_fmetadata_t *
 zs_msg_fmetadata_first (zs_msg_t *self)
 {
     assert (self);
+    if (self->arena) {
+        self->fitems_cursor = 0;
+        return self->fitems_size? self->fitems [0]: NULL;
+    }
     if (self->fmetadata)
         return (zs_fmetadata_t *) (zlist_first (self->fmetadata));
     else
@@ -630,6 +1378,11 @@ zs_fmetadata_t *
 zs_msg_fmetadata_next (zs_msg_t *self)
 {
     assert (self);
+    if (self->arena) {
+        if (self->fitems_cursor + 1 >= self->fitems_size)
+            return NULL;
+        return self->fitems [++self->fitems_cursor];
+    }
     if (self->fmetadata)
         return (zs_fmetadata_t *) (zlist_next (self->fmetadata));
     else
@@ -640,7 +1393,11 @@ void
 zs_msg_fmetadata_append (zs_msg_t *self, zs_fmetadata_t *fmetadata_item)
 {
     assert (self);
-    // Format into newly allocated string
+    if (self->arena) {
+        s_fitems_reserve (self, 1);
+        self->fitems [self->fitems_size++] = fmetadata_item;
+        return;
+    }
     
     if (!self->fmetadata) {
         self->fmetadata = zlist_new ();
@@ -699,20 +1456,82 @@ zs_msg_fpaths_append (zs_msg_t *self, char *format, ...)
     assert (self);
     va_list argptr;
     va_start (argptr, format);
-    char *string = (char *) malloc (STRING_MAX + 1);
-    assert (string);
-    vsnprintf (string, STRING_MAX, format, argptr);
+    char *string = s_vformat (format, argptr);
     va_end (argptr);
     
     // Attach string to list
-    if (!self->fpaths) {
-        self->fpaths = zlist_new ();
-        zlist_autofree (self->fpaths);
-    }
-    zlist_append (self->fpaths, string);
+    s_fpaths_append (self, string);
     free (string);
 }
 
+// --------------------------------------------------------------------------
+// Get/Set the resume offset and checksum of a requested file
+
+void
+zs_msg_set_resume (zs_msg_t *self, char *path, uint64_t offset, uint64_t checksum)
+{
+    assert (self);
+    assert (path);
+    if (!self->fresume)
+        self->fresume = zhash_new ();
+    uint64_t *resume = (uint64_t *) malloc (2 * sizeof (uint64_t));
+    resume [0] = offset;
+    resume [1] = checksum;
+    zhash_delete (self->fresume, path);
+    zhash_insert (self->fresume, path, resume);
+    zhash_freefn (self->fresume, path, free);
+}
+
+uint64_t
+zs_msg_resume_offset (zs_msg_t *self, char *path)
+{
+    assert (self);
+    uint64_t *resume = self->fresume? (uint64_t *) zhash_lookup (self->fresume, path): NULL;
+    return resume? resume [0]: 0;
+}
+
+uint64_t
+zs_msg_resume_checksum (zs_msg_t *self, char *path)
+{
+    assert (self);
+    uint64_t *resume = self->fresume? (uint64_t *) zhash_lookup (self->fresume, path): NULL;
+    return resume? resume [1]: 0;
+}
+
+// --------------------------------------------------------------------------
+// Get/Set the UPDATE encoding
+
+void
+zs_msg_set_encoding (zs_msg_t *self, byte encoding)
+{
+    assert (self);
+    self->encoding = encoding;
+}
+
+byte
+zs_msg_encoding (zs_msg_t *self)
+{
+    assert (self);
+    return self->encoding;
+}
+
+// --------------------------------------------------------------------------
+// Get/Set the protocol features, a set of ZS_FEATURE_* flags
+
+void
+zs_msg_set_features (zs_msg_t *self, byte features)
+{
+    assert (self);
+    self->features = features;
+}
+
+byte
+zs_msg_features (zs_msg_t *self)
+{
+    assert (self);
+    return self->features;
+}
+
 // --------------------------------------------------------------------------
 // Get/Set the credit
 
@@ -730,6 +1549,40 @@ zs_msg_get_credit (zs_msg_t *self)
     return self->credit;
 }
 
+// --------------------------------------------------------------------------
+// Get/Set the priority
+
+void 
+zs_msg_set_priority (zs_msg_t *self, byte priority)
+{
+    assert (self);
+    self->priority = priority;
+}
+
+byte 
+zs_msg_get_priority (zs_msg_t *self)
+{
+    assert (self);
+    return self->priority;
+}
+
+// --------------------------------------------------------------------------
+// Get/Set the max chunk size
+
+void 
+zs_msg_set_chunk_size (zs_msg_t *self, uint64_t chunk_size)
+{
+    assert (self);
+    self->chunk_size = chunk_size;
+}
+
+uint64_t 
+zs_msg_get_chunk_size (zs_msg_t *self)
+{
+    assert (self);
+    return self->chunk_size;
+}
+
 // --------------------------------------------------------------------------
 // Get/Set the chunk
 
@@ -747,6 +1600,18 @@ zs_msg_get_chunk (zs_msg_t *self)
     return self->chunk;     
 }
 
+// Returns the chunk and transfers its ownership to the caller, this allows
+// to pass on received data without copying it.
+
+zframe_t *
+zs_msg_detach_chunk (zs_msg_t *self)
+{
+    assert (self);
+    zframe_t *chunk = self->chunk;
+    self->chunk = NULL;
+    return chunk;
+}
+
 // --------------------------------------------------------------------------
 // Get/Set the msg sequence
 
@@ -772,9 +1637,7 @@ zs_msg_set_file_path (zs_msg_t *self, char *format, ...)
     va_list argptr;
     va_start (argptr, format);
     free (self->file_path);
-    self->file_path = (char *) malloc (STRING_MAX + 1);
-    assert (self->file_path);
-    vsnprintf (self->file_path, STRING_MAX, format, argptr);
+    self->file_path = s_vformat (format, argptr);
     va_end (argptr);
 }
 
@@ -830,7 +1693,8 @@ zs_msg_test ()
     /* [SEND] GREET */
     msg = zmsg_new ();
     zuuid_t *s_uuid = zuuid_new ();
-    zs_msg_pack_greet (msg, zuuid_data (s_uuid), 0xFF);
+    zs_msg_pack_greet (msg, zuuid_data (s_uuid), 0xFF, 0x100000, ZS_ENCODING_COMPACT,
+                       ZS_FEATURE_UPDATE_PARTS);
     zmsg_send (&msg, sender);
     zmsg_destroy (&msg);    // delete zmsg
     
@@ -838,12 +1702,33 @@ zs_msg_test ()
     msg = zmsg_recv (sink);
     zs_msg_t *self = zs_msg_unpack (msg);
     uint64_t state = zs_msg_get_state (self);
+    assert (zs_msg_get_chunk_size (self) == 0x100000);
+    assert (zs_msg_encoding (self) == ZS_ENCODING_COMPACT);
+    assert (zs_msg_features (self) == ZS_FEATURE_UPDATE_PARTS);
     zuuid_t *r_uuid = zuuid_new ();
     zuuid_set (r_uuid, zs_msg_uuid (self));
     assert ( zuuid_eq (s_uuid, zuuid_data (r_uuid)));
     zmsg_destroy (&msg);    // destroy zmsg
     zs_msg_destroy (&self); // destry zs_msg
 
+    /* [RECV] GREET of a peer without chunk size and encoding */
+    msg = zmsg_new ();
+    zframe_t *greet = zframe_new (NULL, 2 + 1 + 16 + 8);
+    byte *needle = zframe_data (greet);
+    *needle++ = SIGNATURE >> 8;
+    *needle++ = SIGNATURE & 0xFF;
+    *needle++ = ZS_CMD_GREET;
+    memcpy (needle, zuuid_data (s_uuid), 16);
+    memset (needle + 16, 0, 8);
+    zmsg_append (msg, &greet);
+    self = zs_msg_unpack (msg);
+    assert (self);
+    assert (zs_msg_get_chunk_size (self) == CHUNK_SIZE);
+    assert (zs_msg_encoding (self) == ZS_ENCODING_PLAIN);
+    assert (zs_msg_features (self) == 0);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
     /* [SEND LAST_STATE */
     msg = zmsg_new ();
     zs_msg_pack_last_state (msg, 0x55);
@@ -866,6 +1751,9 @@ zs_msg_test ()
     zs_fmetadata_set_size (fmetadata, 0x1533);
     zs_fmetadata_set_timestamp (fmetadata, 0x1dfa533);
     zs_fmetadata_set_checksum (fmetadata, 0x3312AFFDE12);
+    byte digest [ZSYNC_DIGEST_SIZE];
+    zsync_hash_sha256 ("a.txt", 5, digest);
+    zs_fmetadata_set_digest (fmetadata, digest);
     zlist_append (filemeta_list, fmetadata);
     zs_fmetadata_t *fmetadata2 = zs_fmetadata_new ();
     zs_fmetadata_set_path (fmetadata2, "%s", "b.txt");
@@ -891,12 +1779,149 @@ zs_msg_test ()
         uint64_t size = zs_fmetadata_size (fmetadata);
         uint64_t timestamp = zs_fmetadata_timestamp (fmetadata);
         uint64_t checksum = zs_fmetadata_checksum (fmetadata);
+        if (operation == ZS_FILE_OP_UPD) {
+            assert (checksum == 0x3312AFFDE12);
+            // Only the compact encoding carries digests
+            byte none [ZSYNC_DIGEST_SIZE] = { 0 };
+            assert (memcmp (zs_fmetadata_digest (fmetadata), none, ZSYNC_DIGEST_SIZE) == 0);
+        }
         
         free (path);
         fmetadata = zs_msg_fmetadata_next (self);
     }
     zmsg_destroy (&msg);    // destroy zmsg
     zs_msg_destroy (&self);
+
+    /* [SEND] UPDATE in parts */
+    filemeta_list = zlist_new ();
+    int index;
+    for (index = 0; index < 100; index++) {
+        fmetadata = zs_fmetadata_new ();
+        zs_fmetadata_set_path (fmetadata, "dir/file%03d.txt", index);
+        zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_DEL);
+        zlist_append (filemeta_list, fmetadata);
+    }
+    // 8-byte state, 8-byte list size and ten deleted files per part
+    size_t batch_size = 16 + 10 * (sizeof (string_size_t) + 16 + 8 + 1);
+    int parts = 0, entries = 0;
+    while (zlist_size (filemeta_list) > 0) {
+        zlist_t *batch = zs_msg_update_batch (filemeta_list, batch_size);
+        assert (zlist_size (batch) == 10);
+        msg = zmsg_new ();
+        if (zlist_size (filemeta_list) > 0)
+            zs_msg_pack_update_part (msg, 0xAC, batch);
+        else
+            zs_msg_pack_update (msg, 0xAC, batch);
+        zmsg_send (&msg, sender);
+
+        /* [RECV] UPDATE part */
+        msg = zmsg_recv (sink);
+        self = zs_msg_unpack (msg);
+        parts++;
+        entries += zlist_size (zs_msg_get_fmetadata (self));
+        assert (zs_msg_get_state (self) == 0xAC);
+        assert (zs_msg_get_cmd (self) == (parts < 10? ZS_CMD_UPDATE_PART: ZS_CMD_UPDATE));
+        zmsg_destroy (&msg);
+        zs_msg_destroy (&self);
+    }
+    assert (parts == 10 && entries == 100);
+    zlist_destroy (&filemeta_list);
+
+    /* [SEND] compact UPDATE */
+    filemeta_list = zlist_new ();
+    for (index = 0; index < 3; index++) {
+        fmetadata = zs_fmetadata_new ();
+        zs_fmetadata_set_path (fmetadata, "dir/sub/file%d.txt", index);
+        zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_UPD + index);
+        zs_fmetadata_set_timestamp (fmetadata, 0x1dfa533 - index);
+        zs_fmetadata_set_size (fmetadata, 0x1533);
+        zs_fmetadata_set_checksum (fmetadata, 0x3312AFFDE12);
+        zs_fmetadata_set_digest (fmetadata, digest);
+        zs_fmetadata_set_renamed_path (fmetadata, "dir/sub/renamed%d.txt", index);
+        zlist_append (filemeta_list, fmetadata);
+    }
+    msg = zmsg_new ();
+    zs_msg_pack_update_encoded (msg, ZS_CMD_UPDATE_PART, ZS_ENCODING_COMPACT, 0xABCDEF, filemeta_list);
+    zmsg_send (&msg, sender);
+
+    /* [RECV] compact UPDATE */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_UPDATE_PART);
+    assert (zs_msg_encoding (self) == ZS_ENCODING_COMPACT);
+    assert (zs_msg_get_state (self) == 0xABCDEF);
+    assert (zlist_size (zs_msg_get_fmetadata (self)) == 3);
+    index = 0;
+    fmetadata = zs_msg_fmetadata_first (self);
+    while (fmetadata) {
+        char expected [32];
+        sprintf (expected, "dir/sub/file%d.txt", index);
+        char *path = zs_fmetadata_path (fmetadata);
+        assert (streq (path, expected));
+        free (path);
+        assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_UPD + index);
+        assert (zs_fmetadata_timestamp (fmetadata) == 0x1dfa533 - index);
+        if (index == 0) {
+            assert (zs_fmetadata_size (fmetadata) == 0x1533);
+            assert (zs_fmetadata_checksum (fmetadata) == 0x3312AFFDE12);
+            assert (memcmp (zs_fmetadata_digest (fmetadata), digest, ZSYNC_DIGEST_SIZE) == 0);
+        }
+        if (index == 2) {
+            sprintf (expected, "dir/sub/renamed%d.txt", index);
+            path = zs_fmetadata_renamed_path (fmetadata);
+            assert (streq (path, expected));
+            free (path);
+        }
+        index++;
+        fmetadata = zs_msg_fmetadata_next (self);
+    }
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] UPDATE into an arena */
+    zsync_arena_t *arena = zsync_arena_new (0);
+    filemeta_list = zlist_new ();
+    for (index = 0; index < 3; index++) {
+        fmetadata = zs_fmetadata_new ();
+        zs_fmetadata_set_path (fmetadata, "dir/file%d.txt", index);
+        zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_REN);
+        zs_fmetadata_set_timestamp (fmetadata, index);
+        zs_fmetadata_set_renamed_path (fmetadata, "dir/renamed%d.txt", index);
+        zlist_append (filemeta_list, fmetadata);
+    }
+    msg = zmsg_new ();
+    zs_msg_pack_update (msg, 0x1234, filemeta_list);
+    zmsg_send (&msg, sender);
+
+    /* [RECV] UPDATE into an arena */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack_arena (msg, arena);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_UPDATE);
+    assert (zs_msg_get_state (self) == 0x1234);
+    assert (zsync_arena_size (arena) > 0);
+    index = 0;
+    fmetadata = zs_msg_fmetadata_first (self);
+    while (fmetadata) {
+        char expected [32];
+        sprintf (expected, "dir/renamed%d.txt", index);
+        char *path = zs_fmetadata_renamed_path (fmetadata);
+        assert (streq (path, expected));
+        free (path);
+        index++;
+        fmetadata = zs_msg_fmetadata_next (self);
+    }
+    assert (index == 3);
+    // Detached meta data can be repacked, the arena keeps owning them
+    filemeta_list = zs_msg_detach_fmetadata (self);
+    assert (zlist_size (filemeta_list) == 3);
+    zmsg_destroy (&msg);
+    msg = zmsg_new ();
+    zs_msg_pack_update (msg, 0x1234, filemeta_list);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+    zsync_arena_reset (arena);
+    assert (zsync_arena_size (arena) == 0);
+    zsync_arena_destroy (&arena);
    
     /* [SEND] REQUEST FILES */
     msg = zmsg_new ();
@@ -905,7 +1930,9 @@ zs_msg_test ()
     zlist_append (paths, "test2.txt");
     zlist_append (paths, "test3.txt");
 
-    zs_msg_pack_request_files (msg, paths);
+    uint64_t resume_offsets [3] = { 0, 60000, 0 };
+    uint64_t resume_checksums [3] = { 0, 0xC0FFEE, 0 };
+    zs_msg_pack_request_priority (msg, paths, resume_offsets, resume_checksums, 300000, 7);
     zmsg_send (&msg, sender);
     zmsg_destroy (&msg);    // destroy zmsg
 
@@ -920,10 +1947,117 @@ zs_msg_test ()
         // next
         path = zs_msg_fpaths_next (self);
     }
+    assert (zs_msg_resume_offset (self, "test1.txt") == 0);
+    assert (zs_msg_resume_offset (self, "test2.txt") == 60000);
+    assert (zs_msg_resume_checksum (self, "test2.txt") == 0xC0FFEE);
+    assert (zs_msg_get_credit (self) == 300000);
+    assert (zs_msg_get_priority (self) == 7);
     // cleanup
     zmsg_destroy (&msg);    // destroy zmsg
     zs_msg_destroy (&self);
 
+    /* [RECV] REQUEST FILES of a peer without credit, priority and resume */
+    msg = zmsg_new ();
+    zframe_t *request = zframe_new (NULL, 2 + 1 + 8 + 3 + 4);
+    needle = zframe_data (request);
+    *needle++ = SIGNATURE >> 8;
+    *needle++ = SIGNATURE & 0xFF;
+    *needle++ = ZS_CMD_REQUEST_FILES;
+    memset (needle, 0, 7);
+    needle [7] = 2;
+    needle += 8;
+    memcpy (needle, "\0\1a\0\2bc", 7);
+    zmsg_append (msg, &request);
+    self = zs_msg_unpack (msg);
+    assert (self);
+    assert (zlist_size (zs_msg_fpaths (self)) == 2);
+    assert (streq (zs_msg_fpaths_first (self), "a"));
+    assert (streq (zs_msg_fpaths_next (self), "bc"));
+    assert (zs_msg_resume_offset (self, "bc") == 0);
+    assert (zs_msg_get_credit (self) == 0);
+    assert (zs_msg_get_priority (self) == 0);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] REQUEST DELTA */
+    msg = zmsg_new ();
+    zs_msg_pack_request_delta (msg, "test1.txt", zframe_new ("signature", 9));
+    zmsg_send (&msg, sender);
+
+    /* [RECV] REQUEST DELTA */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_REQUEST_DELTA);
+    path = zs_msg_get_file_path (self);
+    assert (streq (path, "test1.txt"));
+    free (path);
+    assert (zframe_size (zs_msg_get_chunk (self)) == 9);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] SEND DELTA */
+    msg = zmsg_new ();
+    zs_msg_pack_delta (msg, 3, "test1.txt", 0x1000, zframe_new ("delta", 5));
+    zmsg_send (&msg, sender);
+
+    /* [RECV] SEND DELTA */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_SEND_DELTA);
+    assert (zs_msg_get_sequence (self) == 3);
+    assert (zs_msg_get_offset (self) == 0x1000);
+    zframe_t *delta = zs_msg_detach_chunk (self);
+    assert (memcmp (zframe_data (delta), "delta", 5) == 0);
+    zframe_destroy (&delta);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] REQUEST MANIFEST */
+    zlist_t *manifest_paths = zlist_new ();
+    zlist_append (manifest_paths, "test1.txt");
+    zlist_append (manifest_paths, "test2.txt");
+    msg = zmsg_new ();
+    zs_msg_pack_request_manifest (msg, manifest_paths);
+    zmsg_send (&msg, sender);
+
+    /* [RECV] REQUEST MANIFEST */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_REQUEST_MANIFEST);
+    assert (zlist_size (zs_msg_fpaths (self)) == 2);
+    assert (streq (zs_msg_fpaths_first (self), "test1.txt"));
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] SEND MANIFEST */
+    msg = zmsg_new ();
+    zs_msg_pack_manifest (msg, "test1.txt", zframe_new ("manifest", 8));
+    zmsg_send (&msg, sender);
+
+    /* [RECV] SEND MANIFEST */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_SEND_MANIFEST);
+    path = zs_msg_get_file_path (self);
+    assert (streq (path, "test1.txt"));
+    free (path);
+    assert (zframe_size (zs_msg_get_chunk (self)) == 8);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
+    /* [SEND] REQUEST RANGES */
+    msg = zmsg_new ();
+    zs_msg_pack_request_ranges (msg, "test1.txt", zframe_new ("ranges", 6));
+    zmsg_send (&msg, sender);
+
+    /* [RECV] REQUEST RANGES */
+    msg = zmsg_recv (sink);
+    self = zs_msg_unpack (msg);
+    assert (zs_msg_get_cmd (self) == ZS_CMD_REQUEST_RANGES);
+    assert (memcmp (zframe_data (zs_msg_get_chunk (self)), "ranges", 6) == 0);
+    zmsg_destroy (&msg);
+    zs_msg_destroy (&self);
+
     /* [SEND] ABORT */
     msg = zmsg_new ();
     zs_msg_pack_abort (msg);
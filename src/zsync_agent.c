@@ -42,6 +42,12 @@ struct _zsync_t {
     void *pipe;
 
     bool running;
+
+    uint64_t chunk_size;        // Largest chunk size exchanged with peers
+    bool adaptive_chunks;       // Grow chunks from measured throughput
+    bool zero_copy_chunks;      // Hand received chunks over as CHUNK_FRAME
+    bool adaptive_credit;       // Size credit to the bandwidth-delay product
+    bool write_backpressure;    // Credit follows bytes written to disk
 };
 
 
@@ -56,6 +62,11 @@ zsync_new ()
     self->ctx = zctx_new ();
     assert (self->ctx);
     self->running = false;
+    self->chunk_size = CHUNK_SIZE;
+    self->adaptive_chunks = false;
+    self->zero_copy_chunks = false;
+    self->adaptive_credit = false;
+    self->write_backpressure = false;
     
     return self;
 }
@@ -82,7 +93,7 @@ int
 zsync_start (zsync_t *self)
 {
     assert (self);
-    self->pipe = zthread_fork (self->ctx, zsync_node_engine, NULL);
+    self->pipe = zthread_fork (self->ctx, zsync_node_engine, self);
     self->running = true;
     return 0;
 }
@@ -108,26 +119,147 @@ zsync_stop (zsync_t *self)
 
 void 
 zsync_send_request_files (zsync_t *self, char *receiver, zlist_t *files, uint64_t size)
+{
+    zsync_send_request_files_priority (self, receiver, files, size, ZSYNC_PRIORITY_BULK);
+}
+
+// --------------------------------------------------------------------------
+// Requests files with a priority. The peer sends files with a higher
+// priority first and preempts files with a lower one, e.g. to get files a
+// user waits for ahead of a large synchronization. Within a priority the
+// files with the fewest bytes left are sent first.
+
+void 
+zsync_send_request_files_priority (zsync_t *self, char *receiver, zlist_t *files, uint64_t size, byte priority)
+{
+    assert (self);
+    int rc = zsync_msg_send_req_files (self->pipe, receiver, files, size, priority);   
+    assert (rc == 0);
+}
+
+// --------------------------------------------------------------------------
+// Requests the changes of a file relative to the local copy described by
+// signature. The peer answers with DELTA messages which are applied with
+// zsync_delta_apply.
+
+void
+zsync_send_request_delta (zsync_t *self, char *receiver, char *path, zframe_t **signature_p, uint64_t size)
+{
+    assert (self);
+    assert (signature_p);
+    int rc = zsync_msg_send_req_delta (self->pipe, receiver, path, size, *signature_p);
+    assert (rc == 0);
+    zframe_destroy (signature_p);
+}
+
+// --------------------------------------------------------------------------
+// Requests the chunk manifests of files. The peer's agent answers with
+// zsync_send_manifest.
+
+void
+zsync_send_request_manifest (zsync_t *self, char *receiver, zlist_t *files)
+{
+    assert (self);
+    int rc = zsync_msg_send_req_manifest (self->pipe, receiver, files);
+    assert (rc == 0);
+}
+
+// --------------------------------------------------------------------------
+// Sends the chunk manifest of a file to the peer which requested it
+
+void
+zsync_send_manifest (zsync_t *self, char *receiver, char *path, zframe_t **manifest_p)
+{
+    assert (self);
+    assert (manifest_p);
+    int rc = zsync_msg_send_manifest (self->pipe, receiver, path, *manifest_p);
+    assert (rc == 0);
+    zframe_destroy (manifest_p);
+}
+
+// --------------------------------------------------------------------------
+// Requests the byte ranges of a file which could not be assembled from
+// local chunks. The peer answers with chunks of these ranges.
+
+void
+zsync_send_request_ranges (zsync_t *self, char *receiver, char *path, zframe_t **ranges_p)
 {
     assert (self);
-    int rc = zsync_msg_send_req_files (self->pipe, receiver, files, size);   
+    assert (ranges_p);
+    uint64_t size = zsync_cdc_ranges_size (*ranges_p);
+    int rc = zsync_msg_send_req_ranges (self->pipe, receiver, path, size, *ranges_p);
     assert (rc == 0);
+    zframe_destroy (ranges_p);
+}
+
+// --------------------------------------------------------------------------
+// Sends the file meta data of list in parts of at most ZS_UPDATE_BATCH_SIZE
+// bytes as message id. Unless last is set all parts announce further parts.
+// Takes ownership of list.
+
+static void
+s_send_update (zsync_t *self, int id, uint64_t state, zlist_t *list, bool last)
+{
+    do {
+        zlist_t *batch = zs_msg_update_batch (list, ZS_UPDATE_BATCH_SIZE);
+        zmsg_t *msg = zmsg_new ();
+        int rc;
+        if (last && zlist_size (list) == 0)
+            rc = zs_msg_pack_update (msg, state, batch);
+        else
+            rc = zs_msg_pack_update_part (msg, state, batch);
+        // give the send_update_command to the protocol
+        if (rc == 0) {
+            if (id == ZSYNC_MSG_RES_UPDATE)
+                rc = zsync_msg_send_res_update (self->pipe, "", msg);
+            else
+                rc = zsync_msg_send_update (self->pipe, "", msg);
+            assert (rc == 0);
+        }
+        zmsg_destroy (&msg);
+    } while (zlist_size (list) > 0);
+    zlist_destroy (&list);
 }
 
 // --------------------------------------------------------------------------
-// send_update for the protocol
+// send_update for the protocol. Long lists are sent in several parts which
+// peers process one after another.
 
 void
 zsync_send_update (zsync_t *self, uint64_t state, zlist_t *list)
 {
     assert (self);
-    zmsg_t *msg = zmsg_new ();
-    // give the send_update_command to the protocol
-    if (zs_msg_pack_update (msg, state, list) == 0) {
-        int rc = zsync_msg_send_update (self->pipe, "", msg);
-        assert (rc == 0);
-        printf ("[AG] Update sent.\n");    
-    }
+    assert (list);
+    s_send_update (self, ZSYNC_MSG_UPDATE, state, list, true);
+    printf ("[AG] Update sent.\n");    
+}
+
+// --------------------------------------------------------------------------
+// Answers a REQ_UPDATE with the changes since the requested state. Unlike
+// zsync_send_update the list goes to the requesting peer only, it must not
+// be mixed up with changes announced meanwhile.
+
+void
+zsync_reply_update (zsync_t *self, uint64_t state, zlist_t *list)
+{
+    assert (self);
+    assert (list);
+    s_send_update (self, ZSYNC_MSG_RES_UPDATE, state, list, true);
+}
+
+// --------------------------------------------------------------------------
+// Sends a part of an update, e.g. while the changes are still collected.
+// The update is completed with zsync_send_update.
+
+void
+zsync_send_update_part (zsync_t *self, uint64_t state, zlist_t *list)
+{
+    assert (self);
+    assert (list);
+    if (zlist_size (list) > 0)
+        s_send_update (self, ZSYNC_MSG_UPDATE, state, list, false);
+    else
+        zlist_destroy (&list);
 }
 
 // --------------------------------------------------------------------------
@@ -142,6 +274,180 @@ zsync_send_abort (zsync_t *self, char *receiver, char* fileToAbort)
     printf("[AG] Caution, file transfer aborted!!!\n");
 }
 
+// --------------------------------------------------------------------------
+// Sets the chunk size offered to peers. The chunk size used with a peer is 
+// the smaller one of both. Must be set before the protocol is started.
+
+void
+zsync_set_chunk_size (zsync_t *self, uint64_t chunk_size)
+{
+    assert (self);
+    assert (!self->running);
+    if (chunk_size < CHUNK_SIZE)
+        chunk_size = CHUNK_SIZE;
+    if (chunk_size > CHUNK_SIZE_MAX)
+        chunk_size = CHUNK_SIZE_MAX;
+    self->chunk_size = chunk_size;
+}
+
+// --------------------------------------------------------------------------
+// Returns the chunk size offered to peers
+
+uint64_t
+zsync_chunk_size (zsync_t *self)
+{
+    assert (self);
+    return self->chunk_size;
+}
+
+// --------------------------------------------------------------------------
+// Enables adaptive chunks, which start small and grow up to the chunk size
+// depending on throughput and round-trip time of a peer.
+
+void
+zsync_set_adaptive_chunks (zsync_t *self, bool adaptive)
+{
+    assert (self);
+    assert (!self->running);
+    self->adaptive_chunks = adaptive;
+}
+
+// --------------------------------------------------------------------------
+// Returns whether adaptive chunks are enabled
+
+bool
+zsync_adaptive_chunks (zsync_t *self)
+{
+    assert (self);
+    return self->adaptive_chunks;
+}
+
+// --------------------------------------------------------------------------
+// Enables zero-copy delivery of received chunks. The node then hands the
+// frame received from the network over in a CHUNK_FRAME message instead of
+// copying it into a CHUNK, so the agent has to handle CHUNK_FRAME.
+
+void
+zsync_set_zero_copy_chunks (zsync_t *self, bool zero_copy)
+{
+    assert (self);
+    assert (!self->running);
+    self->zero_copy_chunks = zero_copy;
+}
+
+// --------------------------------------------------------------------------
+// Returns whether received chunks are delivered as CHUNK_FRAME
+
+bool
+zsync_zero_copy_chunks (zsync_t *self)
+{
+    assert (self);
+    return self->zero_copy_chunks;
+}
+
+// --------------------------------------------------------------------------
+// Enables adaptive credit, which sizes the credit window of each peer to
+// its measured delivery rate times its round-trip time.
+
+void
+zsync_set_adaptive_credit (zsync_t *self, bool adaptive)
+{
+    assert (self);
+    assert (!self->running);
+    self->adaptive_credit = adaptive;
+}
+
+// --------------------------------------------------------------------------
+// Returns whether adaptive credit is enabled
+
+bool
+zsync_adaptive_credit (zsync_t *self)
+{
+    assert (self);
+    return self->adaptive_credit;
+}
+
+// --------------------------------------------------------------------------
+// Enables write backpressure. Received bytes only return to the total
+// credit once the agent reports them written with zsync_persisted, which
+// bounds the memory used for received data if the disk is slower than the
+// network.
+
+void
+zsync_set_write_backpressure (zsync_t *self, bool backpressure)
+{
+    assert (self);
+    assert (!self->running);
+    self->write_backpressure = backpressure;
+}
+
+// --------------------------------------------------------------------------
+// Returns whether write backpressure is enabled
+
+bool
+zsync_write_backpressure (zsync_t *self)
+{
+    assert (self);
+    return self->write_backpressure;
+}
+
+// --------------------------------------------------------------------------
+// Reports bytes written to disk at offset of path, the data of a received
+// chunk or the target size of a received delta. Interrupted transfers
+// resume after the bytes reported here.
+
+void
+zsync_persisted (zsync_t *self, char *path, uint64_t offset, uint64_t bytes)
+{
+    assert (self);
+    assert (path);
+    int rc = zsync_msg_send_persisted (self->pipe, path, offset, bytes);
+    assert (rc == 0);
+}
+
+// --------------------------------------------------------------------------
+// Sets the share of bandwidth a peer gets relative to other peers when 
+// sending it files, and the share of credit it gets when receiving files
+// from it. The default weight is 1. The agent must have been started.
+
+void
+zsync_set_peer_weight (zsync_t *self, char *peer, uint32_t weight)
+{
+    assert (self);
+    assert (self->pipe);
+    assert (peer && strlen (peer) > 0);
+    int rc = zsync_msg_send_weight (self->pipe, peer, weight);
+    assert (rc == 0);
+}
+
+// --------------------------------------------------------------------------
+// Limits the bytes per second sent to a peer, or to all peers together if
+// peer is NULL. A rate of 0 removes the limit. The agent must have been
+// started.
+
+void
+zsync_set_upload_rate (zsync_t *self, char *peer, uint64_t rate)
+{
+    assert (self);
+    assert (self->pipe);
+    int rc = zsync_msg_send_upload_rate (self->pipe, peer? peer: "", rate);
+    assert (rc == 0);
+}
+
+// --------------------------------------------------------------------------
+// Limits the bytes per second received from a peer, or from all peers
+// together if peer is NULL, by the credit given. A rate of 0 removes the
+// limit. The agent must have been started.
+
+void
+zsync_set_download_rate (zsync_t *self, char *peer, uint64_t rate)
+{
+    assert (self);
+    assert (self->pipe);
+    int rc = zsync_msg_send_download_rate (self->pipe, peer? peer: "", rate);
+    assert (rc == 0);
+}
+
 // --------------------------------------------------------------------------
 // Returns whether the agents has been started or not
 
@@ -158,6 +464,23 @@ zsync_test ()
     printf(" * zsync_agent: ");
     
     zsync_t *zsync = zsync_new();
+    assert (zsync_chunk_size (zsync) == CHUNK_SIZE);
+    zsync_set_chunk_size (zsync, 1024 * 1024);
+    assert (zsync_chunk_size (zsync) == 1024 * 1024);
+    zsync_set_chunk_size (zsync, 1);
+    assert (zsync_chunk_size (zsync) == CHUNK_SIZE);
+    assert (!zsync_adaptive_chunks (zsync));
+    zsync_set_adaptive_chunks (zsync, true);
+    assert (zsync_adaptive_chunks (zsync));
+    assert (!zsync_zero_copy_chunks (zsync));
+    zsync_set_zero_copy_chunks (zsync, true);
+    assert (zsync_zero_copy_chunks (zsync));
+    assert (!zsync_adaptive_credit (zsync));
+    zsync_set_adaptive_credit (zsync, true);
+    assert (zsync_adaptive_credit (zsync));
+    assert (!zsync_write_backpressure (zsync));
+    zsync_set_write_backpressure (zsync, true);
+    assert (zsync_write_backpressure (zsync));
 
     zsync_destroy (&zsync);
 
@@ -0,0 +1,224 @@
+/* =========================================================================
+    zsync_arena - region allocator for decoded messages
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync region allocator
+
+@discuss
+    Decoding a message creates many small objects, e.g. one meta data
+    object and one or two strings per file of an UPDATE. An arena hands
+    them out from large blocks by advancing an offset and frees all of
+    them at once when it is reset. Allocations larger than a block get a
+    block of their own.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct _block_t block_t;
+
+struct _block_t {
+    block_t *next;              // next block, the first one is the newest
+    size_t size;                // usable bytes in data
+    size_t used;                // allocated bytes in data
+    byte *data;
+};
+
+struct _zsync_arena_t {
+    block_t *blocks;            // blocks in use
+    block_t *spare;             // first block, kept across resets
+    size_t block_size;          // size of regular blocks
+    size_t allocated;           // bytes handed out since the last reset
+};
+
+
+static block_t *
+s_block_new (size_t size)
+{
+    // The data follows the header, aligned like the allocations
+    size_t header = (sizeof (block_t) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    block_t *block = (block_t *) malloc (header + size);
+    assert (block);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->data = (byte *) block + header;
+    return block;
+}
+
+// --------------------------------------------------------------------------
+// Creates an arena
+
+zsync_arena_t *
+zsync_arena_new (size_t block_size)
+{
+    zsync_arena_t *self = (zsync_arena_t *) zmalloc (sizeof (zsync_arena_t));
+    self->block_size = block_size? block_size: ARENA_BLOCK_SIZE;
+    self->spare = s_block_new (self->block_size);
+    self->blocks = self->spare;
+    return self;
+}
+
+// --------------------------------------------------------------------------
+// Destroys the arena
+
+void
+zsync_arena_destroy (zsync_arena_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_arena_t *self = *self_p;
+        while (self->blocks) {
+            block_t *next = self->blocks->next;
+            free (self->blocks);
+            self->blocks = next;
+        }
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Allocates zeroed memory from the arena
+
+void *
+zsync_arena_alloc (zsync_arena_t *self, size_t size)
+{
+    assert (self);
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    block_t *block = self->blocks;
+    if (block->size - block->used < size) {
+        if (size > self->block_size / 4) {
+            // Large allocations don't waste the rest of the current block
+            block = s_block_new (size);
+            block->next = self->blocks->next;
+            self->blocks->next = block;
+        }
+        else {
+            block = s_block_new (self->block_size);
+            block->next = self->blocks;
+            self->blocks = block;
+        }
+    }
+    void *memory = block->data + block->used;
+    block->used += size;
+    self->allocated += size;
+    memset (memory, 0, size);
+    return memory;
+}
+
+// --------------------------------------------------------------------------
+// Copies a string into the arena
+
+char *
+zsync_arena_strndup (zsync_arena_t *self, const char *string, size_t size)
+{
+    assert (self);
+    char *copy = (char *) zsync_arena_alloc (self, size + 1);
+    memcpy (copy, string, size);
+    copy [size] = 0;
+    return copy;
+}
+
+// --------------------------------------------------------------------------
+// Frees everything allocated from the arena
+
+void
+zsync_arena_reset (zsync_arena_t *self)
+{
+    assert (self);
+    while (self->blocks != self->spare) {
+        block_t *next = self->blocks->next;
+        free (self->blocks);
+        self->blocks = next;
+    }
+    // Large blocks may have been linked behind the spare block
+    while (self->spare->next) {
+        block_t *next = self->spare->next->next;
+        free (self->spare->next);
+        self->spare->next = next;
+    }
+    self->spare->used = 0;
+    self->allocated = 0;
+}
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes allocated from the arena
+
+size_t
+zsync_arena_size (zsync_arena_t *self)
+{
+    assert (self);
+    return self->allocated;
+}
+
+// --------------------------------------------------------------------------
+// Selftest
+
+void
+zsync_arena_test ()
+{
+    printf (" * zsync_arena: ");
+
+    zsync_arena_t *arena = zsync_arena_new (1024);
+    
+    // Allocations are aligned, zeroed and don't overlap
+    byte *first = (byte *) zsync_arena_alloc (arena, 3);
+    byte *second = (byte *) zsync_arena_alloc (arena, 5);
+    assert (((uintptr_t) first % ARENA_ALIGNMENT) == 0);
+    assert (((uintptr_t) second % ARENA_ALIGNMENT) == 0);
+    assert (second >= first + 3);
+    assert (first [0] == 0 && second [4] == 0);
+    memset (first, 0xFF, 3);
+    memset (second, 0xFF, 5);
+
+    char *string = zsync_arena_strndup (arena, "path/to/file.txt", 7);
+    assert (streq (string, "path/to"));
+
+    // Further blocks and large allocations
+    int index;
+    for (index = 0; index < 100; index++) {
+        byte *memory = (byte *) zsync_arena_alloc (arena, 100);
+        memset (memory, index, 100);
+    }
+    byte *large = (byte *) zsync_arena_alloc (arena, 10000);
+    memset (large, 0xAA, 10000);
+    assert (zsync_arena_size (arena) >= 3 + 5 + 8 + 100 * 100 + 10000);
+
+    // Reset frees everything but keeps the arena usable
+    zsync_arena_reset (arena);
+    assert (zsync_arena_size (arena) == 0);
+    byte *again = (byte *) zsync_arena_alloc (arena, 3);
+    assert (again == first);
+    assert (again [0] == 0);
+    zsync_arena_alloc (arena, 5000);
+    zsync_arena_reset (arena);
+    zsync_arena_destroy (&arena);
+    assert (arena == NULL);
+
+    printf ("OK\n");
+}
@@ -0,0 +1,223 @@
+/* =========================================================================
+    zsync_bucket - token bucket for rate limits
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync token bucket
+
+@discuss
+    A bucket fills with rate bytes per second up to a quarter of a second's
+    worth. Sending takes bytes out of it and waits while it is empty, which
+    limits the average rate while still allowing short bursts. Whole
+    chunks may be taken even if the bucket holds less, so chunks larger
+    than the bucket can still pass. Time is passed in by the caller in
+    msecs, e.g. from zclock_time.
+@end
+*/
+
+#include "zsync_classes.h"
+
+// Msecs worth of bytes a bucket holds at most
+#define BUCKET_BURST 250
+
+struct _zsync_bucket_t {
+    uint64_t rate;              // bytes per second, 0 for unlimited
+    int64_t capacity;           // most bytes the bucket holds
+    int64_t tokens;             // bytes in the bucket, negative if in debt
+    int64_t filled_at;          // time of the last refill, -1 if never
+};
+
+
+// --------------------------------------------------------------------------
+// Creates a token bucket
+
+zsync_bucket_t *
+zsync_bucket_new (uint64_t rate)
+{
+    zsync_bucket_t *self = (zsync_bucket_t *) zmalloc (sizeof (zsync_bucket_t));
+    self->filled_at = -1;
+    zsync_bucket_set_rate (self, rate);
+    return self;
+}
+
+// --------------------------------------------------------------------------
+// Destroys the bucket
+
+void
+zsync_bucket_destroy (zsync_bucket_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_bucket_t *self = *self_p;
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Sets the rate, bytes in the bucket beyond the new capacity are dropped
+
+void
+zsync_bucket_set_rate (zsync_bucket_t *self, uint64_t rate)
+{
+    assert (self);
+    self->rate = rate;
+    self->capacity = (int64_t) (rate * BUCKET_BURST / 1000);
+    if (self->capacity < 1)
+        self->capacity = 1;
+    if (self->tokens > self->capacity)
+        self->tokens = self->capacity;
+}
+
+// --------------------------------------------------------------------------
+// Returns the rate
+
+uint64_t
+zsync_bucket_rate (zsync_bucket_t *self)
+{
+    assert (self);
+    return self->rate;
+}
+
+// Adds the bytes which accrued since the last refill. A new bucket starts
+// full. Time is only accounted once it added at least one byte, so slow
+// rates don't lose fractions.
+static void
+s_bucket_fill (zsync_bucket_t *self, int64_t now)
+{
+    if (self->filled_at < 0 || self->rate == 0) {
+        self->tokens = self->capacity;
+        self->filled_at = now;
+        return;
+    }
+    int64_t elapsed = now - self->filled_at;
+    if (elapsed <= 0)
+        return;
+    int64_t added = (int64_t) (self->rate * (uint64_t) elapsed / 1000);
+    if (added == 0)
+        return;
+    self->tokens += added;
+    if (self->tokens > self->capacity)
+        self->tokens = self->capacity;
+    self->filled_at = now;
+}
+
+// --------------------------------------------------------------------------
+// Returns the bytes which may pass
+
+uint64_t
+zsync_bucket_available (zsync_bucket_t *self, int64_t now)
+{
+    assert (self);
+    if (self->rate == 0)
+        return UINT64_MAX;
+    s_bucket_fill (self, now);
+    return self->tokens > 0? (uint64_t) self->tokens: 0;
+}
+
+// --------------------------------------------------------------------------
+// Takes bytes from the bucket
+
+void
+zsync_bucket_consume (zsync_bucket_t *self, uint64_t bytes, int64_t now)
+{
+    assert (self);
+    if (self->rate == 0)
+        return;
+    s_bucket_fill (self, now);
+    self->tokens -= (int64_t) bytes;
+}
+
+// --------------------------------------------------------------------------
+// Returns the msecs until bytes may pass again
+
+int64_t
+zsync_bucket_wait (zsync_bucket_t *self, int64_t now)
+{
+    assert (self);
+    if (zsync_bucket_available (self, now) > 0)
+        return 0;
+    // Round up so the bucket isn't empty anymore after waiting
+    return (int64_t) ((uint64_t) (1 - self->tokens) * 1000 / self->rate) + 1;
+}
+
+// --------------------------------------------------------------------------
+// Selftest
+
+void
+zsync_bucket_test ()
+{
+    printf (" * zsync_bucket: ");
+
+    // Unlimited buckets let everything pass
+    zsync_bucket_t *self = zsync_bucket_new (0);
+    assert (zsync_bucket_available (self, 0) == UINT64_MAX);
+    zsync_bucket_consume (self, 1024 * 1024, 0);
+    assert (zsync_bucket_wait (self, 0) == 0);
+
+    // A new bucket holds a quarter of a second's worth
+    zsync_bucket_set_rate (self, 100000);
+    assert (zsync_bucket_rate (self) == 100000);
+    assert (zsync_bucket_available (self, 1000) == 25000);
+    zsync_bucket_consume (self, 20000, 1000);
+    assert (zsync_bucket_available (self, 1000) == 5000);
+
+    // Chunks larger than the bucket pass and leave it in debt
+    zsync_bucket_consume (self, 30000, 1000);
+    assert (zsync_bucket_available (self, 1000) == 0);
+    assert (zsync_bucket_wait (self, 1000) == 251);
+    assert (zsync_bucket_available (self, 1250) == 0);
+    assert (zsync_bucket_wait (self, 1251) == 0);
+    assert (zsync_bucket_available (self, 1251) == 100);
+
+    // The bucket never holds more than its capacity
+    assert (zsync_bucket_available (self, 10000) == 25000);
+
+    // Over a long time the rate is kept, whatever the chunk size
+    int64_t now = 20000;
+    uint64_t sent = 0;
+    zsync_bucket_available (self, now);
+    zsync_bucket_consume (self, 25000, now);
+    while (now < 30000) {
+        if (zsync_bucket_available (self, now) > 0) {
+            zsync_bucket_consume (self, 30000, now);
+            sent += 30000;
+        }
+        now++;
+    }
+    assert (sent >= 990000 && sent <= 1030000);
+
+    zsync_bucket_destroy (&self);
+
+    // Slow rates don't lose bytes to rounding
+    self = zsync_bucket_new (10);
+    zsync_bucket_consume (self, zsync_bucket_available (self, now), now);
+    assert (zsync_bucket_available (self, now) == 0);
+    int64_t start = now;
+    while (now < start + 150)
+        zsync_bucket_available (self, ++now);
+    assert (zsync_bucket_available (self, now) == 1);
+
+    zsync_bucket_destroy (&self);
+    printf ("OK\n");
+}
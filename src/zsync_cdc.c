@@ -0,0 +1,504 @@
+/* =========================================================================
+    zsync_cdc - content-defined chunking
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync content-defined chunking
+
+@discuss
+    Files are split where a rolling Gear hash of the last 64 bytes matches
+    a mask, as in FastCDC. Boundaries depend on the content only, so an
+    insertion shifts the chunks around it but leaves all others intact and
+    identical content in different files yields identical chunks. A
+    stricter mask below and a looser one above the average size keep the
+    chunk sizes close to the average.
+
+    Manifest frame:
+        file size       8 bytes
+        chunk count     4 bytes
+        per chunk       length 4 bytes, SHA-256 32 bytes
+
+    Ranges frame:
+        range count     4 bytes
+        per range       offset 8 bytes, length 8 bytes
+
+    All numbers are in network byte order.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define CDC_MIN_SIZE (2 * 1024)
+#define CDC_AVG_SIZE (8 * 1024)
+#define CDC_MAX_SIZE (64 * 1024)
+
+#define MANIFEST_HEADER_SIZE 12
+#define MANIFEST_CHUNK_SIZE (4 + ZSYNC_DIGEST_SIZE)
+#define RANGES_HEADER_SIZE 4
+#define RANGES_RANGE_SIZE 16
+
+#define CDC_BUFFER_SIZE (1024 * 1024)
+
+struct _zsync_cdc_t {
+    uint32_t min_size;
+    uint32_t avg_size;
+    uint32_t max_size;
+    uint64_t mask_small;        // mask below the average size
+    uint64_t mask_large;        // mask above the average size
+};
+
+// Random value per byte, the same on every peer
+static uint64_t s_gear [256];
+static pthread_once_t s_gear_once = PTHREAD_ONCE_INIT;
+
+static void
+s_gear_init (void)
+{
+    // splitmix64
+    uint64_t seed = 0x5A53594E43434443ull;
+    int index;
+    for (index = 0; index < 256; index++) {
+        uint64_t value = (seed += 0x9E3779B97F4A7C15ull);
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        s_gear [index] = value ^ (value >> 31);
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Byte order helpers
+
+static void
+s_put32 (byte *needle, uint32_t value)
+{
+    needle [0] = (byte) (value >> 24);
+    needle [1] = (byte) (value >> 16);
+    needle [2] = (byte) (value >> 8);
+    needle [3] = (byte) value;
+}
+
+static void
+s_put64 (byte *needle, uint64_t value)
+{
+    s_put32 (needle, (uint32_t) (value >> 32));
+    s_put32 (needle + 4, (uint32_t) value);
+}
+
+static uint32_t
+s_get32 (byte *needle)
+{
+    return (uint32_t) needle [0] << 24 | (uint32_t) needle [1] << 16
+         | (uint32_t) needle [2] << 8 | (uint32_t) needle [3];
+}
+
+static uint64_t
+s_get64 (byte *needle)
+{
+    return (uint64_t) s_get32 (needle) << 32 | s_get32 (needle + 4);
+}
+
+// Mask of the highest bits of the hash, which depend on the most bytes
+static uint64_t
+s_mask (int bits)
+{
+    return ((((uint64_t) 1) << bits) - 1) << (64 - bits);
+}
+
+
+// --------------------------------------------------------------------------
+// Constructor
+
+zsync_cdc_t *
+zsync_cdc_new (uint32_t min_size, uint32_t avg_size, uint32_t max_size)
+{
+    pthread_once (&s_gear_once, s_gear_init);
+    zsync_cdc_t *self = (zsync_cdc_t *) zmalloc (sizeof (zsync_cdc_t));
+    int bits = 0;
+    if (avg_size == 0)
+        avg_size = CDC_AVG_SIZE;
+    while (bits < 30 && ((uint32_t) 1 << (bits + 1)) <= avg_size)
+        bits++;
+    if (bits < 6)
+        bits = 6;
+    self->avg_size = (uint32_t) 1 << bits;
+    self->min_size = min_size? min_size: self->avg_size / 4;
+    self->max_size = max_size? max_size: self->avg_size * 8;
+    if (self->min_size > self->avg_size)
+        self->min_size = self->avg_size;
+    if (self->max_size < self->avg_size)
+        self->max_size = self->avg_size;
+    self->mask_small = s_mask (bits + 2);
+    self->mask_large = s_mask (bits - 2);
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destructor
+
+void
+zsync_cdc_destroy (zsync_cdc_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_cdc_t *self = *self_p;
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the length of the first chunk of data
+
+size_t
+zsync_cdc_cut (zsync_cdc_t *self, const byte *data, size_t size)
+{
+    assert (self);
+    if (size <= self->min_size)
+        return size;
+    size_t normal = size < self->avg_size? size: self->avg_size;
+    size_t limit = size < self->max_size? size: self->max_size;
+    uint64_t hash = 0;
+    size_t index = self->min_size;
+    for (; index < normal; index++) {
+        hash = (hash << 1) + s_gear [data [index]];
+        if (!(hash & self->mask_small))
+            return index + 1;
+    }
+    for (; index < limit; index++) {
+        hash = (hash << 1) + s_gear [data [index]];
+        if (!(hash & self->mask_large))
+            return index + 1;
+    }
+    return limit;
+}
+
+
+// --------------------------------------------------------------------------
+// Splits the file at path into chunks and returns its manifest. Returns
+// NULL if the file could not be read.
+
+zframe_t *
+zsync_cdc_manifest (zsync_cdc_t *self, const char *path)
+{
+    assert (self);
+    assert (path);
+    int fd = open (path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    size_t buffer_max = CDC_BUFFER_SIZE + self->max_size;
+    byte *buffer = (byte *) malloc (buffer_max);
+    size_t manifest_max = MANIFEST_HEADER_SIZE + 64 * MANIFEST_CHUNK_SIZE;
+    byte *manifest = (byte *) malloc (manifest_max);
+    assert (buffer && manifest);
+    size_t manifest_size = MANIFEST_HEADER_SIZE;
+    size_t buffer_size = 0;
+    uint64_t file_size = 0;
+    uint32_t count = 0;
+    bool eof = false;
+    int rc = 0;
+
+    while (true) {
+        // Keep at least one maximum chunk in the buffer until the end
+        while (!eof && buffer_size < self->max_size) {
+            ssize_t size = read (fd, buffer + buffer_size, buffer_max - buffer_size);
+            if (size == -1 && errno == EINTR)
+                continue;
+            if (size == -1) {
+                rc = -1;
+                break;
+            }
+            if (size == 0)
+                eof = true;
+            buffer_size += size;
+        }
+        if (rc == -1 || buffer_size == 0)
+            break;
+
+        size_t offset = 0;
+        while (buffer_size - offset >= self->max_size || (eof && offset < buffer_size)) {
+            size_t length = zsync_cdc_cut (self, buffer + offset, buffer_size - offset);
+            if (manifest_size + MANIFEST_CHUNK_SIZE > manifest_max) {
+                manifest_max *= 2;
+                manifest = (byte *) realloc (manifest, manifest_max);
+                assert (manifest);
+            }
+            s_put32 (manifest + manifest_size, (uint32_t) length);
+            zsync_hash_sha256 (buffer + offset, length, manifest + manifest_size + 4);
+            manifest_size += MANIFEST_CHUNK_SIZE;
+            offset += length;
+            file_size += length;
+            count++;
+        }
+        memmove (buffer, buffer + offset, buffer_size - offset);
+        buffer_size -= offset;
+    }
+    close (fd);
+    free (buffer);
+
+    zframe_t *frame = NULL;
+    if (rc == 0) {
+        s_put64 (manifest, file_size);
+        s_put32 (manifest + 8, count);
+        frame = zframe_new (manifest, manifest_size);
+    }
+    free (manifest);
+    return frame;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the size of the file a manifest describes, or -1 if the
+// manifest is malformed
+
+int64_t
+zsync_cdc_manifest_size (zframe_t *manifest)
+{
+    if (!manifest || zframe_size (manifest) < MANIFEST_HEADER_SIZE)
+        return -1;
+    byte *data = zframe_data (manifest);
+    uint64_t file_size = s_get64 (data);
+    uint64_t count = s_get32 (data + 8);
+    if (zframe_size (manifest) != MANIFEST_HEADER_SIZE + count * MANIFEST_CHUNK_SIZE)
+        return -1;
+    uint64_t total = 0;
+    uint64_t index;
+    for (index = 0; index < count; index++)
+        total += s_get32 (data + MANIFEST_HEADER_SIZE + index * MANIFEST_CHUNK_SIZE);
+    if (total != file_size || file_size > INT64_MAX)
+        return -1;
+    return (int64_t) file_size;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of chunks in a well-formed manifest
+
+size_t
+zsync_cdc_manifest_count (zframe_t *manifest)
+{
+    assert (manifest);
+    return s_get32 (zframe_data (manifest) + 8);
+}
+
+
+// --------------------------------------------------------------------------
+// Gets length and digest of the chunk at index of a well-formed manifest
+
+void
+zsync_cdc_manifest_chunk (zframe_t *manifest, size_t index, uint32_t *length, byte **digest)
+{
+    assert (manifest);
+    assert (index < zsync_cdc_manifest_count (manifest));
+    byte *needle = zframe_data (manifest) + MANIFEST_HEADER_SIZE + index * MANIFEST_CHUNK_SIZE;
+    if (length)
+        *length = s_get32 (needle);
+    if (digest)
+        *digest = needle + 4;
+}
+
+
+// --------------------------------------------------------------------------
+// Encodes count byte ranges of a file as a frame
+
+zframe_t *
+zsync_cdc_ranges_new (uint64_t *offsets, uint64_t *lengths, size_t count)
+{
+    assert (count == 0 || (offsets && lengths));
+    zframe_t *frame = zframe_new (NULL, RANGES_HEADER_SIZE + count * RANGES_RANGE_SIZE);
+    byte *needle = zframe_data (frame);
+    s_put32 (needle, (uint32_t) count);
+    needle += RANGES_HEADER_SIZE;
+    size_t index;
+    for (index = 0; index < count; index++) {
+        s_put64 (needle, offsets [index]);
+        s_put64 (needle + 8, lengths [index]);
+        needle += RANGES_RANGE_SIZE;
+    }
+    return frame;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of ranges in a frame, or -1 if it is malformed
+
+int64_t
+zsync_cdc_ranges_count (zframe_t *ranges)
+{
+    if (!ranges || zframe_size (ranges) < RANGES_HEADER_SIZE)
+        return -1;
+    uint64_t count = s_get32 (zframe_data (ranges));
+    if (zframe_size (ranges) != RANGES_HEADER_SIZE + count * RANGES_RANGE_SIZE)
+        return -1;
+    return (int64_t) count;
+}
+
+
+// --------------------------------------------------------------------------
+// Gets offset and length of the range at index of a well-formed frame
+
+void
+zsync_cdc_ranges_get (zframe_t *ranges, size_t index, uint64_t *offset, uint64_t *length)
+{
+    assert (ranges);
+    byte *needle = zframe_data (ranges) + RANGES_HEADER_SIZE + index * RANGES_RANGE_SIZE;
+    assert (needle + RANGES_RANGE_SIZE <= zframe_data (ranges) + zframe_size (ranges));
+    if (offset)
+        *offset = s_get64 (needle);
+    if (length)
+        *length = s_get64 (needle + 8);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes the ranges of a well-formed frame cover
+
+uint64_t
+zsync_cdc_ranges_size (zframe_t *ranges)
+{
+    assert (ranges);
+    uint64_t total = 0;
+    size_t count = s_get32 (zframe_data (ranges));
+    size_t index;
+    for (index = 0; index < count; index++) {
+        uint64_t length;
+        zsync_cdc_ranges_get (ranges, index, NULL, &length);
+        total += length;
+    }
+    return total;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_FILE ".zsync_cdc_test"
+#define TEST_SIZE (1024 * 1024)
+
+// Returns the number of chunks of b which are also chunks of a
+static size_t
+s_test_shared (zframe_t *a, zframe_t *b)
+{
+    size_t shared = 0;
+    size_t index_a, index_b;
+    for (index_b = 0; index_b < zsync_cdc_manifest_count (b); index_b++) {
+        byte *digest_b;
+        zsync_cdc_manifest_chunk (b, index_b, NULL, &digest_b);
+        for (index_a = 0; index_a < zsync_cdc_manifest_count (a); index_a++) {
+            byte *digest_a;
+            zsync_cdc_manifest_chunk (a, index_a, NULL, &digest_a);
+            if (memcmp (digest_a, digest_b, ZSYNC_DIGEST_SIZE) == 0) {
+                shared++;
+                break;
+            }
+        }
+    }
+    return shared;
+}
+
+static zframe_t *
+s_test_manifest (zsync_cdc_t *cdc, byte *data, size_t size)
+{
+    FILE *file = fopen (TEST_FILE, "wb");
+    assert (file);
+    fwrite (data, 1, size, file);
+    fclose (file);
+    zframe_t *manifest = zsync_cdc_manifest (cdc, TEST_FILE);
+    assert (manifest);
+    assert (zsync_cdc_manifest_size (manifest) == (int64_t) size);
+    return manifest;
+}
+
+void
+zsync_cdc_test ()
+{
+    printf (" * zsync_cdc: ");
+    byte *data = (byte *) malloc (TEST_SIZE + 100);
+    uint32_t seed = 4711;
+    size_t index;
+    for (index = 0; index < TEST_SIZE; index++) {
+        seed = seed * 1103515245 + 12345;
+        data [index] = (byte) (seed >> 16);
+    }
+    zsync_cdc_t *cdc = zsync_cdc_new (0, 0, 0);
+
+    // Chunks respect the bounds and the digests match the data
+    zframe_t *manifest = s_test_manifest (cdc, data, TEST_SIZE);
+    size_t count = zsync_cdc_manifest_count (manifest);
+    assert (count > TEST_SIZE / CDC_MAX_SIZE);
+    assert (count < TEST_SIZE / CDC_MIN_SIZE);
+    size_t offset = 0;
+    for (index = 0; index < count; index++) {
+        uint32_t length;
+        byte *digest;
+        zsync_cdc_manifest_chunk (manifest, index, &length, &digest);
+        assert (length <= CDC_MAX_SIZE);
+        assert (length >= CDC_MIN_SIZE || index == count - 1);
+        byte expected [ZSYNC_DIGEST_SIZE];
+        zsync_hash_sha256 (data + offset, length, expected);
+        assert (memcmp (digest, expected, ZSYNC_DIGEST_SIZE) == 0);
+        offset += length;
+    }
+
+    // An insertion near the start only changes the chunks around it
+    memmove (data + 1100, data + 1000, TEST_SIZE - 1000);
+    memset (data + 1000, 'i', 100);
+    zframe_t *inserted = s_test_manifest (cdc, data, TEST_SIZE + 100);
+    assert (s_test_shared (manifest, inserted) + 3 >= count);
+    zframe_destroy (&inserted);
+
+    // Empty files have no chunks
+    zframe_t *empty = s_test_manifest (cdc, data, 0);
+    assert (zsync_cdc_manifest_count (empty) == 0);
+    zframe_destroy (&empty);
+
+    // Ranges
+    uint64_t offsets [2] = { 0, 100000 };
+    uint64_t lengths [2] = { 8192, 5000000000ull };
+    zframe_t *ranges = zsync_cdc_ranges_new (offsets, lengths, 2);
+    assert (zsync_cdc_ranges_count (ranges) == 2);
+    uint64_t range_offset, range_length;
+    zsync_cdc_ranges_get (ranges, 1, &range_offset, &range_length);
+    assert (range_offset == 100000 && range_length == 5000000000ull);
+    assert (zsync_cdc_ranges_size (ranges) == 5000008192ull);
+    zframe_destroy (&ranges);
+
+    // Malformed input is rejected
+    zframe_t *malformed = zframe_new ("abc", 3);
+    assert (zsync_cdc_manifest_size (malformed) == -1);
+    assert (zsync_cdc_ranges_count (malformed) == -1);
+    zframe_destroy (&malformed);
+    zframe_data (manifest) [3] ^= 1;
+    assert (zsync_cdc_manifest_size (manifest) == -1);
+    zframe_destroy (&manifest);
+
+    zsync_cdc_destroy (&cdc);
+    free (data);
+    zsys_file_delete (TEST_FILE);
+    printf ("OK\n");
+}
@@ -0,0 +1,555 @@
+/* =========================================================================
+    zsync_changelog - persistent index of file changes by state
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync change log, a persistent index of which file changed at which
+    state.
+
+@discuss
+    The index keeps the last change of every path, ordered by the state
+    it was made in. An UPDATE from state S walks back from the newest
+    change until it reaches S, so answering it costs the number of changes
+    since S rather than the size of the tree. The meta data of the changes
+    is held in a zs_fmlist, superseded rows stay there until the log is
+    compacted.
+
+    The log is a zsync_recordlog like the peer journal, with one record
+    per change whose payload is:
+
+        state           8 bytes, network byte order
+        operation       1 byte
+        timestamp       8 bytes
+        file size       8 bytes
+        checksum        8 bytes, XXH64 of the content
+        digest          ZSYNC_DIGEST_SIZE bytes
+        path            2 bytes size and the path
+        renamed path    2 bytes size and the path, size 0 if none
+
+    Records superseded by a later change of the same path are dropped
+    when the log is compacted. Deleted files are kept so peers learn
+    about them, whatever state they come from.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define CHANGELOG_MAGIC "ZSC1"
+
+// Fixed fields of a record payload and the largest payload
+#define PAYLOAD_FIXED (8 + 1 + 8 + 8 + 8 + ZSYNC_DIGEST_SIZE + 2 + 2)
+#define PAYLOAD_MAX (PAYLOAD_FIXED + 2 * STRING_MAX)
+
+// Last change of a path, linked in the order of states
+typedef struct _s_change_t s_change_t;
+
+struct _s_change_t {
+    size_t row;                 // file meta data in the rows of the log
+    uint64_t state;
+    bool written;               // change is in the log file
+    s_change_t *prev;
+    s_change_t *next;
+};
+
+struct _zsync_changelog_t {
+    zsync_recordlog_t *log;     // log file
+    zs_fmlist_t *rows;          // file meta data of the changes
+    zhash_t *changes;           // last change by path
+    s_change_t *oldest;         // change with the lowest state
+    s_change_t *newest;         // change with the highest state
+};
+
+static void
+s_change_free (void *data)
+{
+    free (data);
+}
+
+static byte *
+s_put_number (byte *needle, uint64_t value, int size)
+{
+    int shift;
+    for (shift = (size - 1) * 8; shift >= 0; shift -= 8)
+        *needle++ = (byte) (value >> shift);
+    return needle;
+}
+
+static uint64_t
+s_get_number (byte **needle_p, int size)
+{
+    uint64_t value = 0;
+    while (size--)
+        value = (value << 8) | *(*needle_p)++;
+    return value;
+}
+
+// Encodes a record payload into a new buffer, returns its size
+static size_t
+s_record_encode (byte **buffer_p, zs_fmlist_t *rows, s_change_t *change)
+{
+    size_t row = change->row;
+    const char *path = zs_fmlist_path (rows, row);
+    const char *renamed_path = zs_fmlist_renamed_path (rows, row);
+    size_t path_size = path? strlen (path): 0;
+    size_t renamed_size = renamed_path? strlen (renamed_path): 0;
+    size_t payload_size = PAYLOAD_FIXED + path_size + renamed_size;
+    byte *buffer = (byte *) malloc (payload_size);
+    assert (buffer);
+    byte *needle = s_put_number (buffer, change->state, 8);
+    needle = s_put_number (needle, zs_fmlist_operation (rows, row), 1);
+    needle = s_put_number (needle, zs_fmlist_timestamp (rows, row), 8);
+    needle = s_put_number (needle, zs_fmlist_file_size (rows, row), 8);
+    needle = s_put_number (needle, zs_fmlist_checksum (rows, row), 8);
+    memcpy (needle, zs_fmlist_digest (rows, row), ZSYNC_DIGEST_SIZE);
+    needle += ZSYNC_DIGEST_SIZE;
+    needle = s_put_number (needle, path_size, 2);
+    if (path_size)
+        memcpy (needle, path, path_size);
+    needle += path_size;
+    needle = s_put_number (needle, renamed_size, 2);
+    if (renamed_size)
+        memcpy (needle, renamed_path, renamed_size);
+    needle += renamed_size;
+    *buffer_p = buffer;
+    return needle - buffer;
+}
+
+// Decodes a record payload into a new change and its row. Returns NULL
+// if the payload is corrupt.
+static s_change_t *
+s_record_decode (byte *payload, size_t payload_size, zs_fmlist_t *rows)
+{
+    if (payload_size < PAYLOAD_FIXED)
+        return NULL;
+    zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
+    byte *needle = payload;
+    uint64_t state = s_get_number (&needle, 8);
+    zs_fmetadata_set_operation (fmetadata, (int) s_get_number (&needle, 1));
+    zs_fmetadata_set_timestamp (fmetadata, s_get_number (&needle, 8));
+    zs_fmetadata_set_size (fmetadata, s_get_number (&needle, 8));
+    zs_fmetadata_set_checksum (fmetadata, s_get_number (&needle, 8));
+    zs_fmetadata_set_digest (fmetadata, needle);
+    needle += ZSYNC_DIGEST_SIZE;
+    size_t path_size = s_get_number (&needle, 2);
+    size_t rest = payload_size - PAYLOAD_FIXED;
+    if (path_size > rest) {
+        zs_fmetadata_destroy (&fmetadata);
+        return NULL;
+    }
+    zs_fmetadata_set_path (fmetadata, "%.*s", (int) path_size, needle);
+    needle += path_size;
+    size_t renamed_size = s_get_number (&needle, 2);
+    if (renamed_size != rest - path_size) {
+        zs_fmetadata_destroy (&fmetadata);
+        return NULL;
+    }
+    if (renamed_size)
+        zs_fmetadata_set_renamed_path (fmetadata, "%.*s", (int) renamed_size, needle);
+
+    s_change_t *change = (s_change_t *) zmalloc (sizeof (s_change_t));
+    change->row = zs_fmlist_append (rows, fmetadata);
+    change->state = state;
+    change->written = true;
+    zs_fmetadata_destroy (&fmetadata);
+    return change;
+}
+
+// Appends a change to the log, returns 0 on success and -1 on failure
+static int
+s_changelog_write (zsync_changelog_t *self, s_change_t *change)
+{
+    byte *buffer;
+    size_t size = s_record_encode (&buffer, self->rows, change);
+    int rc = zsync_recordlog_append (self->log, buffer, size);
+    free (buffer);
+    return rc;
+}
+
+// Makes change the last change of its path and the newest change
+static void
+s_changelog_link (zsync_changelog_t *self, s_change_t *change)
+{
+    const char *path = zs_fmlist_path (self->rows, change->row);
+    s_change_t *previous = (s_change_t *) zhash_lookup (self->changes, path);
+    if (previous) {
+        // Superseded, unlink from the order of states
+        if (previous->prev)
+            previous->prev->next = previous->next;
+        else
+            self->oldest = previous->next;
+        if (previous->next)
+            previous->next->prev = previous->prev;
+        else
+            self->newest = previous->prev;
+        zhash_delete (self->changes, path);
+    }
+    change->prev = self->newest;
+    change->next = NULL;
+    if (self->newest)
+        self->newest->next = change;
+    else
+        self->oldest = change;
+    self->newest = change;
+    zhash_insert (self->changes, path, change);
+    zhash_freefn (self->changes, path, s_change_free);
+}
+
+// Decodes a record payload during replay
+static int
+s_changelog_replay (byte *payload, size_t size, void *arg)
+{
+    zsync_changelog_t *self = (zsync_changelog_t *) arg;
+    s_change_t *change = s_record_decode (payload, size, self->rows);
+    if (!change)
+        return -1;
+    s_changelog_link (self, change);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Opens the change log at path and replays the changes recorded in it
+
+zsync_changelog_t *
+zsync_changelog_new (const char *path)
+{
+    assert (path);
+    zsync_changelog_t *self = (zsync_changelog_t *) zmalloc (sizeof (zsync_changelog_t));
+    self->rows = zs_fmlist_new ();
+    self->changes = zhash_new ();
+    self->log = zsync_recordlog_new (path, CHANGELOG_MAGIC, PAYLOAD_MAX, s_changelog_replay, self);
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Flushes pending changes and closes the change log
+
+void
+zsync_changelog_destroy (zsync_changelog_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_changelog_t *self = *self_p;
+        zsync_changelog_flush (self);
+        zsync_recordlog_destroy (&self->log);
+        zhash_destroy (&self->changes);
+        zs_fmlist_destroy (&self->rows);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Records a copy of the file meta data as changed at state, superseding
+// earlier changes of the same path. Returns 0 on success, -1 if state is
+// older than the last recorded one.
+
+int
+zsync_changelog_append (zsync_changelog_t *self, uint64_t state, zs_fmetadata_t *fmetadata)
+{
+    assert (self);
+    assert (fmetadata);
+    assert (zs_fmetadata_path_ref (fmetadata));
+    if (state < zsync_changelog_state (self))
+        return -1;
+    s_change_t *change = (s_change_t *) zmalloc (sizeof (s_change_t));
+    change->row = zs_fmlist_append (self->rows, fmetadata);
+    change->state = state;
+    change->written = false;
+    s_changelog_link (self, change);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns a list of zs_fmetadata_t for all files that changed after
+// from_state, or NULL if nothing changed. Caller owns list and entries.
+
+zlist_t *
+zsync_changelog_update (zsync_changelog_t *self, uint64_t from_state)
+{
+    assert (self);
+    // Walk back to the first change after from_state
+    s_change_t *change = self->newest;
+    if (!change || change->state <= from_state)
+        return NULL;
+    while (change->prev && change->prev->state > from_state)
+        change = change->prev;
+
+    zlist_t *fmetadata_list = zlist_new ();
+    while (change) {
+        // Files deleted before from_state was taken were never sent
+        if (from_state > 0
+        ||  zs_fmlist_operation (self->rows, change->row) != ZS_FILE_OP_DEL)
+            zlist_append (fmetadata_list, zs_fmlist_fmetadata (self->rows, change->row, NULL));
+        change = change->next;
+    }
+    if (zlist_size (fmetadata_list) == 0)
+        zlist_destroy (&fmetadata_list);
+    return fmetadata_list;
+}
+
+
+// --------------------------------------------------------------------------
+// Writes all pending changes to disk and syncs them. Compacts the log if
+// it has grown too large. Returns 0 on success, -1 on failure.
+
+int
+zsync_changelog_flush (zsync_changelog_t *self)
+{
+    assert (self);
+    // Pending changes are the newest ones, superseded ones are gone
+    s_change_t *first = self->newest;
+    if (!first || first->written)
+        return 0;
+    while (first->prev && !first->prev->written)
+        first = first->prev;
+
+    s_change_t *change;
+    for (change = first; change; change = change->next)
+        if (s_changelog_write (self, change) != 0)
+            return -1;
+    if (zsync_recordlog_sync (self->log) != 0)
+        return -1;
+    for (change = first; change; change = change->next)
+        change->written = true;
+
+    if (zsync_recordlog_bloated (self->log, zhash_size (self->changes)))
+        return zsync_changelog_compact (self);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Rewrites the log with the last change of every path and atomically
+// replaces the old file. Returns 0 on success, -1 on failure.
+
+int
+zsync_changelog_compact (zsync_changelog_t *self)
+{
+    assert (self);
+    if (zsync_recordlog_rewrite (self->log) != 0)
+        return -1;
+    s_change_t *change;
+    for (change = self->oldest; change; change = change->next)
+        s_changelog_write (self, change);
+    if (zsync_recordlog_commit (self->log) != 0)
+        return -1;
+
+    // The snapshot holds the last change of every path, drop the rows
+    // of superseded changes as well
+    zs_fmlist_t *rows = zs_fmlist_new ();
+    for (change = self->oldest; change; change = change->next) {
+        zs_fmetadata_t *fmetadata = zs_fmlist_fmetadata (self->rows, change->row, NULL);
+        change->row = zs_fmlist_append (rows, fmetadata);
+        zs_fmetadata_destroy (&fmetadata);
+        change->written = true;
+    }
+    zs_fmlist_destroy (&self->rows);
+    self->rows = rows;
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true if there are changes that have not been flushed yet
+
+bool
+zsync_changelog_dirty (zsync_changelog_t *self)
+{
+    assert (self);
+    return self->newest && !self->newest->written;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the state of the last recorded change, 0 if there is none
+
+uint64_t
+zsync_changelog_state (zsync_changelog_t *self)
+{
+    assert (self);
+    return self->newest? self->newest->state: 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of paths in the index, including deleted ones
+
+size_t
+zsync_changelog_size (zsync_changelog_t *self)
+{
+    assert (self);
+    return zhash_size (self->changes);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of records in the log file
+
+size_t
+zsync_changelog_records (zsync_changelog_t *self)
+{
+    assert (self);
+    return zsync_recordlog_records (self->log);
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_CHANGELOG ".zsync_changelog_test"
+
+static void
+s_test_append (zsync_changelog_t *self, uint64_t state, char *path, int operation, uint64_t size)
+{
+    zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "%s", path);
+    zs_fmetadata_set_operation (fmetadata, operation);
+    zs_fmetadata_set_size (fmetadata, size);
+    int rc = zsync_changelog_append (self, state, fmetadata);
+    assert (rc == 0);
+    zs_fmetadata_destroy (&fmetadata);
+}
+
+static void
+s_test_destroy_list (zlist_t **list_p)
+{
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    while (fmetadata) {
+        zs_fmetadata_destroy (&fmetadata);
+        fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    }
+    zlist_destroy (list_p);
+}
+
+void
+zsync_changelog_test ()
+{
+    printf (" * zsync_changelog: ");
+    zsys_file_delete (TEST_CHANGELOG);
+
+    zsync_changelog_t *changelog = zsync_changelog_new (TEST_CHANGELOG);
+    assert (zsync_changelog_state (changelog) == 0);
+    assert (zsync_changelog_update (changelog, 0) == NULL);
+    s_test_append (changelog, 1, "a", ZS_FILE_OP_UPD, 1);
+    s_test_append (changelog, 1, "b", ZS_FILE_OP_UPD, 2);
+    s_test_append (changelog, 2, "c", ZS_FILE_OP_UPD, 3);
+    s_test_append (changelog, 3, "a", ZS_FILE_OP_UPD, 4);
+    assert (zsync_changelog_dirty (changelog));
+    assert (zsync_changelog_state (changelog) == 3);
+    assert (zsync_changelog_size (changelog) == 3);
+
+    // States must not go back
+    zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "d");
+    assert (zsync_changelog_append (changelog, 2, fmetadata) == -1);
+    zs_fmetadata_destroy (&fmetadata);
+
+    // Updates hold the last change of every path after the state
+    zlist_t *update = zsync_changelog_update (changelog, 1);
+    assert (zlist_size (update) == 2);
+    fmetadata = (zs_fmetadata_t *) zlist_first (update);
+    assert (streq (zs_fmetadata_path_ref (fmetadata), "c"));
+    fmetadata = (zs_fmetadata_t *) zlist_next (update);
+    assert (streq (zs_fmetadata_path_ref (fmetadata), "a"));
+    assert (zs_fmetadata_size (fmetadata) == 4);
+    s_test_destroy_list (&update);
+    assert (zsync_changelog_update (changelog, 3) == NULL);
+
+    int rc = zsync_changelog_flush (changelog);
+    assert (rc == 0);
+    assert (!zsync_changelog_dirty (changelog));
+    assert (zsync_changelog_records (changelog) == 3);
+    s_test_append (changelog, 4, "b", ZS_FILE_OP_DEL, 0);
+    zsync_changelog_destroy (&changelog);
+
+    // Replay restores the index, a full update leaves out deleted files
+    changelog = zsync_changelog_new (TEST_CHANGELOG);
+    assert (zsync_changelog_records (changelog) == 4);
+    assert (zsync_changelog_state (changelog) == 4);
+    assert (zsync_changelog_size (changelog) == 3);
+    update = zsync_changelog_update (changelog, 0);
+    assert (zlist_size (update) == 2);
+    s_test_destroy_list (&update);
+    update = zsync_changelog_update (changelog, 3);
+    assert (zlist_size (update) == 1);
+    fmetadata = (zs_fmetadata_t *) zlist_first (update);
+    assert (streq (zs_fmetadata_path_ref (fmetadata), "b"));
+    assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_DEL);
+    s_test_destroy_list (&update);
+    zsync_changelog_destroy (&changelog);
+
+    // A torn record at the end is dropped
+    ssize_t valid_size = zsys_file_size (TEST_CHANGELOG);
+    FILE *file = fopen (TEST_CHANGELOG, "ab");
+    zs_fmlist_t *rows = zs_fmlist_new ();
+    fmetadata = zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "e");
+    zs_fmetadata_set_renamed_path (fmetadata, "f");
+    s_change_t change = { zs_fmlist_append (rows, fmetadata), 5, false, NULL, NULL };
+    byte *buffer;
+    size_t size = s_record_encode (&buffer, rows, &change);
+    byte header [4] = { 0, 0, (byte) (size >> 8), (byte) size };
+    fwrite (header, 1, 4, file);
+    fwrite (buffer, 1, size, file);
+    fclose (file);
+    free (buffer);
+    zs_fmetadata_destroy (&fmetadata);
+    zs_fmlist_destroy (&rows);
+    changelog = zsync_changelog_new (TEST_CHANGELOG);
+    assert (zsync_changelog_state (changelog) == 4);
+    assert (zsync_changelog_records (changelog) == 4);
+    assert (zsys_file_size (TEST_CHANGELOG) == valid_size);
+
+    // Compaction keeps the last change of every path
+    uint64_t state;
+    for (state = 5; state < ZSYNC_RECORDLOG_COMPACT_MIN + 5; state++) {
+        s_test_append (changelog, state, "a", ZS_FILE_OP_UPD, state);
+        rc = zsync_changelog_flush (changelog);
+        assert (rc == 0);
+    }
+    assert (zsync_changelog_records (changelog) < ZSYNC_RECORDLOG_COMPACT_MIN);
+    rc = zsync_changelog_compact (changelog);
+    assert (rc == 0);
+    assert (zsync_changelog_records (changelog) == 3);
+    assert (zs_fmlist_size (changelog->rows) == 3);
+    assert (!zsys_file_exists (TEST_CHANGELOG ".tmp"));
+    zsync_changelog_destroy (&changelog);
+
+    changelog = zsync_changelog_new (TEST_CHANGELOG);
+    assert (zsync_changelog_records (changelog) == 3);
+    assert (zsync_changelog_state (changelog) == ZSYNC_RECORDLOG_COMPACT_MIN + 4);
+    update = zsync_changelog_update (changelog, ZSYNC_RECORDLOG_COMPACT_MIN + 3);
+    assert (zlist_size (update) == 1);
+    fmetadata = (zs_fmetadata_t *) zlist_first (update);
+    assert (zs_fmetadata_size (fmetadata) == ZSYNC_RECORDLOG_COMPACT_MIN + 4);
+    s_test_destroy_list (&update);
+    zsync_changelog_destroy (&changelog);
+
+    zsys_file_delete (TEST_CHANGELOG);
+    printf ("OK\n");
+}
@@ -0,0 +1,663 @@
+/* =========================================================================
+    zsync_chunkstore - local store of chunks by digest
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync chunk store
+
+@discuss
+    Indexes the content-defined chunks of local files by their SHA-256, so
+    that chunks of a file to be received which exist anywhere below the
+    root, e.g. in a near-duplicate file, are copied locally instead of
+    transferred. The index only records where a chunk was seen. Chunks are
+    verified when they are read and dropped from the index if their file
+    changed meanwhile.
+
+    A file is assembled into ROOT/.zsync/partial while its missing ranges
+    arrive and only replaces the file at its path once every chunk of the
+    manifest is in place, so the old version stays intact meanwhile.
+
+    The index is kept in ROOT/.zsync/chunks, one chunk per line:
+        digest offset length path
+
+    The scanner and the watcher never sync the .zsync directory.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define INDEX_FILE ZSYNC_STATE_DIR "/chunks"
+#define PARTIAL_DIR ZSYNC_STATE_DIR "/partial"
+
+struct _zsync_chunkstore_t {
+    char *root;
+    char *index_path;
+    zsync_cdc_t *cdc;
+    zhash_t *chunks;            // chunk locations by hex digest
+    bool dirty;                 // index changed since it was saved
+    char *source_path;          // file last read from
+    int source_fd;
+};
+
+// Where a chunk has been seen
+struct _zsync_chunk_location_t {
+    char *path;                 // path relative to root
+    uint64_t offset;
+    uint32_t length;
+};
+
+typedef struct _zsync_chunk_location_t zsync_chunk_location_t;
+
+static zsync_chunk_location_t *
+zsync_chunk_location_new (const char *path, uint64_t offset, uint32_t length)
+{
+    zsync_chunk_location_t *self =
+        (zsync_chunk_location_t *) zmalloc (sizeof (zsync_chunk_location_t));
+    self->path = strdup (path);
+    self->offset = offset;
+    self->length = length;
+    return self;
+}
+
+static void
+zsync_chunk_location_destroy (zsync_chunk_location_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_chunk_location_t *self = *self_p;
+        free (self->path);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+static void
+s_destroy_location_item (void *data)
+{
+    zsync_chunk_location_t *location = (zsync_chunk_location_t *) data;
+    zsync_chunk_location_destroy (&location);
+}
+
+static void
+s_hex (byte *digest, char *hex)
+{
+    static const char digits [] = "0123456789abcdef";
+    int index;
+    for (index = 0; index < ZSYNC_DIGEST_SIZE; index++) {
+        hex [index * 2] = digits [digest [index] >> 4];
+        hex [index * 2 + 1] = digits [digest [index] & 0xf];
+    }
+    hex [ZSYNC_DIGEST_SIZE * 2] = '\0';
+}
+
+static char *
+s_full_path (zsync_chunkstore_t *self, const char *path)
+{
+    char *full_path = (char *) malloc (strlen (self->root) + strlen (path) + 2);
+    sprintf (full_path, "%s/%s", self->root, path);
+    return full_path;
+}
+
+static void
+s_insert (zsync_chunkstore_t *self, char *hex, zsync_chunk_location_t *location)
+{
+    zhash_delete (self->chunks, hex);
+    zhash_insert (self->chunks, hex, location);
+    zhash_freefn (self->chunks, hex, s_destroy_location_item);
+    self->dirty = true;
+}
+
+static void
+s_load (zsync_chunkstore_t *self)
+{
+    FILE *file = fopen (self->index_path, "r");
+    if (!file)
+        return;
+    char line [STRING_MAX + 128];
+    while (fgets (line, sizeof (line), file)) {
+        char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+        uint64_t offset;
+        uint32_t length;
+        int path_start = 0;
+        if (sscanf (line, "%64s %"SCNu64" %"SCNu32" %n", hex, &offset, &length, &path_start) != 3
+        ||  path_start == 0
+        ||  strlen (hex) != ZSYNC_DIGEST_SIZE * 2)
+            continue;
+        char *path = line + path_start;
+        path [strcspn (path, "\n")] = '\0';
+        if (*path)
+            s_insert (self, hex, zsync_chunk_location_new (path, offset, length));
+    }
+    fclose (file);
+    self->dirty = false;
+}
+
+// Returns the path of the partial file of path and creates its directory
+static char *
+s_partial_path (zsync_chunkstore_t *self, const char *path)
+{
+    char *partial_path = (char *) malloc (strlen (self->root) + strlen (PARTIAL_DIR) + strlen (path) + 3);
+    sprintf (partial_path, "%s/%s/%s", self->root, PARTIAL_DIR, path);
+    char *slash = strrchr (partial_path, '/');
+    *slash = '\0';
+    zsys_dir_create ("%s", partial_path);
+    *slash = '/';
+    return partial_path;
+}
+
+// Writes size bytes of data to fd at offset, returns 0 on success
+static int
+s_write_all (int fd, byte *data, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t written = pwrite (fd, data + done, size - done, offset + done);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        done += written;
+    }
+    return 0;
+}
+
+// Reads a chunk into buffer and verifies it. Keeps the file open for the
+// next chunk, which usually comes from the same file.
+static bool
+s_read_verified (zsync_chunkstore_t *self, zsync_chunk_location_t *location,
+                 byte *digest, byte *buffer)
+{
+    if (!self->source_path || strneq (self->source_path, location->path)) {
+        if (self->source_fd != -1)
+            close (self->source_fd);
+        free (self->source_path);
+        char *full_path = s_full_path (self, location->path);
+        self->source_fd = open (full_path, O_RDONLY);
+        self->source_path = strdup (location->path);
+        free (full_path);
+    }
+    if (self->source_fd == -1)
+        return false;
+    size_t done = 0;
+    while (done < location->length) {
+        ssize_t rc = pread (self->source_fd, buffer + done,
+                            location->length - done, location->offset + done);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        done += rc;
+    }
+    byte actual [ZSYNC_DIGEST_SIZE];
+    zsync_hash_sha256 (buffer, location->length, actual);
+    return memcmp (actual, digest, ZSYNC_DIGEST_SIZE) == 0;
+}
+
+// Forgets the open file, e.g. before it is written
+static void
+s_close_source (zsync_chunkstore_t *self)
+{
+    if (self->source_fd != -1)
+        close (self->source_fd);
+    self->source_fd = -1;
+    free (self->source_path);
+    self->source_path = NULL;
+}
+
+
+// --------------------------------------------------------------------------
+// Constructor
+
+zsync_chunkstore_t *
+zsync_chunkstore_new (const char *root)
+{
+    assert (root);
+    zsync_chunkstore_t *self = (zsync_chunkstore_t *) zmalloc (sizeof (zsync_chunkstore_t));
+    self->root = strdup (root);
+    self->index_path = s_full_path (self, INDEX_FILE);
+    self->cdc = zsync_cdc_new (0, 0, 0);
+    self->chunks = zhash_new ();
+    self->source_fd = -1;
+    s_load (self);
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destructor
+
+void
+zsync_chunkstore_destroy (zsync_chunkstore_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_chunkstore_t *self = *self_p;
+        if (self->dirty)
+            zsync_chunkstore_save (self);
+        s_close_source (self);
+        zhash_destroy (&self->chunks);
+        zsync_cdc_destroy (&self->cdc);
+        free (self->index_path);
+        free (self->root);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Splits a file into chunks and adds them to the index
+
+int
+zsync_chunkstore_add_file (zsync_chunkstore_t *self, const char *path)
+{
+    assert (self);
+    assert (path);
+    char *full_path = s_full_path (self, path);
+    zframe_t *manifest = zsync_cdc_manifest (self->cdc, full_path);
+    free (full_path);
+    if (!manifest)
+        return -1;
+    zsync_chunkstore_add_manifest (self, path, manifest);
+    int count = (int) zsync_cdc_manifest_count (manifest);
+    zframe_destroy (&manifest);
+    return count;
+}
+
+
+// --------------------------------------------------------------------------
+// Adds the chunks of a file written according to its manifest
+
+void
+zsync_chunkstore_add_manifest (zsync_chunkstore_t *self, const char *path, zframe_t *manifest)
+{
+    assert (self);
+    assert (path);
+    if (zsync_cdc_manifest_size (manifest) == -1)
+        return;
+    uint64_t offset = 0;
+    size_t index;
+    for (index = 0; index < zsync_cdc_manifest_count (manifest); index++) {
+        uint32_t length;
+        byte *digest;
+        zsync_cdc_manifest_chunk (manifest, index, &length, &digest);
+        char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+        s_hex (digest, hex);
+        s_insert (self, hex, zsync_chunk_location_new (path, offset, length));
+        offset += length;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true if a chunk with digest is known
+
+bool
+zsync_chunkstore_has (zsync_chunkstore_t *self, byte *digest)
+{
+    assert (self);
+    assert (digest);
+    char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+    s_hex (digest, hex);
+    return zhash_lookup (self->chunks, hex) != NULL;
+}
+
+
+// --------------------------------------------------------------------------
+// Reads the chunk with digest. Returns NULL if it is unknown or changed.
+
+zframe_t *
+zsync_chunkstore_read (zsync_chunkstore_t *self, byte *digest)
+{
+    assert (self);
+    assert (digest);
+    char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+    s_hex (digest, hex);
+    zsync_chunk_location_t *location =
+        (zsync_chunk_location_t *) zhash_lookup (self->chunks, hex);
+    if (!location)
+        return NULL;
+    zframe_t *chunk = zframe_new (NULL, location->length);
+    if (!s_read_verified (self, location, digest, zframe_data (chunk))) {
+        zframe_destroy (&chunk);
+        zhash_delete (self->chunks, hex);
+        self->dirty = true;
+    }
+    return chunk;
+}
+
+
+// --------------------------------------------------------------------------
+// Writes the chunks of a manifest which are known locally to the partial
+// file of path and returns the byte ranges that still have to be
+// transferred. Chunks of the current version of path are used wherever
+// they moved to, the file itself is only replaced on completion.
+
+zframe_t *
+zsync_chunkstore_assemble (zsync_chunkstore_t *self, zframe_t *manifest, const char *path)
+{
+    assert (self);
+    assert (path);
+    int64_t file_size = zsync_cdc_manifest_size (manifest);
+    if (file_size == -1)
+        return NULL;
+
+    char *partial_path = s_partial_path (self, path);
+    int fd = open (partial_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free (partial_path);
+        return NULL;
+    }
+
+    size_t count = zsync_cdc_manifest_count (manifest);
+    uint64_t *offsets = (uint64_t *) malloc ((count + 1) * sizeof (uint64_t));
+    uint64_t *lengths = (uint64_t *) malloc ((count + 1) * sizeof (uint64_t));
+    byte *buffer = NULL;
+    size_t buffer_size = 0;
+    size_t ranges = 0;
+    uint64_t offset = 0;
+    int rc = 0;
+    size_t index;
+    for (index = 0; index < count && rc == 0; index++) {
+        uint32_t length;
+        byte *digest;
+        zsync_cdc_manifest_chunk (manifest, index, &length, &digest);
+        char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+        s_hex (digest, hex);
+        zsync_chunk_location_t *location =
+            (zsync_chunk_location_t *) zhash_lookup (self->chunks, hex);
+        bool local = false;
+        if (location && location->length == length) {
+            if (buffer_size < length) {
+                buffer_size = length;
+                buffer = (byte *) realloc (buffer, buffer_size);
+                assert (buffer);
+            }
+            local = s_read_verified (self, location, digest, buffer);
+            if (!local) {
+                zhash_delete (self->chunks, hex);
+                self->dirty = true;
+            }
+            else
+                rc = s_write_all (fd, buffer, length, offset);
+        }
+        if (!local) {
+            // Extend the previous range if it ends here
+            if (ranges > 0 && offsets [ranges - 1] + lengths [ranges - 1] == offset)
+                lengths [ranges - 1] += length;
+            else {
+                offsets [ranges] = offset;
+                lengths [ranges] = length;
+                ranges++;
+            }
+        }
+        offset += length;
+    }
+    if (rc == 0 && ftruncate (fd, file_size) != 0)
+        rc = -1;
+    close (fd);
+    s_close_source (self);
+    free (buffer);
+    if (rc != 0)
+        zsys_file_delete ("%s", partial_path);
+    free (partial_path);
+
+    zframe_t *frame = rc == 0? zsync_cdc_ranges_new (offsets, lengths, ranges): NULL;
+    free (offsets);
+    free (lengths);
+    return frame;
+}
+
+
+// --------------------------------------------------------------------------
+// Writes received bytes at offset to the partial file of path
+
+int
+zsync_chunkstore_write (zsync_chunkstore_t *self, const char *path,
+                        uint64_t offset, byte *data, size_t size)
+{
+    assert (self);
+    assert (path);
+    char *partial_path = s_partial_path (self, path);
+    int fd = open (partial_path, O_WRONLY);
+    free (partial_path);
+    if (fd == -1)
+        return -1;
+    int rc = s_write_all (fd, data, size, offset);
+    close (fd);
+    return rc;
+}
+
+
+// --------------------------------------------------------------------------
+// Verifies the partial file of path against its manifest and, once every
+// chunk is in place, replaces the file at path with it
+
+int
+zsync_chunkstore_complete (zsync_chunkstore_t *self, zframe_t *manifest, const char *path)
+{
+    assert (self);
+    assert (path);
+    if (zsync_cdc_manifest_size (manifest) == -1)
+        return -1;
+    char *partial_path = s_partial_path (self, path);
+    int fd = open (partial_path, O_RDWR);
+    if (fd == -1) {
+        free (partial_path);
+        return -1;
+    }
+
+    // Ranges which haven't arrived yet don't match their digest
+    byte *buffer = NULL;
+    size_t buffer_size = 0;
+    uint64_t offset = 0;
+    int rc = 0;
+    size_t index;
+    for (index = 0; index < zsync_cdc_manifest_count (manifest) && rc == 0; index++) {
+        uint32_t length;
+        byte *digest;
+        zsync_cdc_manifest_chunk (manifest, index, &length, &digest);
+        if (buffer_size < length) {
+            buffer_size = length;
+            buffer = (byte *) realloc (buffer, buffer_size);
+            assert (buffer);
+        }
+        byte actual [ZSYNC_DIGEST_SIZE];
+        if (pread (fd, buffer, length, offset) != (ssize_t) length)
+            rc = -1;
+        else {
+            zsync_hash_sha256 (buffer, length, actual);
+            if (memcmp (actual, digest, ZSYNC_DIGEST_SIZE) != 0)
+                rc = -1;
+        }
+        offset += length;
+    }
+    free (buffer);
+    if (rc == 0 && fsync (fd) != 0)
+        rc = -1;
+    close (fd);
+    if (rc == 0) {
+        char *full_path = s_full_path (self, path);
+        char *slash = strrchr (full_path, '/');
+        *slash = '\0';
+        zsys_dir_create ("%s", full_path);
+        *slash = '/';
+        s_close_source (self);
+        rc = rename (partial_path, full_path);
+        free (full_path);
+    }
+    free (partial_path);
+    // Chunks of the replaced version are found at their new offsets
+    if (rc == 0)
+        zsync_chunkstore_add_manifest (self, path, manifest);
+    return rc == 0? 0: -1;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of chunks in the index
+
+size_t
+zsync_chunkstore_size (zsync_chunkstore_t *self)
+{
+    assert (self);
+    return zhash_size (self->chunks);
+}
+
+
+// --------------------------------------------------------------------------
+// Writes the index to a temporary file and replaces the index with it
+
+int
+zsync_chunkstore_save (zsync_chunkstore_t *self)
+{
+    assert (self);
+    char *state_dir = s_full_path (self, ZSYNC_STATE_DIR);
+    zsys_dir_create ("%s", state_dir);
+    free (state_dir);
+    char *tmp_path = (char *) malloc (strlen (self->index_path) + 5);
+    sprintf (tmp_path, "%s.tmp", self->index_path);
+    FILE *file = fopen (tmp_path, "w");
+    if (!file) {
+        free (tmp_path);
+        return -1;
+    }
+    zsync_chunk_location_t *location = (zsync_chunk_location_t *) zhash_first (self->chunks);
+    while (location) {
+        // Paths with line breaks can't be stored, their chunks are found
+        // again once the file is added
+        if (!strchr (location->path, '\n'))
+            fprintf (file, "%s %"PRIu64" %"PRIu32" %s\n", zhash_cursor (self->chunks),
+                     location->offset, location->length, location->path);
+        location = (zsync_chunk_location_t *) zhash_next (self->chunks);
+    }
+    int rc = fclose (file) == 0? 0: -1;
+    if (rc == 0)
+        rc = rename (tmp_path, self->index_path);
+    free (tmp_path);
+    if (rc == 0)
+        self->dirty = false;
+    return rc;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_ROOT ".zsync_chunkstore_test"
+#define TEST_SIZE (512 * 1024)
+
+static void
+s_test_write (char *path, byte *data, size_t size)
+{
+    FILE *file = fopen (path, "wb");
+    assert (file);
+    fwrite (data, 1, size, file);
+    fclose (file);
+}
+
+void
+zsync_chunkstore_test ()
+{
+    printf (" * zsync_chunkstore: ");
+    zsys_dir_create (TEST_ROOT);
+    byte *data = (byte *) malloc (TEST_SIZE + 100);
+    uint32_t seed = 815;
+    size_t index;
+    for (index = 0; index < TEST_SIZE; index++) {
+        seed = seed * 1103515245 + 12345;
+        data [index] = (byte) (seed >> 16);
+    }
+    s_test_write (TEST_ROOT "/a.bin", data, TEST_SIZE);
+
+    zsync_chunkstore_t *store = zsync_chunkstore_new (TEST_ROOT);
+    assert (zsync_chunkstore_size (store) == 0);
+    int chunks = zsync_chunkstore_add_file (store, "a.bin");
+    assert (chunks > 0);
+    assert (zsync_chunkstore_size (store) == (size_t) chunks);
+    assert (zsync_chunkstore_add_file (store, "missing.bin") == -1);
+
+    // The manifest of a new version sent by a peer
+    memmove (data + 200100, data + 200000, TEST_SIZE - 200000);
+    memset (data + 200000, 'i', 100);
+    zsync_cdc_t *cdc = zsync_cdc_new (0, 0, 0);
+    s_test_write (TEST_ROOT "/peer.bin", data, TEST_SIZE + 100);
+    zframe_t *manifest = zsync_cdc_manifest (cdc, TEST_ROOT "/peer.bin");
+    zsys_file_delete (TEST_ROOT "/peer.bin");
+    byte *first_digest;
+    zsync_cdc_manifest_chunk (manifest, 0, NULL, &first_digest);
+    assert (zsync_chunkstore_has (store, first_digest));
+
+    // Only the chunks around the insertion have to be transferred, the
+    // chunks after it are reused although they moved
+    zframe_t *ranges = zsync_chunkstore_assemble (store, manifest, "a.bin");
+    assert (ranges);
+    assert (zsync_cdc_ranges_count (ranges) == 1);
+    assert (zsync_cdc_ranges_size (ranges) > 0);
+    assert (zsync_cdc_ranges_size (ranges) < TEST_SIZE / 4);
+    // The old version stays until every range has arrived
+    assert (zsys_file_size (TEST_ROOT "/a.bin") == TEST_SIZE);
+    assert (zsync_chunkstore_complete (store, manifest, "a.bin") == -1);
+    assert (zsys_file_size (TEST_ROOT "/a.bin") == TEST_SIZE);
+
+    // Receive the ranges and compare
+    uint64_t offset, length;
+    zsync_cdc_ranges_get (ranges, 0, &offset, &length);
+    assert (zsync_chunkstore_write (store, "a.bin", offset, data + offset, length) == 0);
+    zframe_destroy (&ranges);
+    assert (zsync_chunkstore_complete (store, manifest, "a.bin") == 0);
+    assert (!zsys_file_exists (TEST_ROOT "/" PARTIAL_DIR "/a.bin"));
+    byte *result = (byte *) malloc (TEST_SIZE + 100);
+    FILE *file = fopen (TEST_ROOT "/a.bin", "rb");
+    assert (fread (result, 1, TEST_SIZE + 100, file) == TEST_SIZE + 100);
+    fclose (file);
+    assert (memcmp (result, data, TEST_SIZE + 100) == 0);
+    free (result);
+
+    // The index survives a restart
+    size_t size = zsync_chunkstore_size (store);
+    zsync_chunkstore_destroy (&store);
+    store = zsync_chunkstore_new (TEST_ROOT);
+    assert (zsync_chunkstore_size (store) == size);
+    zframe_t *chunk = zsync_chunkstore_read (store, first_digest);
+    assert (chunk);
+    zframe_destroy (&chunk);
+
+    // Changed files are detected when reading
+    memset (data, 0, TEST_SIZE);
+    s_test_write (TEST_ROOT "/a.bin", data, TEST_SIZE);
+    assert (zsync_chunkstore_read (store, first_digest) == NULL);
+    assert (!zsync_chunkstore_has (store, first_digest));
+    assert (zsync_chunkstore_size (store) == size - 1);
+
+    zframe_destroy (&manifest);
+    zsync_cdc_destroy (&cdc);
+    zsync_chunkstore_destroy (&store);
+    free (data);
+    zsys_file_delete (TEST_ROOT "/a.bin");
+    zsys_file_delete (TEST_ROOT "/" INDEX_FILE);
+    rmdir (TEST_ROOT "/" PARTIAL_DIR);
+    rmdir (TEST_ROOT "/" ZSYNC_STATE_DIR);
+    rmdir (TEST_ROOT);
+    printf ("OK\n");
+}
@@ -4,10 +4,23 @@
 #include <czmq.h>
 #include <zyre.h>
 #include <zyre_event.h>
+#include "../include/zsync_hash.h"
+#include "../include/zsync_delta.h"
+#include "../include/zsync_cdc.h"
+#include "../include/zsync_chunkstore.h"
+#include "../include/zsync_arena.h"
+#include "../include/zsync_bucket.h"
 #include "../include/zs_fmetadata.h"
+#include "../include/zs_fmlist.h"
 #include "../include/zs_msg.h"
 #include "../include/zsync_msg.h"
 #include "../include/zsync_peer.h"
+#include "../include/zsync_recordlog.h"
+#include "../include/zsync_journal.h"
+#include "../include/zsync_progress.h"
+#include "../include/zsync_changelog.h"
+#include "../include/zsync_scanner.h"
+#include "../include/zsync_watcher.h"
 #include "../include/zsync_ftmanager.h"
 #include "../include/zsync_credit.h"
 #include "../include/zsync_node.h"
@@ -15,6 +28,10 @@
 #include "../include/zsync_credit_msg.h"
 #include "../include/zsync_ftm_msg.h"
 
+// Directory below the synced root which holds private state, e.g. the
+// chunk index and partially received files. It is never synced.
+#define ZSYNC_STATE_DIR ".zsync"
+
 // Strings are encoded with 2-byte length
 #define STRING_MAX 65535 // 2-byte - 1-bit for trailing \0
 
@@ -28,6 +28,12 @@
     Handles credit apprvals for outgoing file requests.
     By observing outgoing file requests and incoming chunks it manages to
     total credit that is feasible.   
+    With adaptive credit each peer's window is sized to its measured
+    delivery rate times its round-trip time, instead of ten chunks.
+    With write backpressure received bytes stay taken from the total credit
+    until the agent reports them written to disk.
+    Download rates may be limited per peer and for all peers by token
+    buckets, which credit has to pass before it is given.
 @discuss
     LOG message to LOG group on whisper and shout
 @end
@@ -35,23 +41,62 @@
 
 #include "zsync_classes.h"
 
-#define TOTAL_CREDIT 1024 * 1024 * 100; // -> 100 MB
+#define TOTAL_CREDIT (1024 * 1024 * 100) // -> 100 MB
+
+#define CREDIT_CHUNKS 10        // Fixed credit window in chunks
+#define CREDIT_MIN_CHUNKS 4     // Smallest adaptive credit window in chunks
+#define CREDIT_GAIN 2           // Adaptive window per bandwidth-delay product
+#define CREDIT_GRANTS 32        // Grants tracked for round-trip samples
+#define CREDIT_RATE_SAMPLES 10  // Delivery rate samples in the max filter
+#define CREDIT_RTT_EXPIRY 10000 // Msecs until a lower rtt sample is required
+#define CREDIT_IDLE 2000        // Msecs until a peer holding credit is idle
+
+typedef struct {
+    int64_t time;               // When credit was given
+    uint64_t offset;            // Credited bytes before it was given
+} zsync_grant_t;
 
 struct _zsync_credit_t {
+    char *sender;               // UUID of the other peer
+    uint32_t weight;            // Share of the total credit relative to others
+    uint64_t share;             // Most credit the peer may have outstanding
+    int64_t active;             // When the peer last requested or sent bytes
+    zsync_bucket_t *bucket;     // Download rate limit of the peer
     uint64_t requested_bytes;   // Bytes requests for all files
     uint64_t credited_bytes;    // Bytes credited to other peer 
     uint64_t received_bytes;    // Bytes received from other peer 
+    uint64_t chunk_size;        // Largest chunk the other peer may send
+
+    // Bandwidth-delay estimation
+    zsync_grant_t grants [CREDIT_GRANTS];
+    size_t grants_head;         // Oldest grant not yet acknowledged
+    size_t grants_size;         // Number of grants not yet acknowledged
+    int64_t min_rtt;            // Lowest round-trip time in msecs, -1 if none
+    int64_t min_rtt_stamp;      // When min_rtt was sampled
+    uint64_t rates [CREDIT_RATE_SAMPLES];
+    size_t rates_cursor;        // Next delivery rate sample to replace
+    uint64_t max_rate;          // Highest delivery rate in bytes per msec
+    int64_t rate_stamp;         // Start of current rate interval, -1 if none
+    uint64_t rate_bytes;        // Received bytes at start of rate interval
 };
 
 typedef struct _zsync_credit_t zsync_credit_t;
 
 zsync_credit_t *
-zsync_credit_new ()
+zsync_credit_new (char *sender)
 {
     zsync_credit_t *self = (zsync_credit_t *) zmalloc (sizeof (zsync_credit_t));
+    self->sender = strdup (sender);
+    self->weight = 1;
+    self->share = TOTAL_CREDIT;
+    self->active = zclock_time ();
+    self->bucket = zsync_bucket_new (0);
     self->requested_bytes = 0;
     self->credited_bytes = 0;
     self->received_bytes = 0;
+    self->chunk_size = CHUNK_SIZE;
+    self->min_rtt = -1;
+    self->rate_stamp = -1;
     return self;
 }
 
@@ -62,6 +107,8 @@ zsync_credit_destroy (zsync_credit_t **self_p)
 
     if (*self_p) {
         zsync_credit_t *self = *self_p;
+        zsync_bucket_destroy (&self->bucket);
+        free (self->sender);
         free (self);
         self_p = NULL;
     }
@@ -81,6 +128,306 @@ s_credit_dump (zsync_credit_t *self) {
     printf ("     Requested %"PRId64"\n", self->requested_bytes);
     printf ("     Credited %"PRId64"\n", self->credited_bytes);
     printf ("     Received %"PRId64"\n", self->received_bytes);
+    printf ("     Min RTT %"PRId64" ms\n", self->min_rtt);
+    printf ("     Max rate %"PRId64" bytes/ms\n", self->max_rate);
+}
+
+// --------------------------------------------------------------------------
+// Accounts bytes received from the peer and updates its round-trip time and
+// delivery rate estimates. A grant is acknowledged by the first byte beyond
+// the credit that existed before it, which cannot be sent before the grant
+// arrived at the peer. The delivery rate is sampled once per round-trip and
+// the highest of the recent samples is kept, like BBR's bottleneck filter.
+
+static void
+s_credit_receive (zsync_credit_t *self, uint64_t bytes, int64_t now)
+{
+    assert (self);
+    self->received_bytes += bytes;
+    self->active = now;
+
+    while (self->grants_size > 0) {
+        zsync_grant_t *grant = &self->grants [self->grants_head];
+        if (self->received_bytes <= grant->offset)
+            break;
+        int64_t rtt = now - grant->time;
+        if (self->min_rtt < 0 || rtt <= self->min_rtt
+        ||  now - self->min_rtt_stamp > CREDIT_RTT_EXPIRY) {
+            self->min_rtt = rtt;
+            self->min_rtt_stamp = now;
+        }
+        self->grants_head = (self->grants_head + 1) % CREDIT_GRANTS;
+        self->grants_size--;
+    }
+
+    if (self->rate_stamp < 0) {
+        self->rate_stamp = now;
+        self->rate_bytes = self->received_bytes;
+        return;
+    }
+    int64_t elapsed = now - self->rate_stamp;
+    if (self->min_rtt < 0 || elapsed <= 0 || elapsed < self->min_rtt)
+        return;
+
+    self->rates [self->rates_cursor] =
+        (self->received_bytes - self->rate_bytes) / elapsed;
+    self->rates_cursor = (self->rates_cursor + 1) % CREDIT_RATE_SAMPLES;
+    self->max_rate = 0;
+    size_t index;
+    for (index = 0; index < CREDIT_RATE_SAMPLES; index++)
+        if (self->rates [index] > self->max_rate)
+            self->max_rate = self->rates [index];
+    self->rate_stamp = now;
+    self->rate_bytes = self->received_bytes;
+}
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes the peer may have outstanding. Adaptive
+// windows are a multiple of the bandwidth-delay product, so the peer can
+// keep the link busy while credit is on its way; until both estimates
+// exist the fixed window is used.
+
+static uint64_t
+s_credit_window (zsync_credit_t *self, bool adaptive)
+{
+    assert (self);
+    uint64_t window = self->chunk_size * CREDIT_CHUNKS;
+    if (!adaptive || self->min_rtt < 0 || self->max_rate == 0)
+        return window;
+
+    int64_t rtt = self->min_rtt > 0? self->min_rtt: 1;
+    window = CREDIT_GAIN * self->max_rate * rtt;
+    if (window < self->chunk_size * CREDIT_MIN_CHUNKS)
+        window = self->chunk_size * CREDIT_MIN_CHUNKS;
+    return window;
+}
+
+// --------------------------------------------------------------------------
+// Returns the most credit the peer can use right now: its window, or less
+// if fewer bytes are still to come. A peer which holds credit but has not
+// sent anything for a while is idle and only keeps what it already holds.
+
+static uint64_t
+s_credit_demand (zsync_credit_t *self, bool adaptive, int64_t now)
+{
+    assert (self);
+    uint64_t outstanding = self->credited_bytes > self->received_bytes?
+                           self->credited_bytes - self->received_bytes: 0;
+    if (outstanding > 0 && now - self->active > CREDIT_IDLE)
+        return outstanding;
+
+    uint64_t remaining = self->requested_bytes > self->received_bytes?
+                         self->requested_bytes - self->received_bytes: 0;
+    // Fixed windows are refilled while two chunks are still outstanding
+    uint64_t demand = s_credit_window (self, adaptive);
+    if (!adaptive)
+        demand += self->chunk_size * 2;
+    return demand < remaining? demand: remaining;
+}
+
+static int
+s_credit_compare (const void *a, const void *b)
+{
+    const zsync_credit_t *left = *(const zsync_credit_t **) a;
+    const zsync_credit_t *right = *(const zsync_credit_t **) b;
+    double left_level = (double) left->share / left->weight;
+    double right_level = (double) right->share / right->weight;
+    return left_level < right_level? -1: left_level > right_level? 1: 0;
+}
+
+// --------------------------------------------------------------------------
+// Divides the capacity among the peers with weighted max-min fairness.
+// Peers are visited in order of demand per weight; each gets its demand
+// if that is below its weighted share of what is left, otherwise all
+// remaining peers split what is left by weight. Credit an idle or nearly
+// finished peer does not need goes to the others.
+
+static void
+s_credit_share (zsync_credit_t **credits, size_t size, uint64_t capacity,
+                bool adaptive, int64_t now)
+{
+    uint64_t weights = 0;
+    size_t index;
+    for (index = 0; index < size; index++) {
+        // Demand is kept in share until the peer's share is known
+        credits [index]->share = s_credit_demand (credits [index], adaptive, now);
+        weights += credits [index]->weight;
+    }
+    qsort (credits, size, sizeof (zsync_credit_t *), s_credit_compare);
+
+    for (index = 0; index < size; index++) {
+        zsync_credit_t *credit = credits [index];
+        uint64_t fair = (uint64_t) ((double) capacity * credit->weight / weights);
+        if (credit->share > fair)
+            credit->share = fair;
+        capacity -= credit->share;
+        weights -= credit->weight;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Returns the credit to give to the peer now, 0 if none, and takes it from
+// the total credit. Fixed windows give ten chunks once no more than two are
+// left; adaptive windows are topped up in whole chunks once a quarter of
+// the window has been used. Outstanding credit never exceeds the peer's
+// fair share, though a share below one chunk still allows one chunk.
+// Credit beyond limit, e.g. the bytes a rate limit lets pass, is only
+// given in whole chunks, at least one.
+
+static uint64_t
+s_credit_grant (zsync_credit_t *self, uint64_t *total_credit, bool adaptive,
+                uint64_t limit, int64_t now)
+{
+    assert (self);
+    assert (total_credit);
+
+    // Credit is measured in chunks of the size negotiated with the peer
+    uint64_t chunk_size = self->chunk_size;
+    if (*total_credit < chunk_size
+    ||  self->requested_bytes <= self->credited_bytes)
+        return 0;
+
+    uint64_t credit_left = self->credited_bytes > self->received_bytes?
+                           self->credited_bytes - self->received_bytes: 0;
+    uint64_t uncredited_left = self->requested_bytes - self->credited_bytes;
+    uint64_t new_credit;
+    if (adaptive) {
+        uint64_t window = s_credit_window (self, adaptive);
+        uint64_t threshold = window / 4 > chunk_size? window / 4: chunk_size;
+        if (credit_left >= window || window - credit_left < threshold)
+            return 0;
+        new_credit = (window - credit_left) / chunk_size * chunk_size;
+    }
+    else {
+        if (credit_left > chunk_size * 2)
+            return 0;
+        new_credit = chunk_size * CREDIT_CHUNKS;
+    }
+    uint64_t share = self->share > chunk_size? self->share: chunk_size;
+    if (credit_left + new_credit > share) {
+        new_credit = credit_left < share? share - credit_left: 0;
+        if (new_credit < uncredited_left)
+            new_credit = new_credit / chunk_size * chunk_size;
+        if (new_credit == 0)
+            return 0;
+    }
+    if (new_credit > uncredited_left)
+        new_credit = uncredited_left;
+    if (new_credit > limit) {
+        uint64_t limited = limit / chunk_size * chunk_size;
+        if (limited > 0)
+            new_credit = limited;
+        else
+        if (new_credit > chunk_size)
+            new_credit = chunk_size;
+    }
+    if (new_credit > *total_credit)
+        new_credit = *total_credit / chunk_size * chunk_size;
+
+    // Only grants the peer was waiting for measure the round-trip time
+    if (credit_left < chunk_size && self->grants_size < CREDIT_GRANTS) {
+        size_t tail = (self->grants_head + self->grants_size) % CREDIT_GRANTS;
+        self->grants [tail].time = now;
+        self->grants [tail].offset = self->credited_bytes;
+        self->grants_size++;
+    }
+    // Ajust total credit and credited bytes
+    *total_credit -= new_credit;
+    self->credited_bytes += new_credit;
+    return new_credit;
+}
+
+// --------------------------------------------------------------------------
+// Shares the capacity among all peers and gives each the credit it may
+// use now. Every peer is visited, so credit freed by one peer reaches
+// peers that wait for it without sending anything. The initial peer, if
+// any, is always answered with INITIAL_CREDIT, even without credit.
+// Returns the msecs until the rate limits let credit pass again for a
+// peer which is throttled, -1 if none is.
+
+static int64_t
+s_credit_give (zhash_t *peer_credit, uint64_t *total_credit, uint64_t capacity,
+               bool adaptive, zsync_credit_t *initial, zsync_bucket_t *bucket, void *pipe)
+{
+    int64_t wait = -1;
+    size_t size = zhash_size (peer_credit);
+    if (size == 0)
+        return wait;
+    int64_t now = zclock_time ();
+    zsync_credit_t **credits = (zsync_credit_t **) zmalloc (size * sizeof (zsync_credit_t *));
+    size_t index = 0;
+    zsync_credit_t *credit = (zsync_credit_t *) zhash_first (peer_credit);
+    while (credit) {
+        credits [index++] = credit;
+        credit = (zsync_credit_t *) zhash_next (peer_credit);
+    }
+    s_credit_share (credits, size, capacity, adaptive, now);
+
+    for (index = 0; index < size; index++) {
+        credit = credits [index];
+        uint64_t limit = zsync_bucket_available (credit->bucket, now);
+        if (zsync_bucket_available (bucket, now) < limit)
+            limit = zsync_bucket_available (bucket, now);
+        uint64_t new_credit = 0;
+        if (limit > 0) {
+            new_credit = s_credit_grant (credit, total_credit, adaptive, limit, now);
+            zsync_bucket_consume (credit->bucket, new_credit, now);
+            zsync_bucket_consume (bucket, new_credit, now);
+        }
+        else
+        if (credit->requested_bytes > credit->credited_bytes) {
+            int64_t credit_wait = zsync_bucket_wait (credit->bucket, now);
+            if (zsync_bucket_wait (bucket, now) > credit_wait)
+                credit_wait = zsync_bucket_wait (bucket, now);
+            if (wait < 0 || credit_wait < wait)
+                wait = credit_wait;
+        }
+        if (credit == initial) {
+            zsync_credit_msg_send_initial_credit (pipe, credit->sender, new_credit);
+            printf("[CR] [SEND] initial credit: %"PRId64", to %s\n", new_credit, credit->sender);
+        }
+        else
+        if (new_credit > 0) {
+            // Send credit update
+            zmsg_t *zmsg = zmsg_new ();
+            zs_msg_pack_give_credit (zmsg, new_credit);
+            zsync_credit_msg_send_give_credit (pipe, credit->sender, zmsg);
+            printf("[CR] [SEND] credit: %"PRId64", to %s\n", new_credit, credit->sender);
+        }
+    }
+    free (credits);
+    return wait;
+}
+
+// Helper method that keeps a setting of a peer, e.g. its weight, which
+// applies again once the peer reconnects
+static void
+s_peer_setting_store (zhash_t *settings, char *sender, uint64_t value)
+{
+    uint64_t *setting = (uint64_t *) zmalloc (sizeof (uint64_t));
+    *setting = value;
+    zhash_update (settings, sender, setting);
+    zhash_freefn (settings, sender, free);
+}
+
+// Helper method that returns the credit of a peer. A new one gets the
+// download rate limit and weight stored for the peer.
+static zsync_credit_t *
+s_credit_require (zhash_t *peer_credit, zhash_t *peer_rates, zhash_t *peer_weights, char *sender)
+{
+    zsync_credit_t *credit = zhash_lookup (peer_credit, sender);
+    if (!credit) {
+        credit = zsync_credit_new (sender);
+        zhash_insert (peer_credit, sender, credit);
+        zhash_freefn (peer_credit, sender, s_destroy_credit_item);
+        uint64_t *rate = (uint64_t *) zhash_lookup (peer_rates, sender);
+        if (rate)
+            zsync_bucket_set_rate (credit->bucket, *rate);
+        uint64_t *weight = (uint64_t *) zhash_lookup (peer_weights, sender);
+        if (weight)
+            credit->weight = (uint32_t) *weight;
+    }
+    return credit;
 }
 
 void
@@ -89,53 +436,126 @@ zsync_credit_manager_engine (void *args, zctx_t *ctx, void *pipe)
     uint64_t total_credit = TOTAL_CREDIT;
     zhash_t *peer_credit = zhash_new ();
     zsync_credit_msg_t *msg;
+    uint64_t backlog = 0;       // Bytes received but not yet written
+    zsync_bucket_t *bucket = zsync_bucket_new (0);  // Download rate limit of all peers
+    zhash_t *peer_rates = zhash_new ();  // Download rate limits, kept across aborts
+    zhash_t *peer_weights = zhash_new ();   // Weights, kept across aborts
+    int64_t wait = -1;          // Msecs until a throttled peer may get credit
+    bool adaptive = false;
+    bool backpressure = false;
     bool terminated = false;
-    int rc;
+
+    if (args) {
+        adaptive = zsync_adaptive_credit ((zsync_t *) args);
+        backpressure = zsync_write_backpressure ((zsync_t *) args);
+    }
 
     zpoller_t *poller = zpoller_new (pipe, NULL);
 
     printf("[CR] started with %"PRId64" bytes credit\n", total_credit);
-    while (!zpoller_terminated (poller)) {
-        void *which = zpoller_wait (poller, -1);
-        
-        if (which == pipe) {
-            msg = zsync_credit_msg_recv (pipe);
-            assert (msg);
-        } 
-        else 
-        if (which == NULL) {
+    while (!terminated) {
+        // Wake up regularly to pass on the credit of idle peers
+        // and to give credit as soon as the rate limits let it pass
+        void *which = zpoller_wait (poller,
+            wait >= 0 && wait < CREDIT_IDLE? (int) wait: CREDIT_IDLE);
+        if (which != pipe) {
+            if (zpoller_expired (poller)) {
+                wait = s_credit_give (peer_credit, &total_credit,
+                                      TOTAL_CREDIT - backlog, adaptive, NULL, bucket, pipe);
+                continue;
+            }
             // stop thread if being interupted
             break;
         }
-        
+        msg = zsync_credit_msg_recv (pipe);
+        if (!msg)
+            break;
 
-        char *sender;
-        zsync_credit_t *credit;
-        if (zsync_credit_msg_id (msg) != ZSYNC_CREDIT_MSG_TERMINATE) {
+        char *sender = NULL;
+        zsync_credit_t *credit = NULL;
+        zsync_credit_t *initial = NULL;
+        if (zsync_credit_msg_id (msg) != ZSYNC_CREDIT_MSG_TERMINATE
+        &&  zsync_credit_msg_id (msg) != ZSYNC_CREDIT_MSG_PERSISTED
+        &&  strlen (zsync_credit_msg_sender (msg)) > 0) {
             sender = zsync_credit_msg_sender (msg);
             // Get credit information for sender
-            credit = zhash_lookup (peer_credit, sender);
-            if (!credit) {
-               credit = zsync_credit_new ();
-               zhash_insert (peer_credit, sender, credit);
-               zhash_freefn (peer_credit, sender, s_destroy_credit_item);
-            }
+            // Only requests start a transfer, anything else may arrive
+            // after the peer aborted and its credit has been returned
+            if (zsync_credit_msg_id (msg) == ZSYNC_CREDIT_MSG_REQUEST
+            ||  zsync_credit_msg_id (msg) == ZSYNC_CREDIT_MSG_REQUEST_CREDIT)
+                credit = s_credit_require (peer_credit, peer_rates, peer_weights, sender);
+            else
+                credit = zhash_lookup (peer_credit, sender);
         }
         
+        int64_t now = zclock_time ();
         switch (zsync_credit_msg_id (msg)) {
+            case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+                // The requester waits for the credit to send with the
+                // request, otherwise it is handled like REQUEST
+                initial = credit;
             case ZSYNC_CREDIT_MSG_REQUEST:
                 credit->requested_bytes += zsync_credit_msg_req_bytes (msg);
+                if (zsync_credit_msg_chunk_size (msg) > 0)
+                    credit->chunk_size = zsync_credit_msg_chunk_size (msg);
+                credit->active = now;
                 printf("[CR] [RECV] request %"PRId64"\n", credit->requested_bytes);
                 break;
             case ZSYNC_CREDIT_MSG_UPDATE:
-                credit->received_bytes += zsync_credit_msg_recv_bytes (msg);
-                total_credit += zsync_credit_msg_recv_bytes (msg);
+                // Chunks in flight when the peer aborted
+                if (!credit)
+                    break;
+                s_credit_receive (credit, zsync_credit_msg_recv_bytes (msg), now);
+                // Bytes held until written still count against the total
+                if (backpressure)
+                    backlog += zsync_credit_msg_recv_bytes (msg);
+                else
+                    total_credit += zsync_credit_msg_recv_bytes (msg);
                 printf("[CR] [RECV] update %"PRId64"\n", credit->received_bytes);
                 break;
+            case ZSYNC_CREDIT_MSG_PERSISTED: {
+                uint64_t persisted = zsync_credit_msg_persisted_bytes (msg);
+                if (!backpressure)
+                    break;
+                if (persisted > backlog)
+                    persisted = backlog;
+                backlog -= persisted;
+                total_credit += persisted;
+                break;
+            }
             case ZSYNC_CREDIT_MSG_ABORT:
+                if (!credit)
+                    break;
+                // Credit the peer will not use returns to the total credit
+                if (credit->credited_bytes > credit->received_bytes)
+                    total_credit += credit->credited_bytes - credit->received_bytes;
                 zhash_delete (peer_credit, sender);
                 printf("[CR] [RECV] abort\n");
                 break;
+            case ZSYNC_CREDIT_MSG_WEIGHT: {
+                if (!sender)
+                    break;
+                uint32_t weight = zsync_credit_msg_weight (msg);
+                if (weight == 0)
+                    weight = 1;
+                // Kept for the next transfer of the peer
+                if (credit)
+                    credit->weight = weight;
+                s_peer_setting_store (peer_weights, sender, weight);
+                break;
+            }
+            case ZSYNC_CREDIT_MSG_RATE: {
+                uint64_t rate = zsync_credit_msg_rate (msg);
+                if (!sender) {
+                    zsync_bucket_set_rate (bucket, rate);
+                    break;
+                }
+                // Kept for the next transfer of the peer
+                if (credit)
+                    zsync_bucket_set_rate (credit->bucket, rate);
+                s_peer_setting_store (peer_rates, sender, rate);
+                break;
+            }
             case ZSYNC_CREDIT_MSG_TERMINATE: {
                 zmsg_t *tmsg = zmsg_new ();
                 zmsg_pushstr (tmsg, "OK");
@@ -144,44 +564,18 @@ zsync_credit_manager_engine (void *args, zctx_t *ctx, void *pipe)
                 break;
              }
         }
-
-        if (terminated) {
-            // Stop thread
-            break;
-        }
-        
-        if (total_credit >= CHUNK_SIZE) {
-
-            uint64_t credit_left = credit->credited_bytes - credit->received_bytes;
-            if (credit_left <= CHUNK_SIZE * 2) {
-                uint64_t new_credit = 0;
-                uint64_t uncredited_left = credit->requested_bytes - credit->credited_bytes;
-                // send more credit
-                int chunks_left = (uncredited_left / CHUNK_SIZE);
-                // s_credit_dump (credit);
-                if (chunks_left >= 10) {
-                    new_credit = CHUNK_SIZE * 10;                  
-                } 
-                else if (uncredited_left > 0 ) {
-                    new_credit = uncredited_left;
-                } 
-                else {
-                    continue;
-                }
-                // Send credit update
-                zmsg_t *zmsg = zmsg_new ();
-                zs_msg_pack_give_credit (zmsg, new_credit);
-                zsync_credit_msg_send_give_credit (pipe, sender, zmsg);
-                // Ajust total credit and credited bytes
-                total_credit -= new_credit;
-                credit->credited_bytes += new_credit;
-                printf("[CR] [SEND] credit: %"PRId64", to %s\n", new_credit, sender);
-            }
-        }
         // Cleanup
         zsync_credit_msg_destroy (&msg);
+
+        if (!terminated)
+            wait = s_credit_give (peer_credit, &total_credit,
+                                  TOTAL_CREDIT - backlog, adaptive, initial, bucket, pipe);
     }
+    zpoller_destroy (&poller);
+    zhash_destroy (&peer_rates);
+    zhash_destroy (&peer_weights);
     zhash_destroy (&peer_credit);
+    zsync_bucket_destroy (&bucket);
     printf("[CR] stopped\n");
 }
 
@@ -198,6 +592,82 @@ s_test_expect_credit (void *pipe, char *peer, uint64_t expected_credit)
     assert (expected_credit == actual_credit); 
 }
  
+// --------------------------------------------------------------------------
+// Simulates a peer behind a link with the given rate in bytes per msec and
+// round-trip time in msecs, which sends as fast as its credit allows. Credit
+// and data each take half the round-trip time to arrive. Returns the bytes
+// received per msec.
+
+typedef struct {
+    int64_t time;
+    uint64_t bytes;
+} s_test_event_t;
+
+static uint64_t
+s_test_simulate (bool adaptive, uint64_t rate, int64_t rtt, int64_t duration)
+{
+    zsync_credit_t *credit = zsync_credit_new ("0001");
+    credit->requested_bytes = (uint64_t) 1024 * 1024 * 1024 * 64;
+    uint64_t total_credit = TOTAL_CREDIT;
+
+    s_test_event_t *grants = zmalloc (duration * sizeof (s_test_event_t));
+    s_test_event_t *data = zmalloc (duration * sizeof (s_test_event_t));
+    size_t grants_head = 0, grants_tail = 0;
+    size_t data_head = 0, data_tail = 0;
+    uint64_t sender_credit = 0;
+    uint64_t received = 0;
+
+    int64_t now;
+    for (now = 0; now < duration; now++) {
+        while (grants_head < grants_tail && grants [grants_head].time <= now)
+            sender_credit += grants [grants_head++].bytes;
+
+        uint64_t sent = sender_credit < rate? sender_credit: rate;
+        if (sent > 0) {
+            sender_credit -= sent;
+            data [data_tail].time = now + rtt / 2;
+            data [data_tail++].bytes = sent;
+        }
+        while (data_head < data_tail && data [data_head].time <= now) {
+            s_credit_receive (credit, data [data_head].bytes, now);
+            total_credit += data [data_head].bytes;
+            received += data [data_head++].bytes;
+        }
+        uint64_t new_credit = s_credit_grant (credit, &total_credit, adaptive, UINT64_MAX, now);
+        if (new_credit > 0) {
+            grants [grants_tail].time = now + rtt / 2;
+            grants [grants_tail++].bytes = new_credit;
+        }
+    }
+    if (adaptive)
+        assert (credit->min_rtt >= rtt && credit->min_rtt <= rtt + 1);
+
+    free (grants);
+    free (data);
+    zsync_credit_destroy (&credit);
+    return received / duration;
+}
+
+static void
+s_test_expect_initial_credit (void *pipe, char *peer, uint64_t expected_credit) 
+{
+    zsync_credit_msg_t *msg = zsync_credit_msg_recv (pipe);
+    assert (zsync_credit_msg_id (msg) == ZSYNC_CREDIT_MSG_INITIAL_CREDIT);
+    assert (streq (peer, zsync_credit_msg_receiver (msg)));
+    assert (zsync_credit_msg_initial_credit (msg) == expected_credit);
+    zsync_credit_msg_destroy (&msg);
+}
+
+static zsync_credit_t *
+s_test_peer (char *sender, uint64_t requested_bytes, uint32_t weight)
+{
+    zsync_credit_t *credit = zsync_credit_new (sender);
+    credit->requested_bytes = requested_bytes;
+    credit->chunk_size = 1024 * 1024;
+    credit->weight = weight;
+    return credit;
+}
+
 void
 zsync_credit_test ()
 {
@@ -210,7 +680,7 @@ zsync_credit_test ()
     char *peer2 = "0002";
 
     // Request from Peer 1
-    zsync_credit_msg_send_request (pipe, peer1, 310000);    
+    zsync_credit_msg_send_request (pipe, peer1, 310000, CHUNK_SIZE);    
     s_test_expect_credit (pipe, peer1, 300000);
     zsync_credit_msg_send_update (pipe, peer1, 239000);    
     zclock_sleep (100);                             // Give time for a message to arrive
@@ -222,7 +692,7 @@ zsync_credit_test ()
     assert (zmsg_recv_nowait (pipe) == NULL);
 
     // Request from Peer 2
-    zsync_credit_msg_send_request (pipe, peer2, 650000);    
+    zsync_credit_msg_send_request (pipe, peer2, 650000, CHUNK_SIZE);    
     s_test_expect_credit (pipe, peer2, 300000);
     zsync_credit_msg_send_update (pipe, peer2, 300000);    
     s_test_expect_credit (pipe, peer2, 300000);
@@ -232,11 +702,168 @@ zsync_credit_test ()
     zclock_sleep (100);
     assert (zmsg_recv_nowait (pipe) == NULL);
 
+    // Request from Peer 3 with a larger negotiated chunk size
+    char *peer3 = "0003";
+    zsync_credit_msg_send_request (pipe, peer3, 20 * 1024 * 1024, 1024 * 1024);    
+    s_test_expect_credit (pipe, peer3, 10 * 1024 * 1024);
+    zsync_credit_msg_send_update (pipe, peer3, 7 * 1024 * 1024);    
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+    zsync_credit_msg_send_update (pipe, peer3, 1024 * 1024);    
+    s_test_expect_credit (pipe, peer3, 10 * 1024 * 1024);
+
+    // The first credit is answered right away to be sent with the request
+    char *peer8 = "0008";
+    zsync_credit_msg_send_request_credit (pipe, peer8, 310000, CHUNK_SIZE);
+    s_test_expect_initial_credit (pipe, peer8, 300000);
+    zsync_credit_msg_send_update (pipe, peer8, 250000);
+    s_test_expect_credit (pipe, peer8, 10000);
+
+    // A download rate limit lets one chunk pass every 250 msecs
+    char *peer10 = "000A";
+    int64_t start = zclock_time ();
+    zsync_credit_msg_send_rate (pipe, peer10, CHUNK_SIZE * 4);
+    zsync_credit_msg_send_request (pipe, peer10, CHUNK_SIZE * 4, CHUNK_SIZE);
+    s_test_expect_credit (pipe, peer10, CHUNK_SIZE);
+    int chunk_nbr;
+    for (chunk_nbr = 0; chunk_nbr < 3; chunk_nbr++) {
+        zsync_credit_msg_send_update (pipe, peer10, CHUNK_SIZE);
+        s_test_expect_credit (pipe, peer10, CHUNK_SIZE);
+    }
+    assert (zclock_time () - start >= 400);
+    zsync_credit_msg_send_update (pipe, peer10, CHUNK_SIZE);
+    zclock_sleep (300);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+
+    // A peer which disconnected resumes with fresh credit, credit it got
+    // before but didn't use doesn't stall the transfer
+    char *peer9 = "0009";
+    zsync_credit_msg_send_request_credit (pipe, peer9, 310000, CHUNK_SIZE);
+    s_test_expect_initial_credit (pipe, peer9, 300000);
+    zsync_credit_msg_send_update (pipe, peer9, 60000);
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+    zsync_credit_msg_send_abort (pipe, peer9);
+    // Chunks still in flight don't return credit a second time
+    zsync_credit_msg_send_update (pipe, peer9, 60000);
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+    zsync_credit_msg_send_request_credit (pipe, peer9, 250000, CHUNK_SIZE);
+    s_test_expect_initial_credit (pipe, peer9, 250000);
+    zsync_credit_msg_send_update (pipe, peer9, 250000);
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+
+    // Peers share the total credit fairly, according to their weight
+    uint64_t mb = 1024 * 1024;
+    int64_t now = zclock_time ();
+    zsync_credit_t *peers [3];
+    zsync_credit_t *fast = s_test_peer ("0004", 100 * mb, 1);
+    zsync_credit_t *slow = s_test_peer ("0005", 100 * mb, 1);
+    zsync_credit_t *third = s_test_peer ("0006", 100 * mb, 1);
+    peers [0] = fast; peers [1] = slow; peers [2] = third;
+    s_credit_share (peers, 3, 6 * mb, false, now);
+    assert (fast->share == 2 * mb && slow->share == 2 * mb && third->share == 2 * mb);
+
+    // Credit beyond the share is withheld even though the pool has more
+    uint64_t pool = 6 * mb;
+    assert (s_credit_grant (fast, &pool, false, UINT64_MAX, now) == 2 * mb);
+    s_credit_receive (fast, mb, now);
+    pool += mb;
+    assert (s_credit_grant (fast, &pool, false, UINT64_MAX, now) == mb);
+    assert (s_credit_grant (slow, &pool, false, UINT64_MAX, now) == 2 * mb);
+    assert (s_credit_grant (third, &pool, false, UINT64_MAX, now) == 2 * mb);
+    assert (pool == 0);
+
+    slow->weight = 2;
+    third->weight = 3;
+    s_credit_share (peers, 3, 6 * mb, false, now);
+    assert (fast->share == mb && slow->share == 2 * mb && third->share == 3 * mb);
+
+    // A peer which reconnects keeps its weight
+    zhash_t *peer_credit = zhash_new ();
+    zhash_t *peer_rates = zhash_new ();
+    zhash_t *peer_weights = zhash_new ();
+    s_peer_setting_store (peer_weights, "0006", 3);
+    zsync_credit_t *credit = s_credit_require (peer_credit, peer_rates, peer_weights, "0006");
+    assert (credit->weight == 3);
+    zhash_delete (peer_credit, "0006");
+    credit = s_credit_require (peer_credit, peer_rates, peer_weights, "0006");
+    assert (credit->weight == 3);
+    credit = s_credit_require (peer_credit, peer_rates, peer_weights, "0005");
+    assert (credit->weight == 1);
+    zhash_destroy (&peer_weights);
+    zhash_destroy (&peer_rates);
+    zhash_destroy (&peer_credit);
+
+    // A peer which needs less leaves its credit to the others
+    zsync_credit_destroy (&fast);
+    zsync_credit_destroy (&slow);
+    zsync_credit_destroy (&third);
+    zsync_credit_t *small = s_test_peer ("0004", mb, 1);
+    slow = s_test_peer ("0005", 100 * mb, 1);
+    third = s_test_peer ("0006", 100 * mb, 1);
+    peers [0] = small; peers [1] = slow; peers [2] = third;
+    s_credit_share (peers, 3, 6 * mb, false, now);
+    assert (small->share == mb);
+    assert (slow->share == 5 * mb / 2 && third->share == 5 * mb / 2);
+
+    // An idle peer only keeps the credit it holds
+    third->credited_bytes = mb / 2;
+    third->active = now - CREDIT_IDLE - 1;
+    s_credit_share (peers, 3, 6 * mb, false, now);
+    assert (third->share == mb / 2);
+    assert (small->share == mb);
+    assert (slow->share == 6 * mb - mb - mb / 2);
+    assert (s_credit_grant (third, &pool, false, UINT64_MAX, now) == 0);
+
+    zsync_credit_destroy (&small);
+    zsync_credit_destroy (&slow);
+    zsync_credit_destroy (&third);
+
+    // A 100 MB/s link with 50 ms latency: ten chunks per round-trip cannot
+    // fill it, a window sized to the bandwidth-delay product can
+    uint64_t rate = 100000;
+    uint64_t fixed_rate = s_test_simulate (false, rate, 50, 3000);
+    uint64_t adaptive_rate = s_test_simulate (true, rate, 50, 3000);
+    assert (fixed_rate < rate / 10);
+    assert (adaptive_rate > rate * 8 / 10);
+
+    // With little latency the adaptive window still fills the link
+    fixed_rate = s_test_simulate (false, rate, 2, 1000);
+    adaptive_rate = s_test_simulate (true, rate, 2, 1000);
+    assert (fixed_rate > rate / 2);
+    assert (adaptive_rate > rate * 9 / 10);
+
     // Terminate
     zsync_credit_msg_send_terminate (pipe);
 
+    // With write backpressure received bytes return to the total credit
+    // once written, so at most the total credit is held in memory
+    zsync_t *zsync = zsync_new ();
+    zsync_set_write_backpressure (zsync, true);
+    pipe = zthread_fork (ctx, zsync_credit_manager_engine, zsync);
+    char *peer7 = "0007";
+    zsync_credit_msg_send_request (pipe, peer7, 1000 * mb, 10 * mb);
+    s_test_expect_credit (pipe, peer7, 100 * mb);
+    zsync_credit_msg_send_update (pipe, peer7, 100 * mb);
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+    zsync_credit_msg_send_persisted (pipe, 30 * mb);
+    s_test_expect_credit (pipe, peer7, 30 * mb);
+    zsync_credit_msg_send_update (pipe, peer7, 10 * mb);
+    zclock_sleep (100);
+    assert (zmsg_recv_nowait (pipe) == NULL);
+    zsync_credit_msg_send_persisted (pipe, 100 * mb);
+    s_test_expect_credit (pipe, peer7, 80 * mb);
+    // Without credit left the request is sent without credit
+    zsync_credit_msg_send_request_credit (pipe, "0009", 10 * mb, 10 * mb);
+    s_test_expect_initial_credit (pipe, "0009", 0);
+    zsync_credit_msg_send_terminate (pipe);
+
     // Cleanup
     zctx_destroy (&ctx);
+    zsync_destroy (&zsync);
 
     printf("OK\n");
 }
@@ -52,9 +52,14 @@ struct _zsync_credit_msg_t {
     byte *ceiling;              //  Valid upper limit for read pointer
     char *sender;               //  
     uint64_t req_bytes;         //  
+    uint64_t chunk_size;        //  Largest chunk the other peer may send
     uint64_t recv_bytes;        //  
     char *receiver;             //  
     zmsg_t *credit;             //  
+    uint32_t weight;            //  Share of the credit relative to other peers
+    uint64_t persisted_bytes;   //  Bytes written to disk
+    uint64_t initial_credit;    //  Credit to send along with the request, may be 0
+    uint64_t rate;              //  Bytes per second, 0 for unlimited
 };
 
 //  --------------------------------------------------------------------------
@@ -260,6 +265,7 @@ zsync_credit_msg_decode (zmsg_t *msg)
         case ZSYNC_CREDIT_MSG_REQUEST:
             GET_STRING (self->sender);
             GET_NUMBER8 (self->req_bytes);
+            GET_NUMBER8 (self->chunk_size);
             break;
 
         case ZSYNC_CREDIT_MSG_UPDATE:
@@ -280,11 +286,37 @@ zsync_credit_msg_decode (zmsg_t *msg)
             break;
 
         case ZSYNC_CREDIT_MSG_ABORT:
+            GET_STRING (self->sender);
             break;
 
         case ZSYNC_CREDIT_MSG_TERMINATE:
             break;
 
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            GET_STRING (self->sender);
+            GET_NUMBER4 (self->weight);
+            break;
+
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            GET_NUMBER8 (self->persisted_bytes);
+            break;
+
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            GET_STRING (self->sender);
+            GET_NUMBER8 (self->req_bytes);
+            GET_NUMBER8 (self->chunk_size);
+            break;
+
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            GET_STRING (self->receiver);
+            GET_NUMBER8 (self->initial_credit);
+            break;
+
+        case ZSYNC_CREDIT_MSG_RATE:
+            GET_STRING (self->sender);
+            GET_NUMBER8 (self->rate);
+            break;
+
         default:
             goto malformed;
     }
@@ -384,6 +416,8 @@ zsync_credit_msg_encode (zsync_credit_msg_t *self)
                 frame_size += strlen (self->sender);
             //  req_bytes is a 8-byte integer
             frame_size += 8;
+            //  chunk_size is a 8-byte integer
+            frame_size += 8;
             break;
             
         case ZSYNC_CREDIT_MSG_UPDATE:
@@ -403,11 +437,58 @@ zsync_credit_msg_encode (zsync_credit_msg_t *self)
             break;
             
         case ZSYNC_CREDIT_MSG_ABORT:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
             break;
             
         case ZSYNC_CREDIT_MSG_TERMINATE:
             break;
             
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  weight is a 4-byte integer
+            frame_size += 4;
+            break;
+            
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            //  persisted_bytes is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  req_bytes is a 8-byte integer
+            frame_size += 8;
+            //  chunk_size is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  initial_credit is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_CREDIT_MSG_RATE:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  rate is a 8-byte integer
+            frame_size += 8;
+            break;
+            
         default:
             printf ("E: bad message type '%d', not sent\n", self->id);
             //  No recovery, this is a fatal application error
@@ -427,6 +508,7 @@ zsync_credit_msg_encode (zsync_credit_msg_t *self)
             else
                 PUT_NUMBER1 (0);    //  Empty string
             PUT_NUMBER8 (self->req_bytes);
+            PUT_NUMBER8 (self->chunk_size);
             break;
 
         case ZSYNC_CREDIT_MSG_UPDATE:
@@ -447,11 +529,57 @@ zsync_credit_msg_encode (zsync_credit_msg_t *self)
             break;
 
         case ZSYNC_CREDIT_MSG_ABORT:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
             break;
 
         case ZSYNC_CREDIT_MSG_TERMINATE:
             break;
 
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER4 (self->weight);
+            break;
+
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            PUT_NUMBER8 (self->persisted_bytes);
+            break;
+
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->req_bytes);
+            PUT_NUMBER8 (self->chunk_size);
+            break;
+
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->initial_credit);
+            break;
+
+        case ZSYNC_CREDIT_MSG_RATE:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->rate);
+            break;
+
     }
     //  Now send the data frame
     if (zmsg_append (msg, &frame)) {
@@ -524,11 +652,13 @@ int
 zsync_credit_msg_send_request (
     void *output,
     char *sender,
-    uint64_t req_bytes)
+    uint64_t req_bytes,
+    uint64_t chunk_size)
 {
     zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_REQUEST);
     zsync_credit_msg_set_sender (self, sender);
     zsync_credit_msg_set_req_bytes (self, req_bytes);
+    zsync_credit_msg_set_chunk_size (self, chunk_size);
     return zsync_credit_msg_send (&self, output);
 }
 
@@ -570,9 +700,11 @@ zsync_credit_msg_send_give_credit (
 
 int
 zsync_credit_msg_send_abort (
-    void *output)
+    void *output,
+    char *sender)
 {
     zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_ABORT);
+    zsync_credit_msg_set_sender (self, sender);
     return zsync_credit_msg_send (&self, output);
 }
 
@@ -589,6 +721,86 @@ zsync_credit_msg_send_terminate (
 }
 
 
+//  --------------------------------------------------------------------------
+//  Send the WEIGHT to the socket in one step
+
+int
+zsync_credit_msg_send_weight (
+    void *output,
+    char *sender,
+    uint32_t weight)
+{
+    zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_WEIGHT);
+    zsync_credit_msg_set_sender (self, sender);
+    zsync_credit_msg_set_weight (self, weight);
+    return zsync_credit_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the PERSISTED to the socket in one step
+
+int
+zsync_credit_msg_send_persisted (
+    void *output,
+    uint64_t persisted_bytes)
+{
+    zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_PERSISTED);
+    zsync_credit_msg_set_persisted_bytes (self, persisted_bytes);
+    return zsync_credit_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the REQUEST_CREDIT to the socket in one step
+
+int
+zsync_credit_msg_send_request_credit (
+    void *output,
+    char *sender,
+    uint64_t req_bytes,
+    uint64_t chunk_size)
+{
+    zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_REQUEST_CREDIT);
+    zsync_credit_msg_set_sender (self, sender);
+    zsync_credit_msg_set_req_bytes (self, req_bytes);
+    zsync_credit_msg_set_chunk_size (self, chunk_size);
+    return zsync_credit_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the INITIAL_CREDIT to the socket in one step
+
+int
+zsync_credit_msg_send_initial_credit (
+    void *output,
+    char *receiver,
+    uint64_t initial_credit)
+{
+    zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_INITIAL_CREDIT);
+    zsync_credit_msg_set_receiver (self, receiver);
+    zsync_credit_msg_set_initial_credit (self, initial_credit);
+    return zsync_credit_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the RATE to the socket in one step
+
+int
+zsync_credit_msg_send_rate (
+    void *output,
+    char *sender,
+    uint64_t rate)
+{
+    zsync_credit_msg_t *self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_RATE);
+    zsync_credit_msg_set_sender (self, sender);
+    zsync_credit_msg_set_rate (self, rate);
+    return zsync_credit_msg_send (&self, output);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Duplicate the zsync_credit_msg message
 
@@ -606,6 +818,7 @@ zsync_credit_msg_dup (zsync_credit_msg_t *self)
         case ZSYNC_CREDIT_MSG_REQUEST:
             copy->sender = self->sender? strdup (self->sender): NULL;
             copy->req_bytes = self->req_bytes;
+            copy->chunk_size = self->chunk_size;
             break;
 
         case ZSYNC_CREDIT_MSG_UPDATE:
@@ -619,11 +832,37 @@ zsync_credit_msg_dup (zsync_credit_msg_t *self)
             break;
 
         case ZSYNC_CREDIT_MSG_ABORT:
+            copy->sender = self->sender? strdup (self->sender): NULL;
             break;
 
         case ZSYNC_CREDIT_MSG_TERMINATE:
             break;
 
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->weight = self->weight;
+            break;
+
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            copy->persisted_bytes = self->persisted_bytes;
+            break;
+
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->req_bytes = self->req_bytes;
+            copy->chunk_size = self->chunk_size;
+            break;
+
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->initial_credit = self->initial_credit;
+            break;
+
+        case ZSYNC_CREDIT_MSG_RATE:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->rate = self->rate;
+            break;
+
     }
     return copy;
 }
@@ -645,6 +884,7 @@ zsync_credit_msg_dump (zsync_credit_msg_t *self)
             else
                 printf ("    sender=\n");
             printf ("    req_bytes=%ld\n", (long) self->req_bytes);
+            printf ("    chunk_size=%ld\n", (long) self->chunk_size);
             break;
             
         case ZSYNC_CREDIT_MSG_UPDATE:
@@ -672,12 +912,58 @@ zsync_credit_msg_dump (zsync_credit_msg_t *self)
             
         case ZSYNC_CREDIT_MSG_ABORT:
             puts ("ABORT:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
             break;
             
         case ZSYNC_CREDIT_MSG_TERMINATE:
             puts ("TERMINATE:");
             break;
             
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            puts ("WEIGHT:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    weight=%ld\n", (long) self->weight);
+            break;
+            
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            puts ("PERSISTED:");
+            printf ("    persisted_bytes=%ld\n", (long) self->persisted_bytes);
+            break;
+            
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            puts ("REQUEST_CREDIT:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    req_bytes=%ld\n", (long) self->req_bytes);
+            printf ("    chunk_size=%ld\n", (long) self->chunk_size);
+            break;
+            
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            puts ("INITIAL_CREDIT:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            printf ("    initial_credit=%ld\n", (long) self->initial_credit);
+            break;
+            
+        case ZSYNC_CREDIT_MSG_RATE:
+            puts ("RATE:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    rate=%ld\n", (long) self->rate);
+            break;
+            
     }
 }
 
@@ -740,6 +1026,21 @@ zsync_credit_msg_command (zsync_credit_msg_t *self)
         case ZSYNC_CREDIT_MSG_TERMINATE:
             return ("TERMINATE");
             break;
+        case ZSYNC_CREDIT_MSG_WEIGHT:
+            return ("WEIGHT");
+            break;
+        case ZSYNC_CREDIT_MSG_PERSISTED:
+            return ("PERSISTED");
+            break;
+        case ZSYNC_CREDIT_MSG_REQUEST_CREDIT:
+            return ("REQUEST_CREDIT");
+            break;
+        case ZSYNC_CREDIT_MSG_INITIAL_CREDIT:
+            return ("INITIAL_CREDIT");
+            break;
+        case ZSYNC_CREDIT_MSG_RATE:
+            return ("RATE");
+            break;
     }
     return "?";
 }
@@ -785,6 +1086,24 @@ zsync_credit_msg_set_req_bytes (zsync_credit_msg_t *self, uint64_t req_bytes)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Get/set the chunk_size field
+
+uint64_t
+zsync_credit_msg_chunk_size (zsync_credit_msg_t *self)
+{
+    assert (self);
+    return self->chunk_size;
+}
+
+void
+zsync_credit_msg_set_chunk_size (zsync_credit_msg_t *self, uint64_t chunk_size)
+{
+    assert (self);
+    self->chunk_size = chunk_size;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Get/set the recv_bytes field
 
@@ -847,6 +1166,82 @@ zsync_credit_msg_set_credit (zsync_credit_msg_t *self, zmsg_t *msg)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Get/set the weight field
+
+uint32_t
+zsync_credit_msg_weight (zsync_credit_msg_t *self)
+{
+    assert (self);
+    return self->weight;
+}
+
+void
+zsync_credit_msg_set_weight (zsync_credit_msg_t *self, uint32_t weight)
+{
+    assert (self);
+    self->weight = weight;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the persisted_bytes field
+
+uint64_t
+zsync_credit_msg_persisted_bytes (zsync_credit_msg_t *self)
+{
+    assert (self);
+    return self->persisted_bytes;
+}
+
+void
+zsync_credit_msg_set_persisted_bytes (zsync_credit_msg_t *self, uint64_t persisted_bytes)
+{
+    assert (self);
+    self->persisted_bytes = persisted_bytes;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the initial_credit field
+
+uint64_t
+zsync_credit_msg_initial_credit (zsync_credit_msg_t *self)
+{
+    assert (self);
+    return self->initial_credit;
+}
+
+void
+zsync_credit_msg_set_initial_credit (zsync_credit_msg_t *self, uint64_t initial_credit)
+{
+    assert (self);
+    self->initial_credit = initial_credit;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the rate field
+
+uint64_t
+zsync_credit_msg_rate (zsync_credit_msg_t *self)
+{
+    assert (self);
+    return self->rate;
+}
+
+void
+zsync_credit_msg_set_rate (zsync_credit_msg_t *self, uint64_t rate)
+{
+    assert (self);
+    self->rate = rate;
+}
+
+
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -884,6 +1279,7 @@ zsync_credit_msg_test (bool verbose)
 
     zsync_credit_msg_set_sender (self, "Life is short but Now lasts for ever");
     zsync_credit_msg_set_req_bytes (self, 123);
+    zsync_credit_msg_set_chunk_size (self, 123);
     //  Send twice from same object
     zsync_credit_msg_send_again (self, output);
     zsync_credit_msg_send (&self, output);
@@ -900,6 +1296,7 @@ zsync_credit_msg_test (bool verbose)
         
         assert (streq (zsync_credit_msg_sender (self), "Life is short but Now lasts for ever"));
         assert (zsync_credit_msg_req_bytes (self) == 123);
+        assert (zsync_credit_msg_chunk_size (self) == 123);
         zsync_credit_msg_destroy (&self);
     }
     self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_UPDATE);
@@ -964,6 +1361,7 @@ zsync_credit_msg_test (bool verbose)
     assert (copy);
     zsync_credit_msg_destroy (&copy);
 
+    zsync_credit_msg_set_sender (self, "Life is short but Now lasts for ever");
     //  Send twice from same object
     zsync_credit_msg_send_again (self, output);
     zsync_credit_msg_send (&self, output);
@@ -978,6 +1376,7 @@ zsync_credit_msg_test (bool verbose)
         }
         assert (self);
         
+        assert (streq (zsync_credit_msg_sender (self), "Life is short but Now lasts for ever"));
         zsync_credit_msg_destroy (&self);
     }
     self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_TERMINATE);
@@ -1003,6 +1402,141 @@ zsync_credit_msg_test (bool verbose)
         
         zsync_credit_msg_destroy (&self);
     }
+    self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_WEIGHT);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_credit_msg_dup (self);
+    assert (copy);
+    zsync_credit_msg_destroy (&copy);
+
+    zsync_credit_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_credit_msg_set_weight (self, 123);
+    //  Send twice from same object
+    zsync_credit_msg_send_again (self, output);
+    zsync_credit_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_credit_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_credit_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_credit_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zsync_credit_msg_weight (self) == 123);
+        zsync_credit_msg_destroy (&self);
+    }
+    self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_PERSISTED);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_credit_msg_dup (self);
+    assert (copy);
+    zsync_credit_msg_destroy (&copy);
+
+    zsync_credit_msg_set_persisted_bytes (self, 123);
+    //  Send twice from same object
+    zsync_credit_msg_send_again (self, output);
+    zsync_credit_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_credit_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_credit_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (zsync_credit_msg_persisted_bytes (self) == 123);
+        zsync_credit_msg_destroy (&self);
+    }
+    self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_REQUEST_CREDIT);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_credit_msg_dup (self);
+    assert (copy);
+    zsync_credit_msg_destroy (&copy);
+
+    zsync_credit_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_credit_msg_set_req_bytes (self, 123);
+    zsync_credit_msg_set_chunk_size (self, 123);
+    //  Send twice from same object
+    zsync_credit_msg_send_again (self, output);
+    zsync_credit_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_credit_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_credit_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_credit_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zsync_credit_msg_req_bytes (self) == 123);
+        assert (zsync_credit_msg_chunk_size (self) == 123);
+        zsync_credit_msg_destroy (&self);
+    }
+    self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_INITIAL_CREDIT);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_credit_msg_dup (self);
+    assert (copy);
+    zsync_credit_msg_destroy (&copy);
+
+    zsync_credit_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_credit_msg_set_initial_credit (self, 123);
+    //  Send twice from same object
+    zsync_credit_msg_send_again (self, output);
+    zsync_credit_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_credit_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_credit_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_credit_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (zsync_credit_msg_initial_credit (self) == 123);
+        zsync_credit_msg_destroy (&self);
+    }
+    self = zsync_credit_msg_new (ZSYNC_CREDIT_MSG_RATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_credit_msg_dup (self);
+    assert (copy);
+    zsync_credit_msg_destroy (&copy);
+
+    zsync_credit_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_credit_msg_set_rate (self, 123);
+    //  Send twice from same object
+    zsync_credit_msg_send_again (self, output);
+    zsync_credit_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_credit_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_credit_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_credit_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zsync_credit_msg_rate (self) == 123);
+        zsync_credit_msg_destroy (&self);
+    }
 
     zctx_destroy (&ctx);
     //  @end
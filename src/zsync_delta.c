@@ -0,0 +1,687 @@
+/* =========================================================================
+    zsync_delta - block level delta encoding
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync block level delta encoding
+
+@discuss
+    Delta transfer in the style of rsync. The requester splits its copy of
+    a file into blocks and sends a signature of every block: a rolling
+    weak checksum and the XXH64 of the block. The sending peer slides a
+    window over the new file, looks the weak checksum of every position
+    up in a hash table and confirms candidates by XXH64. Matching blocks
+    are sent as copy instructions, everything else as literal bytes.
+
+    Signature frame:
+        block size      4 bytes
+        file size       8 bytes
+        block count     8 bytes
+        per block       weak checksum 4 bytes, XXH64 8 bytes
+
+    Delta frame:
+        block size      4 bytes
+        instructions    COPY: 0x01, first block 8 bytes, block count 4 bytes
+                        LITERAL: 0x02, length 4 bytes, data
+
+    All numbers are in network byte order. The encoder works on a stream
+    so that the chunks read by the agent can be encoded as they arrive.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define DELTA_COPY 0x01
+#define DELTA_LITERAL 0x02
+
+#define SIGNATURE_HEADER_SIZE 20
+#define SIGNATURE_BLOCK_SIZE 12
+
+#define BLOCK_SIZE_MIN 1024
+#define BLOCK_SIZE_MAX (128 * 1024)
+
+struct _zsync_delta_t {
+    uint32_t block_size;
+    size_t blocks;              // blocks of the requester's copy
+    uint32_t *weak;             // weak checksum per block
+    uint64_t *strong;           // XXH64 per block
+    uint32_t *buckets;          // first block + 1 per hash bucket
+    uint32_t *chain;            // next block + 1 in the same bucket
+    int bucket_bits;
+    byte *buffer;               // input that is not resolved yet
+    size_t buffer_size;
+    size_t buffer_max;
+    byte *ops;                  // instructions of the current frame
+    size_t ops_size;
+    size_t ops_max;
+    uint64_t copy_block;        // run of copied blocks not yet written
+    uint32_t copy_count;
+    uint64_t consumed;          // bytes fed
+    uint64_t offset;            // bytes described by the instructions
+    uint64_t literal_bytes;     // bytes sent as literals
+};
+
+
+// --------------------------------------------------------------------------
+// Byte order helpers
+
+static void
+s_put32 (byte *needle, uint32_t value)
+{
+    needle [0] = (byte) (value >> 24);
+    needle [1] = (byte) (value >> 16);
+    needle [2] = (byte) (value >> 8);
+    needle [3] = (byte) value;
+}
+
+static void
+s_put64 (byte *needle, uint64_t value)
+{
+    s_put32 (needle, (uint32_t) (value >> 32));
+    s_put32 (needle + 4, (uint32_t) value);
+}
+
+static uint32_t
+s_get32 (byte *needle)
+{
+    return (uint32_t) needle [0] << 24 | (uint32_t) needle [1] << 16
+         | (uint32_t) needle [2] << 8 | (uint32_t) needle [3];
+}
+
+static uint64_t
+s_get64 (byte *needle)
+{
+    return (uint64_t) s_get32 (needle) << 32 | s_get32 (needle + 4);
+}
+
+
+// --------------------------------------------------------------------------
+// Rolling checksum, two 16 bit sums as in rsync
+
+static void
+s_weak_init (byte *data, uint32_t size, uint32_t *a_p, uint32_t *b_p)
+{
+    uint32_t a = 0, b = 0;
+    uint32_t index;
+    for (index = 0; index < size; index++) {
+        a += data [index];
+        b += (size - index) * data [index];
+    }
+    *a_p = a & 0xffff;
+    *b_p = b & 0xffff;
+}
+
+static inline uint32_t
+s_bucket (uint32_t weak, int bits)
+{
+    return (weak * 0x9E3779B1u) >> (32 - bits);
+}
+
+static ssize_t
+s_read_full (int fd, byte *buffer, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rc = pread (fd, buffer + done, size - done, offset + done);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return -1;
+        if (rc == 0)
+            break;
+        done += rc;
+    }
+    return done;
+}
+
+static int
+s_write_full (int fd, byte *buffer, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rc = pwrite (fd, buffer + done, size - done, offset + done);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        done += rc;
+    }
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Computes the block signatures of the file at path, which the sending
+// peer uses to find the blocks the requester already has. If block_size
+// is 0 it is chosen from the file size. Returns NULL if the file could
+// not be read.
+
+zframe_t *
+zsync_delta_signature (const char *path, uint32_t block_size)
+{
+    assert (path);
+    int fd = open (path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat (fd, &st) != 0) {
+        close (fd);
+        return NULL;
+    }
+    uint64_t file_size = st.st_size;
+    if (block_size == 0) {
+        // Square root of the file size balances signature and literal sizes
+        block_size = BLOCK_SIZE_MIN;
+        while ((uint64_t) block_size * block_size < file_size && block_size < BLOCK_SIZE_MAX)
+            block_size *= 2;
+        if (block_size < BLOCK_SIZE_MIN)
+            block_size = BLOCK_SIZE_MIN;
+        if (block_size > BLOCK_SIZE_MAX)
+            block_size = BLOCK_SIZE_MAX;
+    }
+    // Only full blocks are signed, a short last block is sent as literal
+    uint64_t blocks = file_size / block_size;
+    zframe_t *frame = zframe_new (NULL, SIGNATURE_HEADER_SIZE + blocks * SIGNATURE_BLOCK_SIZE);
+    byte *needle = zframe_data (frame);
+    s_put32 (needle, block_size);
+    s_put64 (needle + 4, file_size);
+    s_put64 (needle + 12, blocks);
+    needle += SIGNATURE_HEADER_SIZE;
+
+    byte *buffer = (byte *) malloc (block_size);
+    assert (buffer);
+    uint64_t block;
+    for (block = 0; block < blocks; block++) {
+        if (s_read_full (fd, buffer, block_size, block * block_size) != block_size) {
+            zframe_destroy (&frame);
+            break;
+        }
+        uint32_t a, b;
+        s_weak_init (buffer, block_size, &a, &b);
+        s_put32 (needle, a | b << 16);
+        s_put64 (needle + 4, zsync_hash_xxh64 (buffer, block_size, 0));
+        needle += SIGNATURE_BLOCK_SIZE;
+    }
+    free (buffer);
+    close (fd);
+    return frame;
+}
+
+
+// --------------------------------------------------------------------------
+// Constructs a delta encoder from the signatures of the requester's copy
+
+zsync_delta_t *
+zsync_delta_new (zframe_t *signature)
+{
+    assert (signature);
+    byte *needle = zframe_data (signature);
+    size_t size = zframe_size (signature);
+    if (size < SIGNATURE_HEADER_SIZE)
+        return NULL;
+    uint32_t block_size = s_get32 (needle);
+    uint64_t blocks = s_get64 (needle + 12);
+    if (block_size == 0 || blocks > UINT32_MAX - 1
+    ||  size != SIGNATURE_HEADER_SIZE + blocks * SIGNATURE_BLOCK_SIZE)
+        return NULL;
+    needle += SIGNATURE_HEADER_SIZE;
+
+    zsync_delta_t *self = (zsync_delta_t *) zmalloc (sizeof (zsync_delta_t));
+    self->block_size = block_size;
+    self->blocks = blocks;
+    self->bucket_bits = 4;
+    while (((size_t) 1 << self->bucket_bits) < blocks * 2)
+        self->bucket_bits++;
+    self->weak = (uint32_t *) malloc (sizeof (uint32_t) * (blocks + 1));
+    self->strong = (uint64_t *) malloc (sizeof (uint64_t) * (blocks + 1));
+    self->chain = (uint32_t *) zmalloc (sizeof (uint32_t) * (blocks + 1));
+    self->buckets = (uint32_t *) zmalloc (sizeof (uint32_t) << self->bucket_bits);
+    assert (self->weak && self->strong && self->chain && self->buckets);
+
+    // Insert in reverse so every chain starts with the lowest block
+    size_t block;
+    for (block = 0; block < blocks; block++) {
+        self->weak [block] = s_get32 (needle + block * SIGNATURE_BLOCK_SIZE);
+        self->strong [block] = s_get64 (needle + block * SIGNATURE_BLOCK_SIZE + 4);
+    }
+    for (block = blocks; block > 0; block--) {
+        uint32_t bucket = s_bucket (self->weak [block - 1], self->bucket_bits);
+        self->chain [block - 1] = self->buckets [bucket];
+        self->buckets [bucket] = (uint32_t) block;
+    }
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destroys the delta encoder
+
+void
+zsync_delta_destroy (zsync_delta_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_delta_t *self = *self_p;
+        free (self->weak);
+        free (self->strong);
+        free (self->chain);
+        free (self->buckets);
+        free (self->buffer);
+        free (self->ops);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Instruction output
+
+static byte *
+s_ops_reserve (zsync_delta_t *self, size_t size)
+{
+    if (self->ops_size + size > self->ops_max) {
+        self->ops_max = (self->ops_size + size) * 2;
+        self->ops = (byte *) realloc (self->ops, self->ops_max);
+        assert (self->ops);
+    }
+    byte *needle = self->ops + self->ops_size;
+    self->ops_size += size;
+    return needle;
+}
+
+static void
+s_flush_copy (zsync_delta_t *self)
+{
+    if (self->copy_count == 0)
+        return;
+    byte *needle = s_ops_reserve (self, 13);
+    needle [0] = DELTA_COPY;
+    s_put64 (needle + 1, self->copy_block);
+    s_put32 (needle + 9, self->copy_count);
+    self->offset += (uint64_t) self->copy_count * self->block_size;
+    self->copy_count = 0;
+}
+
+static void
+s_emit_copy (zsync_delta_t *self, uint64_t block)
+{
+    if (self->copy_count > 0 && self->copy_block + self->copy_count == block)
+        self->copy_count++;
+    else {
+        s_flush_copy (self);
+        self->copy_block = block;
+        self->copy_count = 1;
+    }
+}
+
+static void
+s_emit_literal (zsync_delta_t *self, byte *data, size_t size)
+{
+    if (size == 0)
+        return;
+    s_flush_copy (self);
+    byte *needle = s_ops_reserve (self, 5 + size);
+    needle [0] = DELTA_LITERAL;
+    s_put32 (needle + 1, (uint32_t) size);
+    memcpy (needle + 5, data, size);
+    self->offset += size;
+    self->literal_bytes += size;
+}
+
+// Returns the block matching data or -1. The block following the current
+// run of copied blocks is tried first, so runs are not split up.
+static int64_t
+s_lookup (zsync_delta_t *self, uint32_t weak, byte *data)
+{
+    uint64_t strong = 0;
+    bool have_strong = false;
+    if (self->copy_count > 0) {
+        uint64_t next = self->copy_block + self->copy_count;
+        if (next < self->blocks && self->weak [next] == weak) {
+            strong = zsync_hash_xxh64 (data, self->block_size, 0);
+            have_strong = true;
+            if (self->strong [next] == strong)
+                return next;
+        }
+    }
+    uint32_t entry = self->buckets [s_bucket (weak, self->bucket_bits)];
+    while (entry) {
+        uint32_t block = entry - 1;
+        if (self->weak [block] == weak) {
+            if (!have_strong) {
+                strong = zsync_hash_xxh64 (data, self->block_size, 0);
+                have_strong = true;
+            }
+            if (self->strong [block] == strong)
+                return block;
+        }
+        entry = self->chain [block];
+    }
+    return -1;
+}
+
+
+// --------------------------------------------------------------------------
+// Encodes the next size bytes of the new file. Returns a frame of copy
+// and literal instructions for the part of the input that has been
+// resolved, bytes that might still start a matching block are held back
+// until more data or the last part arrives.
+
+zframe_t *
+zsync_delta_feed (zsync_delta_t *self, byte *data, size_t size, bool last)
+{
+    assert (self);
+    if (self->buffer_size + size > self->buffer_max) {
+        self->buffer_max = self->buffer_size + size;
+        self->buffer = (byte *) realloc (self->buffer, self->buffer_max);
+        assert (self->buffer);
+    }
+    if (size)
+        memcpy (self->buffer + self->buffer_size, data, size);
+    self->buffer_size += size;
+    self->consumed += size;
+
+    self->ops_size = 0;
+    s_put32 (s_ops_reserve (self, 4), self->block_size);
+
+    byte *buffer = self->buffer;
+    uint32_t block_size = self->block_size;
+    size_t pos = 0, literal = 0;
+    uint32_t a = 0, b = 0;
+    bool rolling = false;
+    while (self->blocks && pos + block_size <= self->buffer_size) {
+        if (!rolling) {
+            s_weak_init (buffer + pos, block_size, &a, &b);
+            rolling = true;
+        }
+        int64_t block = s_lookup (self, a | b << 16, buffer + pos);
+        if (block >= 0) {
+            s_emit_literal (self, buffer + literal, pos - literal);
+            s_emit_copy (self, block);
+            pos += block_size;
+            literal = pos;
+            rolling = false;
+        }
+        else {
+            if (pos + block_size < self->buffer_size) {
+                uint32_t out = buffer [pos];
+                uint32_t in = buffer [pos + block_size];
+                a = (a - out + in) & 0xffff;
+                b = (b - block_size * out + a) & 0xffff;
+            }
+            pos++;
+        }
+    }
+    // Without more input the rest can't match a block anymore
+    if (last || !self->blocks)
+        pos = self->buffer_size;
+    s_emit_literal (self, buffer + literal, pos - literal);
+    s_flush_copy (self);
+    memmove (buffer, buffer + pos, self->buffer_size - pos);
+    self->buffer_size -= pos;
+
+    return zframe_new (self->ops, self->ops_size);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes of the new file that were fed so far
+
+uint64_t
+zsync_delta_consumed (zsync_delta_t *self)
+{
+    assert (self);
+    return self->consumed;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the offset in the new file at which the next frame of
+// instructions starts
+
+uint64_t
+zsync_delta_offset (zsync_delta_t *self)
+{
+    assert (self);
+    return self->offset;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes sent as literals so far
+
+uint64_t
+zsync_delta_literal_bytes (zsync_delta_t *self)
+{
+    assert (self);
+    return self->literal_bytes;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of bytes of the new file a frame of instructions
+// describes, or -1 if the frame is malformed
+
+int64_t
+zsync_delta_target_size (zframe_t *delta)
+{
+    assert (delta);
+    byte *needle = zframe_data (delta);
+    byte *limit = needle + zframe_size (delta);
+    if (limit - needle < 4)
+        return -1;
+    uint32_t block_size = s_get32 (needle);
+    needle += 4;
+    int64_t size = 0;
+    while (needle < limit) {
+        if (*needle == DELTA_COPY && limit - needle >= 13) {
+            size += (int64_t) s_get32 (needle + 9) * block_size;
+            needle += 13;
+        }
+        else
+        if (*needle == DELTA_LITERAL && limit - needle >= 5
+        &&  (uint64_t) (limit - needle - 5) >= s_get32 (needle + 1)) {
+            size += s_get32 (needle + 1);
+            needle += 5 + s_get32 (needle + 1);
+        }
+        else
+            return -1;
+    }
+    return size;
+}
+
+
+// --------------------------------------------------------------------------
+// Applies a frame of instructions to target_path at offset, copying
+// blocks from basis_path. Target and basis must be different files.
+// Returns 0 on success, -1 on failure.
+
+int
+zsync_delta_apply (zframe_t *delta, const char *basis_path,
+    const char *target_path, uint64_t offset)
+{
+    assert (delta);
+    assert (target_path);
+    if (zsync_delta_target_size (delta) < 0)
+        return -1;
+    byte *needle = zframe_data (delta);
+    byte *limit = needle + zframe_size (delta);
+    uint32_t block_size = s_get32 (needle);
+    needle += 4;
+
+    int target = open (target_path, O_WRONLY | O_CREAT, 0644);
+    if (target == -1)
+        return -1;
+    int basis = -1;
+    byte *buffer = NULL;
+    int rc = 0;
+    while (needle < limit && rc == 0) {
+        if (*needle == DELTA_COPY) {
+            uint64_t block = s_get64 (needle + 1);
+            uint32_t count = s_get32 (needle + 9);
+            needle += 13;
+            if (basis == -1) {
+                basis = basis_path? open (basis_path, O_RDONLY): -1;
+                buffer = (byte *) malloc (block_size);
+                if (basis == -1 || !buffer) {
+                    rc = -1;
+                    break;
+                }
+            }
+            while (count-- && rc == 0) {
+                if (s_read_full (basis, buffer, block_size, block * block_size) != block_size
+                ||  s_write_full (target, buffer, block_size, offset) != 0)
+                    rc = -1;
+                block++;
+                offset += block_size;
+            }
+        }
+        else {
+            uint32_t size = s_get32 (needle + 1);
+            if (s_write_full (target, needle + 5, size, offset) != 0)
+                rc = -1;
+            needle += 5 + size;
+            offset += size;
+        }
+    }
+    if (basis != -1)
+        close (basis);
+    free (buffer);
+    close (target);
+    return rc;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_BASIS ".zsync_delta_basis"
+#define TEST_TARGET ".zsync_delta_target"
+#define TEST_SIZE 200000
+#define TEST_BLOCK_SIZE 1024
+#define TEST_CHUNK_SIZE 30000
+
+static void
+s_test_write (char *path, byte *data, size_t size)
+{
+    FILE *file = fopen (path, "wb");
+    assert (file);
+    fwrite (data, 1, size, file);
+    fclose (file);
+}
+
+// Encodes data against the signature in chunks, applies the result and
+// compares it. Returns the bytes sent as literals.
+static uint64_t
+s_test_roundtrip (zframe_t *signature, byte *data, size_t size)
+{
+    zsync_delta_t *delta = zsync_delta_new (signature);
+    assert (delta);
+    zsys_file_delete (TEST_TARGET);
+    size_t offset = 0;
+    do {
+        size_t chunk = size - offset < TEST_CHUNK_SIZE? size - offset: TEST_CHUNK_SIZE;
+        uint64_t target_offset = zsync_delta_offset (delta);
+        zframe_t *ops = zsync_delta_feed (delta, data + offset, chunk, offset + chunk == size);
+        offset += chunk;
+        assert (zsync_delta_target_size (ops) == (int64_t) (zsync_delta_offset (delta) - target_offset));
+        int rc = zsync_delta_apply (ops, TEST_BASIS, TEST_TARGET, target_offset);
+        assert (rc == 0);
+        zframe_destroy (&ops);
+    } while (offset < size);
+    assert (zsync_delta_consumed (delta) == size);
+    assert (zsync_delta_offset (delta) == size);
+    uint64_t literal_bytes = zsync_delta_literal_bytes (delta);
+    zsync_delta_destroy (&delta);
+
+    assert (zsys_file_size (TEST_TARGET) == (ssize_t) size);
+    byte *result = (byte *) malloc (size + 1);
+    FILE *file = fopen (TEST_TARGET, "rb");
+    assert (fread (result, 1, size, file) == size);
+    fclose (file);
+    assert (memcmp (result, data, size) == 0);
+    free (result);
+    return literal_bytes;
+}
+
+void
+zsync_delta_test ()
+{
+    printf (" * zsync_delta: ");
+    byte *basis = (byte *) malloc (TEST_SIZE);
+    uint32_t seed = 42;
+    size_t index;
+    for (index = 0; index < TEST_SIZE; index++) {
+        seed = seed * 1103515245 + 12345;
+        basis [index] = (byte) (seed >> 16);
+    }
+    s_test_write (TEST_BASIS, basis, TEST_SIZE);
+    zframe_t *signature = zsync_delta_signature (TEST_BASIS, TEST_BLOCK_SIZE);
+    assert (signature);
+    assert (zframe_size (signature) == SIGNATURE_HEADER_SIZE
+        + (TEST_SIZE / TEST_BLOCK_SIZE) * SIGNATURE_BLOCK_SIZE);
+
+    // An unchanged file is sent as copies and its short tail
+    uint64_t literal_bytes = s_test_roundtrip (signature, basis, TEST_SIZE);
+    assert (literal_bytes == TEST_SIZE % TEST_BLOCK_SIZE);
+
+    // Insert, modify, delete and append
+    byte *target = (byte *) malloc (TEST_SIZE * 2);
+    size_t size = 0;
+    memcpy (target, basis, 5000);
+    size += 5000;
+    memset (target + size, 'i', 100);
+    size += 100;
+    memcpy (target + size, basis + 5000, 115000);
+    size += 115000;
+    memset (target + 50100, 'm', 10);
+    memcpy (target + size, basis + 123000, TEST_SIZE - 123000);
+    size += TEST_SIZE - 123000;
+    memset (target + size, 'a', 777);
+    size += 777;
+    literal_bytes = s_test_roundtrip (signature, target, size);
+    assert (literal_bytes < 8 * TEST_BLOCK_SIZE);
+
+    // Without a usable basis everything is a literal
+    zframe_t *empty = zframe_new (NULL, SIGNATURE_HEADER_SIZE);
+    memset (zframe_data (empty), 0, SIGNATURE_HEADER_SIZE);
+    s_put32 (zframe_data (empty), TEST_BLOCK_SIZE);
+    literal_bytes = s_test_roundtrip (empty, target, size);
+    assert (literal_bytes == size);
+    zframe_destroy (&empty);
+
+    // Malformed input is rejected
+    zframe_t *malformed = zframe_new ("abc", 3);
+    assert (zsync_delta_new (malformed) == NULL);
+    assert (zsync_delta_target_size (malformed) == -1);
+    zframe_destroy (&malformed);
+
+    zframe_destroy (&signature);
+    free (target);
+    free (basis);
+    zsys_file_delete (TEST_BASIS);
+    zsys_file_delete (TEST_TARGET);
+    printf ("OK\n");
+}
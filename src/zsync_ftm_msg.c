@@ -52,12 +52,18 @@ struct _zsync_ftm_msg_t {
     byte *ceiling;              //  Valid upper limit for read pointer
     char *sender;               //  UUID that identifies the sender
     zlist_t *paths;             //  
+    uint64_t max_chunk_size;    //  Size chunks may grow to in bytes
+    byte priority;              //  Priority of the files, higher is sent first
+    zframe_t *sizes;            //  Sizes of the files as 8-byte host integers, 0 if unknown
     uint64_t credit;            //  
     char *receiver;             //  UUID that identifies the receiver
     char *path;                 //  Path of file that the 'chunk' belongs to
     uint64_t sequence;          //  
     uint64_t chunk_size;        //  Size of the requested chunk in bytes
     uint64_t offset;            //  File offset for for the chunk in bytes
+    uint32_t weight;            //  Share of the bandwidth relative to other peers
+    zframe_t *ranges;           //  Byte ranges of the file to transfer
+    uint64_t rate;              //  Bytes per second, 0 for unlimited
 };
 
 //  --------------------------------------------------------------------------
@@ -225,6 +231,8 @@ zsync_ftm_msg_destroy (zsync_ftm_msg_t **self_p)
             zlist_destroy (&self->paths);
         free (self->receiver);
         free (self->path);
+        zframe_destroy (&self->sizes);
+        zframe_destroy (&self->ranges);
 
         //  Free object itself
         free (self);
@@ -276,6 +284,16 @@ zsync_ftm_msg_decode (zmsg_t *msg)
                     free (string);
                 }
             }
+            GET_NUMBER8 (self->chunk_size);
+            GET_NUMBER8 (self->max_chunk_size);
+            GET_NUMBER1 (self->priority);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *sizes = zmsg_pop (msg);
+                if (!sizes)
+                    goto malformed;
+                self->sizes = sizes;
+            }
             break;
 
         case ZSYNC_FTM_MSG_CREDIT:
@@ -299,6 +317,29 @@ zsync_ftm_msg_decode (zmsg_t *msg)
         case ZSYNC_FTM_MSG_TERMINATE:
             break;
 
+        case ZSYNC_FTM_MSG_WEIGHT:
+            GET_STRING (self->sender);
+            GET_NUMBER4 (self->weight);
+            break;
+
+        case ZSYNC_FTM_MSG_RANGES:
+            GET_STRING (self->sender);
+            GET_STRING (self->path);
+            GET_NUMBER1 (self->priority);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *ranges = zmsg_pop (msg);
+                if (!ranges)
+                    goto malformed;
+                self->ranges = ranges;
+            }
+            break;
+
+        case ZSYNC_FTM_MSG_RATE:
+            GET_STRING (self->sender);
+            GET_NUMBER8 (self->rate);
+            break;
+
         default:
             goto malformed;
     }
@@ -406,6 +447,12 @@ zsync_ftm_msg_encode (zsync_ftm_msg_t *self)
                     paths = (char *) zlist_next (self->paths);
                 }
             }
+            //  chunk_size is a 8-byte integer
+            frame_size += 8;
+            //  max_chunk_size is a 8-byte integer
+            frame_size += 8;
+            //  priority is a 1-byte integer
+            frame_size += 1;
             break;
             
         case ZSYNC_FTM_MSG_CREDIT:
@@ -448,6 +495,37 @@ zsync_ftm_msg_encode (zsync_ftm_msg_t *self)
         case ZSYNC_FTM_MSG_TERMINATE:
             break;
             
+        case ZSYNC_FTM_MSG_WEIGHT:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  weight is a 4-byte integer
+            frame_size += 4;
+            break;
+            
+        case ZSYNC_FTM_MSG_RANGES:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  priority is a 1-byte integer
+            frame_size += 1;
+            break;
+            
+        case ZSYNC_FTM_MSG_RATE:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            //  rate is a 8-byte integer
+            frame_size += 8;
+            break;
+            
         default:
             printf ("E: bad message type '%d', not sent\n", self->id);
             //  No recovery, this is a fatal application error
@@ -476,6 +554,9 @@ zsync_ftm_msg_encode (zsync_ftm_msg_t *self)
             }
             else
                 PUT_NUMBER4 (0);    //  Empty string array
+            PUT_NUMBER8 (self->chunk_size);
+            PUT_NUMBER8 (self->max_chunk_size);
+            PUT_NUMBER1 (self->priority);
             break;
 
         case ZSYNC_FTM_MSG_CREDIT:
@@ -519,6 +600,38 @@ zsync_ftm_msg_encode (zsync_ftm_msg_t *self)
         case ZSYNC_FTM_MSG_TERMINATE:
             break;
 
+        case ZSYNC_FTM_MSG_WEIGHT:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER4 (self->weight);
+            break;
+
+        case ZSYNC_FTM_MSG_RANGES:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER1 (self->priority);
+            break;
+
+        case ZSYNC_FTM_MSG_RATE:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->rate);
+            break;
+
     }
     //  Now send the data frame
     if (zmsg_append (msg, &frame)) {
@@ -526,6 +639,28 @@ zsync_ftm_msg_encode (zsync_ftm_msg_t *self)
         zsync_ftm_msg_destroy (&self);
         return NULL;
     }
+    //  Now send any frame fields, in order
+    if (self->id == ZSYNC_FTM_MSG_REQUEST) {
+        //  If sizes isn't set, send an empty frame
+        if (!self->sizes)
+            self->sizes = zframe_new (NULL, 0);
+        if (zmsg_append (msg, &self->sizes)) {
+            zmsg_destroy (&msg);
+            zsync_ftm_msg_destroy (&self);
+            return NULL;
+        }
+    }
+    //  Now send any frame fields, in order
+    if (self->id == ZSYNC_FTM_MSG_RANGES) {
+        //  If ranges isn't set, send an empty frame
+        if (!self->ranges)
+            self->ranges = zframe_new (NULL, 0);
+        if (zmsg_append (msg, &self->ranges)) {
+            zmsg_destroy (&msg);
+            zsync_ftm_msg_destroy (&self);
+            return NULL;
+        }
+    }
     //  Destroy zsync_ftm_msg object
     zsync_ftm_msg_destroy (&self);
     return msg;
@@ -583,11 +718,19 @@ int
 zsync_ftm_msg_send_request (
     void *output,
     char *sender,
-    zlist_t *paths)
+    zlist_t *paths,
+    uint64_t chunk_size,
+    uint64_t max_chunk_size,
+    byte priority,
+    zframe_t *sizes)
 {
     zsync_ftm_msg_t *self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_REQUEST);
     zsync_ftm_msg_set_sender (self, sender);
     zsync_ftm_msg_set_paths (self, zlist_dup (paths));
+    zsync_ftm_msg_set_chunk_size (self, chunk_size);
+    zsync_ftm_msg_set_max_chunk_size (self, max_chunk_size);
+    zsync_ftm_msg_set_priority (self, priority);
+    zsync_ftm_msg_set_sizes (self, sizes? zframe_dup (sizes): NULL);
     return zsync_ftm_msg_send (&self, output);
 }
 
@@ -658,6 +801,58 @@ zsync_ftm_msg_send_terminate (
 }
 
 
+//  --------------------------------------------------------------------------
+//  Send the WEIGHT to the socket in one step
+
+int
+zsync_ftm_msg_send_weight (
+    void *output,
+    char *sender,
+    uint32_t weight)
+{
+    zsync_ftm_msg_t *self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_WEIGHT);
+    zsync_ftm_msg_set_sender (self, sender);
+    zsync_ftm_msg_set_weight (self, weight);
+    return zsync_ftm_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the RANGES to the socket in one step
+
+int
+zsync_ftm_msg_send_ranges (
+    void *output,
+    char *sender,
+    char *path,
+    byte priority,
+    zframe_t *ranges)
+{
+    zsync_ftm_msg_t *self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_RANGES);
+    zsync_ftm_msg_set_sender (self, sender);
+    zsync_ftm_msg_set_path (self, path);
+    zsync_ftm_msg_set_priority (self, priority);
+    zsync_ftm_msg_set_ranges (self, zframe_dup (ranges));
+    return zsync_ftm_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the RATE to the socket in one step
+
+int
+zsync_ftm_msg_send_rate (
+    void *output,
+    char *sender,
+    uint64_t rate)
+{
+    zsync_ftm_msg_t *self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_RATE);
+    zsync_ftm_msg_set_sender (self, sender);
+    zsync_ftm_msg_set_rate (self, rate);
+    return zsync_ftm_msg_send (&self, output);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Duplicate the zsync_ftm_msg message
 
@@ -675,6 +870,10 @@ zsync_ftm_msg_dup (zsync_ftm_msg_t *self)
         case ZSYNC_FTM_MSG_REQUEST:
             copy->sender = self->sender? strdup (self->sender): NULL;
             copy->paths = self->paths? zlist_dup (self->paths): NULL;
+            copy->chunk_size = self->chunk_size;
+            copy->max_chunk_size = self->max_chunk_size;
+            copy->priority = self->priority;
+            copy->sizes = self->sizes? zframe_dup (self->sizes): NULL;
             break;
 
         case ZSYNC_FTM_MSG_CREDIT:
@@ -698,6 +897,23 @@ zsync_ftm_msg_dup (zsync_ftm_msg_t *self)
         case ZSYNC_FTM_MSG_TERMINATE:
             break;
 
+        case ZSYNC_FTM_MSG_WEIGHT:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->weight = self->weight;
+            break;
+
+        case ZSYNC_FTM_MSG_RANGES:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->priority = self->priority;
+            copy->ranges = self->ranges? zframe_dup (self->ranges): NULL;
+            break;
+
+        case ZSYNC_FTM_MSG_RATE:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->rate = self->rate;
+            break;
+
     }
     return copy;
 }
@@ -727,6 +943,15 @@ zsync_ftm_msg_dump (zsync_ftm_msg_t *self)
                 }
             }
             printf (" }\n");
+            printf ("    chunk_size=%ld\n", (long) self->chunk_size);
+            printf ("    max_chunk_size=%ld\n", (long) self->max_chunk_size);
+            printf ("    priority=%ld\n", (long) self->priority);
+            printf ("    sizes={\n");
+            if (self->sizes)
+                zframe_print (self->sizes, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
             break;
             
         case ZSYNC_FTM_MSG_CREDIT:
@@ -769,6 +994,43 @@ zsync_ftm_msg_dump (zsync_ftm_msg_t *self)
             puts ("TERMINATE:");
             break;
             
+        case ZSYNC_FTM_MSG_WEIGHT:
+            puts ("WEIGHT:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    weight=%ld\n", (long) self->weight);
+            break;
+            
+        case ZSYNC_FTM_MSG_RANGES:
+            puts ("RANGES:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    priority=%ld\n", (long) self->priority);
+            printf ("    ranges={\n");
+            if (self->ranges)
+                zframe_print (self->ranges, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_FTM_MSG_RATE:
+            puts ("RATE:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    rate=%ld\n", (long) self->rate);
+            break;
+            
     }
 }
 
@@ -831,6 +1093,15 @@ zsync_ftm_msg_command (zsync_ftm_msg_t *self)
         case ZSYNC_FTM_MSG_TERMINATE:
             return ("TERMINATE");
             break;
+        case ZSYNC_FTM_MSG_WEIGHT:
+            return ("WEIGHT");
+            break;
+        case ZSYNC_FTM_MSG_RANGES:
+            return ("RANGES");
+            break;
+        case ZSYNC_FTM_MSG_RATE:
+            return ("RATE");
+            break;
     }
     return "?";
 }
@@ -1010,6 +1281,63 @@ zsync_ftm_msg_set_sequence (zsync_ftm_msg_t *self, uint64_t sequence)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Get/set the max_chunk_size field
+
+uint64_t
+zsync_ftm_msg_max_chunk_size (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->max_chunk_size;
+}
+
+void
+zsync_ftm_msg_set_max_chunk_size (zsync_ftm_msg_t *self, uint64_t max_chunk_size)
+{
+    assert (self);
+    self->max_chunk_size = max_chunk_size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the priority field
+
+byte
+zsync_ftm_msg_priority (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->priority;
+}
+
+void
+zsync_ftm_msg_set_priority (zsync_ftm_msg_t *self, byte priority)
+{
+    assert (self);
+    self->priority = priority;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the sizes field
+
+zframe_t *
+zsync_ftm_msg_sizes (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->sizes;
+}
+
+//  Takes ownership of supplied frame
+void
+zsync_ftm_msg_set_sizes (zsync_ftm_msg_t *self, zframe_t *frame)
+{
+    assert (self);
+    if (self->sizes)
+        zframe_destroy (&self->sizes);
+    self->sizes = frame;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Get/set the chunk_size field
 
@@ -1047,6 +1375,66 @@ zsync_ftm_msg_set_offset (zsync_ftm_msg_t *self, uint64_t offset)
 
 
 
+//  --------------------------------------------------------------------------
+//  Get/set the weight field
+
+uint32_t
+zsync_ftm_msg_weight (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->weight;
+}
+
+void
+zsync_ftm_msg_set_weight (zsync_ftm_msg_t *self, uint32_t weight)
+{
+    assert (self);
+    self->weight = weight;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the ranges field
+
+zframe_t *
+zsync_ftm_msg_ranges (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->ranges;
+}
+
+//  Takes ownership of supplied frame
+void
+zsync_ftm_msg_set_ranges (zsync_ftm_msg_t *self, zframe_t *frame)
+{
+    assert (self);
+    if (self->ranges)
+        zframe_destroy (&self->ranges);
+    self->ranges = frame;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the rate field
+
+uint64_t
+zsync_ftm_msg_rate (zsync_ftm_msg_t *self)
+{
+    assert (self);
+    return self->rate;
+}
+
+void
+zsync_ftm_msg_set_rate (zsync_ftm_msg_t *self, uint64_t rate)
+{
+    assert (self);
+    self->rate = rate;
+}
+
+
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -1085,6 +1473,10 @@ zsync_ftm_msg_test (bool verbose)
     zsync_ftm_msg_set_sender (self, "Life is short but Now lasts for ever");
     zsync_ftm_msg_paths_append (self, "Name: %s", "Brutus");
     zsync_ftm_msg_paths_append (self, "Age: %d", 43);
+    zsync_ftm_msg_set_chunk_size (self, 123);
+    zsync_ftm_msg_set_max_chunk_size (self, 123);
+    zsync_ftm_msg_set_priority (self, 123);
+    zsync_ftm_msg_set_sizes (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_ftm_msg_send_again (self, output);
     zsync_ftm_msg_send (&self, output);
@@ -1103,6 +1495,10 @@ zsync_ftm_msg_test (bool verbose)
         assert (zsync_ftm_msg_paths_size (self) == 2);
         assert (streq (zsync_ftm_msg_paths_first (self), "Name: Brutus"));
         assert (streq (zsync_ftm_msg_paths_next (self), "Age: 43"));
+        assert (zsync_ftm_msg_chunk_size (self) == 123);
+        assert (zsync_ftm_msg_max_chunk_size (self) == 123);
+        assert (zsync_ftm_msg_priority (self) == 123);
+        assert (zframe_streq (zsync_ftm_msg_sizes (self), "Captcha Diem"));
         zsync_ftm_msg_destroy (&self);
     }
     self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_CREDIT);
@@ -1215,6 +1611,91 @@ zsync_ftm_msg_test (bool verbose)
         
         zsync_ftm_msg_destroy (&self);
     }
+    self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_WEIGHT);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_ftm_msg_dup (self);
+    assert (copy);
+    zsync_ftm_msg_destroy (&copy);
+
+    zsync_ftm_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_ftm_msg_set_weight (self, 123);
+    //  Send twice from same object
+    zsync_ftm_msg_send_again (self, output);
+    zsync_ftm_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_ftm_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_ftm_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_ftm_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zsync_ftm_msg_weight (self) == 123);
+        zsync_ftm_msg_destroy (&self);
+    }
+    self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_RANGES);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_ftm_msg_dup (self);
+    assert (copy);
+    zsync_ftm_msg_destroy (&copy);
+
+    zsync_ftm_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_ftm_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_ftm_msg_set_priority (self, 123);
+    zsync_ftm_msg_set_ranges (self, zframe_new ("Captcha Diem", 12));
+    //  Send twice from same object
+    zsync_ftm_msg_send_again (self, output);
+    zsync_ftm_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_ftm_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_ftm_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_ftm_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (streq (zsync_ftm_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_ftm_msg_priority (self) == 123);
+        assert (zframe_streq (zsync_ftm_msg_ranges (self), "Captcha Diem"));
+        zsync_ftm_msg_destroy (&self);
+    }
+    self = zsync_ftm_msg_new (ZSYNC_FTM_MSG_RATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_ftm_msg_dup (self);
+    assert (copy);
+    zsync_ftm_msg_destroy (&copy);
+
+    zsync_ftm_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_ftm_msg_set_rate (self, 123);
+    //  Send twice from same object
+    zsync_ftm_msg_send_again (self, output);
+    zsync_ftm_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_ftm_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_ftm_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_ftm_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zsync_ftm_msg_rate (self) == 123);
+        zsync_ftm_msg_destroy (&self);
+    }
 
     zctx_destroy (&ctx);
     //  @end
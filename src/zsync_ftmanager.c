@@ -28,6 +28,28 @@
     Handles incoming file requests from peers and their credit approval.
     Automatically sends chunks of data once a credit approval has been send.
     Outstanding files are only transfered if peer has enough credit.
+
+    Chunks start with the size negotiated with the peer. In adaptive mode
+    they grow up to a maximum size, depending on the rate credit arrives at
+    and the time it takes the peer to give new credit once it ran out.
+
+    Peers are served by deficit round-robin. Each round a peer may send
+    chunks worth the largest chunk size of all peers times its weight. Up to
+    FILES_IN_FLIGHT files of a peer are transfered at once.
+
+    The files of a peer are sent by priority first, then those with the
+    fewest bytes left, which keeps small files from waiting behind large
+    ones. Files of equal rank are sent in turns. The next file is chosen
+    for every chunk, so a file requested with a higher priority preempts
+    the others right away.
+
+    Instead of a whole file a peer may request some byte ranges of it, e.g.
+    the chunks it couldn't find locally. The file is done once the last
+    range has been sent.
+
+    Upload rates may be limited per peer and for all peers. A chunk is
+    only sent while both token buckets hold bytes; the manager sleeps until
+    they refill otherwise.
 @discuss
     LOG message to LOG group on whisper and shout
 @end
@@ -35,15 +57,36 @@
 
 #include "zsync_classes.h"
 
+// Interval in msecs after which the chunk size is adapted
+#define CHUNK_ADAPT_INTERVAL 250
+// Number of files per peer that are transfered at once
+#define FILES_IN_FLIGHT 4
+
 struct _zsync_ftfile_t {
     char *path;
     uint64_t sequence;
     uint64_t offset;
+    byte priority;              // Files with a higher priority are sent first
+    uint64_t remaining;         // Bytes left to send, UINT64_MAX if unknown
+    zframe_t *ranges;           // Byte ranges to send, NULL for whole file
+    size_t range;               // Index of the next range
+    uint64_t range_end;         // End of the current range
 };
 
 struct _zsync_ftrequest_t {
-    zlist_t *requested_files;
+    char *sender;               // Peer that requested the files
+    zlist_t *active_files;      // Files being transfered in turns
+    zlist_t *requested_files;   // Files waiting to be transfered
     uint64_t credit;
+    uint32_t weight;            // Share of bandwidth relative to other peers
+    uint64_t deficit;           // Bytes the peer may send in this round
+    uint64_t chunk_size;        // Size of the next chunk
+    uint64_t max_chunk_size;    // Size chunks may grow to
+    uint64_t window_credit;     // Credit received in current interval
+    int64_t window_start;       // Start of current interval
+    int64_t stalled_at;         // Time credit ran out, 0 if not stalled
+    int64_t rtt;                // Estimated time to get new credit in msecs
+    zsync_bucket_t *bucket;     // Upload rate limit of the peer
 };
 
 typedef struct _zsync_ftfile_t zsync_ftfile_t;
@@ -53,9 +96,11 @@ zsync_ftfile_t *
 zsync_ftfile_new (char *path)
 {
     zsync_ftfile_t *self = (zsync_ftfile_t *) zmalloc (sizeof (zsync_ftfile_t));
-    self->path = path;
+    self->path = strdup (path);
     self->sequence = 0;
     self->offset = 0;
+    self->priority = 0;
+    self->remaining = UINT64_MAX;
     return self;
 }
 
@@ -67,17 +112,97 @@ zsync_ftfile_destroy (zsync_ftfile_t **self_p)
     if (*self_p) {
         zsync_ftfile_t *self = *self_p;
         free (self->path);
+        zframe_destroy (&self->ranges);
         free (self);
         self_p = NULL;
     }
 }
 
+// Returns true if file should be sent before other, i.e. it has a higher
+// priority or the same one and fewer bytes left
+static bool
+s_ftfile_before (zsync_ftfile_t *self, zsync_ftfile_t *other)
+{
+    assert (self);
+    assert (other);
+    if (self->priority != other->priority)
+        return self->priority > other->priority;
+    return self->remaining < other->remaining;
+}
+
+// Inserts a file into a list ordered by s_ftfile_before, behind the files
+// of equal rank
+static void
+s_ftfile_insert (zlist_t *files, zsync_ftfile_t *file)
+{
+    assert (files);
+    assert (file);
+    size_t size = zlist_size (files);
+    while (size--) {
+        zsync_ftfile_t *item = (zsync_ftfile_t *) zlist_pop (files);
+        if (file && s_ftfile_before (file, item)) {
+            zlist_append (files, file);
+            file = NULL;
+        }
+        zlist_append (files, item);
+    }
+    if (file)
+        zlist_append (files, file);
+}
+
+// Sets the ranges to send of a file and the bytes left
+static void
+s_ftfile_set_ranges (zsync_ftfile_t *self, zframe_t *ranges)
+{
+    assert (self);
+    self->ranges = zframe_dup (ranges);
+    self->remaining = 0;
+    size_t count = (size_t) zsync_cdc_ranges_count (ranges);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        uint64_t offset, length;
+        zsync_cdc_ranges_get (ranges, index, &offset, &length);
+        self->remaining += length;
+    }
+}
+
+// Moves on to the next range of a file which isn't empty. Returns false if
+// there is none left.
+static bool
+s_ftfile_next_range (zsync_ftfile_t *self)
+{
+    assert (self);
+    assert (self->ranges);
+    size_t count = (size_t) zsync_cdc_ranges_count (self->ranges);
+    while (self->range < count) {
+        uint64_t offset, length;
+        zsync_cdc_ranges_get (self->ranges, self->range++, &offset, &length);
+        if (length > 0) {
+            self->offset = offset;
+            self->range_end = offset + length;
+            return true;
+        }
+    }
+    return false;
+}
+
 zsync_ftrequest_t *
-zsync_ftrequest_new ()
+zsync_ftrequest_new (char *sender)
 {
     zsync_ftrequest_t *self = (zsync_ftrequest_t *) zmalloc (sizeof (zsync_ftrequest_t));
+    self->sender = strdup (sender);
+    self->active_files = zlist_new ();
     self->requested_files = zlist_new ();
     self->credit = 0;
+    self->weight = 1;
+    self->deficit = 0;
+    self->chunk_size = CHUNK_SIZE;
+    self->max_chunk_size = CHUNK_SIZE;
+    self->window_credit = 0;
+    self->window_start = zclock_time ();
+    self->stalled_at = 0;
+    self->rtt = 0;
+    self->bucket = zsync_bucket_new (0);
     return self;
 }
 
@@ -88,13 +213,21 @@ zsync_ftrequest_destroy (zsync_ftrequest_t **self_p)
 
     if (*self_p) {
         zsync_ftrequest_t *self = *self_p;
-        zsync_ftfile_t *file = zlist_first (self->requested_files);
+        zsync_ftfile_t *file = zlist_pop (self->active_files);
         while (file) {
             zsync_ftfile_destroy (&file);
-            file = zlist_next (self->requested_files);
+            file = zlist_pop (self->active_files);
+        }
+        zlist_destroy (&self->active_files);
+        file = zlist_pop (self->requested_files);
+        while (file) {
+            zsync_ftfile_destroy (&file);
+            file = zlist_pop (self->requested_files);
         }
         zlist_destroy (&self->requested_files);
 
+        zsync_bucket_destroy (&self->bucket);
+        free (self->sender);
         free (self);
         self_p = NULL;
     }
@@ -107,123 +240,390 @@ zsync_ftmanager_destroy_item (void *data)
     zsync_ftrequest_destroy (&request);        
 }
 
-// Helper method that returns true is there is still work left, otherwise false
+// Helper method that accounts for new credit and adapts the chunk size once
+// per interval. If credit never ran out the peer keeps up, so chunks grow.
+// Otherwise they are sized so that four chunks are sent per round-trip.
+// Chunks at most double or halve per interval.
+static void
+s_ftrequest_credit (zsync_ftrequest_t *self, uint64_t credit)
+{
+    assert (self);
+    int64_t now = zclock_time ();
+    self->credit += credit;
+    self->window_credit += credit;
+    if (self->stalled_at) {
+        int64_t rtt = now - self->stalled_at;
+        self->rtt = self->rtt? (self->rtt * 7 + rtt) / 8: rtt;
+        self->stalled_at = 0;
+    }
+
+    int64_t elapsed = now - self->window_start;
+    if (elapsed < CHUNK_ADAPT_INTERVAL)
+        return;
+
+    uint64_t chunk_size = self->chunk_size * 2;
+    if (self->rtt) {
+        uint64_t rate = self->window_credit * 1000 / elapsed;
+        chunk_size = rate * (uint64_t) self->rtt / 1000 / 4;
+        if (chunk_size > self->chunk_size * 2)
+            chunk_size = self->chunk_size * 2;
+        if (chunk_size < self->chunk_size / 2)
+            chunk_size = self->chunk_size / 2;
+    }
+    if (chunk_size > self->max_chunk_size)
+        chunk_size = self->max_chunk_size;
+    if (chunk_size < CHUNK_SIZE)
+        chunk_size = CHUNK_SIZE;
+    self->chunk_size = chunk_size;
+    self->window_credit = 0;
+    self->window_start = now;
+}
+
+// Helper method that fills up the files being transfered with the first
+// requested files. Files being transfered which rank below a requested
+// file are preempted and wait again where they left off.
+static void
+s_ftrequest_activate (zsync_ftrequest_t *self)
+{
+    assert (self);
+    while (zlist_size (self->requested_files) > 0) {
+        zsync_ftfile_t *file = (zsync_ftfile_t *) zlist_first (self->requested_files);
+        if (zlist_size (self->active_files) >= FILES_IN_FLIGHT) {
+            zsync_ftfile_t *last = (zsync_ftfile_t *) zlist_last (self->active_files);
+            if (!s_ftfile_before (file, last))
+                break;
+            zlist_remove (self->active_files, last);
+            s_ftfile_insert (self->requested_files, last);
+        }
+        zlist_remove (self->requested_files, file);
+        s_ftfile_insert (self->active_files, file);
+    }
+}
+
+// Helper method that returns true if the peer is able to receive a chunk
 static bool
-s_work_left (zhash_t *self) 
+s_ftrequest_ready (zsync_ftrequest_t *self)
 {
     assert (self);
-    if (zhash_size (self) == 0)
-       return false; 
-
-    zlist_t *keys = zhash_keys (self);
-    char *key = zlist_first (keys);
-    while (key) {
-        zsync_ftrequest_t *request =  zhash_lookup (self, key);
-        int request_count = zlist_size (request->requested_files);
-        printf("[FT] requests (%d), credit(%"PRId64")\n", request_count, request->credit);
-        if (request_count > 0 && request->credit > CHUNK_SIZE) {
-            return true; 
+    return zlist_size (self->active_files) > 0 && self->credit > 0;
+}
+
+// Helper method that returns the msecs until the peer may send a chunk
+// within the upload rate limits, 0 if it may now or -1 if it isn't ready
+static int64_t
+s_ftrequest_wait (zsync_ftrequest_t *self, zsync_bucket_t *bucket, int64_t now)
+{
+    assert (self);
+    if (!s_ftrequest_ready (self))
+        return -1;
+    int64_t wait = zsync_bucket_wait (self->bucket, now);
+    int64_t global_wait = zsync_bucket_wait (bucket, now);
+    return wait > global_wait? wait: global_wait;
+}
+
+// Helper method that sends a chunk of the first file, which takes its turn
+// behind the files of equal rank afterwards
+static uint64_t
+s_ftrequest_send_chunk (zsync_ftrequest_t *self, void *pipe, uint64_t chunk_size)
+{
+    assert (self);
+    zsync_ftfile_t *file = zlist_pop (self->active_files);
+    assert (file);
+    // Chunks don't cross the end of a range
+    if (file->ranges && chunk_size > file->range_end - file->offset)
+        chunk_size = file->range_end - file->offset;
+    // nor the end of a file of known size
+    if (chunk_size > file->remaining)
+        chunk_size = file->remaining;
+    // The node reads chunks asynchronously and aborts the file
+    // once the agent reaches its end
+    zsync_ftm_msg_send_chunk (pipe, self->sender, file->path, file->sequence, chunk_size, file->offset);
+    // Increment for next chunk
+    file->sequence++;
+    file->offset += chunk_size;
+    if (file->remaining != UINT64_MAX)
+        file->remaining -= chunk_size;
+    self->credit -= chunk_size;
+    if (self->credit == 0 && !self->stalled_at)
+        self->stalled_at = zclock_time ();
+    if (file->remaining == 0
+    || (file->ranges && file->offset == file->range_end && !s_ftfile_next_range (file))) {
+        // The whole file or all ranges have been sent
+        zsync_ftfile_destroy (&file);
+        s_ftrequest_activate (self);
+    }
+    else
+        s_ftfile_insert (self->active_files, file);
+    return chunk_size;
+}
+
+// Helper method that serves a peer for one round of the deficit round-robin.
+// Chunks are sent as long as the deficit covers them and the upload rate
+// limits allow. Returns true if the peer is able to send another chunk now.
+static bool
+s_ftrequest_serve (zsync_ftrequest_t *self, void *pipe, uint64_t quantum, zsync_bucket_t *bucket)
+{
+    assert (self);
+    if (!s_ftrequest_ready (self)) {
+        // Peers which are waiting don't save up for later rounds
+        self->deficit = 0;
+        return false;
+    }
+    int64_t now = zclock_time ();
+    self->deficit += quantum * self->weight;
+    while (s_ftrequest_wait (self, bucket, now) == 0) {
+        // Never send more than credited
+        uint64_t chunk_size = self->chunk_size;
+        if (chunk_size > self->credit)
+            chunk_size = self->credit;
+        if (chunk_size > self->deficit)
+            break;
+        chunk_size = s_ftrequest_send_chunk (self, pipe, chunk_size);
+        self->deficit -= chunk_size;
+        zsync_bucket_consume (self->bucket, chunk_size, now);
+        zsync_bucket_consume (bucket, chunk_size, now);
+    }
+    if (!s_ftrequest_ready (self))
+        self->deficit = 0;
+    else
+    if (s_ftrequest_wait (self, bucket, now) > 0) {
+        // Peers which are throttled don't save up more than one round
+        if (self->deficit > quantum * self->weight)
+            self->deficit = quantum * self->weight;
+        return false;
+    }
+    return s_ftrequest_ready (self);
+}
+
+// Helper method that removes a file from the files of a peer
+static void
+s_remove_file (zsync_ftrequest_t *request, char *path)
+{
+    assert (request);
+    zlist_t *lists [2] = { request->active_files, request->requested_files };
+    int index;
+    for (index = 0; index < 2; index++) {
+        zsync_ftfile_t *file = zlist_first (lists [index]);
+        while (file) {
+            if (streq (file->path, path)) {
+                zlist_remove (lists [index], file);
+                zsync_ftfile_destroy (&file);
+                s_ftrequest_activate (request);
+                return;
+            }
+            file = zlist_next (lists [index]);
         }
-        key = zlist_next (keys);
     }
-    return false;
+}
+
+// Helper method that keeps a setting of a peer, e.g. its weight, which
+// applies again once the peer reconnects
+static void
+s_peer_setting_store (zhash_t *settings, char *sender, uint64_t value)
+{
+    uint64_t *setting = (uint64_t *) zmalloc (sizeof (uint64_t));
+    *setting = value;
+    zhash_update (settings, sender, setting);
+    zhash_freefn (settings, sender, free);
+}
+
+// Helper method that returns the request of a peer. A new one gets the
+// upload rate limit and weight stored for the peer.
+static zsync_ftrequest_t *
+s_ftrequest_require (zhash_t *peer_requests, zlist_t *peers,
+                     zhash_t *peer_rates, zhash_t *peer_weights, char *sender)
+{
+    zsync_ftrequest_t *ftrequest = zhash_lookup (peer_requests, sender);
+    if (!ftrequest) {
+        ftrequest = zsync_ftrequest_new (sender);
+        zhash_insert (peer_requests, sender, ftrequest);
+        zhash_freefn (peer_requests, sender, zsync_ftmanager_destroy_item);
+        zlist_append (peers, ftrequest);
+        uint64_t *rate = (uint64_t *) zhash_lookup (peer_rates, sender);
+        if (rate)
+            zsync_bucket_set_rate (ftrequest->bucket, *rate);
+        uint64_t *weight = (uint64_t *) zhash_lookup (peer_weights, sender);
+        if (weight)
+            ftrequest->weight = (uint32_t) *weight;
+    }
+    return ftrequest;
 }
 
 void
 zsync_ftmanager_engine (void *args, zctx_t *ctx, void *pipe)
 {
-    int rc;
-    void *agent_pipe = zsocket_new (ctx, ZMQ_PAIR);
-    zsocket_connect (agent_pipe, "inproc://agent");
+    bool terminated = false;
+    bool ready = false;         // true if any peer can receive a chunk
+    int64_t wait = -1;          // msecs until a throttled peer may send
+    zsync_bucket_t *bucket = zsync_bucket_new (0);  // upload rate limit of all peers
     zhash_t *peer_requests = zhash_new ();
+    zhash_t *peer_rates = zhash_new ();  // upload rate limits, kept across aborts
+    zhash_t *peer_weights = zhash_new ();   // weights, kept across aborts
+    zlist_t *peers = zlist_new ();  // peer requests in round-robin order
+    zpoller_t *poller = zpoller_new (pipe, NULL);
 
     zsync_ftm_msg_t *msg;
 
     printf("[FT] started\n");
-    while (true) {
-        // Proceed if there is still work to do and no message are in queue,
-        // Otherwise wait for work
-        if (s_work_left (peer_requests)) {
-            printf("[FT] go into recv nowait\n");
-            msg = zsync_ftm_msg_recv_nowait (pipe);
-        } else {
-            printf("[FT] go into recv\n");
+    while (!terminated) {
+        // Sleep until a message arrives while all peers wait for credit or
+        // files, or until the rate limits let a peer send again. Otherwise
+        // only pick up messages which are already queued.
+        void *which = zpoller_wait (poller, ready? 0: (int) wait);
+        if (which == pipe) {
             msg = zsync_ftm_msg_recv (pipe);
-        }
-        
-        if (msg) {
-            printf("[FT] recv\n");
+            if (!msg)
+                break;              //  Interrupted
+
             char *sender = zsync_ftm_msg_sender (msg);
             // Get file transfer request object
-            zsync_ftrequest_t *ftrequest = zhash_lookup (peer_requests, sender);
-            if (!ftrequest) {
-                ftrequest = zsync_ftrequest_new ();
-                zhash_insert (peer_requests, sender, ftrequest);
-                zhash_freefn (peer_requests, sender, zsync_ftmanager_destroy_item);
+            zsync_ftrequest_t *ftrequest = NULL;
+            if (sender && strlen (sender) > 0) {
+                if (zsync_ftm_msg_id (msg) == ZSYNC_FTM_MSG_ABORT)
+                    ftrequest = zhash_lookup (peer_requests, sender);
+                else
+                    ftrequest = s_ftrequest_require (peer_requests, peers,
+                                                     peer_rates, peer_weights, sender);
             }
             
             // Read the command
             switch (zsync_ftm_msg_id (msg)) {
                 case ZSYNC_FTM_MSG_REQUEST: 
                 {
+                    // A chunk size of 0 keeps the current chunk size
+                    uint64_t chunk_size = zsync_ftm_msg_chunk_size (msg);
+                    uint64_t max_chunk_size = zsync_ftm_msg_max_chunk_size (msg);
+                    if (chunk_size > 0) {
+                        ftrequest->chunk_size = chunk_size;
+                        ftrequest->max_chunk_size = max_chunk_size > chunk_size? max_chunk_size: chunk_size;
+                    }
+                    // Files of unknown size are sent after those of the
+                    // same priority whose size is known
+                    zframe_t *sizes = zsync_ftm_msg_sizes (msg);
+                    size_t count = sizes? zframe_size (sizes) / sizeof (uint64_t): 0;
+                    size_t index = 0;
                     char *fpath = zsync_ftm_msg_paths_first (msg);
                     while (fpath) {
                         // TODO check for duplicates
-                        zlist_append (ftrequest->requested_files, zsync_ftfile_new (fpath));
+                        zsync_ftfile_t *file = zsync_ftfile_new (fpath);
+                        file->priority = zsync_ftm_msg_priority (msg);
+                        if (index < count) {
+                            uint64_t size;
+                            memcpy (&size, zframe_data (sizes) + index * sizeof (uint64_t), sizeof (uint64_t));
+                            if (size > 0)
+                                file->remaining = size;
+                        }
+                        s_ftfile_insert (ftrequest->requested_files, file);
                         printf("[FT] added %s\n", fpath);
+                        index++;
                         fpath = zsync_ftm_msg_paths_next (msg);
                     }
+                    s_ftrequest_activate (ftrequest);
+                   break;
+                }
+                case ZSYNC_FTM_MSG_RANGES:
+                {
+                    zsync_ftfile_t *file = zsync_ftfile_new (zsync_ftm_msg_path (msg));
+                    file->priority = zsync_ftm_msg_priority (msg);
+                    if (zsync_cdc_ranges_count (zsync_ftm_msg_ranges (msg)) > 0) {
+                        s_ftfile_set_ranges (file, zsync_ftm_msg_ranges (msg));
+                        if (s_ftfile_next_range (file)) {
+                            s_ftfile_insert (ftrequest->requested_files, file);
+                            file = NULL;
+                            s_ftrequest_activate (ftrequest);
+                        }
+                    }
+                    zsync_ftfile_destroy (&file);
                    break;
                 }
                 case ZSYNC_FTM_MSG_CREDIT:
                 {
                     uint64_t credit = zsync_ftm_msg_credit (msg);
-                    ftrequest->credit += credit;
-                    printf("[FT] credit %"PRId64"\n", credit);
+                    s_ftrequest_credit (ftrequest, credit);
                    break;
                 }
                 case ZSYNC_FTM_MSG_ABORT:
-                    zhash_delete (peer_requests, sender);
+                {
+                    if (!ftrequest)
+                        break;
+                    // Abort a single file e.g. once it has been completely
+                    // transfered, or all files of the peer if path is empty
+                    char *path = zsync_ftm_msg_path (msg);
+                    if (path && strlen (path) > 0)
+                        s_remove_file (ftrequest, path);
+                    else {
+                        zlist_remove (peers, ftrequest);
+                        zhash_delete (peer_requests, sender);
+                    }
                     printf("[FT] FT_ABORT\n");
                    break;
+                }
+                case ZSYNC_FTM_MSG_WEIGHT:
+                {
+                    if (!ftrequest)
+                        break;
+                    uint32_t weight = zsync_ftm_msg_weight (msg);
+                    ftrequest->weight = weight > 0? weight: 1;
+                    s_peer_setting_store (peer_weights, sender, ftrequest->weight);
+                   break;
+                }
+                case ZSYNC_FTM_MSG_RATE:
+                {
+                    uint64_t rate = zsync_ftm_msg_rate (msg);
+                    if (!ftrequest) {
+                        zsync_bucket_set_rate (bucket, rate);
+                        break;
+                    }
+                    zsync_bucket_set_rate (ftrequest->bucket, rate);
+                    s_peer_setting_store (peer_rates, sender, rate);
+                   break;
+                }
                 case ZSYNC_FTM_MSG_TERMINATE:
                    zsync_ftm_msg_send_terminate (pipe);
+                   terminated = true;
                    break;
             }
             zsync_ftm_msg_destroy (&msg);
+            if (terminated)
+                break;
         }
+        else
+        if (!zpoller_expired (poller))
+            break;                  //  Interrupted
        
-        printf("[FT] LOOKUP\n");
-        // Search for file transfer request
-        // Transfer one chunk then proceed 
-        zlist_t *keys = zhash_keys (peer_requests);
-        char *key = zlist_first (keys);
-        while (key) {
-            zsync_ftrequest_t *request =  zhash_lookup (peer_requests, key);
-            int request_count = zlist_size (request->requested_files);
-            printf("[FT] requests (%d), credit(%"PRId64")\n", request_count, request->credit);
-            if (request_count > 0 && request->credit > CHUNK_SIZE) {
-                zsync_ftfile_t *file = zlist_first (request->requested_files);
-                // Use agent_api
-                zchunk_t *chunk;
-                if (chunk) {
-                    zsync_ftm_msg_send_chunk (pipe, key, file->path, file->sequence, CHUNK_SIZE, file->offset);
-                    // Increment for next chunk
-                    file->sequence++;
-                    file->offset += CHUNK_SIZE;
-                    request->credit -= CHUNK_SIZE;
-                    printf("[FT] chunk send\n");
-                } 
-                else {
-                    printf("[FT] file completed\n");
-                    (void *) zlist_pop (request->requested_files); 
-                }
-                // Advance after sending one chunk, in order to catch abort 
-                break;            
-            }
-            key = zlist_next (keys);
+        // The quantum covers the largest chunk, so every peer which is
+        // ready gets to send at least one chunk per round
+        uint64_t quantum = 0;
+        zsync_ftrequest_t *request = zlist_first (peers);
+        while (request) {
+            if (s_ftrequest_ready (request) && request->chunk_size > quantum)
+                quantum = request->chunk_size;
+            request = zlist_next (peers);
+        }
+        // Serve every peer for one round
+        ready = false;
+        request = zlist_first (peers);
+        while (request) {
+            if (s_ftrequest_serve (request, pipe, quantum, bucket))
+                ready = true;
+            request = zlist_next (peers);
+        }
+        // Find the first throttled peer which may send again
+        wait = -1;
+        int64_t now = zclock_time ();
+        request = zlist_first (peers);
+        while (request && !ready) {
+            int64_t request_wait = s_ftrequest_wait (request, bucket, now);
+            if (request_wait >= 0 && (wait < 0 || request_wait < wait))
+                wait = request_wait;
+            request = zlist_next (peers);
         }
     }
+    zsync_bucket_destroy (&bucket);
+    zhash_destroy (&peer_rates);
+    zhash_destroy (&peer_weights);
+    zpoller_destroy (&poller);
+    zlist_destroy (&peers);
     zhash_destroy (&peer_requests);
     printf("[FT] stopped\n");
 }
@@ -232,6 +632,194 @@ void
 zsync_ftmanager_test ()
 {
     printf(" * zsync_ftmanager: ");
+
+    zctx_t *ctx = zctx_new ();
+    void *pipe = zthread_fork (ctx, zsync_ftmanager_engine, NULL);
+
+    // Request a file and give credit for two and a half chunks
+    zlist_t *paths = zlist_new ();
+    zlist_append (paths, "a.txt");
+    zsync_ftm_msg_send_request (pipe, "0001", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_BULK, NULL);
+    zsync_ftm_msg_send_credit (pipe, "0001", CHUNK_SIZE * 2 + CHUNK_SIZE / 2);
+    zlist_destroy (&paths);
+    int index;
+
+    // Expect two full chunks and one limited by the credit left
+    uint64_t offset = 0;
+    uint64_t expected [3] = { CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE / 2 };
+    for (index = 0; index < 3; index++) {
+        zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+        assert (zsync_ftm_msg_id (msg) == ZSYNC_FTM_MSG_CHUNK);
+        assert (streq (zsync_ftm_msg_receiver (msg), "0001"));
+        assert (streq (zsync_ftm_msg_path (msg), "a.txt"));
+        assert (zsync_ftm_msg_sequence (msg) == index);
+        assert (zsync_ftm_msg_chunk_size (msg) == expected [index]);
+        assert (zsync_ftm_msg_offset (msg) == offset);
+        offset += expected [index];
+        zsync_ftm_msg_destroy (&msg);
+    }
+    zclock_sleep (100);
+    assert (zsync_ftm_msg_recv_nowait (pipe) == NULL);
+
+    zsync_ftm_msg_send_abort (pipe, "0001", "a.txt");
+
+    // Several files of a peer are transfered in turns
+    paths = zlist_new ();
+    zlist_append (paths, "b.txt");
+    zlist_append (paths, "c.txt");
+    zsync_ftm_msg_send_request (pipe, "0001", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_BULK, NULL);
+    zsync_ftm_msg_send_credit (pipe, "0001", CHUNK_SIZE * 4);
+    zlist_destroy (&paths);
+    char *expected_paths [4] = { "b.txt", "c.txt", "b.txt", "c.txt" };
+    for (index = 0; index < 4; index++) {
+        zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+        assert (streq (zsync_ftm_msg_path (msg), expected_paths [index]));
+        assert (zsync_ftm_msg_offset (msg) == (index / 2) * CHUNK_SIZE);
+        zsync_ftm_msg_destroy (&msg);
+    }
+    zsync_ftm_msg_send_abort (pipe, "0001", "");
+
+    // Peers share the bandwidth according to their weight, which is kept
+    // when a peer reconnects
+    zhash_t *peer_requests = zhash_new ();
+    zlist_t *peers = zlist_new ();
+    zhash_t *peer_rates = zhash_new ();
+    zhash_t *peer_weights = zhash_new ();
+    zsync_bucket_t *bucket = zsync_bucket_new (0);
+    void *sink = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_bind (sink, "inproc://ftmanager-weight");
+    void *source = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_connect (source, "inproc://ftmanager-weight");
+    s_peer_setting_store (peer_weights, "0003", 2);
+    zsync_ftrequest_t *light = s_ftrequest_require (peer_requests, peers, peer_rates, peer_weights, "0002");
+    zsync_ftrequest_t *heavy = s_ftrequest_require (peer_requests, peers, peer_rates, peer_weights, "0003");
+    assert (light->weight == 1 && heavy->weight == 2);
+    zlist_remove (peers, heavy);
+    zhash_delete (peer_requests, "0003");
+    heavy = s_ftrequest_require (peer_requests, peers, peer_rates, peer_weights, "0003");
+    assert (heavy->weight == 2);
+    zlist_append (light->requested_files, zsync_ftfile_new ("d.txt"));
+    s_ftrequest_activate (light);
+    zlist_append (heavy->requested_files, zsync_ftfile_new ("d.txt"));
+    s_ftrequest_activate (heavy);
+    s_ftrequest_credit (light, CHUNK_SIZE * 30);
+    s_ftrequest_credit (heavy, CHUNK_SIZE * 30);
+    for (index = 0; index < 5; index++) {
+        s_ftrequest_serve (light, sink, CHUNK_SIZE, bucket);
+        s_ftrequest_serve (heavy, sink, CHUNK_SIZE, bucket);
+    }
+    assert (light->credit == CHUNK_SIZE * 25);
+    assert (heavy->credit == CHUNK_SIZE * 20);
+    zsocket_destroy (ctx, source);
+    zsocket_destroy (ctx, sink);
+    zsync_bucket_destroy (&bucket);
+    zhash_destroy (&peer_weights);
+    zhash_destroy (&peer_rates);
+    zlist_destroy (&peers);
+    zhash_destroy (&peer_requests);
+
+    // Only the requested ranges of a file are sent, the file is done after
+    // the last one
+    uint64_t range_offsets [2] = { 1000, CHUNK_SIZE * 3 };
+    uint64_t range_lengths [2] = { CHUNK_SIZE + 500, 700 };
+    zframe_t *ranges = zsync_cdc_ranges_new (range_offsets, range_lengths, 2);
+    zsync_ftm_msg_send_ranges (pipe, "0004", "e.txt", ZSYNC_PRIORITY_BULK, ranges);
+    zsync_ftm_msg_send_credit (pipe, "0004", CHUNK_SIZE * 10);
+    zframe_destroy (&ranges);
+    uint64_t expected_offsets [3] = { 1000, 1000 + CHUNK_SIZE, CHUNK_SIZE * 3 };
+    uint64_t expected_sizes [3] = { CHUNK_SIZE, 500, 700 };
+    for (index = 0; index < 3; index++) {
+        zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+        if (!streq (zsync_ftm_msg_receiver (msg), "0004")) {
+            // Chunk sent before the abort arrived
+            zsync_ftm_msg_destroy (&msg);
+            index--;
+            continue;
+        }
+        assert (streq (zsync_ftm_msg_path (msg), "e.txt"));
+        assert (zsync_ftm_msg_offset (msg) == expected_offsets [index]);
+        assert (zsync_ftm_msg_chunk_size (msg) == expected_sizes [index]);
+        zsync_ftm_msg_destroy (&msg);
+    }
+    zclock_sleep (100);
+    assert (zsync_ftm_msg_recv_nowait (pipe) == NULL);
+
+    // Files with fewer bytes left are sent first
+    paths = zlist_new ();
+    zlist_append (paths, "big.txt");
+    zlist_append (paths, "small.txt");
+    uint64_t sizes [2] = { CHUNK_SIZE * 100, CHUNK_SIZE * 2 - 100 };
+    zframe_t *size_frame = zframe_new (sizes, sizeof (sizes));
+    zsync_ftm_msg_send_request (pipe, "0006", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_BULK, size_frame);
+    zsync_ftm_msg_send_credit (pipe, "0006", CHUNK_SIZE * 2);
+    zframe_destroy (&size_frame);
+    zlist_destroy (&paths);
+    for (index = 0; index < 2; index++) {
+        zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+        assert (streq (zsync_ftm_msg_path (msg), "small.txt"));
+        assert (zsync_ftm_msg_offset (msg) == index * CHUNK_SIZE);
+        assert (zsync_ftm_msg_chunk_size (msg) == (index? CHUNK_SIZE - 100: CHUNK_SIZE));
+        zsync_ftm_msg_destroy (&msg);
+    }
+    // The last chunk ends the file, credit left goes to the next one
+    // without waiting for the abort
+    zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+    assert (streq (zsync_ftm_msg_path (msg), "big.txt"));
+    assert (zsync_ftm_msg_chunk_size (msg) == 100);
+    zsync_ftm_msg_destroy (&msg);
+    zsync_ftm_msg_send_abort (pipe, "0006", "small.txt");
+
+    // A file with a higher priority preempts the others, even if larger
+    paths = zlist_new ();
+    zlist_append (paths, "urgent.txt");
+    sizes [0] = CHUNK_SIZE * 200;
+    size_frame = zframe_new (sizes, sizeof (uint64_t));
+    zsync_ftm_msg_send_request (pipe, "0006", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_INTERACTIVE, size_frame);
+    zsync_ftm_msg_send_credit (pipe, "0006", CHUNK_SIZE * 2);
+    zframe_destroy (&size_frame);
+    zlist_destroy (&paths);
+    for (index = 0; index < 2; index++) {
+        msg = zsync_ftm_msg_recv (pipe);
+        assert (streq (zsync_ftm_msg_path (msg), "urgent.txt"));
+        zsync_ftm_msg_destroy (&msg);
+    }
+    zsync_ftm_msg_send_abort (pipe, "0006", "urgent.txt");
+    zsync_ftm_msg_send_credit (pipe, "0006", CHUNK_SIZE);
+    msg = zsync_ftm_msg_recv (pipe);
+    assert (streq (zsync_ftm_msg_path (msg), "big.txt"));
+    assert (zsync_ftm_msg_offset (msg) == 100);
+    zsync_ftm_msg_destroy (&msg);
+    zsync_ftm_msg_send_abort (pipe, "0006", "");
+
+    // An upload rate limit lets one chunk pass every 250 msecs
+    zsync_ftm_msg_send_rate (pipe, "", CHUNK_SIZE * 4);
+    int64_t start = zclock_time ();
+    paths = zlist_new ();
+    zlist_append (paths, "f.txt");
+    zsync_ftm_msg_send_request (pipe, "0005", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_BULK, NULL);
+    zsync_ftm_msg_send_credit (pipe, "0005", CHUNK_SIZE * 4);
+    zlist_destroy (&paths);
+    for (index = 0; index < 4; index++) {
+        zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+        assert (streq (zsync_ftm_msg_receiver (msg), "0005"));
+        zsync_ftm_msg_destroy (&msg);
+    }
+    assert (zclock_time () - start >= 400);
+    zsync_ftm_msg_send_rate (pipe, "", 0);
+    zsync_ftm_msg_send_abort (pipe, "0005", "");
+
+    // Terminate, skipping chunks sent before the abort arrived
+    zsync_ftm_msg_send_terminate (pipe);
+    msg = zsync_ftm_msg_recv (pipe);
+    while (zsync_ftm_msg_id (msg) == ZSYNC_FTM_MSG_CHUNK) {
+        zsync_ftm_msg_destroy (&msg);
+        msg = zsync_ftm_msg_recv (pipe);
+    }
+    assert (zsync_ftm_msg_id (msg) == ZSYNC_FTM_MSG_TERMINATE);
+    zsync_ftm_msg_destroy (&msg);
+
+    // Cleanup
+    zctx_destroy (&ctx);
     
     printf("OK\n");
 }
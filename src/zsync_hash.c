@@ -0,0 +1,736 @@
+/* =========================================================================
+    zsync_hash - content checksums and digests
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync content hashing
+
+@discuss
+    Every file gets two hashes. XXH64 is a fast non-cryptographic checksum
+    used to detect changes, SHA-256 is a digest used to verify integrity.
+    XXH64 keeps four independent lanes so the multiplications of a 32 byte
+    stripe run in parallel. SHA-256 uses the SHA extensions of x86 CPUs
+    when they are available and a portable implementation otherwise.
+
+    Files are hashed in parallel by a pool of threads taking paths from a
+    shared index, so hashing a tree of many files keeps up with the disk.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#   define HAVE_SHA_NI
+#   include <cpuid.h>
+#   include <immintrin.h>
+#endif
+
+#define HASH_BUFFER_SIZE (1024 * 1024)
+#define HASH_THREADS 4
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+struct _zsync_hash_t {
+    uint64_t size;              // bytes added so far
+    uint64_t lanes [4];         // XXH64 accumulators
+    byte stripe [32];           // XXH64 input not yet consumed
+    size_t stripe_size;
+    bool strong;                // compute the SHA-256 digest
+    uint32_t sha [8];           // SHA-256 state
+    byte block [64];            // SHA-256 input not yet consumed
+    size_t block_size;
+};
+
+static const uint32_t s_sha256_k [64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t s_sha256_init [8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+
+// --------------------------------------------------------------------------
+// XXH64
+
+static inline uint64_t
+s_rotl64 (uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t
+s_read64 (const byte *data)
+{
+    uint64_t value;
+    memcpy (&value, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64 (value);
+#endif
+    return value;
+}
+
+static inline uint32_t
+s_read32 (const byte *data)
+{
+    uint32_t value;
+    memcpy (&value, data, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32 (value);
+#endif
+    return value;
+}
+
+static inline uint64_t
+s_xxh64_round (uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = s_rotl64 (acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t
+s_xxh64_merge (uint64_t acc, uint64_t lane)
+{
+    acc ^= s_xxh64_round (0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// Consumes whole stripes, returns the number of bytes consumed
+static size_t
+s_xxh64_stripes (uint64_t *lanes, const byte *data, size_t size)
+{
+    uint64_t lane1 = lanes [0], lane2 = lanes [1];
+    uint64_t lane3 = lanes [2], lane4 = lanes [3];
+    const byte *needle = data;
+    const byte *limit = data + size - (size % 32);
+    while (needle < limit) {
+        lane1 = s_xxh64_round (lane1, s_read64 (needle));
+        lane2 = s_xxh64_round (lane2, s_read64 (needle + 8));
+        lane3 = s_xxh64_round (lane3, s_read64 (needle + 16));
+        lane4 = s_xxh64_round (lane4, s_read64 (needle + 24));
+        needle += 32;
+    }
+    lanes [0] = lane1; lanes [1] = lane2;
+    lanes [2] = lane3; lanes [3] = lane4;
+    return needle - data;
+}
+
+static void
+s_xxh64_reset (uint64_t *lanes, uint64_t seed)
+{
+    lanes [0] = seed + PRIME64_1 + PRIME64_2;
+    lanes [1] = seed + PRIME64_2;
+    lanes [2] = seed;
+    lanes [3] = seed - PRIME64_1;
+}
+
+// Finishes the hash from the lanes and the last partial stripe
+static uint64_t
+s_xxh64_finish (uint64_t *lanes, uint64_t seed, uint64_t total,
+                const byte *tail, size_t size)
+{
+    uint64_t hash;
+    if (total >= 32) {
+        hash = s_rotl64 (lanes [0], 1) + s_rotl64 (lanes [1], 7)
+             + s_rotl64 (lanes [2], 12) + s_rotl64 (lanes [3], 18);
+        hash = s_xxh64_merge (hash, lanes [0]);
+        hash = s_xxh64_merge (hash, lanes [1]);
+        hash = s_xxh64_merge (hash, lanes [2]);
+        hash = s_xxh64_merge (hash, lanes [3]);
+    }
+    else
+        hash = seed + PRIME64_5;
+    hash += total;
+
+    while (size >= 8) {
+        hash ^= s_xxh64_round (0, s_read64 (tail));
+        hash = s_rotl64 (hash, 27) * PRIME64_1 + PRIME64_4;
+        tail += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        hash ^= (uint64_t) s_read32 (tail) * PRIME64_1;
+        hash = s_rotl64 (hash, 23) * PRIME64_2 + PRIME64_3;
+        tail += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        hash ^= *tail * PRIME64_5;
+        hash = s_rotl64 (hash, 11) * PRIME64_1;
+        tail++;
+        size--;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+
+// --------------------------------------------------------------------------
+// SHA-256
+
+#define ROTR32(value,bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+static void
+s_sha256_blocks_c (uint32_t *state, const byte *data, size_t blocks)
+{
+    while (blocks--) {
+        uint32_t w [64];
+        int index;
+        for (index = 0; index < 16; index++)
+            w [index] = (uint32_t) data [index * 4] << 24
+                      | (uint32_t) data [index * 4 + 1] << 16
+                      | (uint32_t) data [index * 4 + 2] << 8
+                      | (uint32_t) data [index * 4 + 3];
+        for (index = 16; index < 64; index++) {
+            uint32_t s0 = ROTR32 (w [index - 15], 7) ^ ROTR32 (w [index - 15], 18)
+                        ^ (w [index - 15] >> 3);
+            uint32_t s1 = ROTR32 (w [index - 2], 17) ^ ROTR32 (w [index - 2], 19)
+                        ^ (w [index - 2] >> 10);
+            w [index] = w [index - 16] + s0 + w [index - 7] + s1;
+        }
+        uint32_t a = state [0], b = state [1], c = state [2], d = state [3];
+        uint32_t e = state [4], f = state [5], g = state [6], h = state [7];
+        for (index = 0; index < 64; index++) {
+            uint32_t s1 = ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + s_sha256_k [index] + w [index];
+            uint32_t s0 = ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state [0] += a; state [1] += b; state [2] += c; state [3] += d;
+        state [4] += e; state [5] += f; state [6] += g; state [7] += h;
+        data += 64;
+    }
+}
+
+#ifdef HAVE_SHA_NI
+// Four rounds per step, the message schedule is computed alongside
+__attribute__ ((target ("sha,sse4.1")))
+static void
+s_sha256_blocks_ni (uint32_t *state, const byte *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128 ((const __m128i *) &state [0]);
+    __m128i state1 = _mm_loadu_si128 ((const __m128i *) &state [4]);
+    tmp = _mm_shuffle_epi32 (tmp, 0xB1);                // CDAB
+    state1 = _mm_shuffle_epi32 (state1, 0x1B);          // EFGH
+    __m128i state0 = _mm_alignr_epi8 (tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16 (state1, tmp, 0xF0);       // CDGH
+
+    while (blocks--) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w [4];
+        int step;
+        for (step = 0; step < 16; step++) {
+            if (step < 4)
+                w [step] = _mm_shuffle_epi8 (
+                    _mm_loadu_si128 ((const __m128i *) (data + step * 16)), mask);
+            __m128i msg = _mm_add_epi32 (w [step % 4],
+                _mm_loadu_si128 ((const __m128i *) &s_sha256_k [step * 4]));
+            state1 = _mm_sha256rnds2_epu32 (state1, state0, msg);
+            if (step >= 3 && step <= 14) {
+                __m128i *next = &w [(step + 1) % 4];
+                *next = _mm_add_epi32 (*next,
+                    _mm_alignr_epi8 (w [step % 4], w [(step + 3) % 4], 4));
+                *next = _mm_sha256msg2_epu32 (*next, w [step % 4]);
+            }
+            msg = _mm_shuffle_epi32 (msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32 (state0, state1, msg);
+            if (step >= 1 && step <= 12)
+                w [(step + 3) % 4] = _mm_sha256msg1_epu32 (w [(step + 3) % 4], w [step % 4]);
+        }
+        state0 = _mm_add_epi32 (state0, abef);
+        state1 = _mm_add_epi32 (state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32 (state0, 0x1B);             // FEBA
+    state1 = _mm_shuffle_epi32 (state1, 0xB1);          // DCHG
+    state0 = _mm_blend_epi16 (tmp, state1, 0xF0);       // DCBA
+    state1 = _mm_alignr_epi8 (state1, tmp, 8);          // ABEF
+    _mm_storeu_si128 ((__m128i *) &state [0], state0);
+    _mm_storeu_si128 ((__m128i *) &state [4], state1);
+}
+#endif
+
+typedef void (s_sha256_blocks_fn) (uint32_t *state, const byte *data, size_t blocks);
+static s_sha256_blocks_fn *s_sha256_blocks = s_sha256_blocks_c;
+static pthread_once_t s_sha256_once = PTHREAD_ONCE_INIT;
+
+static void
+s_sha256_select (void)
+{
+#ifdef HAVE_SHA_NI
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid (1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1)
+    &&  __get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29)))
+        s_sha256_blocks = s_sha256_blocks_ni;
+#endif
+}
+
+static void
+s_sha256_final (uint32_t *state, byte *block, size_t block_size,
+                uint64_t total, byte *digest)
+{
+    uint64_t bits = total * 8;
+    block [block_size++] = 0x80;
+    if (block_size > 56) {
+        memset (block + block_size, 0, 64 - block_size);
+        s_sha256_blocks (state, block, 1);
+        block_size = 0;
+    }
+    memset (block + block_size, 0, 56 - block_size);
+    int index;
+    for (index = 0; index < 8; index++)
+        block [56 + index] = (byte) (bits >> (56 - index * 8));
+    s_sha256_blocks (state, block, 1);
+    for (index = 0; index < 8; index++) {
+        digest [index * 4] = (byte) (state [index] >> 24);
+        digest [index * 4 + 1] = (byte) (state [index] >> 16);
+        digest [index * 4 + 2] = (byte) (state [index] >> 8);
+        digest [index * 4 + 3] = (byte) state [index];
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Constructs a streaming hash. The XXH64 checksum is always computed,
+// the SHA-256 digest only if strong is true.
+
+zsync_hash_t *
+zsync_hash_new (bool strong)
+{
+    pthread_once (&s_sha256_once, s_sha256_select);
+    zsync_hash_t *self = (zsync_hash_t *) zmalloc (sizeof (zsync_hash_t));
+    s_xxh64_reset (self->lanes, 0);
+    self->strong = strong;
+    memcpy (self->sha, s_sha256_init, sizeof (self->sha));
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destroys the hash
+
+void
+zsync_hash_destroy (zsync_hash_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_hash_t *self = *self_p;
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Adds data to the hash
+
+void
+zsync_hash_update (zsync_hash_t *self, const void *data, size_t size)
+{
+    assert (self);
+    const byte *input = (const byte *) data;
+    self->size += size;
+
+    // XXH64
+    const byte *needle = input;
+    size_t left = size;
+    if (self->stripe_size > 0) {
+        size_t fill = 32 - self->stripe_size;
+        if (fill > left)
+            fill = left;
+        memcpy (self->stripe + self->stripe_size, needle, fill);
+        self->stripe_size += fill;
+        needle += fill;
+        left -= fill;
+        if (self->stripe_size == 32) {
+            s_xxh64_stripes (self->lanes, self->stripe, 32);
+            self->stripe_size = 0;
+        }
+    }
+    size_t consumed = s_xxh64_stripes (self->lanes, needle, left);
+    memcpy (self->stripe + self->stripe_size, needle + consumed, left - consumed);
+    self->stripe_size += left - consumed;
+
+    // SHA-256
+    if (!self->strong)
+        return;
+    needle = input;
+    left = size;
+    if (self->block_size > 0) {
+        size_t fill = 64 - self->block_size;
+        if (fill > left)
+            fill = left;
+        memcpy (self->block + self->block_size, needle, fill);
+        self->block_size += fill;
+        needle += fill;
+        left -= fill;
+        if (self->block_size == 64) {
+            s_sha256_blocks (self->sha, self->block, 1);
+            self->block_size = 0;
+        }
+    }
+    if (left >= 64) {
+        s_sha256_blocks (self->sha, needle, left / 64);
+        needle += left - (left % 64);
+        left %= 64;
+    }
+    memcpy (self->block + self->block_size, needle, left);
+    self->block_size += left;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the XXH64 checksum of the data added so far
+
+uint64_t
+zsync_hash_checksum (zsync_hash_t *self)
+{
+    assert (self);
+    return s_xxh64_finish (self->lanes, 0, self->size, self->stripe, self->stripe_size);
+}
+
+
+// --------------------------------------------------------------------------
+// Writes the SHA-256 digest of the data added so far to digest, which
+// must hold ZSYNC_DIGEST_SIZE bytes
+
+void
+zsync_hash_digest (zsync_hash_t *self, byte *digest)
+{
+    assert (self);
+    assert (self->strong);
+    uint32_t state [8];
+    byte block [64];
+    memcpy (state, self->sha, sizeof (state));
+    memcpy (block, self->block, self->block_size);
+    s_sha256_final (state, block, self->block_size, self->size, digest);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the XXH64 checksum of a block, e.g. a chunk
+
+uint64_t
+zsync_hash_xxh64 (const void *data, size_t size, uint64_t seed)
+{
+    uint64_t lanes [4];
+    s_xxh64_reset (lanes, seed);
+    size_t consumed = s_xxh64_stripes (lanes, (const byte *) data, size);
+    return s_xxh64_finish (lanes, seed, size, (const byte *) data + consumed, size - consumed);
+}
+
+
+// --------------------------------------------------------------------------
+// Writes the SHA-256 digest of a block to digest
+
+void
+zsync_hash_sha256 (const void *data, size_t size, byte *digest)
+{
+    zsync_hash_t *hash = zsync_hash_new (true);
+    zsync_hash_update (hash, data, size);
+    zsync_hash_digest (hash, digest);
+    zsync_hash_destroy (&hash);
+}
+
+
+// --------------------------------------------------------------------------
+// Hashes a file. The digest is skipped if digest is NULL.
+// Returns 0 on success, -1 if the file could not be read.
+
+int
+zsync_hash_file (const char *path, uint64_t *checksum, byte *digest)
+{
+    assert (path);
+    assert (checksum);
+    int fd = open (path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    byte *buffer = (byte *) malloc (HASH_BUFFER_SIZE);
+    assert (buffer);
+    zsync_hash_t *hash = zsync_hash_new (digest != NULL);
+    int rc = 0;
+    while (true) {
+        ssize_t size = read (fd, buffer, HASH_BUFFER_SIZE);
+        if (size == 0)
+            break;
+        if (size == -1) {
+            if (errno == EINTR)
+                continue;
+            rc = -1;
+            break;
+        }
+        zsync_hash_update (hash, buffer, size);
+    }
+    close (fd);
+    free (buffer);
+    if (rc == 0) {
+        *checksum = zsync_hash_checksum (hash);
+        if (digest)
+            zsync_hash_digest (hash, digest);
+    }
+    zsync_hash_destroy (&hash);
+    return rc;
+}
+
+
+// --------------------------------------------------------------------------
+// Hashes count files below root with a pool of threads. Stores the
+// checksums and, unless digests is NULL, ZSYNC_DIGEST_SIZE bytes of digest
+// per file. A file that could not be read gets checksum 0 and a zeroed
+// digest. Returns the number of files that could not be read.
+
+typedef struct {
+    const char *root;
+    char **paths;
+    size_t count;
+    uint64_t *checksums;
+    byte *digests;
+    pthread_mutex_t mutex;
+    size_t next;                // index of the next file to hash
+    int failed;
+} s_hash_jobs_t;
+
+static void *
+s_hash_thread (void *args)
+{
+    s_hash_jobs_t *jobs = (s_hash_jobs_t *) args;
+    int failed = 0;
+    while (true) {
+        pthread_mutex_lock (&jobs->mutex);
+        size_t index = jobs->next++;
+        pthread_mutex_unlock (&jobs->mutex);
+        if (index >= jobs->count)
+            break;
+
+        char *path = (char *) malloc (strlen (jobs->root) + strlen (jobs->paths [index]) + 2);
+        sprintf (path, "%s/%s", jobs->root, jobs->paths [index]);
+        byte *digest = jobs->digests? jobs->digests + index * ZSYNC_DIGEST_SIZE: NULL;
+        if (zsync_hash_file (path, &jobs->checksums [index], digest) != 0) {
+            jobs->checksums [index] = 0;
+            if (digest)
+                memset (digest, 0, ZSYNC_DIGEST_SIZE);
+            failed++;
+        }
+        free (path);
+    }
+    pthread_mutex_lock (&jobs->mutex);
+    jobs->failed += failed;
+    pthread_mutex_unlock (&jobs->mutex);
+    return NULL;
+}
+
+int
+zsync_hash_paths (const char *root, char **paths, size_t count,
+    uint64_t *checksums, byte *digests, int threads)
+{
+    assert (root);
+    if (count == 0)
+        return 0;
+    if (threads < 1)
+        threads = HASH_THREADS;
+    if ((size_t) threads > count)
+        threads = (int) count;
+
+    s_hash_jobs_t jobs;
+    jobs.root = root;
+    jobs.paths = paths;
+    jobs.count = count;
+    jobs.checksums = checksums;
+    jobs.digests = digests;
+    pthread_mutex_init (&jobs.mutex, NULL);
+    jobs.next = 0;
+    jobs.failed = 0;
+
+    pthread_t *pool = (pthread_t *) zmalloc (sizeof (pthread_t) * threads);
+    int index;
+    for (index = 0; index < threads; index++)
+        pthread_create (&pool [index], NULL, s_hash_thread, &jobs);
+    for (index = 0; index < threads; index++)
+        pthread_join (pool [index], NULL);
+    free (pool);
+    pthread_mutex_destroy (&jobs.mutex);
+    return jobs.failed;
+}
+
+
+// --------------------------------------------------------------------------
+// Sets checksum and digest of every ZS_FILE_OP_UPD entry in a list of
+// zs_fmetadata_t with paths relative to root. Returns the number of files
+// that could not be read.
+
+int
+zsync_hash_fmetadata (const char *root, zlist_t *fmetadata, int threads)
+{
+    assert (root);
+    assert (fmetadata);
+    size_t count = 0;
+    size_t size = zlist_size (fmetadata);
+    zs_fmetadata_t **entries = (zs_fmetadata_t **) zmalloc (sizeof (zs_fmetadata_t *) * (size + 1));
+    char **paths = (char **) zmalloc (sizeof (char *) * (size + 1));
+    zs_fmetadata_t *entry = (zs_fmetadata_t *) zlist_first (fmetadata);
+    while (entry) {
+        if (zs_fmetadata_operation (entry) == ZS_FILE_OP_UPD) {
+            entries [count] = entry;
+            paths [count] = (char *) zs_fmetadata_path_ref (entry);
+            count++;
+        }
+        entry = (zs_fmetadata_t *) zlist_next (fmetadata);
+    }
+
+    uint64_t *checksums = (uint64_t *) zmalloc (sizeof (uint64_t) * (count + 1));
+    byte *digests = (byte *) zmalloc (ZSYNC_DIGEST_SIZE * (count + 1));
+    int failed = zsync_hash_paths (root, paths, count, checksums, digests, threads);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        zs_fmetadata_set_checksum (entries [index], checksums [index]);
+        zs_fmetadata_set_digest (entries [index], digests + index * ZSYNC_DIGEST_SIZE);
+    }
+    free (digests);
+    free (checksums);
+    free (paths);
+    free (entries);
+    return failed;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_DIR ".zsync_hash_test"
+
+static void
+s_test_hex (byte *digest, char *hex)
+{
+    int index;
+    for (index = 0; index < ZSYNC_DIGEST_SIZE; index++)
+        sprintf (hex + index * 2, "%02x", digest [index]);
+}
+
+void
+zsync_hash_test ()
+{
+    printf (" * zsync_hash: ");
+    char hex [ZSYNC_DIGEST_SIZE * 2 + 1];
+    byte digest [ZSYNC_DIGEST_SIZE];
+    
+    // Reference values
+    assert (zsync_hash_xxh64 ("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    assert (zsync_hash_xxh64 ("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+    zsync_hash_sha256 ("", 0, digest);
+    s_test_hex (digest, hex);
+    assert (streq (hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    zsync_hash_sha256 ("abc", 3, digest);
+    s_test_hex (digest, hex);
+    assert (streq (hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+    
+    // Streaming matches one-shot hashing for any split and both kernels
+    size_t size = 100003;
+    byte *data = (byte *) malloc (size);
+    size_t index;
+    for (index = 0; index < size; index++)
+        data [index] = (byte) (index * 31 + (index >> 8));
+    uint64_t checksum = zsync_hash_xxh64 (data, size, 0);
+    byte expected [ZSYNC_DIGEST_SIZE];
+    zsync_hash_sha256 (data, size, expected);
+    uint32_t state [8];
+    memcpy (state, s_sha256_init, sizeof (state));
+    s_sha256_blocks_c (state, data, size / 64);
+    uint32_t state_fast [8];
+    memcpy (state_fast, s_sha256_init, sizeof (state_fast));
+    s_sha256_blocks (state_fast, data, size / 64);
+    assert (memcmp (state, state_fast, sizeof (state)) == 0);
+
+    size_t splits [] = { 1, 7, 32, 63, 64, 1000, 65536 };
+    for (index = 0; index < sizeof (splits) / sizeof (size_t); index++) {
+        zsync_hash_t *hash = zsync_hash_new (true);
+        size_t offset;
+        for (offset = 0; offset < size; offset += splits [index]) {
+            size_t part = size - offset < splits [index]? size - offset: splits [index];
+            zsync_hash_update (hash, data + offset, part);
+        }
+        assert (zsync_hash_checksum (hash) == checksum);
+        zsync_hash_digest (hash, digest);
+        assert (memcmp (digest, expected, ZSYNC_DIGEST_SIZE) == 0);
+        zsync_hash_destroy (&hash);
+    }
+
+    // Files are hashed in parallel into their metadata
+    zsys_dir_create (TEST_DIR);
+    FILE *file = fopen (TEST_DIR "/data", "wb");
+    fwrite (data, 1, size, file);
+    fclose (file);
+    file = fopen (TEST_DIR "/empty", "wb");
+    fclose (file);
+    zlist_t *fmetadata = zlist_new ();
+    char *names [] = { "data", "empty", "missing" };
+    for (index = 0; index < 3; index++) {
+        zs_fmetadata_t *entry = zs_fmetadata_new ();
+        zs_fmetadata_set_path (entry, "%s", names [index]);
+        zs_fmetadata_set_operation (entry, ZS_FILE_OP_UPD);
+        zlist_append (fmetadata, entry);
+    }
+    int failed = zsync_hash_fmetadata (TEST_DIR, fmetadata, 2);
+    assert (failed == 1);
+    zs_fmetadata_t *entry = (zs_fmetadata_t *) zlist_first (fmetadata);
+    assert (zs_fmetadata_checksum (entry) == checksum);
+    assert (memcmp (zs_fmetadata_digest (entry), expected, ZSYNC_DIGEST_SIZE) == 0);
+    entry = (zs_fmetadata_t *) zlist_next (fmetadata);
+    assert (zs_fmetadata_checksum (entry) == 0xEF46DB3751D8E999ULL);
+    while ((entry = (zs_fmetadata_t *) zlist_pop (fmetadata)))
+        zs_fmetadata_destroy (&entry);
+    zlist_destroy (&fmetadata);
+    
+    zsys_file_delete (TEST_DIR "/data");
+    zsys_file_delete (TEST_DIR "/empty");
+    rmdir (TEST_DIR);
+    free (data);
+    printf ("OK\n");
+}
@@ -0,0 +1,362 @@
+/* =========================================================================
+    zsync_journal - append-only journal of peer states
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync peer state journal
+
+@discuss
+    The journal is a zsync_recordlog with one record per state change,
+    whose payload is:
+
+        uuid length     1 byte
+        uuid            uuid length bytes
+        state           8 bytes, network byte order
+
+    States are buffered in memory and written in batches by flush, which
+    syncs the file before returning. On startup the journal is replayed,
+    the last record of a peer wins. Once the file holds many superseded
+    records it is compacted into one record per peer.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define JOURNAL_MAGIC "ZSJ2"
+
+// Largest record payload: length, uuid and state
+#define PAYLOAD_MAX (1 + 255 + 8)
+
+struct _zsync_journal_t {
+    zsync_recordlog_t *log;     // journal file
+    zhash_t *entries;           // last known state by peer uuid
+    zlist_t *pending;           // entries changed since the last flush
+};
+
+// Last known state of a peer
+typedef struct {
+    char *uuid;
+    uint64_t state;
+    bool dirty;                 // entry is in the pending list
+} s_entry_t;
+
+static void
+s_entry_free (void *data)
+{
+    s_entry_t *entry = (s_entry_t *) data;
+    free (entry->uuid);
+    free (entry);
+}
+
+// Encodes a record payload into buffer, returns its size
+static size_t
+s_record_encode (byte *buffer, char *uuid, uint64_t state)
+{
+    size_t uuid_size = strlen (uuid);
+    assert (uuid_size <= 255);
+    byte *needle = buffer;
+    *needle++ = (byte) uuid_size;
+    memcpy (needle, uuid, uuid_size);
+    needle += uuid_size;
+    int shift;
+    for (shift = 56; shift >= 0; shift -= 8)
+        *needle++ = (byte) (state >> shift);
+    return needle - buffer;
+}
+
+static void
+s_journal_set (zsync_journal_t *self, char *uuid, uint64_t state)
+{
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, uuid);
+    if (!entry) {
+        entry = (s_entry_t *) zmalloc (sizeof (s_entry_t));
+        entry->uuid = strdup (uuid);
+        zhash_insert (self->entries, uuid, entry);
+        zhash_freefn (self->entries, uuid, s_entry_free);
+    }
+    entry->state = state;
+}
+
+// Decodes a record payload during replay
+static int
+s_journal_replay (byte *payload, size_t size, void *arg)
+{
+    zsync_journal_t *self = (zsync_journal_t *) arg;
+    if (size < 1 || size != 1 + (size_t) payload [0] + 8)
+        return -1;
+    size_t uuid_size = payload [0];
+    char uuid [256];
+    memcpy (uuid, payload + 1, uuid_size);
+    uuid [uuid_size] = 0;
+    byte *needle = payload + 1 + uuid_size;
+    uint64_t state = 0;
+    int index;
+    for (index = 0; index < 8; index++)
+        state = (state << 8) | *needle++;
+    s_journal_set (self, uuid, state);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Opens the journal at path and replays the states recorded in it
+
+zsync_journal_t *
+zsync_journal_new (const char *path)
+{
+    assert (path);
+    zsync_journal_t *self = (zsync_journal_t *) zmalloc (sizeof (zsync_journal_t));
+    self->entries = zhash_new ();
+    self->pending = zlist_new ();
+    self->log = zsync_recordlog_new (path, JOURNAL_MAGIC, PAYLOAD_MAX, s_journal_replay, self);
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Flushes pending states and closes the journal
+
+void
+zsync_journal_destroy (zsync_journal_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_journal_t *self = *self_p;
+        zsync_journal_flush (self);
+        zsync_recordlog_destroy (&self->log);
+        zlist_destroy (&self->pending);
+        zhash_destroy (&self->entries);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Records the state of a peer, the record is written on the next flush
+
+void
+zsync_journal_append (zsync_journal_t *self, char *uuid, uint64_t state)
+{
+    assert (self);
+    assert (uuid);
+    s_journal_set (self, uuid, state);
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, uuid);
+    if (!entry->dirty) {
+        entry->dirty = true;
+        zlist_append (self->pending, entry);
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Writes all pending states to disk and syncs them. Compacts the journal
+// if it has grown too large. Returns 0 on success, -1 on failure.
+
+int
+zsync_journal_flush (zsync_journal_t *self)
+{
+    assert (self);
+    if (zlist_size (self->pending) == 0)
+        return 0;
+
+    // Pending entries stay dirty until the records are synced
+    byte buffer [PAYLOAD_MAX];
+    s_entry_t *entry = (s_entry_t *) zlist_first (self->pending);
+    while (entry) {
+        size_t size = s_record_encode (buffer, entry->uuid, entry->state);
+        if (zsync_recordlog_append (self->log, buffer, size) != 0)
+            return -1;
+        entry = (s_entry_t *) zlist_next (self->pending);
+    }
+    if (zsync_recordlog_sync (self->log) != 0)
+        return -1;
+
+    entry = (s_entry_t *) zlist_pop (self->pending);
+    while (entry) {
+        entry->dirty = false;
+        entry = (s_entry_t *) zlist_pop (self->pending);
+    }
+
+    if (zsync_recordlog_bloated (self->log, zhash_size (self->entries)))
+        return zsync_journal_compact (self);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Rewrites the journal with one record per peer and atomically replaces
+// the old file. Returns 0 on success, -1 on failure.
+
+int
+zsync_journal_compact (zsync_journal_t *self)
+{
+    assert (self);
+    if (zsync_recordlog_rewrite (self->log) != 0)
+        return -1;
+    byte buffer [PAYLOAD_MAX];
+    zlist_t *uuids = zhash_keys (self->entries);
+    char *uuid = (char *) zlist_first (uuids);
+    while (uuid) {
+        s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, uuid);
+        size_t size = s_record_encode (buffer, entry->uuid, entry->state);
+        zsync_recordlog_append (self->log, buffer, size);
+        uuid = (char *) zlist_next (uuids);
+    }
+    zlist_destroy (&uuids);
+    if (zsync_recordlog_commit (self->log) != 0)
+        return -1;
+
+    // The snapshot holds the current state of every peer
+    s_entry_t *entry = (s_entry_t *) zlist_pop (self->pending);
+    while (entry) {
+        entry->dirty = false;
+        entry = (s_entry_t *) zlist_pop (self->pending);
+    }
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true if there are states that have not been flushed yet
+
+bool
+zsync_journal_dirty (zsync_journal_t *self)
+{
+    assert (self);
+    return zlist_size (self->pending) > 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the uuids of all known peers, caller must destroy the list
+
+zlist_t *
+zsync_journal_uuids (zsync_journal_t *self)
+{
+    assert (self);
+    return zhash_keys (self->entries);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the last recorded state of a peer or 0 if the peer is unknown
+
+uint64_t
+zsync_journal_state (zsync_journal_t *self, char *uuid)
+{
+    assert (self);
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, uuid);
+    return entry? entry->state: 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of records in the journal file
+
+size_t
+zsync_journal_records (zsync_journal_t *self)
+{
+    assert (self);
+    return zsync_recordlog_records (self->log);
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_JOURNAL ".zsync_journal_test"
+
+void
+zsync_journal_test ()
+{
+    printf (" * zsync_journal: ");
+    zsys_file_delete (TEST_JOURNAL);
+    
+    char *uuid1 = "0123456789ABCDEF0123456789ABCDEF";
+    char *uuid2 = "FEDCBA9876543210FEDCBA9876543210";
+    
+    // Appends are buffered until flushed
+    zsync_journal_t *journal = zsync_journal_new (TEST_JOURNAL);
+    assert (!zsync_journal_dirty (journal));
+    zsync_journal_append (journal, uuid1, 1);
+    zsync_journal_append (journal, uuid1, 2);
+    zsync_journal_append (journal, uuid2, 7);
+    assert (zsync_journal_dirty (journal));
+    assert (zsync_journal_records (journal) == 0);
+    int rc = zsync_journal_flush (journal);
+    assert (rc == 0);
+    assert (!zsync_journal_dirty (journal));
+    assert (zsync_journal_records (journal) == 2);
+    zsync_journal_append (journal, uuid1, 3);
+    zsync_journal_destroy (&journal);
+
+    // Replay restores the last state of every peer
+    journal = zsync_journal_new (TEST_JOURNAL);
+    assert (zsync_journal_records (journal) == 3);
+    assert (zsync_journal_state (journal, uuid1) == 3);
+    assert (zsync_journal_state (journal, uuid2) == 7);
+    zlist_t *uuids = zsync_journal_uuids (journal);
+    assert (zlist_size (uuids) == 2);
+    zlist_destroy (&uuids);
+    zsync_journal_destroy (&journal);
+
+    // A torn record at the end is dropped
+    ssize_t valid_size = zsys_file_size (TEST_JOURNAL);
+    FILE *file = fopen (TEST_JOURNAL, "ab");
+    byte buffer [PAYLOAD_MAX];
+    size_t size = s_record_encode (buffer, uuid2, 8);
+    byte header [4] = { 0, 0, (byte) (size >> 8), (byte) size };
+    fwrite (header, 1, 4, file);
+    fwrite (buffer, 1, size, file);
+    fclose (file);
+    journal = zsync_journal_new (TEST_JOURNAL);
+    assert (zsync_journal_state (journal, uuid2) == 7);
+    assert (zsync_journal_records (journal) == 3);
+    assert (zsys_file_size (TEST_JOURNAL) == valid_size);
+    
+    // Compaction keeps one record per peer
+    int state;
+    for (state = 0; state < ZSYNC_RECORDLOG_COMPACT_MIN; state++) {
+        zsync_journal_append (journal, uuid1, state);
+        rc = zsync_journal_flush (journal);
+        assert (rc == 0);
+    }
+    assert (zsync_journal_records (journal) < ZSYNC_RECORDLOG_COMPACT_MIN);
+    zsync_journal_append (journal, uuid2, 9);
+    rc = zsync_journal_compact (journal);
+    assert (rc == 0);
+    assert (zsync_journal_records (journal) == 2);
+    assert (!zsys_file_exists (TEST_JOURNAL ".tmp"));
+    zsync_journal_destroy (&journal);
+    
+    journal = zsync_journal_new (TEST_JOURNAL);
+    assert (zsync_journal_records (journal) == 2);
+    assert (zsync_journal_state (journal, uuid1) == ZSYNC_RECORDLOG_COMPACT_MIN - 1);
+    assert (zsync_journal_state (journal, uuid2) == 9);
+    zsync_journal_destroy (&journal);
+    
+    zsys_file_delete (TEST_JOURNAL);
+    printf ("OK\n");
+}
@@ -56,11 +56,15 @@ struct _zsync_msg_t {
     char *receiver;             //  UUID that identifies the receiver
     zlist_t *files;             //  List of file names
     uint64_t size;              //  Total size of all files in bytes
+    byte priority;              //  Priority of the files, higher is sent first
     char *path;                 //  Path of file that the 'chunk' belongs to 
     uint64_t chunk_size;        //  Size of the requested chunk in bytes
     uint64_t offset;            //  File offset for for the chunk in bytes
     zchunk_t *chunk;            //  Requested chunk
     uint64_t sequence;          //  Defines which chunk of the file at 'path' this is!
+    zframe_t *frame;            //  Chunk data as received from the remote peer
+    uint32_t weight;            //  Share of the bandwidth relative to other peers
+    uint64_t rate;              //  Bytes per second, 0 for unlimited
 };
 
 //  --------------------------------------------------------------------------
@@ -230,6 +234,7 @@ zsync_msg_destroy (zsync_msg_t **self_p)
             zlist_destroy (&self->files);
         free (self->path);
         zchunk_destroy (&self->chunk);
+        zframe_destroy (&self->frame);
 
         //  Free object itself
         free (self);
@@ -305,12 +310,14 @@ zsync_msg_decode (zmsg_t *msg)
                 }
             }
             GET_NUMBER8 (self->size);
+            GET_NUMBER1 (self->priority);
             break;
 
         case ZSYNC_MSG_REQ_CHUNK:
             GET_STRING (self->path);
             GET_NUMBER8 (self->chunk_size);
             GET_NUMBER8 (self->offset);
+            GET_NUMBER8 (self->sequence);
             break;
 
         case ZSYNC_MSG_RES_CHUNK:
@@ -322,6 +329,7 @@ zsync_msg_decode (zmsg_t *msg)
                 self->chunk = zchunk_new (self->needle, chunk_size);
                 self->needle += chunk_size;
             }
+            GET_NUMBER8 (self->sequence);
             break;
 
         case ZSYNC_MSG_CHUNK:
@@ -346,6 +354,130 @@ zsync_msg_decode (zmsg_t *msg)
         case ZSYNC_MSG_TERMINATE:
             break;
 
+        case ZSYNC_MSG_CHUNK_FRAME:
+            GET_STRING (self->path);
+            GET_NUMBER8 (self->sequence);
+            GET_NUMBER8 (self->offset);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            GET_NUMBER8 (self->sequence);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_WEIGHT:
+            GET_STRING (self->receiver);
+            GET_NUMBER4 (self->weight);
+            break;
+
+        case ZSYNC_MSG_REQ_DELTA:
+            GET_STRING (self->receiver);
+            GET_STRING (self->path);
+            GET_NUMBER8 (self->size);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_DELTA:
+            GET_STRING (self->path);
+            GET_NUMBER8 (self->sequence);
+            GET_NUMBER8 (self->offset);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_REQ_MANIFEST:
+            GET_STRING (self->receiver);
+            {
+                size_t list_size;
+                GET_NUMBER4 (list_size);
+                self->files = zlist_new ();
+                zlist_autofree (self->files);
+                while (list_size--) {
+                    char *string;
+                    GET_LONGSTR (string);
+                    zlist_append (self->files, string);
+                    free (string);
+                }
+            }
+            break;
+
+        case ZSYNC_MSG_MANIFEST:
+            GET_STRING (self->receiver);
+            GET_STRING (self->path);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_REQ_RANGES:
+            GET_STRING (self->receiver);
+            GET_STRING (self->path);
+            GET_NUMBER8 (self->size);
+            //  Get next frame, leave current untouched
+            {
+                zframe_t *frame = zmsg_pop (msg);
+                if (!frame)
+                    goto malformed;
+                self->frame = frame;
+            }
+            break;
+
+        case ZSYNC_MSG_PERSISTED:
+            GET_STRING (self->path);
+            GET_NUMBER8 (self->offset);
+            GET_NUMBER8 (self->size);
+            break;
+
+        case ZSYNC_MSG_UPLOAD_RATE:
+            GET_STRING (self->receiver);
+            GET_NUMBER8 (self->rate);
+            break;
+
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            GET_STRING (self->receiver);
+            GET_NUMBER8 (self->rate);
+            break;
+
+        case ZSYNC_MSG_RES_UPDATE:
+            GET_STRING (self->sender);
+            //  Get zero or more remaining frames,
+            //  leave current frame untouched
+            self->update_msg = zmsg_new ();
+            update_msg_part = zmsg_pop (msg);
+            while (update_msg_part) {
+                zmsg_add (self->update_msg, update_msg_part);
+                update_msg_part = zmsg_pop (msg);
+            }
+            break;
+
         default:
             goto malformed;
     }
@@ -475,6 +607,8 @@ zsync_msg_encode (zsync_msg_t *self)
             }
             //  size is a 8-byte integer
             frame_size += 8;
+            //  priority is a 1-byte integer
+            frame_size += 1;
             break;
             
         case ZSYNC_MSG_REQ_CHUNK:
@@ -486,6 +620,8 @@ zsync_msg_encode (zsync_msg_t *self)
             frame_size += 8;
             //  offset is a 8-byte integer
             frame_size += 8;
+            //  sequence is a 8-byte integer
+            frame_size += 8;
             break;
             
         case ZSYNC_MSG_RES_CHUNK:
@@ -493,6 +629,8 @@ zsync_msg_encode (zsync_msg_t *self)
             frame_size += 4;
             if (self->chunk)
                 frame_size += zchunk_size (self->chunk);
+            //  sequence is a 8-byte integer
+            frame_size += 8;
             break;
             
         case ZSYNC_MSG_CHUNK:
@@ -524,6 +662,132 @@ zsync_msg_encode (zsync_msg_t *self)
         case ZSYNC_MSG_TERMINATE:
             break;
             
+        case ZSYNC_MSG_CHUNK_FRAME:
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  sequence is a 8-byte integer
+            frame_size += 8;
+            //  offset is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            //  sequence is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_WEIGHT:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  weight is a 4-byte integer
+            frame_size += 4;
+            break;
+            
+        case ZSYNC_MSG_REQ_DELTA:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  size is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_DELTA:
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  sequence is a 8-byte integer
+            frame_size += 8;
+            //  offset is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_REQ_MANIFEST:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  files is an array of strings
+            frame_size += 4;    //  Size is 4 octets
+            if (self->files) {
+                //  Add up size of list contents
+                char *files = (char *) zlist_first (self->files);
+                while (files) {
+                    frame_size += 4 + strlen (files);
+                    files = (char *) zlist_next (self->files);
+                }
+            }
+            break;
+            
+        case ZSYNC_MSG_MANIFEST:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            break;
+            
+        case ZSYNC_MSG_REQ_RANGES:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  size is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_PERSISTED:
+            //  path is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->path)
+                frame_size += strlen (self->path);
+            //  offset is a 8-byte integer
+            frame_size += 8;
+            //  size is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_UPLOAD_RATE:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  rate is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            //  receiver is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->receiver)
+                frame_size += strlen (self->receiver);
+            //  rate is a 8-byte integer
+            frame_size += 8;
+            break;
+            
+        case ZSYNC_MSG_RES_UPDATE:
+            //  sender is a string with 1-byte length
+            frame_size++;       //  Size is one octet
+            if (self->sender)
+                frame_size += strlen (self->sender);
+            break;
+            
         default:
             printf ("E: bad message type '%d', not sent\n", self->id);
             //  No recovery, this is a fatal application error
@@ -572,6 +836,7 @@ zsync_msg_encode (zsync_msg_t *self)
             else
                 PUT_NUMBER4 (0);    //  Empty string array
             PUT_NUMBER8 (self->size);
+            PUT_NUMBER1 (self->priority);
             break;
 
         case ZSYNC_MSG_REQ_CHUNK:
@@ -582,6 +847,7 @@ zsync_msg_encode (zsync_msg_t *self)
                 PUT_NUMBER1 (0);    //  Empty string
             PUT_NUMBER8 (self->chunk_size);
             PUT_NUMBER8 (self->offset);
+            PUT_NUMBER8 (self->sequence);
             break;
 
         case ZSYNC_MSG_RES_CHUNK:
@@ -594,6 +860,7 @@ zsync_msg_encode (zsync_msg_t *self)
             }
             else
                 PUT_NUMBER4 (0);    //  Empty chunk
+            PUT_NUMBER8 (self->sequence);
             break;
 
         case ZSYNC_MSG_CHUNK:
@@ -631,47 +898,192 @@ zsync_msg_encode (zsync_msg_t *self)
         case ZSYNC_MSG_TERMINATE:
             break;
 
-    }
-    //  Now send the data frame
-    if (zmsg_append (msg, &frame)) {
-        zmsg_destroy (&msg);
-        zsync_msg_destroy (&self);
-        return NULL;
-    }
-    //  Now send the update_msg field if set
-    if (self->id == ZSYNC_MSG_UPDATE) {
-        zframe_t *update_msg_part = zmsg_pop (self->update_msg);
-        while (update_msg_part) {
-            zmsg_append (msg, &update_msg_part);
-            update_msg_part = zmsg_pop (self->update_msg);
-        }
-    }
-    //  Destroy zsync_msg object
-    zsync_msg_destroy (&self);
-    return msg;
-
-}
-
-//  --------------------------------------------------------------------------
-//  Send the zsync_msg to the socket, and destroy it
-//  Returns 0 if OK, else -1
+        case ZSYNC_MSG_CHUNK_FRAME:
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->sequence);
+            PUT_NUMBER8 (self->offset);
+            break;
 
-int
-zsync_msg_send (zsync_msg_t **self_p, void *output)
-{
-    assert (self_p);
-    assert (*self_p);
-    assert (output);
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            PUT_NUMBER8 (self->sequence);
+            break;
 
-    zsync_msg_t *self = *self_p;
-    zmsg_t *msg = NULL;
-    //  Encode zsync_msg into zmsg.
-    msg = zsync_msg_encode (self);
+        case ZSYNC_MSG_WEIGHT:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER4 (self->weight);
+            break;
 
-    //  If we're sending to a ROUTER, we send the routing_id first
-    if (zsocket_type (output) == ZMQ_ROUTER) {
-        assert (self->routing_id);
-        if (zmsg_push (msg, self->routing_id)) {
+        case ZSYNC_MSG_REQ_DELTA:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->size);
+            break;
+
+        case ZSYNC_MSG_DELTA:
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->sequence);
+            PUT_NUMBER8 (self->offset);
+            break;
+
+        case ZSYNC_MSG_REQ_MANIFEST:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            if (self->files) {
+                PUT_NUMBER4 (zlist_size (self->files));
+                char *files = (char *) zlist_first (self->files);
+                while (files) {
+                    PUT_LONGSTR (files);
+                    files = (char *) zlist_next (self->files);
+                }
+            }
+            else
+                PUT_NUMBER4 (0);    //  Empty string array
+            break;
+
+        case ZSYNC_MSG_MANIFEST:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            break;
+
+        case ZSYNC_MSG_REQ_RANGES:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->size);
+            break;
+
+        case ZSYNC_MSG_PERSISTED:
+            if (self->path) {
+                PUT_STRING (self->path);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->offset);
+            PUT_NUMBER8 (self->size);
+            break;
+
+        case ZSYNC_MSG_UPLOAD_RATE:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->rate);
+            break;
+
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            if (self->receiver) {
+                PUT_STRING (self->receiver);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            PUT_NUMBER8 (self->rate);
+            break;
+
+        case ZSYNC_MSG_RES_UPDATE:
+            if (self->sender) {
+                PUT_STRING (self->sender);
+            }
+            else
+                PUT_NUMBER1 (0);    //  Empty string
+            break;
+
+    }
+    //  Now send the data frame
+    if (zmsg_append (msg, &frame)) {
+        zmsg_destroy (&msg);
+        zsync_msg_destroy (&self);
+        return NULL;
+    }
+    //  Now send any frame fields, in order
+    if (self->id == ZSYNC_MSG_CHUNK_FRAME
+    ||  self->id == ZSYNC_MSG_RES_CHUNK_FRAME
+    ||  self->id == ZSYNC_MSG_REQ_DELTA
+    ||  self->id == ZSYNC_MSG_DELTA
+    ||  self->id == ZSYNC_MSG_MANIFEST
+    ||  self->id == ZSYNC_MSG_REQ_RANGES) {
+        //  If frame isn't set, send an empty frame
+        if (!self->frame)
+            self->frame = zframe_new (NULL, 0);
+        if (zmsg_append (msg, &self->frame)) {
+            zmsg_destroy (&msg);
+            zsync_msg_destroy (&self);
+            return NULL;
+        }
+    }
+    //  Now send the update_msg field if set
+    if (self->id == ZSYNC_MSG_UPDATE
+    ||  self->id == ZSYNC_MSG_RES_UPDATE) {
+        zframe_t *update_msg_part = zmsg_pop (self->update_msg);
+        while (update_msg_part) {
+            zmsg_append (msg, &update_msg_part);
+            update_msg_part = zmsg_pop (self->update_msg);
+        }
+    }
+    //  Destroy zsync_msg object
+    zsync_msg_destroy (&self);
+    return msg;
+
+}
+
+//  --------------------------------------------------------------------------
+//  Send the zsync_msg to the socket, and destroy it
+//  Returns 0 if OK, else -1
+
+int
+zsync_msg_send (zsync_msg_t **self_p, void *output)
+{
+    assert (self_p);
+    assert (*self_p);
+    assert (output);
+
+    zsync_msg_t *self = *self_p;
+    zmsg_t *msg = NULL;
+    //  Encode zsync_msg into zmsg.
+    msg = zsync_msg_encode (self);
+
+    //  If we're sending to a ROUTER, we send the routing_id first
+    if (zsocket_type (output) == ZMQ_ROUTER) {
+        assert (self->routing_id);
+        if (zmsg_push (msg, self->routing_id)) {
             return -1;
         }
     }
@@ -760,12 +1172,14 @@ zsync_msg_send_req_files (
     void *output,
     char *receiver,
     zlist_t *files,
-    uint64_t size)
+    uint64_t size,
+    byte priority)
 {
     zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_REQ_FILES);
     zsync_msg_set_receiver (self, receiver);
     zsync_msg_set_files (self, zlist_dup (files));
     zsync_msg_set_size (self, size);
+    zsync_msg_set_priority (self, priority);
     return zsync_msg_send (&self, output);
 }
 
@@ -778,12 +1192,14 @@ zsync_msg_send_req_chunk (
     void *output,
     char *path,
     uint64_t chunk_size,
-    uint64_t offset)
+    uint64_t offset,
+    uint64_t sequence)
 {
     zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_REQ_CHUNK);
     zsync_msg_set_path (self, path);
     zsync_msg_set_chunk_size (self, chunk_size);
     zsync_msg_set_offset (self, offset);
+    zsync_msg_set_sequence (self, sequence);
     return zsync_msg_send (&self, output);
 }
 
@@ -794,10 +1210,12 @@ zsync_msg_send_req_chunk (
 int
 zsync_msg_send_res_chunk (
     void *output,
-    zchunk_t *chunk)
+    zchunk_t *chunk,
+    uint64_t sequence)
 {
     zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_RES_CHUNK);
     zsync_msg_set_chunk (self, zchunk_dup (chunk));
+    zsync_msg_set_sequence (self, sequence);
     return zsync_msg_send (&self, output);
 }
 
@@ -851,79 +1269,370 @@ zsync_msg_send_terminate (
 
 
 //  --------------------------------------------------------------------------
-//  Duplicate the zsync_msg message
+//  Send the CHUNK_FRAME to the socket in one step, takes ownership of the
+//  frame so that its data is not copied
 
-zsync_msg_t *
-zsync_msg_dup (zsync_msg_t *self)
+int
+zsync_msg_send_chunk_frame (
+    void *output,
+    char *path,
+    uint64_t sequence,
+    uint64_t offset,
+    zframe_t **frame_p)
 {
-    if (!self)
-        return NULL;
-        
-    zsync_msg_t *copy = zsync_msg_new (self->id);
-    if (self->routing_id)
-        copy->routing_id = zframe_dup (self->routing_id);
+    assert (frame_p);
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_CHUNK_FRAME);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_sequence (self, sequence);
+    zsync_msg_set_offset (self, offset);
+    zsync_msg_set_frame (self, *frame_p);
+    *frame_p = NULL;
+    return zsync_msg_send (&self, output);
+}
 
-    switch (self->id) {
-        case ZSYNC_MSG_REQ_STATE:
-            break;
 
-        case ZSYNC_MSG_RES_STATE:
-            copy->state = self->state;
-            break;
+//  --------------------------------------------------------------------------
+//  Send the RES_CHUNK_FRAME to the socket in one step, takes ownership of
+//  the frame so that its data is not copied
 
-        case ZSYNC_MSG_REQ_UPDATE:
-            copy->state = self->state;
-            break;
+int
+zsync_msg_send_res_chunk_frame (
+    void *output,
+    uint64_t sequence,
+    zframe_t **frame_p)
+{
+    assert (frame_p);
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_RES_CHUNK_FRAME);
+    zsync_msg_set_sequence (self, sequence);
+    zsync_msg_set_frame (self, *frame_p);
+    *frame_p = NULL;
+    return zsync_msg_send (&self, output);
+}
 
-        case ZSYNC_MSG_UPDATE:
-            copy->sender = self->sender? strdup (self->sender): NULL;
-            copy->update_msg = self->update_msg? zmsg_dup (self->update_msg): NULL;
-            break;
 
-        case ZSYNC_MSG_REQ_FILES:
-            copy->receiver = self->receiver? strdup (self->receiver): NULL;
-            copy->files = self->files? zlist_dup (self->files): NULL;
-            copy->size = self->size;
-            break;
+//  --------------------------------------------------------------------------
+//  Send the WEIGHT to the socket in one step
 
-        case ZSYNC_MSG_REQ_CHUNK:
-            copy->path = self->path? strdup (self->path): NULL;
-            copy->chunk_size = self->chunk_size;
-            copy->offset = self->offset;
-            break;
+int
+zsync_msg_send_weight (
+    void *output,
+    char *receiver,
+    uint32_t weight)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_WEIGHT);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_weight (self, weight);
+    return zsync_msg_send (&self, output);
+}
 
-        case ZSYNC_MSG_RES_CHUNK:
-            copy->chunk = self->chunk? zchunk_dup (self->chunk): NULL;
-            break;
 
-        case ZSYNC_MSG_CHUNK:
-            copy->chunk = self->chunk? zchunk_dup (self->chunk): NULL;
-            copy->path = self->path? strdup (self->path): NULL;
-            copy->sequence = self->sequence;
-            copy->offset = self->offset;
-            break;
+//  --------------------------------------------------------------------------
+//  Send the REQ_DELTA to the socket in one step
 
-        case ZSYNC_MSG_ABORT:
-            copy->receiver = self->receiver? strdup (self->receiver): NULL;
-            copy->path = self->path? strdup (self->path): NULL;
-            break;
+int
+zsync_msg_send_req_delta (
+    void *output,
+    char *receiver,
+    char *path,
+    uint64_t size,
+    zframe_t *frame)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_REQ_DELTA);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_size (self, size);
+    zsync_msg_set_frame (self, zframe_dup (frame));
+    return zsync_msg_send (&self, output);
+}
 
-        case ZSYNC_MSG_TERMINATE:
-            break;
 
-    }
-    return copy;
+//  --------------------------------------------------------------------------
+//  Send the DELTA to the socket in one step
+
+int
+zsync_msg_send_delta (
+    void *output,
+    char *path,
+    uint64_t sequence,
+    uint64_t offset,
+    zframe_t *frame)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_DELTA);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_sequence (self, sequence);
+    zsync_msg_set_offset (self, offset);
+    zsync_msg_set_frame (self, zframe_dup (frame));
+    return zsync_msg_send (&self, output);
 }
 
 
+//  --------------------------------------------------------------------------
+//  Send the REQ_MANIFEST to the socket in one step
+
+int
+zsync_msg_send_req_manifest (
+    void *output,
+    char *receiver,
+    zlist_t *files)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_REQ_MANIFEST);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_files (self, zlist_dup (files));
+    return zsync_msg_send (&self, output);
+}
+
 
 //  --------------------------------------------------------------------------
-//  Print contents of message to stdout
+//  Send the MANIFEST to the socket in one step
 
-void
-zsync_msg_dump (zsync_msg_t *self)
+int
+zsync_msg_send_manifest (
+    void *output,
+    char *receiver,
+    char *path,
+    zframe_t *frame)
 {
-    assert (self);
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_MANIFEST);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_frame (self, zframe_dup (frame));
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the REQ_RANGES to the socket in one step
+
+int
+zsync_msg_send_req_ranges (
+    void *output,
+    char *receiver,
+    char *path,
+    uint64_t size,
+    zframe_t *frame)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_REQ_RANGES);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_size (self, size);
+    zsync_msg_set_frame (self, zframe_dup (frame));
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the PERSISTED to the socket in one step
+
+int
+zsync_msg_send_persisted (
+    void *output,
+    char *path,
+    uint64_t offset,
+    uint64_t size)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_PERSISTED);
+    zsync_msg_set_path (self, path);
+    zsync_msg_set_offset (self, offset);
+    zsync_msg_set_size (self, size);
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the UPLOAD_RATE to the socket in one step
+
+int
+zsync_msg_send_upload_rate (
+    void *output,
+    char *receiver,
+    uint64_t rate)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_UPLOAD_RATE);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_rate (self, rate);
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the DOWNLOAD_RATE to the socket in one step
+
+int
+zsync_msg_send_download_rate (
+    void *output,
+    char *receiver,
+    uint64_t rate)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_DOWNLOAD_RATE);
+    zsync_msg_set_receiver (self, receiver);
+    zsync_msg_set_rate (self, rate);
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the RES_UPDATE to the socket in one step
+
+int
+zsync_msg_send_res_update (
+    void *output,
+    char *sender,
+    zmsg_t *update_msg)
+{
+    zsync_msg_t *self = zsync_msg_new (ZSYNC_MSG_RES_UPDATE);
+    zsync_msg_set_sender (self, sender);
+    zsync_msg_set_update_msg (self, zmsg_dup (update_msg));
+    return zsync_msg_send (&self, output);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Duplicate the zsync_msg message
+
+zsync_msg_t *
+zsync_msg_dup (zsync_msg_t *self)
+{
+    if (!self)
+        return NULL;
+        
+    zsync_msg_t *copy = zsync_msg_new (self->id);
+    if (self->routing_id)
+        copy->routing_id = zframe_dup (self->routing_id);
+
+    switch (self->id) {
+        case ZSYNC_MSG_REQ_STATE:
+            break;
+
+        case ZSYNC_MSG_RES_STATE:
+            copy->state = self->state;
+            break;
+
+        case ZSYNC_MSG_REQ_UPDATE:
+            copy->state = self->state;
+            break;
+
+        case ZSYNC_MSG_UPDATE:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->update_msg = self->update_msg? zmsg_dup (self->update_msg): NULL;
+            break;
+
+        case ZSYNC_MSG_REQ_FILES:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->files = self->files? zlist_dup (self->files): NULL;
+            copy->size = self->size;
+            copy->priority = self->priority;
+            break;
+
+        case ZSYNC_MSG_REQ_CHUNK:
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->chunk_size = self->chunk_size;
+            copy->offset = self->offset;
+            copy->sequence = self->sequence;
+            break;
+
+        case ZSYNC_MSG_RES_CHUNK:
+            copy->chunk = self->chunk? zchunk_dup (self->chunk): NULL;
+            copy->sequence = self->sequence;
+            break;
+
+        case ZSYNC_MSG_CHUNK:
+            copy->chunk = self->chunk? zchunk_dup (self->chunk): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->sequence = self->sequence;
+            copy->offset = self->offset;
+            break;
+
+        case ZSYNC_MSG_ABORT:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            break;
+
+        case ZSYNC_MSG_TERMINATE:
+            break;
+
+        case ZSYNC_MSG_CHUNK_FRAME:
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->sequence = self->sequence;
+            copy->offset = self->offset;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            copy->sequence = self->sequence;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_WEIGHT:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->weight = self->weight;
+            break;
+
+        case ZSYNC_MSG_REQ_DELTA:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->size = self->size;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_DELTA:
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->sequence = self->sequence;
+            copy->offset = self->offset;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_REQ_MANIFEST:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->files = self->files? zlist_dup (self->files): NULL;
+            break;
+
+        case ZSYNC_MSG_MANIFEST:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_REQ_RANGES:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->size = self->size;
+            copy->frame = self->frame? zframe_dup (self->frame): NULL;
+            break;
+
+        case ZSYNC_MSG_PERSISTED:
+            copy->path = self->path? strdup (self->path): NULL;
+            copy->offset = self->offset;
+            copy->size = self->size;
+            break;
+
+        case ZSYNC_MSG_UPLOAD_RATE:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->rate = self->rate;
+            break;
+
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            copy->receiver = self->receiver? strdup (self->receiver): NULL;
+            copy->rate = self->rate;
+            break;
+
+        case ZSYNC_MSG_RES_UPDATE:
+            copy->sender = self->sender? strdup (self->sender): NULL;
+            copy->update_msg = self->update_msg? zmsg_dup (self->update_msg): NULL;
+            break;
+
+    }
+    return copy;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Print contents of message to stdout
+
+void
+zsync_msg_dump (zsync_msg_t *self)
+{
+    assert (self);
     switch (self->id) {
         case ZSYNC_MSG_REQ_STATE:
             puts ("REQ_STATE:");
@@ -969,6 +1678,7 @@ zsync_msg_dump (zsync_msg_t *self)
             }
             printf (" }\n");
             printf ("    size=%ld\n", (long) self->size);
+            printf ("    priority=%ld\n", (long) self->priority);
             break;
             
         case ZSYNC_MSG_REQ_CHUNK:
@@ -979,6 +1689,7 @@ zsync_msg_dump (zsync_msg_t *self)
                 printf ("    path=\n");
             printf ("    chunk_size=%ld\n", (long) self->chunk_size);
             printf ("    offset=%ld\n", (long) self->offset);
+            printf ("    sequence=%ld\n", (long) self->sequence);
             break;
             
         case ZSYNC_MSG_RES_CHUNK:
@@ -989,6 +1700,7 @@ zsync_msg_dump (zsync_msg_t *self)
             else
                 printf ("(NULL)\n");
             printf ("    }\n");
+            printf ("    sequence=%ld\n", (long) self->sequence);
             break;
             
         case ZSYNC_MSG_CHUNK:
@@ -1023,58 +1735,225 @@ zsync_msg_dump (zsync_msg_t *self)
             puts ("TERMINATE:");
             break;
             
-    }
-}
-
-
-//  --------------------------------------------------------------------------
-//  Get/set the message routing_id
-
-zframe_t *
-zsync_msg_routing_id (zsync_msg_t *self)
-{
-    assert (self);
-    return self->routing_id;
-}
-
-void
-zsync_msg_set_routing_id (zsync_msg_t *self, zframe_t *routing_id)
-{
-    if (self->routing_id)
-        zframe_destroy (&self->routing_id);
-    self->routing_id = zframe_dup (routing_id);
-}
-
-
-//  --------------------------------------------------------------------------
-//  Get/set the zsync_msg id
-
-int
-zsync_msg_id (zsync_msg_t *self)
-{
-    assert (self);
-    return self->id;
-}
-
-void
-zsync_msg_set_id (zsync_msg_t *self, int id)
-{
-    self->id = id;
-}
-
-//  --------------------------------------------------------------------------
-//  Return a printable command string
-
-char *
-zsync_msg_command (zsync_msg_t *self)
-{
-    assert (self);
-    switch (self->id) {
-        case ZSYNC_MSG_REQ_STATE:
-            return ("REQ_STATE");
+        case ZSYNC_MSG_CHUNK_FRAME:
+            puts ("CHUNK_FRAME:");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    sequence=%ld\n", (long) self->sequence);
+            printf ("    offset=%ld\n", (long) self->offset);
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
             break;
-        case ZSYNC_MSG_RES_STATE:
-            return ("RES_STATE");
+            
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            puts ("RES_CHUNK_FRAME:");
+            printf ("    sequence=%ld\n", (long) self->sequence);
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_MSG_WEIGHT:
+            puts ("WEIGHT:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            printf ("    weight=%ld\n", (long) self->weight);
+            break;
+            
+        case ZSYNC_MSG_REQ_DELTA:
+            puts ("REQ_DELTA:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    size=%ld\n", (long) self->size);
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_MSG_DELTA:
+            puts ("DELTA:");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    sequence=%ld\n", (long) self->sequence);
+            printf ("    offset=%ld\n", (long) self->offset);
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_MSG_REQ_MANIFEST:
+            puts ("REQ_MANIFEST:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            printf ("    files={");
+            if (self->files) {
+                char *files = (char *) zlist_first (self->files);
+                while (files) {
+                    printf (" '%s'", files);
+                    files = (char *) zlist_next (self->files);
+                }
+            }
+            printf (" }\n");
+            break;
+            
+        case ZSYNC_MSG_MANIFEST:
+            puts ("MANIFEST:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_MSG_REQ_RANGES:
+            puts ("REQ_RANGES:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    size=%ld\n", (long) self->size);
+            printf ("    frame={\n");
+            if (self->frame)
+                zframe_print (self->frame, NULL);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+        case ZSYNC_MSG_PERSISTED:
+            puts ("PERSISTED:");
+            if (self->path)
+                printf ("    path='%s'\n", self->path);
+            else
+                printf ("    path=\n");
+            printf ("    offset=%ld\n", (long) self->offset);
+            printf ("    size=%ld\n", (long) self->size);
+            break;
+            
+        case ZSYNC_MSG_UPLOAD_RATE:
+            puts ("UPLOAD_RATE:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            printf ("    rate=%ld\n", (long) self->rate);
+            break;
+            
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            puts ("DOWNLOAD_RATE:");
+            if (self->receiver)
+                printf ("    receiver='%s'\n", self->receiver);
+            else
+                printf ("    receiver=\n");
+            printf ("    rate=%ld\n", (long) self->rate);
+            break;
+            
+        case ZSYNC_MSG_RES_UPDATE:
+            puts ("RES_UPDATE:");
+            if (self->sender)
+                printf ("    sender='%s'\n", self->sender);
+            else
+                printf ("    sender=\n");
+            printf ("    update_msg={\n");
+            if (self->update_msg)
+                zmsg_dump (self->update_msg);
+            else
+                printf ("(NULL)\n");
+            printf ("    }\n");
+            break;
+            
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the message routing_id
+
+zframe_t *
+zsync_msg_routing_id (zsync_msg_t *self)
+{
+    assert (self);
+    return self->routing_id;
+}
+
+void
+zsync_msg_set_routing_id (zsync_msg_t *self, zframe_t *routing_id)
+{
+    if (self->routing_id)
+        zframe_destroy (&self->routing_id);
+    self->routing_id = zframe_dup (routing_id);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the zsync_msg id
+
+int
+zsync_msg_id (zsync_msg_t *self)
+{
+    assert (self);
+    return self->id;
+}
+
+void
+zsync_msg_set_id (zsync_msg_t *self, int id)
+{
+    self->id = id;
+}
+
+//  --------------------------------------------------------------------------
+//  Return a printable command string
+
+char *
+zsync_msg_command (zsync_msg_t *self)
+{
+    assert (self);
+    switch (self->id) {
+        case ZSYNC_MSG_REQ_STATE:
+            return ("REQ_STATE");
+            break;
+        case ZSYNC_MSG_RES_STATE:
+            return ("RES_STATE");
             break;
         case ZSYNC_MSG_REQ_UPDATE:
             return ("REQ_UPDATE");
@@ -1100,6 +1979,42 @@ zsync_msg_command (zsync_msg_t *self)
         case ZSYNC_MSG_TERMINATE:
             return ("TERMINATE");
             break;
+        case ZSYNC_MSG_CHUNK_FRAME:
+            return ("CHUNK_FRAME");
+            break;
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            return ("RES_CHUNK_FRAME");
+            break;
+        case ZSYNC_MSG_WEIGHT:
+            return ("WEIGHT");
+            break;
+        case ZSYNC_MSG_REQ_DELTA:
+            return ("REQ_DELTA");
+            break;
+        case ZSYNC_MSG_DELTA:
+            return ("DELTA");
+            break;
+        case ZSYNC_MSG_REQ_MANIFEST:
+            return ("REQ_MANIFEST");
+            break;
+        case ZSYNC_MSG_MANIFEST:
+            return ("MANIFEST");
+            break;
+        case ZSYNC_MSG_REQ_RANGES:
+            return ("REQ_RANGES");
+            break;
+        case ZSYNC_MSG_PERSISTED:
+            return ("PERSISTED");
+            break;
+        case ZSYNC_MSG_UPLOAD_RATE:
+            return ("UPLOAD_RATE");
+            break;
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            return ("DOWNLOAD_RATE");
+            break;
+        case ZSYNC_MSG_RES_UPDATE:
+            return ("RES_UPDATE");
+            break;
     }
     return "?";
 }
@@ -1276,6 +2191,24 @@ zsync_msg_set_size (zsync_msg_t *self, uint64_t size)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Get/set the priority field
+
+byte
+zsync_msg_priority (zsync_msg_t *self)
+{
+    assert (self);
+    return self->priority;
+}
+
+void
+zsync_msg_set_priority (zsync_msg_t *self, byte priority)
+{
+    assert (self);
+    self->priority = priority;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Get/set the path field
 
@@ -1355,60 +2288,437 @@ zsync_msg_set_chunk (zsync_msg_t *self, zchunk_t *chunk)
     self->chunk = chunk;
 }
 
-//  --------------------------------------------------------------------------
-//  Get/set the sequence field
+//  --------------------------------------------------------------------------
+//  Get/set the sequence field
+
+uint64_t
+zsync_msg_sequence (zsync_msg_t *self)
+{
+    assert (self);
+    return self->sequence;
+}
+
+void
+zsync_msg_set_sequence (zsync_msg_t *self, uint64_t sequence)
+{
+    assert (self);
+    self->sequence = sequence;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the frame field
+
+zframe_t *
+zsync_msg_frame (zsync_msg_t *self)
+{
+    assert (self);
+    return self->frame;
+}
+
+//  Get the frame field and transfer ownership to caller
+
+zframe_t *
+zsync_msg_get_frame (zsync_msg_t *self)
+{
+    assert (self);
+    zframe_t *frame = self->frame;
+    self->frame = NULL;
+    return frame;
+}
+
+//  Takes ownership of supplied frame
+void
+zsync_msg_set_frame (zsync_msg_t *self, zframe_t *frame)
+{
+    assert (self);
+    if (self->frame)
+        zframe_destroy (&self->frame);
+    self->frame = frame;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the weight field
+
+uint32_t
+zsync_msg_weight (zsync_msg_t *self)
+{
+    assert (self);
+    return self->weight;
+}
+
+void
+zsync_msg_set_weight (zsync_msg_t *self, uint32_t weight)
+{
+    assert (self);
+    self->weight = weight;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Get/set the rate field
+
+uint64_t
+zsync_msg_rate (zsync_msg_t *self)
+{
+    assert (self);
+    return self->rate;
+}
+
+void
+zsync_msg_set_rate (zsync_msg_t *self, uint64_t rate)
+{
+    assert (self);
+    self->rate = rate;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+int
+zsync_msg_test (bool verbose)
+{
+    printf (" * zsync_msg: ");
+
+    //  @selftest
+    //  Simple create/destroy test
+    zsync_msg_t *self = zsync_msg_new (0);
+    assert (self);
+    zsync_msg_destroy (&self);
+
+    //  Create pair of sockets we can send through
+    zctx_t *ctx = zctx_new ();
+    assert (ctx);
+
+    void *output = zsocket_new (ctx, ZMQ_DEALER);
+    assert (output);
+    zsocket_bind (output, "inproc://selftest");
+    void *input = zsocket_new (ctx, ZMQ_ROUTER);
+    assert (input);
+    zsocket_connect (input, "inproc://selftest");
+    
+    //  Encode/send/decode and verify each message type
+    int instance;
+    zsync_msg_t *copy;
+    self = zsync_msg_new (ZSYNC_MSG_REQ_STATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_RES_STATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_state (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (zsync_msg_state (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_REQ_UPDATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_state (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (zsync_msg_state (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_UPDATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_update_msg (self, zmsg_new ());
+//    zmsg_addstr (zsync_msg_update_msg (self), "Hello, World");
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zmsg_size (zsync_msg_update_msg (self)) == 0);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_REQ_FILES);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_files_append (self, "Name: %s", "Brutus");
+    zsync_msg_files_append (self, "Age: %d", 43);
+    zsync_msg_set_size (self, 123);
+    zsync_msg_set_priority (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_files_size (self) == 2);
+        assert (streq (zsync_msg_files_first (self), "Name: Brutus"));
+        assert (streq (zsync_msg_files_next (self), "Age: 43"));
+        assert (zsync_msg_size (self) == 123);
+        assert (zsync_msg_priority (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_REQ_CHUNK);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_chunk_size (self, 123);
+    zsync_msg_set_offset (self, 123);
+    zsync_msg_set_sequence (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_chunk_size (self) == 123);
+        assert (zsync_msg_offset (self) == 123);
+        assert (zsync_msg_sequence (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_RES_CHUNK);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_chunk (self, zchunk_new ("Captcha Diem", 12));
+    zsync_msg_set_sequence (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
 
-uint64_t
-zsync_msg_sequence (zsync_msg_t *self)
-{
-    assert (self);
-    return self->sequence;
-}
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (memcmp (zchunk_data (zsync_msg_chunk (self)), "Captcha Diem", 12) == 0);
+        assert (zsync_msg_sequence (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_CHUNK);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
 
-void
-zsync_msg_set_sequence (zsync_msg_t *self, uint64_t sequence)
-{
-    assert (self);
-    self->sequence = sequence;
-}
+    zsync_msg_set_chunk (self, zchunk_new ("Captcha Diem", 12));
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_sequence (self, 123);
+    zsync_msg_set_offset (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
 
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (memcmp (zchunk_data (zsync_msg_chunk (self)), "Captcha Diem", 12) == 0);
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_sequence (self) == 123);
+        assert (zsync_msg_offset (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_ABORT);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
 
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
 
-//  --------------------------------------------------------------------------
-//  Selftest
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_TERMINATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
 
-int
-zsync_msg_test (bool verbose)
-{
-    printf (" * zsync_msg: ");
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
 
-    //  @selftest
-    //  Simple create/destroy test
-    zsync_msg_t *self = zsync_msg_new (0);
-    assert (self);
-    zsync_msg_destroy (&self);
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_CHUNK_FRAME);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
 
-    //  Create pair of sockets we can send through
-    zctx_t *ctx = zctx_new ();
-    assert (ctx);
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_sequence (self, 123);
+    zsync_msg_set_offset (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
 
-    void *output = zsocket_new (ctx, ZMQ_DEALER);
-    assert (output);
-    zsocket_bind (output, "inproc://selftest");
-    void *input = zsocket_new (ctx, ZMQ_ROUTER);
-    assert (input);
-    zsocket_connect (input, "inproc://selftest");
-    
-    //  Encode/send/decode and verify each message type
-    int instance;
-    zsync_msg_t *copy;
-    self = zsync_msg_new (ZSYNC_MSG_REQ_STATE);
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_sequence (self) == 123);
+        assert (zsync_msg_offset (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_RES_CHUNK_FRAME);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
+    zsync_msg_set_sequence (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1423,16 +2733,19 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
+        assert (zsync_msg_sequence (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_RES_STATE);
+    self = zsync_msg_new (ZSYNC_MSG_WEIGHT);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
-    zsync_msg_set_state (self, 123);
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_weight (self, 123);
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1447,17 +2760,21 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
-        assert (zsync_msg_state (self) == 123);
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_weight (self) == 123);
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_REQ_UPDATE);
+    self = zsync_msg_new (ZSYNC_MSG_REQ_DELTA);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
-    zsync_msg_set_state (self, 123);
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_size (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1472,19 +2789,23 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
-        assert (zsync_msg_state (self) == 123);
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_size (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_UPDATE);
+    self = zsync_msg_new (ZSYNC_MSG_DELTA);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
-    zsync_msg_set_sender (self, "Life is short but Now lasts for ever");
-    zsync_msg_set_update_msg (self, zmsg_new ());
-//    zmsg_addstr (zsync_msg_update_msg (self), "Hello, World");
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_sequence (self, 123);
+    zsync_msg_set_offset (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1499,11 +2820,13 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
-        assert (streq (zsync_msg_sender (self), "Life is short but Now lasts for ever"));
-        assert (zmsg_size (zsync_msg_update_msg (self)) == 0);
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_sequence (self) == 123);
+        assert (zsync_msg_offset (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_REQ_FILES);
+    self = zsync_msg_new (ZSYNC_MSG_REQ_MANIFEST);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
@@ -1513,7 +2836,6 @@ zsync_msg_test (bool verbose)
     zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
     zsync_msg_files_append (self, "Name: %s", "Brutus");
     zsync_msg_files_append (self, "Age: %d", 43);
-    zsync_msg_set_size (self, 123);
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1532,19 +2854,18 @@ zsync_msg_test (bool verbose)
         assert (zsync_msg_files_size (self) == 2);
         assert (streq (zsync_msg_files_first (self), "Name: Brutus"));
         assert (streq (zsync_msg_files_next (self), "Age: 43"));
-        assert (zsync_msg_size (self) == 123);
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_REQ_CHUNK);
+    self = zsync_msg_new (ZSYNC_MSG_MANIFEST);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
     zsync_msg_set_path (self, "Life is short but Now lasts for ever");
-    zsync_msg_set_chunk_size (self, 123);
-    zsync_msg_set_offset (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1559,19 +2880,22 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
         assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
-        assert (zsync_msg_chunk_size (self) == 123);
-        assert (zsync_msg_offset (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_RES_CHUNK);
+    self = zsync_msg_new (ZSYNC_MSG_REQ_RANGES);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
-    zsync_msg_set_chunk (self, zchunk_new ("Captcha Diem", 12));
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_size (self, 123);
+    zsync_msg_set_frame (self, zframe_new ("Captcha Diem", 12));
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1586,20 +2910,22 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
-        assert (memcmp (zchunk_data (zsync_msg_chunk (self)), "Captcha Diem", 12) == 0);
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_size (self) == 123);
+        assert (zframe_streq (zsync_msg_frame (self), "Captcha Diem"));
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_CHUNK);
+    self = zsync_msg_new (ZSYNC_MSG_PERSISTED);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
-    zsync_msg_set_chunk (self, zchunk_new ("Captcha Diem", 12));
     zsync_msg_set_path (self, "Life is short but Now lasts for ever");
-    zsync_msg_set_sequence (self, 123);
     zsync_msg_set_offset (self, 123);
+    zsync_msg_set_size (self, 123);
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1614,13 +2940,12 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
-        assert (memcmp (zchunk_data (zsync_msg_chunk (self)), "Captcha Diem", 12) == 0);
         assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
-        assert (zsync_msg_sequence (self) == 123);
         assert (zsync_msg_offset (self) == 123);
+        assert (zsync_msg_size (self) == 123);
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_ABORT);
+    self = zsync_msg_new (ZSYNC_MSG_UPLOAD_RATE);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
@@ -1628,7 +2953,7 @@ zsync_msg_test (bool verbose)
     zsync_msg_destroy (&copy);
 
     zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
-    zsync_msg_set_path (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_rate (self, 123);
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1644,16 +2969,46 @@ zsync_msg_test (bool verbose)
         assert (self);
         
         assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
-        assert (streq (zsync_msg_path (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_rate (self) == 123);
         zsync_msg_destroy (&self);
     }
-    self = zsync_msg_new (ZSYNC_MSG_TERMINATE);
+    self = zsync_msg_new (ZSYNC_MSG_DOWNLOAD_RATE);
+    
+    //  Check that _dup works on empty message
+    copy = zsync_msg_dup (self);
+    assert (copy);
+    zsync_msg_destroy (&copy);
+
+    zsync_msg_set_receiver (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_rate (self, 123);
+    //  Send twice from same object
+    zsync_msg_send_again (self, output);
+    zsync_msg_send (&self, output);
+
+    for (instance = 0; instance < 2; instance++) {
+        if (instance == 0) {
+            self = zsync_msg_recv (input);
+        }
+        if (instance == 1) {
+            zclock_sleep (250);     // give time for message to arrive
+            self = zsync_msg_recv_nowait (input);
+        }
+        assert (self);
+        
+        assert (streq (zsync_msg_receiver (self), "Life is short but Now lasts for ever"));
+        assert (zsync_msg_rate (self) == 123);
+        zsync_msg_destroy (&self);
+    }
+    self = zsync_msg_new (ZSYNC_MSG_RES_UPDATE);
     
     //  Check that _dup works on empty message
     copy = zsync_msg_dup (self);
     assert (copy);
     zsync_msg_destroy (&copy);
 
+    zsync_msg_set_sender (self, "Life is short but Now lasts for ever");
+    zsync_msg_set_update_msg (self, zmsg_new ());
+    zmsg_addstr (zsync_msg_update_msg (self), "Hello, World");
     //  Send twice from same object
     zsync_msg_send_again (self, output);
     zsync_msg_send (&self, output);
@@ -1668,6 +3023,8 @@ zsync_msg_test (bool verbose)
         }
         assert (self);
         
+        assert (streq (zsync_msg_sender (self), "Life is short but Now lasts for ever"));
+        assert (zmsg_size (zsync_msg_update_msg (self)) == 1);
         zsync_msg_destroy (&self);
     }
 
@@ -36,6 +36,16 @@
 
 #define UUID_FILE ".zsync_uuid"
 #define PEER_STATES_FILE ".zsync_peer_states"
+#define PEER_JOURNAL_FILE ".zsync_peer_journal"
+#define ANNOUNCED_FILE ".zsync_announced"
+#define RECEIVED_FILE ".zsync_received"
+
+// Interval in ms after which changed peer states and transfer progress
+// are written to disk
+#define JOURNAL_FLUSH_INTERVAL 1000
+
+// Number of chunks per file transfer the agent reads ahead
+#define CHUNKS_IN_FLIGHT 4
 
 struct _zsync_node_t {
     zctx_t *ctx;
@@ -45,10 +55,360 @@ struct _zsync_node_t {
     void *file_pipe;            // Pipe to file manager
     zuuid_t *own_uuid;          // uuid of this node
     zlist_t *peers;
+    zhash_t *peer_index;        // mapping of permanent uuid to zsync peers
+    zsync_journal_t *journal;   // journal of the peer states
+    zsync_progress_t *announced;    // versions of own files sent to peers
+    zsync_progress_t *remote;   // versions of files announced by peers
+    zsync_progress_t *received; // progress of files requested from peers
+    zhash_t *senders;           // uuid of the peer a file is received from
+    int64_t flush_at;           // time to flush journal and progress, 0 if clean
     zhash_t *zyre_peers;        // mapping of zyre id to zsync peers
+    bool group_update_parts;    // all peers in the group accept UPDATE parts
+    byte group_encoding;        // UPDATE encoding understood by all peers
+    zlist_t *agent_queue;       // agent messages received while awaiting a reply
+    zhash_t *zyre_ids;          // mapping of permanent uuid to zyre id
+    zhash_t *chunk_requests;    // REQ_CHUNK sent to agent by their sequence
+    zhash_t *transfers;         // file transfers with outstanding chunks
+    zhash_t *deltas;            // delta encoded file transfers by key
+    zsync_arena_t *arena;       // memory of the message received from zyre
+    zlist_t *update_parts;      // file meta data of UPDATE parts collected into one
+    uint64_t update_state;      // state of the collected UPDATE parts
+    uint64_t chunk_sequence;    // sequence of the last REQ_CHUNK
+    uint64_t chunk_size;        // largest chunk size offered to peers
+    bool adaptive_chunks;       // grow chunks up to the negotiated size
+    bool zero_copy_chunks;      // hand received chunks over as CHUNK_FRAME
     bool terminated;
 };
 
+// A chunk that has been requested from the agent on behalf of a peer
+struct _zsync_chunk_request_t {
+    char *receiver;             // permanent uuid of the receiving peer
+    char *path;
+    char *transfer;             // key of the file transfer
+    uint64_t sequence;          // sequence of the chunk in the file
+    uint64_t chunk_size;
+    uint64_t offset;
+};
+
+// Limits the number of chunks requested from the agent per file transfer
+struct _zsync_transfer_t {
+    int in_flight;              // chunks requested but not yet answered
+    zlist_t *queued;            // chunk requests waiting to be requested
+};
+
+// A file transfer which is encoded as delta. The encoder takes the file as
+// a stream, chunks read ahead of its offset wait until it gets there.
+struct _zsync_delta_transfer_t {
+    zsync_delta_t *encoder;
+    uint64_t offset;            // offset of the next chunk the encoder takes
+    zlist_t *pending;           // chunks read ahead of offset
+};
+
+// A chunk read by the agent waiting for the delta encoder
+struct _zsync_pending_chunk_t {
+    uint64_t offset;
+    uint64_t sequence;
+    bool last;                  // chunk ends the file
+    zframe_t *frame;
+};
+
+typedef struct _zsync_chunk_request_t zsync_chunk_request_t;
+typedef struct _zsync_transfer_t zsync_transfer_t;
+typedef struct _zsync_delta_transfer_t zsync_delta_transfer_t;
+typedef struct _zsync_pending_chunk_t zsync_pending_chunk_t;
+
+static zsync_chunk_request_t *
+zsync_chunk_request_new (zsync_ftm_msg_t *msg)
+{
+    zsync_chunk_request_t *self = 
+        (zsync_chunk_request_t *) zmalloc (sizeof (zsync_chunk_request_t));
+    self->receiver = strdup (zsync_ftm_msg_receiver (msg));
+    self->path = strdup (zsync_ftm_msg_path (msg));
+    self->transfer = (char *) malloc (strlen (self->receiver) + strlen (self->path) + 2);
+    sprintf (self->transfer, "%s/%s", self->receiver, self->path);
+    self->sequence = zsync_ftm_msg_sequence (msg);
+    self->chunk_size = zsync_ftm_msg_chunk_size (msg);
+    self->offset = zsync_ftm_msg_offset (msg);
+    return self;
+}
+
+static void
+zsync_chunk_request_destroy (zsync_chunk_request_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_chunk_request_t *self = *self_p;
+        free (self->receiver);
+        free (self->path);
+        free (self->transfer);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+static zsync_transfer_t *
+zsync_transfer_new ()
+{
+    zsync_transfer_t *self = (zsync_transfer_t *) zmalloc (sizeof (zsync_transfer_t));
+    self->in_flight = 0;
+    self->queued = zlist_new ();
+    return self;
+}
+
+static void
+zsync_transfer_destroy (zsync_transfer_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_transfer_t *self = *self_p;
+        zsync_chunk_request_t *request = zlist_pop (self->queued);
+        while (request) {
+            zsync_chunk_request_destroy (&request);
+            request = zlist_pop (self->queued);
+        }
+        zlist_destroy (&self->queued);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+static zsync_delta_transfer_t *
+zsync_delta_transfer_new (zsync_delta_t *encoder)
+{
+    zsync_delta_transfer_t *self =
+        (zsync_delta_transfer_t *) zmalloc (sizeof (zsync_delta_transfer_t));
+    self->encoder = encoder;
+    self->offset = 0;
+    self->pending = zlist_new ();
+    return self;
+}
+
+static void
+zsync_delta_transfer_destroy (zsync_delta_transfer_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_delta_transfer_t *self = *self_p;
+        zsync_pending_chunk_t *pending = zlist_pop (self->pending);
+        while (pending) {
+            zframe_destroy (&pending->frame);
+            free (pending);
+            pending = zlist_pop (self->pending);
+        }
+        zlist_destroy (&self->pending);
+        zsync_delta_destroy (&self->encoder);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+static void
+s_destroy_chunk_request_item (void *data)
+{
+    zsync_chunk_request_t *request = (zsync_chunk_request_t *) data;
+    zsync_chunk_request_destroy (&request);
+}
+
+static void
+s_destroy_transfer_item (void *data)
+{
+    zsync_transfer_t *transfer = (zsync_transfer_t *) data;
+    zsync_transfer_destroy (&transfer);
+}
+
+static void
+s_fmetadata_list_destroy (zlist_t **list_p)
+{
+    assert (list_p);
+    if (*list_p) {
+        zs_fmetadata_t *meta = zlist_pop (*list_p);
+        while (meta) {
+            zs_fmetadata_destroy (&meta);
+            meta = zlist_pop (*list_p);
+        }
+        zlist_destroy (list_p);
+    }
+}
+
+static void
+s_destroy_delta_item (void *data)
+{
+    zsync_delta_transfer_t *delta = (zsync_delta_transfer_t *) data;
+    zsync_delta_transfer_destroy (&delta);
+}
+
+// Imports the peer states of the text file used by earlier versions into
+// the journal and removes the file afterwards
+
+static void
+zsync_node_import_peers (zsync_node_t *self)
+{
+    assert (self);
+    zhash_t *peer_states = zhash_new ();
+    int rc = zhash_load (peer_states, PEER_STATES_FILE);
+    assert (rc == 0);
+    zlist_t *uuids = zhash_keys (peer_states);
+    char *uuid = zlist_first (uuids);
+    while (uuid) {
+        char *state_str = zhash_lookup (peer_states, uuid);
+        uint64_t state;
+        sscanf (state_str, "%"SCNd64, &state);
+        zsync_journal_append (self->journal, uuid, state);
+        uuid = zlist_next (uuids);
+    }
+    zlist_destroy (&uuids);
+    zhash_destroy (&peer_states);
+    if (zsync_journal_compact (self->journal) == 0)
+        zsys_file_delete (PEER_STATES_FILE);
+}
+
+// Returns the progress key of a file of a peer, caller must free it
+
+static char *
+s_progress_key (char *uuid, char *path)
+{
+    char *key = (char *) malloc (strlen (uuid) + strlen (path) + 2);
+    sprintf (key, "%s/%s", uuid, path);
+    return key;
+}
+
+// Records the file versions of an UPDATE. Updated files are set in
+// progress, deleted and renamed files are removed. If uuid is not NULL
+// files are keyed by the peer's uuid.
+
+static void
+zsync_node_track_update (zsync_progress_t *progress, char *uuid, zlist_t *fmetadata)
+{
+    if (!fmetadata)
+        return;
+    zs_fmetadata_t *meta = zlist_first (fmetadata);
+    while (meta) {
+        char *path = (char *) zs_fmetadata_path_ref (meta);
+        char *key = uuid? s_progress_key (uuid, path): strdup (path);
+        if (zs_fmetadata_operation (meta) == ZS_FILE_OP_UPD)
+            zsync_progress_set (progress, key, zs_fmetadata_checksum (meta), zs_fmetadata_size (meta));
+        else
+            zsync_progress_remove (progress, key);
+        free (key);
+        meta = zlist_next (fmetadata);
+    }
+}
+
+// Records the file versions of an UPDATE from the agent and encodes it
+// for peers. Sets cmd to the command of the UPDATE, ZS_CMD_UPDATE_PART if
+// further parts follow. Returns the encoded message.
+
+static zmsg_t *
+zsync_node_encode_update (zsync_node_t *self, zmsg_t *update_msg, byte encoding, int *cmd)
+{
+    assert (self);
+    *cmd = 0;
+    if (!update_msg)
+        return NULL;
+    zmsg_t *copy = zmsg_dup (update_msg);
+    zs_msg_t *update = zs_msg_unpack (copy);
+    zmsg_destroy (&copy);
+    if (update)
+        *cmd = zs_msg_get_cmd (update);
+    if (*cmd != ZS_CMD_UPDATE && *cmd != ZS_CMD_UPDATE_PART) {
+        zs_msg_destroy (&update);
+        return zmsg_dup (update_msg);
+    }
+    zsync_node_track_update (self->announced, NULL, zs_msg_get_fmetadata (update));
+    zmsg_t *output;
+    if (encoding == ZS_ENCODING_PLAIN)
+        output = zmsg_dup (update_msg);
+    else {
+        output = zmsg_new ();
+        zs_msg_pack_update_encoded (output, *cmd, encoding, zs_msg_get_state (update),
+                                    zs_msg_detach_fmetadata (update));
+    }
+    zs_msg_destroy (&update);
+    return output;
+}
+
+// Records the file versions of an UPDATE or a part of it from the agent and
+// appends its file meta data to fmetadata. Sets state to the state of the
+// UPDATE. Returns the command of the UPDATE, ZS_CMD_UPDATE_PART if further
+// parts follow, or 0 if it isn't an UPDATE.
+
+static int
+zsync_node_collect_update (zsync_node_t *self, zmsg_t *update_msg, zlist_t *fmetadata, uint64_t *state)
+{
+    assert (self);
+    assert (fmetadata);
+    if (!update_msg)
+        return 0;
+    zmsg_t *copy = zmsg_dup (update_msg);
+    zs_msg_t *update = zs_msg_unpack (copy);
+    zmsg_destroy (&copy);
+    int cmd = update? zs_msg_get_cmd (update): 0;
+    if (cmd == ZS_CMD_UPDATE || cmd == ZS_CMD_UPDATE_PART) {
+        zlist_t *part = zs_msg_detach_fmetadata (update);
+        zsync_node_track_update (self->announced, NULL, part);
+        zs_fmetadata_t *meta = part? zlist_pop (part): NULL;
+        while (meta) {
+            zlist_append (fmetadata, meta);
+            meta = zlist_pop (part);
+        }
+        zlist_destroy (&part);
+        *state = zs_msg_get_state (update);
+    }
+    else
+        cmd = 0;
+    zs_msg_destroy (&update);
+    return cmd;
+}
+
+// --------------------------------------------------------------------------
+// Recomputes the features shared by all peers in the group, called when a
+// peer enters, greets or exits. Peers which haven't greeted yet are expected
+// to support the plain UPDATE encoding only and no parts.
+
+static void
+zsync_node_group_refresh (zsync_node_t *self)
+{
+    assert (self);
+    self->group_update_parts = true;
+    self->group_encoding = ZS_ENCODING_COMPACT;
+    zsync_peer_t *peer = (zsync_peer_t *) zhash_first (self->zyre_peers);
+    size_t unknown = zhash_size (self->zyre_peers);
+    while (peer) {
+        if (!zsync_peer_update_parts (peer))
+            self->group_update_parts = false;
+        if (zsync_peer_encoding (peer) < self->group_encoding)
+            self->group_encoding = zsync_peer_encoding (peer);
+        unknown--;
+        peer = (zsync_peer_t *) zhash_next (self->zyre_peers);
+    }
+    // Iteration stops at a peer which hasn't greeted yet
+    if (unknown > 0) {
+        self->group_update_parts = false;
+        self->group_encoding = ZS_ENCODING_PLAIN;
+    }
+}
+
+// Returns true if all peers in the group accept UPDATEs in parts
+
+static bool
+zsync_node_group_update_parts (zsync_node_t *self)
+{
+    assert (self);
+    return self->group_update_parts;
+}
+
+// Returns the UPDATE encoding understood by all peers in the group
+
+static byte
+zsync_node_group_encoding (zsync_node_t *self)
+{
+    assert (self);
+    return self->group_encoding;
+}
+
 static zsync_node_t *
 zsync_node_new ()
 {
@@ -85,22 +445,42 @@ zsync_node_new ()
     
     // Obtain peers and states
     self->peers = zlist_new ();
-    if (zsys_file_exists (PEER_STATES_FILE)) {
-        zhash_t *peer_states = zhash_new ();
-        int rc = zhash_load (peer_states, PEER_STATES_FILE);
-        assert (rc == 0);
-        zlist_t *uuids = zhash_keys (peer_states);
-        char *uuid = zlist_first (uuids);
-        while (uuid) {
-            char * state_str = zhash_lookup (peer_states, uuid);
-            uint64_t state;
-            sscanf (state_str, "%"SCNd64, &state);
-            zlist_append (self->peers, zsync_peer_new (uuid, state)); 
-            uuid = zlist_next (uuids);
-        }
+    self->peer_index = zhash_new ();
+    self->journal = zsync_journal_new (PEER_JOURNAL_FILE);
+    if (zsys_file_exists (PEER_STATES_FILE))
+        zsync_node_import_peers (self);
+    zlist_t *uuids = zsync_journal_uuids (self->journal);
+    char *uuid = zlist_first (uuids);
+    while (uuid) {
+        zsync_peer_t *peer = zsync_peer_new (uuid, zsync_journal_state (self->journal, uuid));
+        zlist_append (self->peers, peer);
+        zhash_insert (self->peer_index, uuid, peer);
+        uuid = zlist_next (uuids);
     }
+    zlist_destroy (&uuids);
+    self->announced = zsync_progress_new (ANNOUNCED_FILE);
+    self->remote = zsync_progress_new (NULL);
+    self->received = zsync_progress_new (RECEIVED_FILE);
+    self->senders = zhash_new ();
+    zhash_autofree (self->senders);
+    self->flush_at = 0;
     
     self->zyre_peers = zhash_new ();
+    self->group_update_parts = true;
+    self->group_encoding = ZS_ENCODING_COMPACT;
+    self->agent_queue = zlist_new ();
+    self->zyre_ids = zhash_new ();
+    zhash_autofree (self->zyre_ids);
+    self->chunk_requests = zhash_new ();
+    self->transfers = zhash_new ();
+    self->deltas = zhash_new ();
+    self->arena = zsync_arena_new (0);
+    self->update_parts = NULL;
+    self->update_state = 0;
+    self->chunk_sequence = 0;
+    self->chunk_size = CHUNK_SIZE;
+    self->adaptive_chunks = false;
+    self->zero_copy_chunks = false;
     self->terminated = false;
     return self;
 }
@@ -117,7 +497,24 @@ zsync_node_destroy (zsync_node_t **self_p)
       
         // TODO destroy all zsync_peers
         zlist_destroy (&self->peers);
+        zhash_destroy (&self->peer_index);
+        zsync_journal_destroy (&self->journal);
+        zsync_progress_destroy (&self->announced);
+        zsync_progress_destroy (&self->remote);
+        zsync_progress_destroy (&self->received);
+        zhash_destroy (&self->senders);
         zhash_destroy (&self->zyre_peers);
+        while (zlist_size (self->agent_queue)) {
+            zsync_msg_t *msg = (zsync_msg_t *) zlist_pop (self->agent_queue);
+            zsync_msg_destroy (&msg);
+        }
+        zlist_destroy (&self->agent_queue);
+        zhash_destroy (&self->zyre_ids);
+        zhash_destroy (&self->chunk_requests);
+        zhash_destroy (&self->transfers);
+        zhash_destroy (&self->deltas);
+        zsync_arena_destroy (&self->arena);
+        s_fmetadata_list_destroy (&self->update_parts);
         zyre_destroy (&self->zyre);
 
         free (self);
@@ -129,52 +526,454 @@ static zsync_peer_t *
 zsync_node_peers_lookup (zsync_node_t *self, char *uuid)
 {
     assert (self);
-    zsync_peer_t *peer = zlist_first (self->peers);
-    while (peer) {
-        if (streq (zsync_peer_uuid (peer), uuid)) {
-            return peer;
-        }
-        peer = zlist_next (self->peers);
+    return (zsync_peer_t *) zhash_lookup (self->peer_index, uuid);
+}
+
+static char *
+zsync_node_zyre_uuid (zsync_node_t *self, char *sender)
+{
+    assert (self);
+    assert (sender);
+    return (char *) zhash_lookup (self->zyre_ids, sender);
+}
+
+// --------------------------------------------------------------------------
+// Forwards credit given by the credit manager to its receiver
+
+static void
+zsync_node_give_credit (zsync_node_t *self, zsync_credit_msg_t *cmsg)
+{
+    assert (self);
+    char *receiver = zsync_credit_msg_receiver (cmsg);
+    char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
+    if (zyre_uuid) {
+        // The credit message is owned by cmsg
+        zmsg_t *credit_msg = zmsg_dup (zsync_credit_msg_credit (cmsg));
+        zyre_whisper (self->zyre, zyre_uuid, &credit_msg);
     }
-    return NULL;
 }
 
-static int
-zsync_node_save_peers (zsync_node_t *self)
+// --------------------------------------------------------------------------
+// Requests credit for size bytes from the credit manager and waits for the
+// credit the receiver may use right away. Credit given to other peers in
+// the meantime is forwarded.
+
+static uint64_t
+zsync_node_request_credit (zsync_node_t *self, char *receiver, uint64_t size, uint64_t chunk_size)
 {
     assert (self);
-    int rc;
-    
-    // Obtain peer state key-values
-    zhash_t *peer_states = zhash_new ();
-        
-    zsync_peer_t *peer = zlist_first (self->peers);
-    while (peer) {
-        char *uuid = zsync_peer_uuid (peer);
-        char state[20];
-        sprintf (state, "%"PRId64, zsync_peer_state (peer));
-        zhash_insert (peer_states, uuid, state); 
-        peer = zlist_next (self->peers);
+    zsync_credit_msg_send_request_credit (self->credit_pipe, receiver, size, chunk_size);
+    uint64_t credit = 0;
+    zsync_credit_msg_t *cmsg = zsync_credit_msg_recv (self->credit_pipe);
+    while (cmsg) {
+        if (zsync_credit_msg_id (cmsg) == ZSYNC_CREDIT_MSG_INITIAL_CREDIT) {
+            credit = zsync_credit_msg_initial_credit (cmsg);
+            zsync_credit_msg_destroy (&cmsg);
+            break;
+        }
+        zsync_node_give_credit (self, cmsg);
+        zsync_credit_msg_destroy (&cmsg);
+        cmsg = zsync_credit_msg_recv (self->credit_pipe);
     }
-    rc = zhash_save (peer_states, PEER_STATES_FILE);
-    return rc;
+    return credit;
 }
 
-static char *
-zsync_node_zyre_uuid (zsync_node_t *self, char *sender)
+// --------------------------------------------------------------------------
+// Requests files from a peer. Files of which a known version has been
+// received partially are resumed at their offset, credit is only
+// requested for the outstanding bytes. The first credit is sent along
+// with the request, as well as the priority at which the peer sends the
+// files. Takes ownership of paths.
+
+static void
+zsync_node_request_files (zsync_node_t *self, char *receiver, zlist_t *paths, uint64_t size, byte priority)
 {
     assert (self);
-    assert (sender);
+    char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
+    if (!zyre_uuid) {
+        zlist_destroy (&paths);
+        return;
+    }
+    size_t count = zlist_size (paths);
+    uint64_t *offsets = (uint64_t *) zmalloc ((count + 1) * sizeof (uint64_t));
+    uint64_t *checksums = (uint64_t *) zmalloc ((count + 1) * sizeof (uint64_t));
+    size_t index = 0;
+    char *path = zlist_first (paths);
+    while (path) {
+        char *key = s_progress_key (receiver, path);
+        uint64_t checksum, file_size;
+        if (zsync_progress_lookup (self->remote, key, &checksum, &file_size, NULL))
+            zsync_progress_set (self->received, key, checksum, file_size);
+        if (zsync_progress_lookup (self->received, key, &checksums [index], NULL, &offsets [index])) {
+            size = size > offsets [index]? size - offsets [index]: 0;
+            if (offsets [index] > 0)
+                printf ("[ND] resume %s at %"PRIu64"\n", path, offsets [index]);
+        }
+        free (key);
+        index++;
+        path = zlist_next (paths);
+    }
+    zsync_peer_t *peer = zsync_node_peers_lookup (self, receiver);
+    uint64_t chunk_size = peer? zsync_peer_chunk_size (peer): CHUNK_SIZE;
+    uint64_t credit = zsync_node_request_credit (self, receiver, size, chunk_size);
+    zmsg_t *zyre_out = zmsg_new ();
+    zs_msg_pack_request_priority (zyre_out, paths, offsets, checksums, credit, priority);
+    zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
+    free (offsets);
+    free (checksums);
+}
+
+// --------------------------------------------------------------------------
+// Requests the files which haven't been received completely from a peer,
+// e.g. after it reconnected. Credit granted before is reset first, chunks
+// which were in flight when the peer left won't arrive anymore.
 
-    zlist_t *keys = zhash_keys (self->zyre_peers);
+static void
+zsync_node_resume_files (zsync_node_t *self, char *receiver)
+{
+    assert (self);
+    zsync_credit_msg_send_abort (self->credit_pipe, receiver);
+    zlist_t *paths = zlist_new ();
+    zlist_autofree (paths);
+    uint64_t size = 0;
+    size_t prefix_len = strlen (receiver);
+    zlist_t *keys = zsync_progress_keys (self->received);
     char *key = zlist_first (keys);
     while (key) {
-        zsync_peer_t *peer = zhash_lookup (self->zyre_peers, key);
-        if (peer && streq (sender, zsync_peer_uuid (peer))) {
-           return key;
+        uint64_t file_size;
+        if (strncmp (key, receiver, prefix_len) == 0 && key [prefix_len] == '/'
+        &&  zsync_progress_lookup (self->received, key, NULL, &file_size, NULL)) {
+            zlist_append (paths, key + prefix_len + 1);
+            size += file_size;
         }
         key = zlist_next (keys);
     }
+    zlist_destroy (&keys);
+    if (zlist_size (paths) > 0)
+        zsync_node_request_files (self, receiver, paths, size, ZSYNC_PRIORITY_BULK);
+    else
+        zlist_destroy (&paths);
+}
+
+// --------------------------------------------------------------------------
+// Requests a chunk from the agent without waiting for the response. Only
+// CHUNKS_IN_FLIGHT chunks per file transfer are requested at once, further
+// chunks are queued until a response for that file transfer arrives.
+
+static void
+zsync_node_request_chunk (zsync_node_t *self, zsync_chunk_request_t *request)
+{
+    assert (self);
+    assert (request);
+
+    zsync_transfer_t *transfer = zhash_lookup (self->transfers, request->transfer);
+    if (!transfer) {
+        transfer = zsync_transfer_new ();
+        zhash_insert (self->transfers, request->transfer, transfer);
+        zhash_freefn (self->transfers, request->transfer, s_destroy_transfer_item);
+    }
+    if (transfer->in_flight >= CHUNKS_IN_FLIGHT) {
+        zlist_append (transfer->queued, request);
+        return;
+    }
+    transfer->in_flight++;
+
+    char sequence [21];
+    sprintf (sequence, "%"PRIu64, ++self->chunk_sequence);
+    zhash_insert (self->chunk_requests, sequence, request);
+    zhash_freefn (self->chunk_requests, sequence, s_destroy_chunk_request_item);
+    zsync_msg_send_req_chunk (self->zsync_pipe, request->path, request->chunk_size,
+                              request->offset, self->chunk_sequence);
+}
+
+// --------------------------------------------------------------------------
+// Feeds the chunks of a delta transfer which continue the file to the
+// encoder and whispers the instructions to the receiver. Returns true once
+// the last chunk has been encoded.
+
+static bool
+zsync_node_feed_delta (zsync_node_t *self, zsync_chunk_request_t *request,
+                       zsync_delta_transfer_t *delta)
+{
+    assert (self);
+    assert (request);
+    assert (delta);
+
+    char *zyre_uuid = zsync_node_zyre_uuid (self, request->receiver);
+    zsync_pending_chunk_t *pending = zlist_first (delta->pending);
+    while (pending) {
+        if (pending->offset != delta->offset) {
+            pending = zlist_next (delta->pending);
+            continue;
+        }
+        zlist_remove (delta->pending, pending);
+        uint64_t size = zframe_size (pending->frame);
+        uint64_t offset = zsync_delta_offset (delta->encoder);
+        zframe_t *ops = zsync_delta_feed (delta->encoder, zframe_data (pending->frame), size, pending->last);
+        delta->offset += size;
+        if (zyre_uuid && zsync_delta_offset (delta->encoder) > offset) {
+            zmsg_t *zmsg = zmsg_new ();
+            zs_msg_pack_delta (zmsg, pending->sequence, request->path, offset, ops);
+            zyre_whisper (self->zyre, zyre_uuid, &zmsg);
+        }
+        else
+            zframe_destroy (&ops);
+        bool last = pending->last;
+        zframe_destroy (&pending->frame);
+        free (pending);
+        if (last)
+            return true;
+        // The chunk may be followed by one which is already waiting
+        pending = zlist_first (delta->pending);
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+// Whispers a chunk read by the agent to the peer that requested it. A chunk
+// smaller than requested marks the end of the file, the credit which hasn't
+// been used is given back to the file transfer manager. If the peer asked
+// for a delta the chunk is encoded against its copy of the file first. The
+// encoder takes the file in order, chunks answered ahead of their turn are
+// held back.
+
+static void
+zsync_node_send_chunk (zsync_node_t *self, zsync_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    char sequence [21];
+    sprintf (sequence, "%"PRIu64, zsync_msg_sequence (msg));
+    zsync_chunk_request_t *request = zhash_lookup (self->chunk_requests, sequence);
+    if (!request) {
+        printf ("[ND] unknown chunk %s\n", sequence);
+        return;
+    }
+
+    zframe_t *frame;
+    if (zsync_msg_id (msg) == ZSYNC_MSG_RES_CHUNK_FRAME) {
+        // Whisper the agent's frame without copying it
+        frame = zsync_msg_get_frame (msg);
+    }
+    else {
+        zchunk_t *chunk = zsync_msg_chunk (msg);
+        frame = zframe_new (zchunk_data (chunk), zchunk_size (chunk));
+    }
+    uint64_t chunk_size = zframe_size (frame);
+
+    char *zyre_uuid = zsync_node_zyre_uuid (self, request->receiver);
+    zsync_delta_transfer_t *delta =
+        (zsync_delta_transfer_t *) zhash_lookup (self->deltas, request->transfer);
+    if (delta) {
+        zsync_pending_chunk_t *pending =
+            (zsync_pending_chunk_t *) zmalloc (sizeof (zsync_pending_chunk_t));
+        pending->offset = request->offset;
+        pending->sequence = request->sequence;
+        pending->last = chunk_size < request->chunk_size;
+        pending->frame = frame;
+        zlist_append (delta->pending, pending);
+        if (zsync_node_feed_delta (self, request, delta))
+            zhash_delete (self->deltas, request->transfer);
+    }
+    else
+    if (zyre_uuid && chunk_size > 0) {
+        zmsg_t *zmsg = zmsg_new ();
+        zs_msg_pack_chunk (zmsg, request->sequence, request->path, request->offset, frame);
+        zyre_whisper (self->zyre, zyre_uuid, &zmsg);
+    }
+    else
+        zframe_destroy (&frame);
+
+    zsync_transfer_t *transfer = zhash_lookup (self->transfers, request->transfer);
+    assert (transfer);
+    transfer->in_flight--;
+    if (chunk_size < request->chunk_size) {
+        // End of file, drop queued chunks and return their credit
+        uint64_t unused_credit = request->chunk_size - chunk_size;
+        zsync_chunk_request_t *queued = zlist_pop (transfer->queued);
+        while (queued) {
+            unused_credit += queued->chunk_size;
+            zsync_chunk_request_destroy (&queued);
+            queued = zlist_pop (transfer->queued);
+        }
+        zsync_ftm_msg_send_credit (self->file_pipe, request->receiver, unused_credit);
+        zsync_ftm_msg_send_abort (self->file_pipe, request->receiver, request->path);
+    }
+    zsync_chunk_request_t *next = zlist_pop (transfer->queued);
+    if (next)
+        zsync_node_request_chunk (self, next);
+    else
+    if (transfer->in_flight == 0)
+        zhash_delete (self->transfers, request->transfer);
+    zhash_delete (self->chunk_requests, sequence);
+}
+
+// --------------------------------------------------------------------------
+// Handles a message from the agent and destroys it
+
+static void
+zsync_node_handle_agent (zsync_node_t *self, zsync_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    switch (zsync_msg_id (msg)) {
+        case ZSYNC_MSG_REQ_FILES: {
+            char *receiver = zsync_msg_receiver (msg);
+            printf("[ND] Recv Agent WHISPER REQUEST %s\n", receiver);
+            zsync_node_request_files (self, receiver, zlist_dup (zsync_msg_files (msg)),
+                                      zsync_msg_size (msg), zsync_msg_priority (msg));
+            break;
+        }
+        case ZSYNC_MSG_REQ_DELTA: {
+            char *receiver = zsync_msg_receiver (msg);
+            char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
+            if (zyre_uuid) {
+                zmsg_t *zyre_out = zmsg_new ();
+                zs_msg_pack_request_delta (zyre_out, zsync_msg_path (msg), zsync_msg_get_frame (msg));
+                zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
+                zsync_peer_t *peer = zsync_node_peers_lookup (self, receiver);
+                uint64_t chunk_size = peer? zsync_peer_chunk_size (peer): CHUNK_SIZE;
+                zsync_credit_msg_send_request (self->credit_pipe, receiver, zsync_msg_size (msg), chunk_size);
+            }
+            break;
+        }
+        case ZSYNC_MSG_REQ_MANIFEST: {
+            char *zyre_uuid = zsync_node_zyre_uuid (self, zsync_msg_receiver (msg));
+            if (zyre_uuid) {
+                zmsg_t *zyre_out = zmsg_new ();
+                zs_msg_pack_request_manifest (zyre_out, zlist_dup (zsync_msg_files (msg)));
+                zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
+            }
+            break;
+        }
+        case ZSYNC_MSG_MANIFEST: {
+            char *zyre_uuid = zsync_node_zyre_uuid (self, zsync_msg_receiver (msg));
+            if (zyre_uuid) {
+                zmsg_t *zyre_out = zmsg_new ();
+                zs_msg_pack_manifest (zyre_out, zsync_msg_path (msg), zsync_msg_get_frame (msg));
+                zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
+            }
+            break;
+        }
+        case ZSYNC_MSG_REQ_RANGES: {
+            char *receiver = zsync_msg_receiver (msg);
+            char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
+            if (zyre_uuid) {
+                zmsg_t *zyre_out = zmsg_new ();
+                zs_msg_pack_request_ranges (zyre_out, zsync_msg_path (msg), zsync_msg_get_frame (msg));
+                zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
+                zsync_peer_t *peer = zsync_node_peers_lookup (self, receiver);
+                uint64_t chunk_size = peer? zsync_peer_chunk_size (peer): CHUNK_SIZE;
+                zsync_credit_msg_send_request (self->credit_pipe, receiver, zsync_msg_size (msg), chunk_size);
+            }
+            break;
+        }
+        case ZSYNC_MSG_UPDATE:
+            printf("[ND] Recv Agent SHOUT UPDATE\n");
+            int update_cmd;
+            zmsg_t *zyre_out;
+            // If a peer doesn't accept UPDATEs in parts, the parts are
+            // collected and the group gets them in one UPDATE
+            if (self->update_parts || !zsync_node_group_update_parts (self)) {
+                if (!self->update_parts)
+                    self->update_parts = zlist_new ();
+                update_cmd = zsync_node_collect_update (self, zsync_msg_update_msg (msg),
+                                                        self->update_parts, &self->update_state);
+                if (update_cmd == ZS_CMD_UPDATE_PART)
+                    break;
+                if (update_cmd == ZS_CMD_UPDATE) {
+                    zyre_out = zmsg_new ();
+                    zs_msg_pack_update_encoded (zyre_out, ZS_CMD_UPDATE, zsync_node_group_encoding (self),
+                                                self->update_state, self->update_parts);
+                    self->update_parts = NULL;
+                    zyre_shout (self->zyre, "ZSYNC", &zyre_out);
+                }
+                s_fmetadata_list_destroy (&self->update_parts);
+                break;
+            }
+            zyre_out = zsync_node_encode_update (self, zsync_msg_update_msg (msg),
+                                                 zsync_node_group_encoding (self), &update_cmd);
+            zyre_shout (self->zyre, "ZSYNC", &zyre_out);
+            break;                     
+        case ZSYNC_MSG_RES_CHUNK:
+        case ZSYNC_MSG_RES_CHUNK_FRAME:
+            zsync_node_send_chunk (self, msg);
+            break;
+        case ZSYNC_MSG_WEIGHT:
+            zsync_ftm_msg_send_weight (self->file_pipe, zsync_msg_receiver (msg), zsync_msg_weight (msg));
+            zsync_credit_msg_send_weight (self->credit_pipe, zsync_msg_receiver (msg), zsync_msg_weight (msg));
+            break;
+        case ZSYNC_MSG_UPLOAD_RATE:
+            zsync_ftm_msg_send_rate (self->file_pipe, zsync_msg_receiver (msg), zsync_msg_rate (msg));
+            break;
+        case ZSYNC_MSG_DOWNLOAD_RATE:
+            zsync_credit_msg_send_rate (self->credit_pipe, zsync_msg_receiver (msg), zsync_msg_rate (msg));
+            break;
+        case ZSYNC_MSG_PERSISTED: {
+            zsync_credit_msg_send_persisted (self->credit_pipe, zsync_msg_size (msg));
+            // Files resume after the data written, not after the data received
+            char *path = zsync_msg_path (msg);
+            char *uuid = zhash_lookup (self->senders, path);
+            if (!uuid)
+                break;
+            char *key = s_progress_key (uuid, path);
+            zsync_progress_advance (self->received, key, zsync_msg_offset (msg), zsync_msg_size (msg));
+            if (!zsync_progress_lookup (self->received, key, NULL, NULL, NULL))
+                zhash_delete (self->senders, path);
+            free (key);
+            break;
+        }
+        case ZSYNC_MSG_TERMINATE: {
+            zyre_stop (self->zyre);
+            // terminate file transfer manager
+            zsync_ftm_msg_send_terminate (self->file_pipe);
+            // terminate credit manager
+            zsync_credit_msg_send_terminate (self->credit_pipe);
+            // receive termination confirmation, skip pending chunk requests
+            zsync_ftm_msg_t *ftm_msg = zsync_ftm_msg_recv (self->file_pipe);
+            while (ftm_msg && zsync_ftm_msg_id (ftm_msg) != ZSYNC_FTM_MSG_TERMINATE) {
+                zsync_ftm_msg_destroy (&ftm_msg);
+                ftm_msg = zsync_ftm_msg_recv (self->file_pipe);
+            }
+            zsync_ftm_msg_destroy (&ftm_msg);
+            printf("OK ft\n");
+            zmsg_t *credit_msg = zmsg_recv (self->credit_pipe);
+            zmsg_destroy (&credit_msg);
+            printf("OK cm\n");
+
+            // send shutdown confirmation to agent
+            zsync_msg_send_terminate (self->zsync_pipe);
+            self->terminated = true;
+            break;            
+        }
+    }
+    zsync_msg_destroy (&msg);
+}
+
+// --------------------------------------------------------------------------
+// Waits for the agent to respond with a message of type 'id'. Messages that
+// arrive in the meantime, e.g. requested chunks or UPDATEs for the group,
+// are queued and handled once the current event is done. TERMINATE is
+// handled right away as the agent won't answer anymore.
+// Returns NULL if the node has been terminated or interrupted meanwhile.
+
+static zsync_msg_t *
+zsync_node_agent_reply (zsync_node_t *self, int id)
+{
+    assert (self);
+    while (!self->terminated) {
+        zsync_msg_t *msg = zsync_msg_recv (self->zsync_pipe);
+        if (!msg)
+            return NULL;
+        if (zsync_msg_id (msg) == id)
+            return msg;
+        if (zsync_msg_id (msg) == ZSYNC_MSG_TERMINATE)
+            zsync_node_handle_agent (self, msg);
+        else
+            zlist_append (self->agent_queue, msg);
+    }
     return NULL;
 }
     
@@ -184,8 +983,8 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
     zsync_peer_t *sender;
     char *zyre_sender;
     zuuid_t *sender_uuid;
-    zmsg_t *zyre_in, *zyre_out, *fm_msg;
-    zlist_t *fpaths, *fmetadata;
+    zmsg_t *zyre_in, *zyre_out;
+    zlist_t *fmetadata;
     
     zyre_event_t *event = zyre_event_recv (self->zyre);
     zyre_sender = zyre_event_sender (event); // get tmp uuid
@@ -194,22 +993,41 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
         case ZYRE_EVENT_ENTER:
             printf("[ND] ZS_ENTER: %s\n", zyre_sender);
             zhash_insert (self->zyre_peers, zyre_sender, NULL);
+            zsync_node_group_refresh (self);
             break;        
         case ZYRE_EVENT_JOIN:
             printf ("[ND] ZS_JOIN: %s\n", zyre_sender);
             //  Obtain own current state
             zsync_msg_send_req_state (self->zsync_pipe);
-            zsync_msg_t *msg_state = zsync_msg_recv (self->zsync_pipe);
-            assert (zsync_msg_id (msg_state) == ZSYNC_MSG_RES_STATE);
+            zsync_msg_t *msg_state = zsync_node_agent_reply (self, ZSYNC_MSG_RES_STATE);
+            if (!msg_state)
+                break;
             uint64_t state = zsync_msg_state (msg_state); 
+            zsync_msg_destroy (&msg_state);
             //  Send GREET message
             zyre_out = zmsg_new ();
-            zs_msg_pack_greet (zyre_out, zuuid_data (self->own_uuid), state);
+            zs_msg_pack_greet (zyre_out, zuuid_data (self->own_uuid), state, self->chunk_size,
+                               ZS_ENCODING_COMPACT, ZS_FEATURE_UPDATE_PARTS);
             zyre_whisper (self->zyre, zyre_sender, &zyre_out);
             break;
         case ZYRE_EVENT_LEAVE:
             break;
         case ZYRE_EVENT_EXIT:
+            sender = zhash_lookup (self->zyre_peers, zyre_sender);
+            if (sender) {
+                // Only unbind if the peer hasn't reconnected meanwhile
+                char *zyre_id = zsync_node_zyre_uuid (self, zsync_peer_uuid (sender));
+                if (zyre_id && streq (zyre_id, zyre_sender)) {
+                    zhash_delete (self->zyre_ids, zsync_peer_uuid (sender));
+                    // Stop sending and drop the credit the peer won't use,
+                    // the peer resumes once it's back
+                    zsync_ftm_msg_send_abort (self->file_pipe, zsync_peer_uuid (sender), "");
+                    zsync_credit_msg_send_abort (self->credit_pipe, zsync_peer_uuid (sender));
+                }
+                zsync_peer_set_zyre_state (sender, ZYRE_EVENT_EXIT);
+            }
+            zhash_delete (self->zyre_peers, zyre_sender);
+            zsync_node_group_refresh (self);
             /*
             printf("[ND] ZS_EXIT %s left the house!\n", zyre_sender);
             sender = zhash_lookup (self->zyre_peers, zyre_sender);
@@ -232,7 +1050,12 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
             printf ("[ND] ZS_WHISPER: %s\n", zyre_sender);
             sender = zhash_lookup (self->zyre_peers, zyre_sender);
             zyre_in = zyre_event_msg (event);
-            zs_msg_t *msg = zs_msg_unpack (zyre_in);
+            zs_msg_t *msg = zs_msg_unpack_arena (zyre_in, self->arena);
+            if (!msg) {
+                printf ("[ND] Malformed message from %s\n", zyre_sender);
+                zsync_arena_reset (self->arena);
+                break;
+            }
             switch (zs_msg_get_cmd (msg)) {
                 case ZS_CMD_GREET:
                     // Get perm uuid
@@ -242,10 +1065,26 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
                     if (!sender) {
                         sender = zsync_peer_new (zuuid_str (sender_uuid), 0x0);
                         zlist_append (self->peers, sender);
+                        zhash_insert (self->peer_index, zsync_peer_uuid (sender), sender);
                     } 
                     assert (sender);
                     zhash_update (self->zyre_peers, zyre_sender, sender);
+                    zhash_update (self->zyre_ids, zsync_peer_uuid (sender), zyre_sender);
                     zsync_peer_set_zyre_state (sender, ZYRE_EVENT_JOIN);
+                    // Negotiate chunk size, peers without one use the default
+                    uint64_t peer_chunk_size = zs_msg_get_chunk_size (msg);
+                    if (peer_chunk_size < CHUNK_SIZE)
+                        peer_chunk_size = CHUNK_SIZE;
+                    if (peer_chunk_size > self->chunk_size)
+                        peer_chunk_size = self->chunk_size;
+                    zsync_peer_set_chunk_size (sender, peer_chunk_size);
+                    // Use the best UPDATE encoding both understand
+                    byte peer_encoding = zs_msg_encoding (msg);
+                    zsync_peer_set_encoding (sender, peer_encoding < ZS_ENCODING_COMPACT?
+                                                     peer_encoding: ZS_ENCODING_COMPACT);
+                    zsync_peer_set_update_parts (sender,
+                        (zs_msg_features (msg) & ZS_FEATURE_UPDATE_PARTS) != 0);
+                    zsync_node_group_refresh (self);
                     // Get current state for sender
                     uint64_t remote_current_state = zs_msg_get_state (msg);
                     printf ("[ND] current state: %"PRId64"\n", remote_current_state);
@@ -258,53 +1097,195 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
                         zs_msg_pack_last_state (lmsg, last_state_local);
                         zyre_whisper (self->zyre, zyre_sender, &lmsg);
                     }  
+                    // Resume files which have been received partially
+                    zsync_node_resume_files (self, zsync_peer_uuid (sender));
+                    zuuid_destroy (&sender_uuid);
                     break;
                 case ZS_CMD_LAST_STATE:
                     assert (sender);
-                    zyre_out = zmsg_new ();
                     //  Gets updates from client
                     uint64_t last_state_remote = zs_msg_get_state (msg);
                     zsync_msg_send_req_update (self->zsync_pipe, last_state_remote);
-                    zsync_msg_t *msg_upd = zsync_msg_recv (self->zsync_pipe);
-                    assert (zsync_msg_id (msg_upd) == ZSYNC_MSG_UPDATE);
-                    //  Send UPDATE
-                    zyre_out = zsync_msg_update_msg (msg_upd);
-                    zyre_whisper (self->zyre, zyre_sender, &zyre_out);
+                    //  Send UPDATE, long updates arrive in several parts.
+                    //  Peers which don't accept parts get them in one.
+                    int update_cmd = ZS_CMD_UPDATE_PART;
+                    zlist_t *collected = zsync_peer_update_parts (sender)? NULL: zlist_new ();
+                    uint64_t update_state = 0;
+                    while (update_cmd == ZS_CMD_UPDATE_PART) {
+                        zsync_msg_t *msg_upd = zsync_node_agent_reply (self, ZSYNC_MSG_RES_UPDATE);
+                        if (!msg_upd)
+                            break;
+                        if (collected)
+                            update_cmd = zsync_node_collect_update (self, zsync_msg_update_msg (msg_upd),
+                                                                    collected, &update_state);
+                        else {
+                            zyre_out = zsync_node_encode_update (self, zsync_msg_update_msg (msg_upd),
+                                                                 zsync_peer_encoding (sender), &update_cmd);
+                            zyre_whisper (self->zyre, zyre_sender, &zyre_out);
+                        }
+                        zsync_msg_destroy (&msg_upd);
+                    }
+                    if (collected && update_cmd == ZS_CMD_UPDATE) {
+                        zyre_out = zmsg_new ();
+                        zs_msg_pack_update_encoded (zyre_out, ZS_CMD_UPDATE, zsync_peer_encoding (sender),
+                                                    update_state, collected);
+                        collected = NULL;
+                        zyre_whisper (self->zyre, zyre_sender, &zyre_out);
+                    }
+                    s_fmetadata_list_destroy (&collected);
                     break;
                 case ZS_CMD_UPDATE:
+                case ZS_CMD_UPDATE_PART: {
                     printf ("[ND] UPDATE\n");
                     assert (sender);
                     uint64_t state = zs_msg_get_state (msg);
-                    zsync_peer_set_state (sender, state); 
-                    zsync_node_save_peers (self);
+                    // Parts are passed on as they arrive, the peer's state
+                    // is reached with the last part
+                    bool last = zs_msg_get_cmd (msg) == ZS_CMD_UPDATE;
+                    if (last) {
+                        zsync_peer_set_state (sender, state); 
+                        zsync_journal_append (self->journal, zsync_peer_uuid (sender), state);
+                    }
 
-                    fmetadata = zs_msg_get_fmetadata (msg);
+                    fmetadata = zs_msg_detach_fmetadata (msg);
+                    zsync_node_track_update (self->remote, zsync_peer_uuid (sender), fmetadata);
                     zmsg_t *zsync_msg = zmsg_new ();
-                    zs_msg_pack_update (zsync_msg, zs_msg_get_state (msg), fmetadata);
+                    if (last)
+                        zs_msg_pack_update (zsync_msg, state, fmetadata);
+                    else
+                        zs_msg_pack_update_part (zsync_msg, state, fmetadata);
                     
                     zsync_msg_send_update (self->zsync_pipe, zsync_peer_uuid (sender), zsync_msg);
+                    zmsg_destroy (&zsync_msg);
                     break;
-                case ZS_CMD_REQUEST_FILES:
+                }
+                case ZS_CMD_REQUEST_FILES: {
                     printf ("[ND] REQUEST FILES\n");
-                    fpaths = zs_msg_fpaths (msg);
-                    zmsg_t *fm_msg = zmsg_new ();
-                    zmsg_addstr (fm_msg, zsync_peer_uuid (sender));
-                    zmsg_addstr (fm_msg, "REQUEST");
-                    char *fpath = zs_msg_fpaths_first (msg);
-                    while (fpath) {
-                        zmsg_addstr (fm_msg, fpath);
-                        printf("[ND] %s\n", fpath);
-                        fpath = zs_msg_fpaths_next (msg);
+                    // Files are resumed if the receiver got a prefix of the
+                    // version which is still announced. The announced sizes
+                    // let the file transfer manager send small files first.
+                    zlist_t *paths = zlist_new ();
+                    zlist_t *resumed = zlist_new ();
+                    size_t count = zs_msg_fpaths (msg)? zlist_size (zs_msg_fpaths (msg)): 0;
+                    uint64_t *sizes = (uint64_t *) zmalloc ((count + 1) * sizeof (uint64_t));
+                    char *path = zs_msg_fpaths_first (msg);
+                    while (path) {
+                        uint64_t offset = zs_msg_resume_offset (msg, path);
+                        uint64_t checksum, size;
+                        bool announced = zsync_progress_lookup (self->announced, path, &checksum, &size, NULL);
+                        if (offset > 0 && announced
+                        &&  checksum == zs_msg_resume_checksum (msg, path)
+                        &&  offset < size)
+                            zlist_append (resumed, path);
+                        else {
+                            sizes [zlist_size (paths)] = announced? size: 0;
+                            zlist_append (paths, path);
+                        }
+                        path = zs_msg_fpaths_next (msg);
+                    }
+                    byte priority = zs_msg_get_priority (msg);
+                    zframe_t *size_frame = zframe_new (sizes, zlist_size (paths) * sizeof (uint64_t));
+                    uint64_t max_chunk_size = zsync_peer_chunk_size (sender);
+                    zsync_ftm_msg_send_request (self->file_pipe, zsync_peer_uuid (sender), paths,
+                        self->adaptive_chunks? CHUNK_SIZE: max_chunk_size, max_chunk_size,
+                        priority, size_frame);
+                    zframe_destroy (&size_frame);
+                    free (sizes);
+                    path = zlist_first (resumed);
+                    while (path) {
+                        uint64_t offset = zs_msg_resume_offset (msg, path);
+                        uint64_t size;
+                        zsync_progress_lookup (self->announced, path, NULL, &size, NULL);
+                        uint64_t length = size - offset;
+                        zframe_t *ranges = zsync_cdc_ranges_new (&offset, &length, 1);
+                        zsync_ftm_msg_send_ranges (self->file_pipe, zsync_peer_uuid (sender), path,
+                                                   priority, ranges);
+                        zframe_destroy (&ranges);
+                        path = zlist_next (resumed);
                     }
-                    zmsg_send (&fm_msg, self->file_pipe);
+                    // Start sending right away with the credit of the request
+                    if (zs_msg_get_credit (msg) > 0)
+                        zsync_ftm_msg_send_credit (self->file_pipe, zsync_peer_uuid (sender),
+                                                   zs_msg_get_credit (msg));
+                    zlist_destroy (&paths);
+                    zlist_destroy (&resumed);
                     break;
+                }
+                case ZS_CMD_REQUEST_DELTA: {
+                    printf ("[ND] REQUEST DELTA\n");
+                    char *path = zs_msg_get_file_path (msg);
+                    char *receiver = zsync_peer_uuid (sender);
+                    // Malformed signatures fall back to sending the whole file
+                    zsync_delta_t *encoder = zsync_delta_new (zs_msg_get_chunk (msg));
+                    if (encoder) {
+                        zsync_delta_transfer_t *delta = zsync_delta_transfer_new (encoder);
+                        char *transfer = (char *) malloc (strlen (receiver) + strlen (path) + 2);
+                        sprintf (transfer, "%s/%s", receiver, path);
+                        zhash_update (self->deltas, transfer, delta);
+                        zhash_freefn (self->deltas, transfer, s_destroy_delta_item);
+                        free (transfer);
+                    }
+                    zlist_t *paths = zlist_new ();
+                    zlist_append (paths, path);
+                    uint64_t max_chunk_size = zsync_peer_chunk_size (sender);
+                    zsync_ftm_msg_send_request (self->file_pipe, receiver, paths,
+                        self->adaptive_chunks? CHUNK_SIZE: max_chunk_size, max_chunk_size,
+                        ZSYNC_PRIORITY_BULK, NULL);
+                    zlist_destroy (&paths);
+                    free (path);
+                    break;
+                }
+                case ZS_CMD_SEND_DELTA: {
+                    printf ("[ND] SEND_DELTA (RCV)\n");
+                    zframe_t *ops = zs_msg_get_chunk (msg);
+                    int64_t target_size = zsync_delta_target_size (ops);
+                    if (target_size < 0) {
+                        // The bytes the delta stands for are unknown, stop
+                        // the peer's transfers and return their credit
+                        printf ("[ND] malformed delta, abort\n");
+                        zyre_out = zmsg_new ();
+                        zs_msg_pack_abort (zyre_out);
+                        zyre_whisper (self->zyre, zyre_sender, &zyre_out);
+                        zsync_credit_msg_send_abort (self->credit_pipe, zsync_peer_uuid (sender));
+                        break;
+                    }
+                    zsync_credit_msg_send_update (self->credit_pipe, zsync_peer_uuid (sender), target_size);
+                    char *path = zs_msg_get_file_path (msg);
+                    zhash_update (self->senders, path, zsync_peer_uuid (sender));
+                    zsync_msg_send_delta (self->zsync_pipe, path, zs_msg_get_sequence (msg),
+                                          zs_msg_get_offset (msg), ops);
+                    free (path);
+                    break;
+                }
+                case ZS_CMD_REQUEST_MANIFEST:
+                    printf ("[ND] REQUEST MANIFEST\n");
+                    zsync_msg_send_req_manifest (self->zsync_pipe, zsync_peer_uuid (sender), zs_msg_fpaths (msg));
+                    break;
+                case ZS_CMD_SEND_MANIFEST: {
+                    printf ("[ND] SEND_MANIFEST (RCV)\n");
+                    char *path = zs_msg_get_file_path (msg);
+                    zsync_msg_send_manifest (self->zsync_pipe, zsync_peer_uuid (sender), path, zs_msg_get_chunk (msg));
+                    free (path);
+                    break;
+                }
+                case ZS_CMD_REQUEST_RANGES: {
+                    printf ("[ND] REQUEST RANGES\n");
+                    char *path = zs_msg_get_file_path (msg);
+                    uint64_t max_chunk_size = zsync_peer_chunk_size (sender);
+                    // An empty request sets the chunk size for the ranges
+                    zlist_t *paths = zlist_new ();
+                    zsync_ftm_msg_send_request (self->file_pipe, zsync_peer_uuid (sender), paths,
+                        self->adaptive_chunks? CHUNK_SIZE: max_chunk_size, max_chunk_size,
+                        ZSYNC_PRIORITY_BULK, NULL);
+                    zlist_destroy (&paths);
+                    zsync_ftm_msg_send_ranges (self->file_pipe, zsync_peer_uuid (sender), path,
+                                               ZSYNC_PRIORITY_BULK, zs_msg_get_chunk (msg));
+                    free (path);
+                    break;
+                }
                 case ZS_CMD_GIVE_CREDIT:
                     printf("[ND] GIVE CREDIT\n");
-                    fm_msg = zmsg_new ();
-                    zmsg_addstr (fm_msg, zsync_peer_uuid (sender));
-                    zmsg_addstr (fm_msg, "CREDIT");
-                    zmsg_addstrf (fm_msg, "%"PRId64, zs_msg_get_credit (msg));
-                    zmsg_send (&fm_msg, self->file_pipe);
+                    zsync_ftm_msg_send_credit (self->file_pipe, zsync_peer_uuid (sender), zs_msg_get_credit (msg));
                     break;
                 case ZS_CMD_SEND_CHUNK:
                     printf("[ND] SEND_CHUNK (RCV)\n");
@@ -312,17 +1293,31 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
                     zframe_t *zframe = zs_msg_get_chunk (msg);
                     uint64_t chunk_size = zframe_size (zframe);
                     zsync_credit_msg_send_update (self->credit_pipe, zsync_peer_uuid (sender), chunk_size);
-                    // Pass chunk to client
-                    byte *data = zframe_data (zframe);
-                    zchunk_t *chunk = zchunk_new (data, chunk_size);
+                    // Pass chunk to client. In zero-copy mode the received
+                    // frame is handed over as is, otherwise it's copied
+                    // into a CHUNK for agents which don't know CHUNK_FRAME.
+                    // Progress advances once the agent reports the chunk written
                     char *path = zs_msg_get_file_path (msg);
-                    uint64_t seq = zs_msg_get_sequence (msg);
-                    uint64_t off = zs_msg_get_offset (msg);
-                    zsync_msg_send_chunk (self->zsync_pipe, chunk, path, seq, off);
+                    zhash_update (self->senders, path, zsync_peer_uuid (sender));
+                    zsync_msg_t *chunk_msg;
+                    if (self->zero_copy_chunks) {
+                        chunk_msg = zsync_msg_new (ZSYNC_MSG_CHUNK_FRAME);
+                        zsync_msg_set_frame (chunk_msg, zs_msg_detach_chunk (msg));
+                    }
+                    else {
+                        chunk_msg = zsync_msg_new (ZSYNC_MSG_CHUNK);
+                        zsync_msg_set_chunk (chunk_msg, zchunk_new (zframe_data (zframe), chunk_size));
+                    }
+                    zsync_msg_set_path (chunk_msg, "%s", path);
+                    zsync_msg_set_sequence (chunk_msg, zs_msg_get_sequence (msg));
+                    zsync_msg_set_offset (chunk_msg, zs_msg_get_offset (msg));
+                    zsync_msg_send (&chunk_msg, self->zsync_pipe);
+                    free (path);
                     break;
                 case ZS_CMD_ABORT:
-                    // TODO abort protocol managed file transfer
                     printf("[ND] ABORT\n");
+                    zsync_ftm_msg_send_abort (self->file_pipe, zsync_peer_uuid (sender), "");
+                    zsync_credit_msg_send_abort (self->credit_pipe, zsync_peer_uuid (sender));
                     break;
                 default:
                     assert (false);
@@ -330,6 +1325,7 @@ zsync_node_recv_from_zyre (zsync_node_t *self)
             }
             
             zs_msg_destroy (&msg);
+            zsync_arena_reset (self->arena);
             break;
         default:
             printf("[ND] Error command not found\n");
@@ -343,44 +1339,22 @@ zsync_node_recv_from_agent (zsync_node_t *self)
 {
     assert (self);
     zsync_msg_t *msg = zsync_msg_recv (self->zsync_pipe);
-    switch (zsync_msg_id (msg)) {
-        case ZSYNC_MSG_REQ_FILES: {
-            char *receiver = zsync_msg_receiver (msg);
-            char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
-            if (zyre_uuid) {
-                uint64_t size = zsync_msg_size (msg);
-                printf("[ND] Recv Agent WHISPER REQUEST %s ; %s\n", zyre_uuid, receiver);
-                zmsg_t *zyre_out = zmsg_new ();
-                zs_msg_pack_request_files (zyre_out, zsync_msg_files (msg));
-                zyre_whisper (self->zyre, zyre_uuid, &zyre_out);
-                zsync_credit_msg_send_request (self->credit_pipe, zyre_uuid, size);
-            }
-            break;
-        }
-        case ZSYNC_MSG_UPDATE:
-            printf("[ND] Recv Agent SHOUT UPDATE\n");
-            zmsg_t *zyre_out = zsync_msg_update_msg (msg);
-            zyre_shout (self->zyre, "ZSYNC", &zyre_out);
-            break;                     
-        case ZSYNC_MSG_TERMINATE:
-            zyre_stop (self->zyre);
-            // terminate file transfer manager
-            zsync_ftm_msg_send_terminate (self->file_pipe);
-            // terminate credit manager
-            zsync_credit_msg_send_terminate (self->credit_pipe);
-            // receive termination confirmation
-            msg = zsync_msg_recv (self->file_pipe);
-            zsync_msg_destroy (&msg);
-            printf("OK ft\n");
-            msg = zsync_msg_recv (self->credit_pipe);
-            zsync_msg_destroy (&msg);
-            printf("OK cm\n");
+    if (msg)
+        zsync_node_handle_agent (self, msg);
+}
 
-            // send shutdown confirmation to agent
-            zsync_msg_send_terminate (self->zsync_pipe);
-            self->terminated = true;
-            break;            
+static void
+zsync_node_recv_from_ftmanager (zsync_node_t *self)
+{
+    assert (self);
+    zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (self->file_pipe);
+    if (!msg)
+        return;
+    if (zsync_ftm_msg_id (msg) == ZSYNC_FTM_MSG_CHUNK) {
+        // Request chunk, agent responds asynchronously
+        zsync_node_request_chunk (self, zsync_chunk_request_new (msg));
     }
+    zsync_ftm_msg_destroy (&msg);
 }
 
 
@@ -392,6 +1366,12 @@ zsync_node_engine (void *args, zctx_t *ctx, void *pipe)
     self->ctx = ctx;
     self->zyre = zyre_new (ctx);
     self->zsync_pipe = pipe;
+    if (args) {
+        zsync_t *zsync = (zsync_t *) args;
+        self->chunk_size = zsync_chunk_size (zsync);
+        self->adaptive_chunks = zsync_adaptive_chunks (zsync);
+        self->zero_copy_chunks = zsync_zero_copy_chunks (zsync);
+    }
     
     // Join group
     rc = zyre_join (self->zyre, "ZSYNC");
@@ -406,13 +1386,31 @@ zsync_node_engine (void *args, zctx_t *ctx, void *pipe)
     self->file_pipe = zthread_fork (self->ctx, zsync_ftmanager_engine, NULL);
     zpoller_add (poller, self->file_pipe);
     // Create thread for credit management
-    self->credit_pipe = zthread_fork (self->ctx, zsync_credit_manager_engine, NULL);
+    self->credit_pipe = zthread_fork (self->ctx, zsync_credit_manager_engine, args);
     zpoller_add (poller, self->credit_pipe);
 
     // Start receiving messages
     printf("[ND] started\n");
     while (!zpoller_terminated (poller)) {
-        void *which = zpoller_wait (poller, -1);
+        //  Changed peer states and progress are written in batches
+        int timeout = -1;
+        if (zsync_journal_dirty (self->journal)
+        ||  zsync_progress_dirty (self->announced)
+        ||  zsync_progress_dirty (self->received)) {
+            if (!self->flush_at)
+                self->flush_at = zclock_time () + JOURNAL_FLUSH_INTERVAL;
+            timeout = (int) (self->flush_at - zclock_time ());
+            if (timeout < 0)
+                timeout = 0;
+        }
+        void *which = zpoller_wait (poller, timeout);
+        
+        if (self->flush_at && zclock_time () >= self->flush_at) {
+            zsync_journal_flush (self->journal);
+            zsync_progress_flush (self->announced);
+            zsync_progress_flush (self->received);
+            self->flush_at = 0;
+        }
         
         if (which == zyre_socket (self->zyre)) {
             zsync_node_recv_from_zyre (self);
@@ -425,40 +1423,19 @@ zsync_node_engine (void *args, zctx_t *ctx, void *pipe)
         else
         if (which == self->file_pipe) {
             printf("[ND] Recv FT Manager\n");
-            zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (self->file_pipe);
-            char *receiver = zsync_ftm_msg_receiver (msg);
-            char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
-            if (zyre_uuid) {
-                char *path = zsync_ftm_msg_path (msg);
-                uint64_t sequence = zsync_ftm_msg_sequence (msg);
-                uint64_t chunk_size = zsync_ftm_msg_chunk_size (msg);
-                uint64_t offset = zsync_ftm_msg_offset (msg);
-                zsync_msg_send_req_chunk (pipe, path, chunk_size, offset);
-                zsync_msg_t *zsmsg = zsync_msg_recv (pipe);
-                zchunk_t *chunk = zsync_msg_chunk (zsmsg);
-                zframe_t *frame = zframe_new (zchunk_data (chunk), zchunk_size (chunk));
-
-                zmsg_t *zmsg = zmsg_new ();
-                zs_msg_pack_chunk (zmsg, sequence, path, offset, frame);
-                
-                zyre_whisper (self->zyre, zyre_uuid, &zmsg);
-                zsync_ftm_msg_destroy (&msg);
-                zsync_msg_destroy (&zsmsg);
-            }
+            zsync_node_recv_from_ftmanager (self);
         }
         else
         if (which == self->credit_pipe) {
             printf("[ND] Recv Credit Manager\n");
             zsync_credit_msg_t *cmsg = zsync_credit_msg_recv (self->credit_pipe);
-            char *receiver = zsync_credit_msg_receiver (cmsg);
-            char *zyre_uuid = zsync_node_zyre_uuid (self, receiver);
-            if (zyre_uuid) {
-                zmsg_t *credit_msg = zsync_credit_msg_credit (cmsg);
-                assert (rc == 0);
-                zyre_whisper (self->zyre, zyre_uuid, &credit_msg);
-            }
+            if (cmsg)
+                zsync_node_give_credit (self, cmsg);
             zsync_credit_msg_destroy (&cmsg);
         }
+        //  Agent messages which arrived while waiting for a reply
+        while (!self->terminated && zlist_size (self->agent_queue))
+            zsync_node_handle_agent (self, (zsync_msg_t *) zlist_pop (self->agent_queue));
         if (self->terminated) {
             break;
         }
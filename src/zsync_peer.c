@@ -35,6 +35,9 @@ struct _zsync_peer_t {
     char *uuid;
     uint64_t state;
     int zyre_state;
+    uint64_t chunk_size;    // chunk size negotiated with this peer
+    byte encoding;          // UPDATE encoding negotiated with this peer
+    bool update_parts;      // peer accepts UPDATEs in parts
 };
 
 
@@ -50,6 +53,9 @@ zsync_peer_new (char *uuid, uint64_t state)
     strcpy (self->uuid, uuid);
     self->zyre_state = 0;
     self->state = state;
+    self->chunk_size = CHUNK_SIZE;
+    self->encoding = ZS_ENCODING_PLAIN;
+    self->update_parts = false;
     return self;
 }
 
@@ -121,3 +127,62 @@ zsync_peer_zyre_state (zsync_peer_t *self)
     return self->zyre_state;
 }
 
+// --------------------------------------------------------------------------
+// Returns the chunk size negotiated with this peer
+
+uint64_t
+zsync_peer_chunk_size (zsync_peer_t *self)
+{
+    assert (self);
+    return self->chunk_size;
+}
+
+// --------------------------------------------------------------------------
+// Sets the chunk size negotiated with this peer
+
+void
+zsync_peer_set_chunk_size (zsync_peer_t *self, uint64_t chunk_size)
+{
+    assert (self);
+    self->chunk_size = chunk_size;
+}
+
+// --------------------------------------------------------------------------
+// Returns the UPDATE encoding negotiated with this peer
+
+byte
+zsync_peer_encoding (zsync_peer_t *self)
+{
+    assert (self);
+    return self->encoding;
+}
+
+// --------------------------------------------------------------------------
+// Sets the UPDATE encoding negotiated with this peer
+
+void
+zsync_peer_set_encoding (zsync_peer_t *self, byte encoding)
+{
+    assert (self);
+    self->encoding = encoding;
+}
+
+// --------------------------------------------------------------------------
+// Returns whether this peer accepts UPDATEs in parts
+
+bool
+zsync_peer_update_parts (zsync_peer_t *self)
+{
+    assert (self);
+    return self->update_parts;
+}
+
+// --------------------------------------------------------------------------
+// Sets whether this peer accepts UPDATEs in parts
+
+void
+zsync_peer_set_update_parts (zsync_peer_t *self, bool update_parts)
+{
+    assert (self);
+    self->update_parts = update_parts;
+}
@@ -0,0 +1,463 @@
+/* =========================================================================
+    zsync_progress - progress of file transfers
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync progress of file transfers
+
+@discuss
+    Records the version of a file, its checksum and size, and up to which
+    offset it has been transferred. A node keeps the versions of its files
+    it announced to peers and the progress of every file it requested, so
+    that a transfer continues where it left off after a peer reconnected
+    or the node restarted, as long as the file is still the same version.
+
+    The progress is a zsync_recordlog with one record per changed file,
+    whose payload is:
+
+        key length      2 bytes, network byte order
+        key             key length bytes
+        checksum        8 bytes, network byte order
+        size            8 bytes, network byte order
+        offset          8 bytes, network byte order
+
+    A record with the key only removes the file. Changes are buffered in
+    memory and written in batches by flush, which syncs the file before
+    returning. On startup the log is replayed, the last record of a file
+    wins. Once the file holds many superseded records it is compacted into
+    one record per file.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define PROGRESS_MAGIC "ZSP1"
+
+// Largest key and record payload: length, key, checksum, size and offset
+#define KEY_MAX 0xFFFF
+#define PAYLOAD_MAX (2 + KEY_MAX + 3 * 8)
+
+struct _zsync_progress_t {
+    zsync_recordlog_t *log;     // file to store the progress in, or NULL
+    zhash_t *entries;           // progress by key
+    zhash_t *pending;           // keys changed since the last flush
+    byte *buffer;               // record payload being written
+};
+
+// Version and progress of a file
+typedef struct {
+    uint64_t checksum;
+    uint64_t size;
+    uint64_t offset;
+} s_entry_t;
+
+static void
+s_touch (zsync_progress_t *self, char *key)
+{
+    if (self->log && !zhash_lookup (self->pending, key))
+        zhash_insert (self->pending, key, self);
+}
+
+static void
+s_insert (zsync_progress_t *self, char *key, uint64_t checksum, uint64_t size, uint64_t offset)
+{
+    s_entry_t *entry = (s_entry_t *) zmalloc (sizeof (s_entry_t));
+    entry->checksum = checksum;
+    entry->size = size;
+    entry->offset = offset;
+    zhash_delete (self->entries, key);
+    zhash_insert (self->entries, key, entry);
+    zhash_freefn (self->entries, key, free);
+}
+
+static byte *
+s_put_uint64 (byte *needle, uint64_t value)
+{
+    int shift;
+    for (shift = 56; shift >= 0; shift -= 8)
+        *needle++ = (byte) (value >> shift);
+    return needle;
+}
+
+static byte *
+s_get_uint64 (byte *needle, uint64_t *value)
+{
+    *value = 0;
+    int index;
+    for (index = 0; index < 8; index++)
+        *value = (*value << 8) | *needle++;
+    return needle;
+}
+
+// Encodes the record of a file into the buffer, returns its size or 0 if
+// the key is too long to be stored
+static size_t
+s_record_encode (zsync_progress_t *self, const char *key)
+{
+    size_t key_size = strlen (key);
+    if (key_size > KEY_MAX)
+        return 0;
+    byte *needle = self->buffer;
+    *needle++ = (byte) (key_size >> 8);
+    *needle++ = (byte) key_size;
+    memcpy (needle, key, key_size);
+    needle += key_size;
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, key);
+    if (entry) {
+        needle = s_put_uint64 (needle, entry->checksum);
+        needle = s_put_uint64 (needle, entry->size);
+        needle = s_put_uint64 (needle, entry->offset);
+    }
+    return needle - self->buffer;
+}
+
+// Decodes a record payload during replay
+static int
+s_progress_replay (byte *payload, size_t size, void *arg)
+{
+    zsync_progress_t *self = (zsync_progress_t *) arg;
+    if (size < 2)
+        return -1;
+    size_t key_size = ((size_t) payload [0] << 8) | payload [1];
+    if (size != 2 + key_size && size != 2 + key_size + 3 * 8)
+        return -1;
+    char *key = (char *) malloc (key_size + 1);
+    memcpy (key, payload + 2, key_size);
+    key [key_size] = 0;
+    if (size == 2 + key_size)
+        zhash_delete (self->entries, key);
+    else {
+        uint64_t checksum, file_size, offset;
+        byte *needle = payload + 2 + key_size;
+        needle = s_get_uint64 (needle, &checksum);
+        needle = s_get_uint64 (needle, &file_size);
+        s_get_uint64 (needle, &offset);
+        s_insert (self, key, checksum, file_size, offset);
+    }
+    free (key);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Constructor
+
+zsync_progress_t *
+zsync_progress_new (const char *path)
+{
+    zsync_progress_t *self = (zsync_progress_t *) zmalloc (sizeof (zsync_progress_t));
+    self->entries = zhash_new ();
+    self->pending = zhash_new ();
+    if (path) {
+        self->buffer = (byte *) malloc (PAYLOAD_MAX);
+        self->log = zsync_recordlog_new (path, PROGRESS_MAGIC, PAYLOAD_MAX, s_progress_replay, self);
+    }
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destructor
+
+void
+zsync_progress_destroy (zsync_progress_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zsync_progress_t *self = *self_p;
+        zsync_progress_flush (self);
+        zsync_recordlog_destroy (&self->log);
+        zhash_destroy (&self->pending);
+        zhash_destroy (&self->entries);
+        free (self->buffer);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Sets the version of a file, the offset is kept for the same version
+
+void
+zsync_progress_set (zsync_progress_t *self, char *key, uint64_t checksum, uint64_t size)
+{
+    assert (self);
+    assert (key);
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, key);
+    if (entry && entry->checksum == checksum && entry->size == size)
+        return;
+    s_insert (self, key, checksum, size, 0);
+    s_touch (self, key);
+}
+
+
+// --------------------------------------------------------------------------
+// Advances the offset of a file if data at offset continues it
+
+bool
+zsync_progress_advance (zsync_progress_t *self, char *key, uint64_t offset, uint64_t size)
+{
+    assert (self);
+    assert (key);
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, key);
+    if (!entry || size == 0)
+        return false;
+    //  The sender starts over if it couldn't resume
+    if (offset == 0)
+        entry->offset = 0;
+    if (entry->offset != offset)
+        return false;
+    entry->offset += size;
+    if (entry->offset >= entry->size)
+        zhash_delete (self->entries, key);
+    s_touch (self, key);
+    return true;
+}
+
+
+// --------------------------------------------------------------------------
+// Gets version and offset of a file
+
+bool
+zsync_progress_lookup (zsync_progress_t *self, char *key,
+                       uint64_t *checksum, uint64_t *size, uint64_t *offset)
+{
+    assert (self);
+    assert (key);
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, key);
+    if (!entry)
+        return false;
+    if (checksum)
+        *checksum = entry->checksum;
+    if (size)
+        *size = entry->size;
+    if (offset)
+        *offset = entry->offset;
+    return true;
+}
+
+
+// --------------------------------------------------------------------------
+// Removes a file
+
+void
+zsync_progress_remove (zsync_progress_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+    if (zhash_lookup (self->entries, key)) {
+        zhash_delete (self->entries, key);
+        s_touch (self, key);
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the keys of all files, caller must destroy the list
+
+zlist_t *
+zsync_progress_keys (zsync_progress_t *self)
+{
+    assert (self);
+    return zhash_keys (self->entries);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true if there are changes which haven't been flushed
+
+bool
+zsync_progress_dirty (zsync_progress_t *self)
+{
+    assert (self);
+    return zhash_size (self->pending) > 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Appends the records of the changed files and syncs them. Compacts the
+// log if it has grown too large.
+
+int
+zsync_progress_flush (zsync_progress_t *self)
+{
+    assert (self);
+    if (!zsync_progress_dirty (self))
+        return 0;
+
+    // Changed files stay pending until the records are synced
+    zlist_t *keys = zhash_keys (self->pending);
+    char *key = (char *) zlist_first (keys);
+    while (key) {
+        size_t size = s_record_encode (self, key);
+        if (size && zsync_recordlog_append (self->log, self->buffer, size) != 0)
+            break;
+        key = (char *) zlist_next (keys);
+    }
+    zlist_destroy (&keys);
+    if (key || zsync_recordlog_sync (self->log) != 0)
+        return -1;
+    zhash_destroy (&self->pending);
+    self->pending = zhash_new ();
+
+    if (zsync_recordlog_bloated (self->log, zhash_size (self->entries)))
+        return zsync_progress_compact (self);
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Rewrites the log with one record per file and atomically replaces the
+// old file
+
+int
+zsync_progress_compact (zsync_progress_t *self)
+{
+    assert (self);
+    if (!self->log)
+        return 0;
+    if (zsync_recordlog_rewrite (self->log) != 0)
+        return -1;
+    zlist_t *keys = zhash_keys (self->entries);
+    char *key = (char *) zlist_first (keys);
+    while (key) {
+        size_t size = s_record_encode (self, key);
+        if (size)
+            zsync_recordlog_append (self->log, self->buffer, size);
+        key = (char *) zlist_next (keys);
+    }
+    zlist_destroy (&keys);
+    if (zsync_recordlog_commit (self->log) != 0)
+        return -1;
+
+    // The snapshot holds the current progress of every file
+    zhash_destroy (&self->pending);
+    self->pending = zhash_new ();
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of records in the log file
+
+size_t
+zsync_progress_records (zsync_progress_t *self)
+{
+    assert (self);
+    return self->log? zsync_recordlog_records (self->log): 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_PROGRESS ".zsync_progress_test"
+
+void
+zsync_progress_test ()
+{
+    printf (" * zsync_progress: ");
+    zsys_file_delete (TEST_PROGRESS);
+
+    zsync_progress_t *progress = zsync_progress_new (TEST_PROGRESS);
+    assert (!zsync_progress_dirty (progress));
+    zsync_progress_set (progress, "peer/a.txt", 0xABCD, 100);
+    zsync_progress_set (progress, "peer/dir/b c.txt", 0x1234, 50);
+    assert (zsync_progress_dirty (progress));
+
+    // Only contiguous data advances the offset
+    assert (zsync_progress_advance (progress, "peer/a.txt", 0, 30));
+    assert (!zsync_progress_advance (progress, "peer/a.txt", 60, 30));
+    assert (zsync_progress_advance (progress, "peer/a.txt", 30, 30));
+    assert (!zsync_progress_advance (progress, "peer/unknown", 0, 30));
+    uint64_t checksum, size, offset;
+    assert (zsync_progress_lookup (progress, "peer/a.txt", &checksum, &size, &offset));
+    assert (checksum == 0xABCD && size == 100 && offset == 60);
+
+    // The same version keeps its offset, another one starts over
+    zsync_progress_set (progress, "peer/a.txt", 0xABCD, 100);
+    zsync_progress_lookup (progress, "peer/a.txt", NULL, NULL, &offset);
+    assert (offset == 60);
+    assert (zsync_progress_advance (progress, "peer/dir/b c.txt", 0, 20));
+    assert (zsync_progress_advance (progress, "peer/dir/b c.txt", 20, 10));
+    //  Data at offset 0 starts over
+    assert (zsync_progress_advance (progress, "peer/dir/b c.txt", 0, 20));
+    zsync_progress_lookup (progress, "peer/dir/b c.txt", NULL, NULL, &offset);
+    assert (offset == 20);
+    zsync_progress_set (progress, "peer/dir/b c.txt", 0x5678, 50);
+    zsync_progress_lookup (progress, "peer/dir/b c.txt", NULL, NULL, &offset);
+    assert (offset == 0);
+    assert (zsync_progress_flush (progress) == 0);
+    assert (!zsync_progress_dirty (progress));
+    assert (zsync_progress_records (progress) == 2);
+
+    // Changes are written in batches, one record per changed file
+    zsync_progress_set (progress, "peer/big.txt", 0x9999, 1000);
+    for (offset = 0; offset < 500; offset += 10)
+        assert (zsync_progress_advance (progress, "peer/big.txt", offset, 10));
+    assert (zsync_progress_flush (progress) == 0);
+    assert (zsync_progress_records (progress) == 3);
+    zsync_progress_remove (progress, "peer/big.txt");
+    assert (zsync_progress_flush (progress) == 0);
+    assert (zsync_progress_records (progress) == 4);
+    zsync_progress_destroy (&progress);
+
+    // Progress survives a restart, completed files are removed
+    progress = zsync_progress_new (TEST_PROGRESS);
+    zlist_t *keys = zsync_progress_keys (progress);
+    assert (zlist_size (keys) == 2);
+    zlist_destroy (&keys);
+    assert (zsync_progress_lookup (progress, "peer/dir/b c.txt", &checksum, NULL, NULL));
+    assert (checksum == 0x5678);
+    assert (zsync_progress_advance (progress, "peer/a.txt", 60, 40));
+    assert (!zsync_progress_lookup (progress, "peer/a.txt", NULL, NULL, NULL));
+    zsync_progress_remove (progress, "peer/dir/b c.txt");
+    zsync_progress_destroy (&progress);
+    progress = zsync_progress_new (TEST_PROGRESS);
+    keys = zsync_progress_keys (progress);
+    assert (zlist_size (keys) == 0);
+    zlist_destroy (&keys);
+
+    // A log of superseded records is compacted
+    zsync_progress_set (progress, "peer/c.txt", 0x4321, ZSYNC_RECORDLOG_COMPACT_MIN * 4);
+    for (offset = 0; offset < ZSYNC_RECORDLOG_COMPACT_MIN * 2; offset++) {
+        zsync_progress_advance (progress, "peer/c.txt", offset, 1);
+        assert (zsync_progress_flush (progress) == 0);
+    }
+    assert (zsync_progress_records (progress) < ZSYNC_RECORDLOG_COMPACT_MIN * 2);
+    zsync_progress_destroy (&progress);
+    progress = zsync_progress_new (TEST_PROGRESS);
+    assert (zsync_progress_lookup (progress, "peer/c.txt", NULL, NULL, &offset));
+    assert (offset == ZSYNC_RECORDLOG_COMPACT_MIN * 2);
+    zsync_progress_destroy (&progress);
+
+    // Progress without a path stays in memory
+    progress = zsync_progress_new (NULL);
+    zsync_progress_set (progress, "a.txt", 1, 1);
+    assert (!zsync_progress_dirty (progress));
+    zsync_progress_destroy (&progress);
+
+    zsys_file_delete (TEST_PROGRESS);
+    printf ("OK\n");
+}
@@ -0,0 +1,439 @@
+/* =========================================================================
+    zsync_recordlog - append-only file of checksummed records
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+
+   This file is part of ZeroSync, see http://zerosync.org.
+
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync record log, the file underneath the peer journal and the
+    change log.
+
+@discuss
+    The log starts with a magic header followed by one record per
+    append:
+
+        payload size    4 bytes, network byte order
+        payload         payload size bytes
+        checksum        4 bytes, FNV-1a over the preceding fields
+
+    The owner encodes the payload and keeps its own index in memory,
+    which it rebuilds from the records on open. A torn or corrupt record
+    at the end of the file, e.g. after a crash during a sync, stops the
+    replay and is truncated. To compact, the owner rewrites its live
+    entries into a temporary file which atomically replaces the log.
+@end
+*/
+
+#include "zsync_classes.h"
+
+struct _zsync_recordlog_t {
+    char *path;                 // path of the log file
+    char *magic;                // magic header
+    FILE *file;                 // log opened for appending
+    FILE *rewrite;              // new file while rewriting, else NULL
+    size_t records;             // records in the log file
+    size_t rewritten;           // records in the new file
+    bool failed;                // a write to the new file failed
+};
+
+static uint32_t
+s_checksum (byte *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    size_t index;
+    for (index = 0; index < size; index++) {
+        hash ^= data [index];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void
+s_put_uint32 (byte *needle, uint32_t value)
+{
+    needle [0] = (byte) (value >> 24);
+    needle [1] = (byte) (value >> 16);
+    needle [2] = (byte) (value >> 8);
+    needle [3] = (byte) value;
+}
+
+static uint32_t
+s_get_uint32 (byte *needle)
+{
+    return ((uint32_t) needle [0] << 24) | ((uint32_t) needle [1] << 16)
+         | ((uint32_t) needle [2] << 8)  |  (uint32_t) needle [3];
+}
+
+static char *
+s_tmp_path (zsync_recordlog_t *self)
+{
+    char *tmp_path = (char *) malloc (strlen (self->path) + 5);
+    sprintf (tmp_path, "%s.tmp", self->path);
+    return tmp_path;
+}
+
+// Writes a record to file, returns 0 on success and -1 on failure
+static int
+s_record_write (FILE *file, byte *payload, size_t size)
+{
+    byte *buffer = (byte *) malloc (4 + size + 4);
+    assert (buffer);
+    s_put_uint32 (buffer, (uint32_t) size);
+    memcpy (buffer + 4, payload, size);
+    s_put_uint32 (buffer + 4 + size, s_checksum (buffer, 4 + size));
+    int rc = fwrite (buffer, 1, 4 + size + 4, file) == 4 + size + 4? 0: -1;
+    free (buffer);
+    return rc;
+}
+
+// Replays the log and returns the size of its valid part
+static long
+s_recordlog_replay (zsync_recordlog_t *self, size_t payload_max,
+                    zsync_recordlog_fn *handler, void *arg)
+{
+    FILE *file = fopen (self->path, "rb");
+    if (!file)
+        return 0;
+
+    long valid_size = 0;
+    char magic [ZSYNC_RECORDLOG_MAGIC_SIZE];
+    if (fread (magic, 1, ZSYNC_RECORDLOG_MAGIC_SIZE, file) == ZSYNC_RECORDLOG_MAGIC_SIZE
+    &&  memcmp (magic, self->magic, ZSYNC_RECORDLOG_MAGIC_SIZE) == 0) {
+        valid_size = ZSYNC_RECORDLOG_MAGIC_SIZE;
+        byte *buffer = (byte *) malloc (4 + payload_max + 4);
+        assert (buffer);
+        while (fread (buffer, 1, 4, file) == 4) {
+            size_t size = s_get_uint32 (buffer);
+            if (size > payload_max
+            ||  fread (buffer + 4, 1, size + 4, file) != size + 4
+            ||  s_get_uint32 (buffer + 4 + size) != s_checksum (buffer, 4 + size)
+            ||  handler (buffer + 4, size, arg) != 0)
+                break;
+            self->records++;
+            valid_size = ftell (file);
+        }
+        free (buffer);
+    }
+    fclose (file);
+    return valid_size;
+}
+
+// Syncs the directory holding the log so a rename is durable
+static void
+s_recordlog_sync_dir (zsync_recordlog_t *self)
+{
+    char *dir = strdup (self->path);
+    char *slash = strrchr (dir, '/');
+    if (slash)
+        *slash = 0;
+    int fd = open (slash? dir: ".", O_RDONLY);
+    if (fd != -1) {
+        fsync (fd);
+        close (fd);
+    }
+    free (dir);
+}
+
+
+// --------------------------------------------------------------------------
+// Opens the log at path and passes the payload of every record to handler
+
+zsync_recordlog_t *
+zsync_recordlog_new (const char *path, const char *magic, size_t payload_max,
+                     zsync_recordlog_fn *handler, void *arg)
+{
+    assert (path);
+    assert (magic && strlen (magic) == ZSYNC_RECORDLOG_MAGIC_SIZE);
+    assert (handler);
+    zsync_recordlog_t *self = (zsync_recordlog_t *) zmalloc (sizeof (zsync_recordlog_t));
+    self->path = strdup (path);
+    self->magic = strdup (magic);
+    self->records = 0;
+
+    long valid_size = s_recordlog_replay (self, payload_max, handler, arg);
+    if (zsys_file_exists (self->path)
+    &&  zsys_file_size (self->path) != valid_size) {
+        // Drop torn or corrupt records
+        int rc = truncate (self->path, valid_size);
+        assert (rc == 0);
+    }
+    self->file = fopen (self->path, "ab");
+    assert (self->file);
+    if (valid_size == 0) {
+        fwrite (self->magic, 1, ZSYNC_RECORDLOG_MAGIC_SIZE, self->file);
+        fflush (self->file);
+        fsync (fileno (self->file));
+    }
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Closes the log, a pending rewrite is dropped
+
+void
+zsync_recordlog_destroy (zsync_recordlog_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_recordlog_t *self = *self_p;
+        if (self->rewrite) {
+            fclose (self->rewrite);
+            char *tmp_path = s_tmp_path (self);
+            zsys_file_delete (tmp_path);
+            free (tmp_path);
+        }
+        if (self->file)
+            fclose (self->file);
+        free (self->magic);
+        free (self->path);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Appends a record with payload, during a rewrite to the new file
+
+int
+zsync_recordlog_append (zsync_recordlog_t *self, byte *payload, size_t size)
+{
+    assert (self);
+    assert (payload || size == 0);
+    if (self->rewrite) {
+        if (self->failed || s_record_write (self->rewrite, payload, size) != 0) {
+            self->failed = true;
+            return -1;
+        }
+        self->rewritten++;
+        return 0;
+    }
+    if (!self->file || s_record_write (self->file, payload, size) != 0)
+        return -1;
+    self->records++;
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Writes appended records to disk and syncs them
+
+int
+zsync_recordlog_sync (zsync_recordlog_t *self)
+{
+    assert (self);
+    if (!self->file)
+        return -1;
+    if (fflush (self->file) != 0 || fsync (fileno (self->file)) != 0)
+        return -1;
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Starts writing a new file, appends go there until the rewrite is
+// committed. Nothing is left to commit if starting fails.
+
+int
+zsync_recordlog_rewrite (zsync_recordlog_t *self)
+{
+    assert (self);
+    assert (!self->rewrite);
+    char *tmp_path = s_tmp_path (self);
+    self->rewrite = fopen (tmp_path, "wb");
+    if (self->rewrite
+    &&  fwrite (self->magic, 1, ZSYNC_RECORDLOG_MAGIC_SIZE, self->rewrite)
+     != ZSYNC_RECORDLOG_MAGIC_SIZE) {
+        fclose (self->rewrite);
+        self->rewrite = NULL;
+        zsys_file_delete (tmp_path);
+    }
+    free (tmp_path);
+    if (!self->rewrite)
+        return -1;
+    self->rewritten = 0;
+    self->failed = false;
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Syncs the new file and atomically replaces the log with it
+
+int
+zsync_recordlog_commit (zsync_recordlog_t *self)
+{
+    assert (self);
+    assert (self->rewrite);
+    FILE *file = self->rewrite;
+    self->rewrite = NULL;
+    int rc = self->failed? -1: 0;
+    if (rc == 0 && (fflush (file) != 0 || fsync (fileno (file)) != 0))
+        rc = -1;
+    fclose (file);
+    char *tmp_path = s_tmp_path (self);
+    if (rc == 0)
+        rc = rename (tmp_path, self->path);
+    if (rc != 0) {
+        zsys_file_delete (tmp_path);
+        free (tmp_path);
+        return -1;
+    }
+    free (tmp_path);
+    s_recordlog_sync_dir (self);
+
+    if (self->file)
+        fclose (self->file);
+    self->file = fopen (self->path, "ab");
+    self->records = self->rewritten;
+    return self->file? 0: -1;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true if the log holds many records superseded by later ones
+
+bool
+zsync_recordlog_bloated (zsync_recordlog_t *self, size_t live)
+{
+    assert (self);
+    return self->records > ZSYNC_RECORDLOG_COMPACT_MIN
+        && self->records > 2 * live;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of records in the log file
+
+size_t
+zsync_recordlog_records (zsync_recordlog_t *self)
+{
+    assert (self);
+    return self->records;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_RECORDLOG ".zsync_recordlog_test"
+
+static int
+s_test_collect (byte *payload, size_t size, void *arg)
+{
+    zlist_t *payloads = (zlist_t *) arg;
+    if (size > 0 && payload [0] == 'X')
+        return -1;
+    zlist_append (payloads, zmalloc (size + 1));
+    memcpy (zlist_last (payloads), payload, size);
+    return 0;
+}
+
+static void
+s_test_clear (zlist_t *payloads)
+{
+    char *payload = (char *) zlist_pop (payloads);
+    while (payload) {
+        free (payload);
+        payload = (char *) zlist_pop (payloads);
+    }
+}
+
+void
+zsync_recordlog_test ()
+{
+    printf (" * zsync_recordlog: ");
+    zsys_file_delete (TEST_RECORDLOG);
+    zlist_t *payloads = zlist_new ();
+
+    // A new log holds the magic header only
+    zsync_recordlog_t *log = zsync_recordlog_new (TEST_RECORDLOG, "ZST1", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 0);
+    assert (zsys_file_size (TEST_RECORDLOG) == ZSYNC_RECORDLOG_MAGIC_SIZE);
+    assert (zsync_recordlog_append (log, (byte *) "one", 3) == 0);
+    assert (zsync_recordlog_append (log, (byte *) "two", 3) == 0);
+    assert (zsync_recordlog_sync (log) == 0);
+    assert (zsync_recordlog_records (log) == 2);
+    zsync_recordlog_destroy (&log);
+    assert (log == NULL);
+
+    // Replay passes every payload in order
+    log = zsync_recordlog_new (TEST_RECORDLOG, "ZST1", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 2);
+    assert (zlist_size (payloads) == 2);
+    assert (streq ((char *) zlist_first (payloads), "one"));
+    assert (streq ((char *) zlist_next (payloads), "two"));
+    s_test_clear (payloads);
+    ssize_t valid_size = zsys_file_size (TEST_RECORDLOG);
+    // A record the handler rejects and everything after it is dropped
+    zsync_recordlog_append (log, (byte *) "X", 1);
+    zsync_recordlog_append (log, (byte *) "three", 5);
+    zsync_recordlog_destroy (&log);
+    log = zsync_recordlog_new (TEST_RECORDLOG, "ZST1", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 2);
+    assert (zsys_file_size (TEST_RECORDLOG) == valid_size);
+    s_test_clear (payloads);
+    zsync_recordlog_destroy (&log);
+
+    // A torn record at the end is dropped
+    FILE *file = fopen (TEST_RECORDLOG, "ab");
+    fwrite ("\0\0\0\5thr", 1, 7, file);
+    fclose (file);
+    log = zsync_recordlog_new (TEST_RECORDLOG, "ZST1", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 2);
+    assert (zsys_file_size (TEST_RECORDLOG) == valid_size);
+    s_test_clear (payloads);
+
+    // A rewrite replaces the log once committed
+    int count;
+    for (count = 0; count < ZSYNC_RECORDLOG_COMPACT_MIN; count++)
+        zsync_recordlog_append (log, (byte *) "two", 3);
+    assert (zsync_recordlog_sync (log) == 0);
+    assert (zsync_recordlog_bloated (log, 2));
+    assert (zsync_recordlog_rewrite (log) == 0);
+    zsync_recordlog_append (log, (byte *) "one", 3);
+    zsync_recordlog_append (log, (byte *) "two", 3);
+    assert (zsync_recordlog_commit (log) == 0);
+    assert (zsync_recordlog_records (log) == 2);
+    assert (!zsync_recordlog_bloated (log, 2));
+    assert (!zsys_file_exists (TEST_RECORDLOG ".tmp"));
+    zsync_recordlog_append (log, (byte *) "three", 5);
+    assert (zsync_recordlog_sync (log) == 0);
+    zsync_recordlog_destroy (&log);
+
+    log = zsync_recordlog_new (TEST_RECORDLOG, "ZST1", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 3);
+    assert (streq ((char *) zlist_last (payloads), "three"));
+    s_test_clear (payloads);
+    zsync_recordlog_destroy (&log);
+
+    // A log with another magic header starts over
+    log = zsync_recordlog_new (TEST_RECORDLOG, "ZST2", 16, s_test_collect, payloads);
+    assert (zsync_recordlog_records (log) == 0);
+    assert (zsys_file_size (TEST_RECORDLOG) == ZSYNC_RECORDLOG_MAGIC_SIZE);
+    zsync_recordlog_destroy (&log);
+
+    zlist_destroy (&payloads);
+    zsys_file_delete (TEST_RECORDLOG);
+    printf ("OK\n");
+}
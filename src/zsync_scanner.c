@@ -0,0 +1,819 @@
+/* =========================================================================
+    zsync_scanner - cached, parallel directory scanner
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync directory scanner
+
+@discuss
+    The scanner keeps a cache of the (inode, mtime, size) of every file
+    below its root. A scan walks the tree with a pool of threads, each
+    taking directories from a shared queue, and compares what it finds
+    against the cache. Files whose metadata changed are hashed by the
+    same number of threads, a file that was only touched keeps its state.
+    Files that are new, changed or gone are stamped with the state of the
+    scan, so an UPDATE from any earlier state is answered from the cache
+    without touching the disk again. Changed entries are also kept in
+    the order of their state, so an update only visits the files that
+    changed after the requested state.
+
+    A file that can't be read keeps its last state until a later scan
+    reads it, and files below a directory that can't be read are not
+    reported as gone.
+
+    With a change log attached, changes are also recorded there and
+    updates are answered from it. The cache starts from the log, so the
+    state survives restarts; files are hashed again on the first scan as
+    the log doesn't know their inode and modification time.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#define SCANNER_THREADS 4
+
+struct _zsync_scanner_t {
+    char *root;                 // root directory of the tree
+    int threads;                // threads walking the tree
+    zhash_t *entries;           // cached files by path relative to root
+    size_t files;               // files that exist in the tree
+    uint64_t state;             // state of the last scan
+    zsync_changelog_t *changelog;   // log of the changes, if any
+    struct _s_entry_t *oldest;  // changed entries by ascending state
+    struct _s_entry_t *newest;
+};
+
+// Cached state of a file
+typedef struct _s_entry_t {
+    char *path;
+    uint64_t inode;
+    uint64_t mtime;             // modification time in ns
+    uint64_t size;
+    uint64_t checksum;          // XXH64 of the content
+    byte digest [ZSYNC_DIGEST_SIZE];    // SHA-256 of the content
+    uint64_t state;             // state of the scan that saw the change
+    int operation;              // ZS_FILE_OP_UPD or ZS_FILE_OP_DEL
+    bool seen;                  // seen during the current scan
+    struct _s_entry_t *prev;    // entry changed before this one
+    struct _s_entry_t *next;    // entry changed after this one
+} s_entry_t;
+
+// A file found while walking the tree
+typedef struct {
+    char *path;
+    uint64_t inode;
+    uint64_t mtime;
+    uint64_t size;
+} s_file_t;
+
+// Work shared by the threads walking the tree
+typedef struct {
+    char *root;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    zlist_t *dirs;              // directories waiting to be read
+    zlist_t *files;             // files found so far
+    zlist_t *failed;            // paths that exist but couldn't be read
+    int busy;                   // threads reading a directory
+} s_walk_t;
+
+static void
+s_entry_free (void *data)
+{
+    s_entry_t *entry = (s_entry_t *) data;
+    free (entry->path);
+    free (entry);
+}
+
+// Returns the file meta data of an entry as sent in an UPDATE
+static zs_fmetadata_t *
+s_entry_fmetadata (s_entry_t *entry)
+{
+    zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "%s", entry->path);
+    zs_fmetadata_set_operation (fmetadata, entry->operation);
+    if (entry->operation == ZS_FILE_OP_UPD) {
+        zs_fmetadata_set_size (fmetadata, entry->size);
+        zs_fmetadata_set_timestamp (fmetadata, entry->mtime / 1000000000);
+        zs_fmetadata_set_checksum (fmetadata, entry->checksum);
+        zs_fmetadata_set_digest (fmetadata, entry->digest);
+    }
+    return fmetadata;
+}
+
+// Returns the entry of path, a new one is deleted until it's seen
+static s_entry_t *
+s_entry_require (zsync_scanner_t *self, const char *path)
+{
+    s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, path);
+    if (!entry) {
+        entry = (s_entry_t *) zmalloc (sizeof (s_entry_t));
+        entry->path = strdup (path);
+        entry->operation = ZS_FILE_OP_DEL;
+        zhash_insert (self->entries, path, entry);
+        zhash_freefn (self->entries, path, s_entry_free);
+    }
+    return entry;
+}
+
+// Stamps entry with state and moves it to the newest end of the
+// changed entries. Entries that never changed aren't linked.
+static void
+s_entry_touch (zsync_scanner_t *self, s_entry_t *entry, uint64_t state)
+{
+    if (entry->state > 0) {
+        if (entry->prev)
+            entry->prev->next = entry->next;
+        else
+            self->oldest = entry->next;
+        if (entry->next)
+            entry->next->prev = entry->prev;
+        else
+            self->newest = entry->prev;
+    }
+    entry->state = state;
+    entry->prev = self->newest;
+    entry->next = NULL;
+    if (self->newest)
+        self->newest->next = entry;
+    else
+        self->oldest = entry;
+    self->newest = entry;
+}
+
+// Records a changed entry in the change log, if any
+static void
+s_entry_log (zsync_scanner_t *self, s_entry_t *entry)
+{
+    if (!self->changelog)
+        return;
+    zs_fmetadata_t *fmetadata = s_entry_fmetadata (entry);
+    zsync_changelog_append (self->changelog, entry->state, fmetadata);
+    zs_fmetadata_destroy (&fmetadata);
+}
+
+static char *
+s_path_join (const char *dir, const char *name)
+{
+    char *path = (char *) malloc (strlen (dir) + strlen (name) + 2);
+    if (*dir)
+        sprintf (path, "%s/%s", dir, name);
+    else
+        strcpy (path, name);
+    return path;
+}
+
+// Returns true if path is the failed path or lies below it
+static bool
+s_path_below (const char *path, const char *failed)
+{
+    size_t size = strlen (failed);
+    return size == 0
+        || (strncmp (path, failed, size) == 0 && (path [size] == '/' || path [size] == 0));
+}
+
+// Reads one directory, files go to files and subdirectories to dirs.
+// Paths which exist but can't be read go to failed, files below them are
+// unknown rather than deleted.
+static void
+s_walk_dir (s_walk_t *walk, char *dir_path, zlist_t *dirs, zlist_t *files, zlist_t *failed)
+{
+    char *full_path = s_path_join (walk->root, dir_path);
+    DIR *dir = opendir (full_path);
+    free (full_path);
+    if (!dir) {
+        if (errno != ENOENT)
+            zlist_append (failed, strdup (dir_path));
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir (dir)) != NULL) {
+        if (streq (ent->d_name, ".") || streq (ent->d_name, ".."))
+            continue;
+        struct stat st;
+        if (fstatat (dirfd (dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno != ENOENT)
+                zlist_append (failed, s_path_join (dir_path, ent->d_name));
+            continue;
+        }
+        if (S_ISDIR (st.st_mode)) {
+            char *child = s_path_join (dir_path, ent->d_name);
+            if (streq (child, ZSYNC_STATE_DIR))
+                free (child);
+            else
+                zlist_append (dirs, child);
+        }
+        else
+        if (S_ISREG (st.st_mode)) {
+            s_file_t *file = (s_file_t *) zmalloc (sizeof (s_file_t));
+            file->path = s_path_join (dir_path, ent->d_name);
+            file->inode = st.st_ino;
+            file->mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            file->size = st.st_size;
+            zlist_append (files, file);
+        }
+    }
+    closedir (dir);
+}
+
+static void *
+s_walk_thread (void *args)
+{
+    s_walk_t *walk = (s_walk_t *) args;
+    zlist_t *dirs = zlist_new ();
+    zlist_t *files = zlist_new ();
+    zlist_t *failed = zlist_new ();
+
+    pthread_mutex_lock (&walk->mutex);
+    while (true) {
+        while (zlist_size (walk->dirs) == 0 && walk->busy > 0)
+            pthread_cond_wait (&walk->cond, &walk->mutex);
+        // Done once no directory is queued and none is being read
+        if (zlist_size (walk->dirs) == 0)
+            break;
+        char *dir_path = (char *) zlist_pop (walk->dirs);
+        walk->busy++;
+        pthread_mutex_unlock (&walk->mutex);
+
+        s_walk_dir (walk, dir_path, dirs, files, failed);
+        free (dir_path);
+
+        pthread_mutex_lock (&walk->mutex);
+        void *item;
+        while ((item = zlist_pop (dirs)))
+            zlist_append (walk->dirs, item);
+        while ((item = zlist_pop (files)))
+            zlist_append (walk->files, item);
+        while ((item = zlist_pop (failed)))
+            zlist_append (walk->failed, item);
+        walk->busy--;
+        pthread_cond_broadcast (&walk->cond);
+    }
+    pthread_mutex_unlock (&walk->mutex);
+
+    zlist_destroy (&dirs);
+    zlist_destroy (&files);
+    zlist_destroy (&failed);
+    return NULL;
+}
+
+
+// --------------------------------------------------------------------------
+// Constructs a scanner for the tree below root. Scans continue from
+// state, the last state the caller persisted or 0 for a new tree.
+
+zsync_scanner_t *
+zsync_scanner_new (const char *root, uint64_t state)
+{
+    assert (root);
+    zsync_scanner_t *self = (zsync_scanner_t *) zmalloc (sizeof (zsync_scanner_t));
+    self->root = strdup (root);
+    self->threads = SCANNER_THREADS;
+    self->entries = zhash_new ();
+    self->files = 0;
+    self->state = state;
+    return self;
+}
+
+
+// --------------------------------------------------------------------------
+// Destroys the scanner and its cache
+
+void
+zsync_scanner_destroy (zsync_scanner_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_scanner_t *self = *self_p;
+        zhash_destroy (&self->entries);
+        free (self->root);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Sets the number of threads walking the tree, default 4
+
+void
+zsync_scanner_set_threads (zsync_scanner_t *self, int threads)
+{
+    assert (self);
+    self->threads = threads > 0? threads: 1;
+}
+
+
+// --------------------------------------------------------------------------
+// Records changes in changelog and answers updates from it. The cache
+// is filled with the files in the log and continues from its state. The
+// scanner doesn't take ownership of the change log.
+
+void
+zsync_scanner_set_changelog (zsync_scanner_t *self, zsync_changelog_t *changelog)
+{
+    assert (self);
+    assert (changelog);
+    self->changelog = changelog;
+    if (zsync_changelog_state (changelog) > self->state)
+        self->state = zsync_changelog_state (changelog);
+    zlist_t *fmetadata_list = zsync_changelog_update (changelog, 0);
+    if (!fmetadata_list)
+        return;
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_pop (fmetadata_list);
+    while (fmetadata) {
+        const char *path = zs_fmetadata_path_ref (fmetadata);
+        if (!zhash_lookup (self->entries, path)) {
+            // Unknown inode and mtime, the first scan hashes the file
+            s_entry_t *entry = (s_entry_t *) zmalloc (sizeof (s_entry_t));
+            entry->path = strdup (path);
+            entry->operation = ZS_FILE_OP_UPD;
+            entry->size = zs_fmetadata_size (fmetadata);
+            entry->checksum = zs_fmetadata_checksum (fmetadata);
+            memcpy (entry->digest, zs_fmetadata_digest (fmetadata), ZSYNC_DIGEST_SIZE);
+            zhash_insert (self->entries, path, entry);
+            zhash_freefn (self->entries, path, s_entry_free);
+        }
+        zs_fmetadata_destroy (&fmetadata);
+        fmetadata = (zs_fmetadata_t *) zlist_pop (fmetadata_list);
+    }
+    zlist_destroy (&fmetadata_list);
+}
+
+
+// --------------------------------------------------------------------------
+// Walks the tree and compares it against the cache. Returns the state
+// after the scan, which is only incremented if anything changed.
+
+uint64_t
+zsync_scanner_scan (zsync_scanner_t *self)
+{
+    assert (self);
+    s_walk_t walk;
+    walk.root = self->root;
+    pthread_mutex_init (&walk.mutex, NULL);
+    pthread_cond_init (&walk.cond, NULL);
+    walk.dirs = zlist_new ();
+    walk.files = zlist_new ();
+    walk.failed = zlist_new ();
+    walk.busy = 0;
+    zlist_append (walk.dirs, strdup (""));
+
+    pthread_t *threads = (pthread_t *) zmalloc (sizeof (pthread_t) * self->threads);
+    int thread_nbr;
+    for (thread_nbr = 0; thread_nbr < self->threads; thread_nbr++)
+        pthread_create (&threads [thread_nbr], NULL, s_walk_thread, &walk);
+    for (thread_nbr = 0; thread_nbr < self->threads; thread_nbr++)
+        pthread_join (threads [thread_nbr], NULL);
+    free (threads);
+    pthread_cond_destroy (&walk.cond);
+    pthread_mutex_destroy (&walk.mutex);
+    zlist_destroy (&walk.dirs);
+
+    // Compare the files found against the cache
+    uint64_t state = self->state + 1;
+    bool changed = false;
+    zlist_t *modified = zlist_new ();
+    self->files = 0;
+    s_file_t *file = (s_file_t *) zlist_pop (walk.files);
+    while (file) {
+        s_entry_t *entry = s_entry_require (self, file->path);
+        if (entry->operation != ZS_FILE_OP_UPD
+        ||  entry->inode != file->inode
+        ||  entry->mtime != file->mtime
+        ||  entry->size != file->size) {
+            entry->inode = file->inode;
+            entry->mtime = file->mtime;
+            entry->size = file->size;
+            zlist_append (modified, entry);
+        }
+        entry->seen = true;
+        self->files++;
+        free (file->path);
+        free (file);
+        file = (s_file_t *) zlist_pop (walk.files);
+    }
+    zlist_destroy (&walk.files);
+
+    // Hash modified files, a file that was only touched keeps its state
+    size_t count = zlist_size (modified);
+    char **hash_paths = (char **) zmalloc (sizeof (char *) * (count + 1));
+    uint64_t *checksums = (uint64_t *) zmalloc (sizeof (uint64_t) * (count + 1));
+    byte *digests = (byte *) zmalloc (ZSYNC_DIGEST_SIZE * (count + 1));
+    size_t index;
+    s_entry_t *entry = (s_entry_t *) zlist_first (modified);
+    for (index = 0; entry; index++) {
+        hash_paths [index] = entry->path;
+        entry = (s_entry_t *) zlist_next (modified);
+    }
+    byte unread [ZSYNC_DIGEST_SIZE] = { 0 };
+    bool failures = zsync_hash_paths (self->root, hash_paths, count, checksums, digests, self->threads) > 0;
+    entry = (s_entry_t *) zlist_first (modified);
+    for (index = 0; entry; index++) {
+        byte *digest = digests + index * ZSYNC_DIGEST_SIZE;
+        if (failures && checksums [index] == 0
+        &&  memcmp (digest, unread, ZSYNC_DIGEST_SIZE) == 0) {
+            // A file which can't be read keeps its last state and is
+            // hashed again by the next scan
+            entry->mtime = 0;
+        }
+        else
+        if (entry->operation != ZS_FILE_OP_UPD
+        ||  entry->checksum != checksums [index]
+        ||  memcmp (entry->digest, digest, ZSYNC_DIGEST_SIZE) != 0) {
+            entry->operation = ZS_FILE_OP_UPD;
+            entry->checksum = checksums [index];
+            memcpy (entry->digest, digest, ZSYNC_DIGEST_SIZE);
+            s_entry_touch (self, entry, state);
+            s_entry_log (self, entry);
+            changed = true;
+        }
+        entry = (s_entry_t *) zlist_next (modified);
+    }
+    free (digests);
+    free (checksums);
+    free (hash_paths);
+    zlist_destroy (&modified);
+
+    // Files not seen have been deleted, unless they are below a path
+    // that couldn't be read
+    zlist_t *paths = zhash_keys (self->entries);
+    char *path = (char *) zlist_first (paths);
+    while (path) {
+        s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, path);
+        char *failed = (char *) zlist_first (walk.failed);
+        while (failed && !entry->seen) {
+            if (s_path_below (path, failed)) {
+                entry->seen = true;
+                if (entry->operation == ZS_FILE_OP_UPD)
+                    self->files++;
+            }
+            failed = (char *) zlist_next (walk.failed);
+        }
+        if (!entry->seen && entry->operation != ZS_FILE_OP_DEL) {
+            entry->operation = ZS_FILE_OP_DEL;
+            s_entry_touch (self, entry, state);
+            s_entry_log (self, entry);
+            changed = true;
+        }
+        entry->seen = false;
+        path = (char *) zlist_next (paths);
+    }
+    zlist_destroy (&paths);
+    char *failed = (char *) zlist_pop (walk.failed);
+    while (failed) {
+        free (failed);
+        failed = (char *) zlist_pop (walk.failed);
+    }
+    zlist_destroy (&walk.failed);
+
+    if (changed)
+        self->state = state;
+    if (self->changelog)
+        zsync_changelog_flush (self->changelog);
+    return self->state;
+}
+
+
+// --------------------------------------------------------------------------
+// Applies changes captured by a zsync_watcher_t to the cache without
+// walking the tree. Updated files must carry their checksum and digest.
+// Returns the state after the changes, which is only incremented if
+// anything changed.
+
+uint64_t
+zsync_scanner_apply (zsync_scanner_t *self, zlist_t *fmetadata_list)
+{
+    assert (self);
+    if (!fmetadata_list)
+        return self->state;
+    uint64_t state = self->state + 1;
+    bool changed = false;
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_first (fmetadata_list);
+    while (fmetadata) {
+        const char *path = zs_fmetadata_path_ref (fmetadata);
+        s_entry_t *entry = (s_entry_t *) zhash_lookup (self->entries, path);
+        int operation = zs_fmetadata_operation (fmetadata);
+        if (operation == ZS_FILE_OP_UPD) {
+            entry = s_entry_require (self, path);
+            if (entry->operation != ZS_FILE_OP_UPD)
+                self->files++;
+            // Unknown inode and mtime make the next scan hash the file
+            char *full_path = s_path_join (self->root, path);
+            struct stat st;
+            if (lstat (full_path, &st) == 0) {
+                entry->inode = st.st_ino;
+                entry->mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            }
+            else
+                entry->inode = entry->mtime = 0;
+            free (full_path);
+            entry->operation = ZS_FILE_OP_UPD;
+            entry->size = zs_fmetadata_size (fmetadata);
+            entry->checksum = zs_fmetadata_checksum (fmetadata);
+            memcpy (entry->digest, zs_fmetadata_digest (fmetadata), ZSYNC_DIGEST_SIZE);
+            s_entry_touch (self, entry, state);
+            s_entry_log (self, entry);
+            changed = true;
+        }
+        else
+        if (entry && entry->operation == ZS_FILE_OP_UPD) {
+            if (operation == ZS_FILE_OP_REN) {
+                // The content moves to the new path
+                s_entry_t *target = s_entry_require (self, zs_fmetadata_renamed_path_ref (fmetadata));
+                if (target->operation != ZS_FILE_OP_UPD)
+                    self->files++;
+                target->operation = ZS_FILE_OP_UPD;
+                target->inode = entry->inode;
+                target->mtime = entry->mtime;
+                target->size = entry->size;
+                target->checksum = entry->checksum;
+                memcpy (target->digest, entry->digest, ZSYNC_DIGEST_SIZE);
+                s_entry_touch (self, target, state);
+                entry->operation = ZS_FILE_OP_DEL;
+                s_entry_touch (self, entry, state);
+                s_entry_log (self, entry);
+                s_entry_log (self, target);
+            }
+            else {
+                entry->operation = ZS_FILE_OP_DEL;
+                s_entry_touch (self, entry, state);
+                s_entry_log (self, entry);
+            }
+            self->files--;
+            changed = true;
+        }
+        fmetadata = (zs_fmetadata_t *) zlist_next (fmetadata_list);
+    }
+    if (changed)
+        self->state = state;
+    if (self->changelog)
+        zsync_changelog_flush (self->changelog);
+    return self->state;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the state of the last scan
+
+uint64_t
+zsync_scanner_state (zsync_scanner_t *self)
+{
+    assert (self);
+    return self->state;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns a list of zs_fmetadata_t for all files that changed after
+// from_state, or NULL if nothing changed. Caller owns list and entries.
+
+zlist_t *
+zsync_scanner_update (zsync_scanner_t *self, uint64_t from_state)
+{
+    assert (self);
+    if (from_state >= self->state)
+        return NULL;
+    if (self->changelog)
+        return zsync_changelog_update (self->changelog, from_state);
+
+    // Walk back from the newest change, pushing keeps the state order
+    zlist_t *fmetadata_list = zlist_new ();
+    s_entry_t *entry = self->newest;
+    while (entry && entry->state > from_state) {
+        // Files deleted before from_state was taken were never sent
+        if (entry->operation == ZS_FILE_OP_UPD || from_state > 0)
+            zlist_push (fmetadata_list, s_entry_fmetadata (entry));
+        entry = entry->prev;
+    }
+
+    if (zlist_size (fmetadata_list) == 0)
+        zlist_destroy (&fmetadata_list);
+    return fmetadata_list;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns the number of files in the cache
+
+size_t
+zsync_scanner_size (zsync_scanner_t *self)
+{
+    assert (self);
+    return self->files;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_ROOT ".zsync_scanner_test"
+
+static void
+s_test_write (char *path, char *content)
+{
+    FILE *file = fopen (path, "w");
+    assert (file);
+    fputs (content, file);
+    fclose (file);
+}
+
+static zs_fmetadata_t *
+s_test_find (zlist_t *list, char *path)
+{
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_first (list);
+    while (fmetadata) {
+        if (streq (zs_fmetadata_path_ref (fmetadata), path))
+            return fmetadata;
+        fmetadata = (zs_fmetadata_t *) zlist_next (list);
+    }
+    return NULL;
+}
+
+static void
+s_test_destroy_list (zlist_t **list_p)
+{
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    while (fmetadata) {
+        zs_fmetadata_destroy (&fmetadata);
+        fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    }
+    zlist_destroy (list_p);
+}
+
+void
+zsync_scanner_test ()
+{
+    printf (" * zsync_scanner: ");
+    zsys_dir_create (TEST_ROOT);
+    zsys_dir_create (TEST_ROOT "/dir");
+    zsys_dir_create (TEST_ROOT "/dir/sub");
+    s_test_write (TEST_ROOT "/a", "a");
+    s_test_write (TEST_ROOT "/dir/b", "bb");
+    s_test_write (TEST_ROOT "/dir/sub/c", "ccc");
+    // Private state is never synced
+    zsys_dir_create (TEST_ROOT "/" ZSYNC_STATE_DIR);
+    s_test_write (TEST_ROOT "/" ZSYNC_STATE_DIR "/chunks", "x");
+
+    zsync_scanner_t *scanner = zsync_scanner_new (TEST_ROOT, 0);
+    zsync_scanner_set_threads (scanner, 3);
+    assert (zsync_scanner_update (scanner, 0) == NULL);
+    
+    // First scan reports every file
+    uint64_t state = zsync_scanner_scan (scanner);
+    assert (state == 1);
+    assert (zsync_scanner_size (scanner) == 3);
+    zlist_t *update = zsync_scanner_update (scanner, 0);
+    assert (zlist_size (update) == 3);
+    zs_fmetadata_t *fmetadata = s_test_find (update, "dir/sub/c");
+    assert (fmetadata);
+    assert (zs_fmetadata_size (fmetadata) == 3);
+    assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_UPD);
+    s_test_destroy_list (&update);
+
+    // An unchanged tree keeps its state
+    assert (zsync_scanner_scan (scanner) == 1);
+    assert (zsync_scanner_update (scanner, 1) == NULL);
+
+    // Touching a file without changing its content is no change
+    s_test_write (TEST_ROOT "/dir/sub/c", "ccc");
+    assert (zsync_scanner_scan (scanner) == 1);
+
+    // Only changes since the given state are reported
+    s_test_write (TEST_ROOT "/dir/b", "bbbb");
+    zsys_file_delete (TEST_ROOT "/a");
+    state = zsync_scanner_scan (scanner);
+    assert (state == 2);
+    assert (zsync_scanner_size (scanner) == 2);
+    update = zsync_scanner_update (scanner, 1);
+    assert (zlist_size (update) == 2);
+    fmetadata = s_test_find (update, "dir/b");
+    assert (zs_fmetadata_size (fmetadata) == 4);
+    assert (zs_fmetadata_checksum (fmetadata) == zsync_hash_xxh64 ("bbbb", 4, 0));
+    fmetadata = s_test_find (update, "a");
+    assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_DEL);
+    s_test_destroy_list (&update);
+
+    // A full update does not report files that are already gone
+    update = zsync_scanner_update (scanner, 0);
+    assert (zlist_size (update) == 2);
+    assert (s_test_find (update, "a") == NULL);
+    s_test_destroy_list (&update);
+
+    // Changes from a watcher apply without a scan
+    zlist_t *changes = zlist_new ();
+    fmetadata = zs_fmetadata_new ();
+    zs_fmetadata_set_path (fmetadata, "dir/b");
+    zs_fmetadata_set_renamed_path (fmetadata, "dir/e");
+    zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_REN);
+    zlist_append (changes, fmetadata);
+    assert (zsync_scanner_apply (scanner, changes) == 3);
+    assert (zsync_scanner_size (scanner) == 2);
+    update = zsync_scanner_update (scanner, 2);
+    assert (zlist_size (update) == 2);
+    assert (zs_fmetadata_operation (s_test_find (update, "dir/b")) == ZS_FILE_OP_DEL);
+    assert (zs_fmetadata_size (s_test_find (update, "dir/e")) == 4);
+    s_test_destroy_list (&update);
+    // Changes of unknown files are no change
+    zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_DEL);
+    assert (zsync_scanner_apply (scanner, changes) == 3);
+    s_test_destroy_list (&changes);
+    zsync_scanner_destroy (&scanner);
+
+    // A scanner continues from the state it was seeded with
+    scanner = zsync_scanner_new (TEST_ROOT, 5);
+    assert (zsync_scanner_update (scanner, 0) == NULL);
+    assert (zsync_scanner_scan (scanner) == 6);
+    update = zsync_scanner_update (scanner, 5);
+    assert (zlist_size (update) == 2);
+    s_test_destroy_list (&update);
+    zsync_scanner_destroy (&scanner);
+
+    // Paths which can't be read are neither updated nor deleted. Root
+    // reads them anyway.
+    if (geteuid () != 0) {
+        scanner = zsync_scanner_new (TEST_ROOT, 0);
+        assert (zsync_scanner_scan (scanner) == 1);
+        s_test_write (TEST_ROOT "/dir/b", "bbbbbb");
+        chmod (TEST_ROOT "/dir/b", 0);
+        chmod (TEST_ROOT "/dir/sub", 0);
+        assert (zsync_scanner_scan (scanner) == 1);
+        assert (zsync_scanner_size (scanner) == 2);
+        chmod (TEST_ROOT "/dir/sub", 0755);
+        chmod (TEST_ROOT "/dir/b", 0644);
+        assert (zsync_scanner_scan (scanner) == 2);
+        update = zsync_scanner_update (scanner, 1);
+        assert (zlist_size (update) == 1);
+        fmetadata = s_test_find (update, "dir/b");
+        assert (zs_fmetadata_checksum (fmetadata) == zsync_hash_xxh64 ("bbbbbb", 6, 0));
+        s_test_destroy_list (&update);
+        zsync_scanner_destroy (&scanner);
+    }
+
+    // A change log keeps the state across scanners
+    zsync_changelog_t *changelog = zsync_changelog_new (TEST_ROOT "/.changes");
+    scanner = zsync_scanner_new (TEST_ROOT "/dir", 0);
+    zsync_scanner_set_changelog (scanner, changelog);
+    assert (zsync_scanner_scan (scanner) == 1);
+    s_test_write (TEST_ROOT "/dir/b", "bbbbb");
+    assert (zsync_scanner_scan (scanner) == 2);
+    zsync_scanner_destroy (&scanner);
+    zsync_changelog_destroy (&changelog);
+
+    changelog = zsync_changelog_new (TEST_ROOT "/.changes");
+    scanner = zsync_scanner_new (TEST_ROOT "/dir", 0);
+    zsync_scanner_set_changelog (scanner, changelog);
+    assert (zsync_scanner_state (scanner) == 2);
+    // Files are hashed again but unchanged ones keep their state
+    assert (zsync_scanner_scan (scanner) == 2);
+    update = zsync_scanner_update (scanner, 1);
+    assert (zlist_size (update) == 1);
+    fmetadata = s_test_find (update, "b");
+    assert (zs_fmetadata_size (fmetadata) == 5);
+    s_test_destroy_list (&update);
+    zsys_file_delete (TEST_ROOT "/dir/b");
+    assert (zsync_scanner_scan (scanner) == 3);
+    update = zsync_scanner_update (scanner, 2);
+    assert (zlist_size (update) == 1);
+    fmetadata = s_test_find (update, "b");
+    assert (zs_fmetadata_operation (fmetadata) == ZS_FILE_OP_DEL);
+    s_test_destroy_list (&update);
+    update = zsync_scanner_update (scanner, 0);
+    assert (zlist_size (update) == 1);
+    assert (s_test_find (update, "sub/c"));
+    s_test_destroy_list (&update);
+    zsync_scanner_destroy (&scanner);
+    zsync_changelog_destroy (&changelog);
+    zsys_file_delete (TEST_ROOT "/.changes");
+
+    zsys_file_delete (TEST_ROOT "/dir/sub/c");
+    zsys_file_delete (TEST_ROOT "/dir/b");
+    rmdir (TEST_ROOT "/dir/sub");
+    rmdir (TEST_ROOT "/dir");
+    zsys_file_delete (TEST_ROOT "/" ZSYNC_STATE_DIR "/chunks");
+    rmdir (TEST_ROOT "/" ZSYNC_STATE_DIR);
+    rmdir (TEST_ROOT);
+    printf ("OK\n");
+}
@@ -24,6 +24,22 @@
 #include "zsync_classes.h"
 
 zsync_agent_t *agent;
+zsync_scanner_t *scanner;
+zsync_changelog_t *changelog;
+
+// Destroys a list of file meta data
+static void
+s_destroy_list (zlist_t **list_p)
+{
+    if (!*list_p)
+        return;
+    zs_fmetadata_t *meta = (zs_fmetadata_t *) zlist_pop (*list_p);
+    while (meta) {
+        zs_fmetadata_destroy (&meta);
+        meta = (zs_fmetadata_t *) zlist_pop (*list_p);
+    }
+    zlist_destroy (list_p);
+}
 
 void
 pass_update (char *sender, zlist_t *fmetadata) 
@@ -57,34 +73,8 @@ zlist_t *
 get_update (uint64_t from_state)
 { 
     printf("[ST] GET_UPDATE\n");
-    zlist_t *filemeta_list = zlist_new ();
-    
-    DIR *dir;
-    struct dirent *ent;
-    if ((dir = opendir ("./syncfolder")) != NULL) {
-        /* print all the files and directories within directory */
-        while ((ent = readdir (dir)) != NULL) {
-            if (strcmp (ent->d_name, ".") != 0 && strcmp (ent->d_name, "..") != 0) {
-                struct stat st;
-                stat(ent->d_name, &st);
-
-                zs_fmetadata_t *fmetadata = zs_fmetadata_new ();
-                zs_fmetadata_set_path (fmetadata, "%s", ent->d_name);
-                zs_fmetadata_set_size (fmetadata, st.st_size);
-                zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_UPD);
-                zs_fmetadata_set_timestamp (fmetadata, st.st_ctime);
-                zs_fmetadata_set_checksum (fmetadata, 0x3312AFFDE12);
-                zlist_append(filemeta_list, fmetadata);
-            }
-        }
-        closedir (dir);
-    } 
-    if (zlist_size (filemeta_list) > 0) {
-        return filemeta_list;
-    }
-    else {
-        return NULL;
-    }
+    zsync_scanner_scan (scanner);
+    return zsync_scanner_update (scanner, from_state);
 }
 
 // Gets the current state
@@ -122,13 +112,16 @@ get_chunk (char *path, uint64_t chunk_size, uint64_t offset)
 uint64_t
 get_current_state () 
 {
-    return 0x0;
+    return zsync_scanner_state (scanner);
 }
 
 void test_integrate_components ()
 {
     printf ("Integration Test: ");
 
+    scanner = zsync_scanner_new ("./syncfolder", 0);
+    changelog = zsync_changelog_new (".zsync_changes");
+    zsync_scanner_set_changelog (scanner, changelog);
     agent = zsync_agent_new ();
     zsync_agent_set_pass_update (agent, pass_update);
     zsync_agent_set_pass_chunk (agent, pass_chunk);
@@ -140,8 +133,26 @@ void test_integrate_components ()
 
     zlist_t *files;
 
+    // Changes are sent as they happen, without a watcher the tree is
+    // scanned when peers ask for updates
+    zsync_watcher_t *watcher = zsync_watcher_new ("./syncfolder");
     while (zsync_agent_running (agent)) {
-        zclock_sleep (25000);
+        if (watcher) {
+            zlist_t *changes = zsync_watcher_changes (watcher, 25000);
+            uint64_t state = zsync_scanner_state (scanner);
+            if (zsync_watcher_overflowed (watcher)) {
+                // Lost changes are found by a scan
+                s_destroy_list (&changes);
+                zsync_scanner_scan (scanner);
+                changes = zsync_scanner_update (scanner, state);
+            }
+            else
+                zsync_scanner_apply (scanner, changes);
+            if (changes)
+                zsync_agent_send_update (agent, zsync_scanner_state (scanner), changes);
+        }
+        else
+            zclock_sleep (25000);
         DIR *dir;
         struct dirent *ent;
         int count = -2;
@@ -153,27 +164,670 @@ void test_integrate_components ()
         if (count == 2)
             break;
     }
+    zsync_watcher_destroy (&watcher);
     zsync_agent_stop (agent);
         
     zclock_sleep (500);
 
     zsync_agent_destroy (&agent);
+    zsync_scanner_destroy (&scanner);
+    zsync_changelog_destroy (&changelog);
     
     printf ("OK\n");
 }
 
+// --------------------------------------------------------------------------
+// Benchmark the bytes copied when passing a chunk received from zyre on to
+// the agent. The CHUNK message copies the frame into a zchunk, serializes it
+// and copies it again on decode. CHUNK_FRAME hands the received frame over,
+// which is checked by sending it through a pipe like the node does.
+
+#define BENCH_CHUNK_SIZE 30000
+#define BENCH_CHUNK_COUNT 1000
+
+static uint64_t
+s_bytes_copied (byte *from, byte *to, size_t size)
+{
+    return from == to? 0: size;
+}
+
+static zmsg_t *
+s_bench_zyre_chunk (byte *payload, uint64_t sequence)
+{
+    zmsg_t *zyre_msg = zmsg_new ();
+    zframe_t *frame = zframe_new (payload, BENCH_CHUNK_SIZE);
+    zs_msg_pack_chunk (zyre_msg, sequence, "bench.bin", sequence * BENCH_CHUNK_SIZE, frame);
+    return zyre_msg;
+}
+
+void
+bench_chunk_delivery ()
+{
+    printf ("Benchmark chunk delivery:\n");
+    zctx_t *ctx = zctx_new ();
+    void *output = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_bind (output, "inproc://bench-chunk-delivery");
+    void *input = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_connect (input, "inproc://bench-chunk-delivery");
+    byte *payload = (byte *) zmalloc (BENCH_CHUNK_SIZE);
+    uint64_t copied_chunk = 0, copied_frame = 0;
+    int64_t time_chunk = 0, time_frame = 0;
+    uint64_t sequence;
+
+    for (sequence = 0; sequence < BENCH_CHUNK_COUNT; sequence++) {
+        // CHUNK
+        zmsg_t *zyre_msg = s_bench_zyre_chunk (payload, sequence);
+        int64_t start = zclock_time ();
+        zs_msg_t *msg = zs_msg_unpack (zyre_msg);
+        byte *received = zframe_data (zs_msg_get_chunk (msg));
+        zchunk_t *chunk = zchunk_new (received, BENCH_CHUNK_SIZE);
+        copied_chunk += s_bytes_copied (received, zchunk_data (chunk), BENCH_CHUNK_SIZE);
+        zsync_msg_t *agent_msg = zsync_msg_new (ZSYNC_MSG_CHUNK);
+        zsync_msg_set_chunk (agent_msg, chunk);
+        zmsg_t *pipe_msg = zsync_msg_encode (agent_msg);
+        byte *encoded = zframe_data (zmsg_first (pipe_msg));
+        copied_chunk += s_bytes_copied (received, encoded, BENCH_CHUNK_SIZE);
+        agent_msg = zsync_msg_decode (pipe_msg);
+        copied_chunk += s_bytes_copied (encoded, zchunk_data (zsync_msg_chunk (agent_msg)), BENCH_CHUNK_SIZE);
+        time_chunk += zclock_time () - start;
+        zsync_msg_destroy (&agent_msg);
+        zs_msg_destroy (&msg);
+        zmsg_destroy (&zyre_msg);
+
+        // CHUNK_FRAME
+        zyre_msg = s_bench_zyre_chunk (payload, sequence);
+        start = zclock_time ();
+        msg = zs_msg_unpack (zyre_msg);
+        received = zframe_data (zs_msg_get_chunk (msg));
+        zframe_t *frame = zs_msg_detach_chunk (msg);
+        zsync_msg_send_chunk_frame (output, "bench.bin", sequence, sequence * BENCH_CHUNK_SIZE, &frame);
+        agent_msg = zsync_msg_recv (input);
+        copied_frame += s_bytes_copied (received, zframe_data (zsync_msg_frame (agent_msg)), BENCH_CHUNK_SIZE);
+        time_frame += zclock_time () - start;
+        zsync_msg_destroy (&agent_msg);
+        zs_msg_destroy (&msg);
+        zmsg_destroy (&zyre_msg);
+    }
+    printf ("    CHUNK:       %"PRId64" bytes copied per chunk, %"PRId64" ms\n",
+            copied_chunk / BENCH_CHUNK_COUNT, time_chunk);
+    printf ("    CHUNK_FRAME: %"PRId64" bytes copied per chunk, %"PRId64" ms\n",
+            copied_frame / BENCH_CHUNK_COUNT, time_frame);
+    free (payload);
+    zctx_destroy (&ctx);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the bytes copied when serving a chunk read by the agent. The
+// agent hands over its read buffer with a free callback in RES_CHUNK_FRAME,
+// which is sent through a pipe like the agent does.
+
+static void
+s_bench_free_region (void *data, void *arg)
+{
+    free (data);
+}
+
+void
+bench_chunk_serving ()
+{
+    printf ("Benchmark chunk serving:\n");
+    zctx_t *ctx = zctx_new ();
+    void *output = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_bind (output, "inproc://bench-chunk-serving");
+    void *input = zsocket_new (ctx, ZMQ_PAIR);
+    zsocket_connect (input, "inproc://bench-chunk-serving");
+    uint64_t copied_chunk = 0, copied_frame = 0;
+    int64_t time_chunk = 0, time_frame = 0;
+    uint64_t sequence;
+
+    for (sequence = 0; sequence < BENCH_CHUNK_COUNT; sequence++) {
+        // RES_CHUNK
+        byte *region = (byte *) zmalloc (BENCH_CHUNK_SIZE);
+        int64_t start = zclock_time ();
+        zsync_msg_t *agent_msg = zsync_msg_new (ZSYNC_MSG_RES_CHUNK);
+        zchunk_t *chunk = zchunk_new (region, BENCH_CHUNK_SIZE);
+        copied_chunk += s_bytes_copied (region, zchunk_data (chunk), BENCH_CHUNK_SIZE);
+        zsync_msg_set_chunk (agent_msg, chunk);
+        zmsg_t *pipe_msg = zsync_msg_encode (agent_msg);
+        byte *encoded = zframe_data (zmsg_first (pipe_msg));
+        copied_chunk += s_bytes_copied (region, encoded, BENCH_CHUNK_SIZE);
+        agent_msg = zsync_msg_decode (pipe_msg);
+        chunk = zsync_msg_chunk (agent_msg);
+        copied_chunk += s_bytes_copied (encoded, zchunk_data (chunk), BENCH_CHUNK_SIZE);
+        zframe_t *frame = zframe_new (zchunk_data (chunk), zchunk_size (chunk));
+        byte *sent = zframe_data (frame);
+        copied_chunk += s_bytes_copied (zchunk_data (chunk), sent, BENCH_CHUNK_SIZE);
+        zmsg_t *zyre_msg = zmsg_new ();
+        zs_msg_pack_chunk (zyre_msg, sequence, "bench.bin", sequence * BENCH_CHUNK_SIZE, frame);
+        time_chunk += zclock_time () - start;
+        zmsg_destroy (&zyre_msg);
+        zsync_msg_destroy (&agent_msg);
+        free (region);
+
+        // RES_CHUNK_FRAME
+        region = (byte *) zmalloc (BENCH_CHUNK_SIZE);
+        start = zclock_time ();
+        frame = zframe_new_zero_copy (region, BENCH_CHUNK_SIZE, s_bench_free_region, NULL);
+        zsync_msg_send_res_chunk_frame (output, sequence, &frame);
+        agent_msg = zsync_msg_recv (input);
+        frame = zsync_msg_get_frame (agent_msg);
+        sent = zframe_data (frame);
+        zyre_msg = zmsg_new ();
+        zs_msg_pack_chunk (zyre_msg, sequence, "bench.bin", sequence * BENCH_CHUNK_SIZE, frame);
+        copied_frame += s_bytes_copied (region, sent, BENCH_CHUNK_SIZE);
+        time_frame += zclock_time () - start;
+        zmsg_destroy (&zyre_msg);
+        zsync_msg_destroy (&agent_msg);
+    }
+    printf ("    RES_CHUNK:       %"PRId64" bytes copied per chunk, %"PRId64" ms\n",
+            copied_chunk / BENCH_CHUNK_COUNT, time_chunk);
+    printf ("    RES_CHUNK_FRAME: %"PRId64" bytes copied per chunk, %"PRId64" ms\n",
+            copied_frame / BENCH_CHUNK_COUNT, time_frame);
+    zctx_destroy (&ctx);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the CPU time the file transfer manager spends per transferred MB
+// and while it waits for credit. CPU time is measured for the whole process.
+
+#define BENCH_TRANSFER_SIZE (1024 * 1024 * 100)
+
+void
+bench_ftmanager_cpu ()
+{
+    printf ("Benchmark file transfer manager:\n");
+    zctx_t *ctx = zctx_new ();
+    void *pipe = zthread_fork (ctx, zsync_ftmanager_engine, NULL);
+    zlist_t *paths = zlist_new ();
+    zlist_append (paths, "bench.bin");
+    zsync_ftm_msg_send_request (pipe, "bench", paths, CHUNK_SIZE, CHUNK_SIZE, ZSYNC_PRIORITY_BULK, NULL);
+    zlist_destroy (&paths);
+    zclock_sleep (100);
+
+    // Give credit for ten chunks at a time, like the credit manager does
+    uint64_t transferred = 0;
+    clock_t start = clock ();
+    int64_t start_time = zclock_time ();
+    while (transferred < BENCH_TRANSFER_SIZE) {
+        zsync_ftm_msg_send_credit (pipe, "bench", CHUNK_SIZE * 10);
+        int chunks;
+        for (chunks = 0; chunks < 10; chunks++) {
+            zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+            transferred += zsync_ftm_msg_chunk_size (msg);
+            zsync_ftm_msg_destroy (&msg);
+        }
+    }
+    double cpu_ms = (double) (clock () - start) * 1000 / CLOCKS_PER_SEC;
+    int64_t time_ms = zclock_time () - start_time;
+    printf ("    transfer:          %.3f ms CPU per MB, %"PRId64" ms total\n",
+            cpu_ms / (transferred / (1024 * 1024)), time_ms);
+
+    // Peer has outstanding files but no credit left
+    start = clock ();
+    zclock_sleep (1000);
+    cpu_ms = (double) (clock () - start) * 1000 / CLOCKS_PER_SEC;
+    printf ("    waiting on credit: %.3f ms CPU per second\n", cpu_ms);
+
+    zsync_ftm_msg_send_terminate (pipe);
+    zsync_ftm_msg_t *msg = zsync_ftm_msg_recv (pipe);
+    zsync_ftm_msg_destroy (&msg);
+    zctx_destroy (&ctx);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the throughput of the checksum and the digest of file contents.
+
+#define BENCH_HASH_SIZE (1024 * 1024 * 16)
+
+void
+bench_hashing ()
+{
+    printf ("Benchmark hashing:\n");
+    byte *data = (byte *) malloc (BENCH_HASH_SIZE);
+    memset (data, 0x5A, BENCH_HASH_SIZE);
+    double size_mb = BENCH_HASH_SIZE / (1024 * 1024);
+
+    int64_t start = zclock_time ();
+    uint64_t checksum = zsync_hash_xxh64 (data, BENCH_HASH_SIZE, 0);
+    int64_t time_ms = zclock_time () - start;
+    printf ("    xxh64 %016"PRIx64":   %.0f MB/s\n", checksum, size_mb * 1000 / (time_ms? time_ms: 1));
+
+    byte digest [ZSYNC_DIGEST_SIZE];
+    start = zclock_time ();
+    zsync_hash_sha256 (data, BENCH_HASH_SIZE, digest);
+    time_ms = zclock_time () - start;
+    printf ("    sha256:                   %.0f MB/s\n", size_mb * 1000 / (time_ms? time_ms: 1));
+    free (data);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the bytes on the wire when a few blocks of a large file change.
+// A full transfer sends every chunk, a delta transfer sends the signature
+// of the old copy and the instructions to rebuild the new one.
+
+#define BENCH_DELTA_SIZE (1024 * 1024 * 64)
+#define BENCH_DELTA_CHANGES 16
+
+void
+bench_delta_transfer ()
+{
+    printf ("Benchmark delta transfer:\n");
+    byte *data = (byte *) malloc (BENCH_DELTA_SIZE);
+    uint32_t seed = 7;
+    size_t index;
+    for (index = 0; index < BENCH_DELTA_SIZE; index++) {
+        seed = seed * 1103515245 + 12345;
+        data [index] = (byte) (seed >> 16);
+    }
+    FILE *file = fopen (".bench_delta", "wb");
+    fwrite (data, 1, BENCH_DELTA_SIZE, file);
+    fclose (file);
+
+    // Change a few bytes spread over the file
+    for (index = 0; index < BENCH_DELTA_CHANGES; index++)
+        memset (data + index * (BENCH_DELTA_SIZE / BENCH_DELTA_CHANGES) + 4321, 0xFF, 100);
+
+    uint64_t full_bytes = 0, delta_bytes = 0;
+    uint64_t offset;
+    for (offset = 0; offset < BENCH_DELTA_SIZE; offset += CHUNK_SIZE) {
+        uint64_t size = BENCH_DELTA_SIZE - offset < CHUNK_SIZE? BENCH_DELTA_SIZE - offset: CHUNK_SIZE;
+        zmsg_t *msg = zmsg_new ();
+        zs_msg_pack_chunk (msg, offset / CHUNK_SIZE, "bench.bin", offset, zframe_new (data + offset, size));
+        full_bytes += zmsg_content_size (msg);
+        zmsg_destroy (&msg);
+    }
+
+    int64_t start = zclock_time ();
+    zframe_t *signature = zsync_delta_signature (".bench_delta", 0);
+    zmsg_t *msg = zmsg_new ();
+    zs_msg_pack_request_delta (msg, "bench.bin", zframe_dup (signature));
+    delta_bytes += zmsg_content_size (msg);
+    zmsg_destroy (&msg);
+    zsync_delta_t *delta = zsync_delta_new (signature);
+    for (offset = 0; offset < BENCH_DELTA_SIZE; offset += CHUNK_SIZE) {
+        uint64_t size = BENCH_DELTA_SIZE - offset < CHUNK_SIZE? BENCH_DELTA_SIZE - offset: CHUNK_SIZE;
+        uint64_t target_offset = zsync_delta_offset (delta);
+        zframe_t *ops = zsync_delta_feed (delta, data + offset, size, offset + size == BENCH_DELTA_SIZE);
+        msg = zmsg_new ();
+        zs_msg_pack_delta (msg, offset / CHUNK_SIZE, "bench.bin", target_offset, ops);
+        delta_bytes += zmsg_content_size (msg);
+        zmsg_destroy (&msg);
+    }
+    int64_t time_ms = zclock_time () - start;
+    printf ("    full transfer:    %"PRIu64" bytes\n", full_bytes);
+    printf ("    delta transfer:   %"PRIu64" bytes, %"PRIu64" literal, %"PRId64" ms\n",
+            delta_bytes, zsync_delta_literal_bytes (delta), time_ms);
+    zsync_delta_destroy (&delta);
+    zframe_destroy (&signature);
+    zsys_file_delete (".bench_delta");
+    free (data);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the bytes on the wire when receiving new versions of a file,
+// like a build artefact which changes in a few places. A full transfer
+// sends every version, with deduplication only the manifests and the
+// missing ranges are sent.
+
+#define BENCH_DEDUP_ROOT ".bench_dedup"
+#define BENCH_DEDUP_FILES 8
+#define BENCH_DEDUP_SIZE (1024 * 1024 * 4)
+
+void
+bench_dedup_transfer ()
+{
+    printf ("Benchmark deduplicated transfer:\n");
+    zsys_dir_create (BENCH_DEDUP_ROOT);
+    byte *data = (byte *) malloc (BENCH_DEDUP_SIZE + 1000);
+    uint32_t seed = 13;
+    size_t index;
+    for (index = 0; index < BENCH_DEDUP_SIZE; index++) {
+        seed = seed * 1103515245 + 12345;
+        data [index] = (byte) (seed >> 16);
+    }
+    zsync_cdc_t *cdc = zsync_cdc_new (0, 0, 0);
+    zsync_chunkstore_t *store = zsync_chunkstore_new (BENCH_DEDUP_ROOT);
+    uint64_t full_bytes = 0, dedup_bytes = 0;
+    int64_t start = zclock_time ();
+    int file_nbr;
+    for (file_nbr = 0; file_nbr < BENCH_DEDUP_FILES; file_nbr++) {
+        // Every version inserts a few bytes and patches a few others
+        memmove (data + 1000 + file_nbr * 10, data + 1000, BENCH_DEDUP_SIZE - 1000);
+        memset (data + 1000, file_nbr, file_nbr * 10);
+        memset (data + BENCH_DEDUP_SIZE / 2, file_nbr, 64);
+        size_t size = BENCH_DEDUP_SIZE + file_nbr * 10;
+
+        // Manifest computed by the sending peer
+        FILE *file = fopen (BENCH_DEDUP_ROOT "/sender.bin", "wb");
+        fwrite (data, 1, size, file);
+        fclose (file);
+        zframe_t *manifest = zsync_cdc_manifest (cdc, BENCH_DEDUP_ROOT "/sender.bin");
+        zmsg_t *msg = zmsg_new ();
+        zs_msg_pack_manifest (msg, "build.bin", zframe_dup (manifest));
+        dedup_bytes += zmsg_content_size (msg);
+        zmsg_destroy (&msg);
+
+        // Receiving peer, which updates its copy
+        char *path = "build.bin";
+        zframe_t *ranges = zsync_chunkstore_assemble (store, manifest, path);
+        msg = zmsg_new ();
+        zs_msg_pack_request_ranges (msg, path, zframe_dup (ranges));
+        dedup_bytes += zmsg_content_size (msg);
+        zmsg_destroy (&msg);
+        uint64_t offset;
+        for (offset = 0; offset < size; offset += CHUNK_SIZE) {
+            uint64_t chunk_size = size - offset < CHUNK_SIZE? size - offset: CHUNK_SIZE;
+            msg = zmsg_new ();
+            zs_msg_pack_chunk (msg, offset / CHUNK_SIZE, path, offset, zframe_new (data + offset, chunk_size));
+            full_bytes += zmsg_content_size (msg);
+            zmsg_destroy (&msg);
+        }
+        int64_t range_nbr;
+        for (range_nbr = 0; range_nbr < zsync_cdc_ranges_count (ranges); range_nbr++) {
+            uint64_t range_offset, range_length;
+            zsync_cdc_ranges_get (ranges, range_nbr, &range_offset, &range_length);
+            zsync_chunkstore_write (store, path, range_offset, data + range_offset, range_length);
+            for (offset = range_offset; offset < range_offset + range_length; offset += CHUNK_SIZE) {
+                uint64_t chunk_size = range_offset + range_length - offset;
+                if (chunk_size > CHUNK_SIZE)
+                    chunk_size = CHUNK_SIZE;
+                msg = zmsg_new ();
+                zs_msg_pack_chunk (msg, offset / CHUNK_SIZE, path, offset, zframe_new (data + offset, chunk_size));
+                dedup_bytes += zmsg_content_size (msg);
+                zmsg_destroy (&msg);
+            }
+        }
+        int rc = zsync_chunkstore_complete (store, manifest, path);
+        assert (rc == 0);
+        zframe_destroy (&ranges);
+        zframe_destroy (&manifest);
+    }
+    int64_t time_ms = zclock_time () - start;
+    printf ("    full transfer:    %"PRIu64" bytes\n", full_bytes);
+    printf ("    deduplicated:     %"PRIu64" bytes, %"PRId64" ms\n", dedup_bytes, time_ms);
+
+    zsync_chunkstore_destroy (&store);
+    zsync_cdc_destroy (&cdc);
+    zsys_file_delete (BENCH_DEDUP_ROOT "/build.bin");
+    zsys_file_delete (BENCH_DEDUP_ROOT "/sender.bin");
+    zsys_file_delete (BENCH_DEDUP_ROOT "/" ZSYNC_STATE_DIR "/chunks");
+    rmdir (BENCH_DEDUP_ROOT "/" ZSYNC_STATE_DIR "/partial");
+    rmdir (BENCH_DEDUP_ROOT "/" ZSYNC_STATE_DIR);
+    rmdir (BENCH_DEDUP_ROOT);
+    free (data);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark encoding the UPDATE of a large tree at once and in parts. The
+// largest frame is what either side has to hold in memory at a time.
+
+#define BENCH_UPDATE_FILES 200000
+
+static zlist_t *
+s_bench_update_list ()
+{
+    zlist_t *list = zlist_new ();
+    byte digest [ZSYNC_DIGEST_SIZE] = { 0 };
+    int index;
+    for (index = 0; index < BENCH_UPDATE_FILES; index++) {
+        zs_fmetadata_t *meta = zs_fmetadata_new ();
+        zs_fmetadata_set_path (meta, "project/src/module-%03d/file-%06d.c", index % 500, index);
+        zs_fmetadata_set_operation (meta, ZS_FILE_OP_UPD);
+        zs_fmetadata_set_size (meta, index);
+        zs_fmetadata_set_timestamp (meta, index);
+        zs_fmetadata_set_checksum (meta, index);
+        zs_fmetadata_set_digest (meta, digest);
+        zlist_append (list, meta);
+    }
+    return list;
+}
+
+void
+bench_update_parts ()
+{
+    printf ("Benchmark UPDATE of %d files:\n", BENCH_UPDATE_FILES);
+    zlist_t *list = s_bench_update_list ();
+    int64_t start = zclock_time ();
+    zmsg_t *msg = zmsg_new ();
+    zs_msg_pack_update (msg, 1, list);
+    size_t whole_size = zmsg_content_size (msg);
+    zmsg_destroy (&msg);
+    printf ("    single frame:  %zu bytes, %"PRId64" ms\n", whole_size, zclock_time () - start);
+
+    list = s_bench_update_list ();
+    start = zclock_time ();
+    size_t largest = 0;
+    int parts = 0;
+    while (zlist_size (list) > 0) {
+        zlist_t *batch = zs_msg_update_batch (list, ZS_UPDATE_BATCH_SIZE);
+        msg = zmsg_new ();
+        if (zlist_size (list) > 0)
+            zs_msg_pack_update_part (msg, 1, batch);
+        else
+            zs_msg_pack_update (msg, 1, batch);
+        if (zmsg_content_size (msg) > largest)
+            largest = zmsg_content_size (msg);
+        parts++;
+        zmsg_destroy (&msg);
+    }
+    zlist_destroy (&list);
+    printf ("    %d parts:    largest %zu bytes, %"PRId64" ms\n", parts, largest, zclock_time () - start);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark size and speed of the plain and the compact UPDATE encoding
+
+static void
+s_bench_update_encoding (char *name, byte encoding)
+{
+    zlist_t *list = s_bench_update_list ();
+    int64_t start = zclock_time ();
+    zmsg_t *msg = zmsg_new ();
+    zs_msg_pack_update_encoded (msg, ZS_CMD_UPDATE, encoding, 1, list);
+    int64_t pack_ms = zclock_time () - start;
+    size_t size = zmsg_content_size (msg);
+    start = zclock_time ();
+    zs_msg_t *update = zs_msg_unpack (msg);
+    int64_t unpack_ms = zclock_time () - start;
+    assert (zlist_size (zs_msg_get_fmetadata (update)) == BENCH_UPDATE_FILES);
+    zs_msg_destroy (&update);
+    zmsg_destroy (&msg);
+    printf ("    %s %zu bytes, pack %"PRId64" ms, unpack %"PRId64" ms\n", name, size, pack_ms, unpack_ms);
+}
+
+void
+bench_update_encoding ()
+{
+    printf ("Benchmark UPDATE encoding of %d files:\n", BENCH_UPDATE_FILES);
+    s_bench_update_encoding ("plain:  ", ZS_ENCODING_PLAIN);
+    s_bench_update_encoding ("compact:", ZS_ENCODING_COMPACT);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark unpacking a large UPDATE onto the heap and into an arena, as
+// the node does for every message it receives
+
+void
+bench_update_unpack ()
+{
+    printf ("Benchmark UPDATE unpack of %d files:\n", BENCH_UPDATE_FILES);
+    zmsg_t *msg = zmsg_new ();
+    zs_msg_pack_update (msg, 1, s_bench_update_list ());
+    // Unpacking consumes the frames
+    zmsg_t *copy = zmsg_dup (msg);
+    int64_t start = zclock_time ();
+    zs_msg_t *update = zs_msg_unpack (copy);
+    zs_msg_destroy (&update);
+    printf ("    heap:   %"PRId64" ms\n", zclock_time () - start);
+    zmsg_destroy (&copy);
+
+    zsync_arena_t *arena = zsync_arena_new (0);
+    start = zclock_time ();
+    update = zs_msg_unpack_arena (msg, arena);
+    assert (zlist_size (zs_msg_get_fmetadata (update)) == BENCH_UPDATE_FILES);
+    zs_msg_destroy (&update);
+    size_t arena_size = zsync_arena_size (arena);
+    zsync_arena_reset (arena);
+    printf ("    arena:  %"PRId64" ms, %zu bytes\n", zclock_time () - start, arena_size);
+    zsync_arena_destroy (&arena);
+    zmsg_destroy (&msg);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the memory taken by the meta data of a large index
+
+#define BENCH_INDEX_FILES 1000000
+
+void
+bench_fmetadata_memory ()
+{
+    printf ("Benchmark meta data of %d files:\n", BENCH_INDEX_FILES);
+    byte digest [ZSYNC_DIGEST_SIZE] = { 0 };
+    zs_fmlist_t *index = zs_fmlist_new ();
+    zs_fmetadata_t *meta = zs_fmetadata_new ();
+    size_t path_bytes = 0;
+    int64_t start = zclock_time ();
+    int file;
+    for (file = 0; file < BENCH_INDEX_FILES; file++) {
+        zs_fmetadata_set_path (meta, "project/src/module-%03d/file-%07d.c", file % 500, file);
+        zs_fmetadata_set_operation (meta, ZS_FILE_OP_UPD);
+        zs_fmetadata_set_size (meta, file);
+        zs_fmetadata_set_timestamp (meta, file);
+        zs_fmetadata_set_checksum (meta, file);
+        zs_fmetadata_set_digest (meta, digest);
+        zs_fmlist_append (index, meta);
+        path_bytes += strlen (zs_fmetadata_path_ref (meta)) + 1;
+    }
+    int64_t build_ms = zclock_time () - start;
+    zs_fmetadata_destroy (&meta);
+    printf ("    STRING_MAX paths:  %zu MB\n", (size_t) BENCH_INDEX_FILES * (STRING_MAX + 1) >> 20);
+    printf ("    exact paths:       %zu MB\n", path_bytes >> 20);
+    printf ("    zs_fmlist:         %zu MB, %"PRId64" ms\n", zs_fmlist_memory (index) >> 20, build_ms);
+    zs_fmlist_destroy (&index);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark answering an UPDATE for a few recent changes and for the whole
+// tree from the change log
+
+#define BENCH_CHANGELOG ".bench_changelog"
+#define BENCH_CHANGELOG_RECENT 100
+
+void
+bench_changelog_update ()
+{
+    printf ("Benchmark change log of %d files:\n", BENCH_UPDATE_FILES);
+    zsys_file_delete (BENCH_CHANGELOG);
+    zsync_changelog_t *log = zsync_changelog_new (BENCH_CHANGELOG);
+    zlist_t *list = s_bench_update_list ();
+    int64_t start = zclock_time ();
+    zs_fmetadata_t *meta = (zs_fmetadata_t *) zlist_first (list);
+    int index;
+    for (index = 0; meta; index++) {
+        zsync_changelog_append (log, index < BENCH_UPDATE_FILES - BENCH_CHANGELOG_RECENT? 1: 2, meta);
+        meta = (zs_fmetadata_t *) zlist_next (list);
+    }
+    zsync_changelog_flush (log);
+    printf ("    append and flush: %"PRId64" ms\n", zclock_time () - start);
+    s_destroy_list (&list);
+
+    start = zclock_time ();
+    list = zsync_changelog_update (log, 1);
+    int64_t recent_ms = zclock_time () - start;
+    assert (zlist_size (list) == BENCH_CHANGELOG_RECENT);
+    s_destroy_list (&list);
+    start = zclock_time ();
+    list = zsync_changelog_update (log, 0);
+    assert (zlist_size (list) == BENCH_UPDATE_FILES);
+    printf ("    %d recent: %"PRId64" ms, full: %"PRId64" ms\n",
+            BENCH_CHANGELOG_RECENT, recent_ms, zclock_time () - start);
+    s_destroy_list (&list);
+    zsync_changelog_destroy (&log);
+    zsys_file_delete (BENCH_CHANGELOG);
+}
+
+// --------------------------------------------------------------------------
+// Benchmark the time from writing a file until the watcher reports it
+
+#define BENCH_WATCHER_ROOT ".bench_watcher"
+#define BENCH_WATCHER_FILES 100
+
+void
+bench_watcher_latency ()
+{
+    printf ("Benchmark watcher latency:\n");
+    zsys_dir_create (BENCH_WATCHER_ROOT);
+    zsync_watcher_t *watcher = zsync_watcher_new (BENCH_WATCHER_ROOT);
+    if (!watcher) {
+        printf ("    not supported\n");
+        rmdir (BENCH_WATCHER_ROOT);
+        return;
+    }
+    int64_t start = zclock_time ();
+    char path [64];
+    int index;
+    for (index = 0; index < BENCH_WATCHER_FILES; index++) {
+        sprintf (path, BENCH_WATCHER_ROOT "/file-%d", index);
+        FILE *file = fopen (path, "w");
+        assert (file);
+        fputs ("content", file);
+        fclose (file);
+    }
+    zlist_t *changes = zsync_watcher_changes (watcher, 1000);
+    int64_t latency = zclock_time () - start;
+    assert (changes);
+    printf ("    %zu of %d files in %"PRId64" ms\n", zlist_size (changes), BENCH_WATCHER_FILES, latency);
+    s_destroy_list (&changes);
+    zsync_watcher_destroy (&watcher);
+    for (index = 0; index < BENCH_WATCHER_FILES; index++) {
+        sprintf (path, BENCH_WATCHER_ROOT "/file-%d", index);
+        zsys_file_delete (path);
+    }
+    rmdir (BENCH_WATCHER_ROOT);
+}
+
 int 
 main (int argc, char *argv [])
 {
     printf("Running self tests...\n");
     zs_msg_test ();
+    zs_fmetadata_test ();
+    zs_fmlist_test ();
+    zsync_hash_test ();
+    zsync_delta_test ();
+    zsync_cdc_test ();
+    zsync_chunkstore_test ();
+    zsync_arena_test ();
+    zsync_bucket_test ();
+    zsync_recordlog_test ();
+    zsync_journal_test ();
+    zsync_progress_test ();
+    zsync_changelog_test ();
+    zsync_scanner_test ();
+    zsync_watcher_test ();
     zsync_credit_test ();
     zsync_ftmanager_test ();
     zsync_node_test ();
     zsync_agent_test ();
+    // Benchmarks only run with "bench", any other argument runs the
+    // integration test
+    if (argc > 1 && streq (argv [1], "bench")) {
+        bench_chunk_delivery ();
+        bench_chunk_serving ();
+        bench_ftmanager_cpu ();
+        bench_hashing ();
+        bench_delta_transfer ();
+        bench_dedup_transfer ();
+        bench_update_parts ();
+        bench_update_encoding ();
+        bench_update_unpack ();
+        bench_fmetadata_memory ();
+        bench_changelog_update ();
+        bench_watcher_latency ();
+    }
+    else
     if (argc > 1) {
         test_integrate_components ();
     }
     printf("Tests passed OK\n");
 }
-
@@ -0,0 +1,713 @@
+/* =========================================================================
+    zsync_watcher - captures file changes as they happen
+
+   -------------------------------------------------------------------------
+   Copyright (c) 2013 Kevin Sapper, Bernhard Finger
+   Copyright other contributors as noted in the AUTHORS file.
+   
+   This file is part of ZeroSync, see http://zerosync.org.
+   
+   This is free software; you can redistribute it and/or modify it under
+   the terms of the GNU Lesser General Public License as published by the
+   Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+   This software is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTA-
+   BILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+   Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see http://www.gnu.org/licenses/.
+   =========================================================================
+*/
+
+/*
+@header
+    ZeroSync file watcher, captures the changes below a root directory as
+    they happen so they can be sent without scanning the tree.
+
+@discuss
+    The watcher uses inotify with a watch on every directory. Events are
+    collected into batches: a batch starts with the first event and ends
+    once no further event arrived within the debounce time, or after ten
+    times that time while events keep coming. The changes of a path are
+    coalesced within a batch, so a file written in many steps is reported
+    once. Moves inside the tree become renames. Files moved out of the
+    tree are deleted, a directory moved out or a queue overflow can't be
+    resolved from the events and is reported by zsync_watcher_overflowed.
+    Watching needs Linux, elsewhere zsync_watcher_new returns NULL.
+
+    The agent doesn't own the tree, so the watcher isn't wired into it.
+    The caller applies each batch to its zsync_scanner_t, scans after an
+    overflow, and passes the changes to zsync_send_update, as done in
+    the integration test of zsync_selftest.
+@end
+*/
+
+#include "zsync_classes.h"
+
+#if defined (__linux__)
+#   define HAVE_INOTIFY
+#   include <sys/inotify.h>
+#   include <poll.h>
+#endif
+
+#define WATCHER_DEBOUNCE 50
+// A batch ends after this many debounce times even if events keep coming
+#define WATCHER_BATCH_FACTOR 10
+#define WATCHER_HASH_THREADS 2
+#define WATCHER_BUFFER_SIZE (64 * 1024)
+
+#ifdef HAVE_INOTIFY
+#   define WATCHER_MASK (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE \
+                       | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW)
+#endif
+
+struct _zsync_watcher_t {
+    char *root;                 // root directory of the tree
+    int fd;                     // inotify instance
+    int debounce;               // ms a batch waits for further changes
+    zhash_t *watches;           // directory path by watch descriptor
+    zhash_t *changes;           // pending change by path
+    zlist_t *order;             // pending changes in the order they came
+    zhash_t *moves;             // paths moved away by cookie
+    bool overflowed;            // changes have been lost
+};
+
+// Pending change of a path
+typedef struct {
+    char *path;
+    char *origin;               // path before a rename
+    int operation;              // ZS_FILE_OP_UPD, DEL or REN
+    bool modified;              // renamed file changed afterwards
+    bool dropped;               // superseded by another change
+} s_change_t;
+
+// Path moved away, waiting for its destination
+typedef struct {
+    char *path;
+    bool dir;
+} s_move_t;
+
+static void
+s_change_free (s_change_t *change)
+{
+    free (change->path);
+    free (change->origin);
+    free (change);
+}
+
+static void
+s_move_free (void *data)
+{
+    s_move_t *move = (s_move_t *) data;
+    free (move->path);
+    free (move);
+}
+
+static char *
+s_path_join (const char *dir, const char *name)
+{
+    char *path = (char *) malloc (strlen (dir) + strlen (name) + 2);
+    if (*dir)
+        sprintf (path, "%s/%s", dir, name);
+    else
+        strcpy (path, name);
+    return path;
+}
+
+static s_change_t *
+s_change_new (zsync_watcher_t *self, const char *path, int operation)
+{
+    s_change_t *change = (s_change_t *) zmalloc (sizeof (s_change_t));
+    change->path = strdup (path);
+    change->operation = operation;
+    zlist_append (self->order, change);
+    zhash_update (self->changes, path, change);
+    return change;
+}
+
+// Supersedes the pending change of path, if any
+static void
+s_change_drop (zsync_watcher_t *self, const char *path)
+{
+    s_change_t *change = (s_change_t *) zhash_lookup (self->changes, path);
+    if (change) {
+        change->dropped = true;
+        zhash_delete (self->changes, path);
+    }
+}
+
+// A file has been created or written
+static void
+s_touch (zsync_watcher_t *self, const char *path)
+{
+    s_change_t *change = (s_change_t *) zhash_lookup (self->changes, path);
+    if (!change)
+        s_change_new (self, path, ZS_FILE_OP_UPD);
+    else
+    if (change->operation == ZS_FILE_OP_DEL)
+        change->operation = ZS_FILE_OP_UPD;
+    else
+    if (change->operation == ZS_FILE_OP_REN)
+        change->modified = true;
+}
+
+// A file has been deleted
+static void
+s_remove (zsync_watcher_t *self, const char *path)
+{
+    s_change_t *change = (s_change_t *) zhash_lookup (self->changes, path);
+    if (!change)
+        s_change_new (self, path, ZS_FILE_OP_DEL);
+    else
+    if (change->operation == ZS_FILE_OP_UPD)
+        change->operation = ZS_FILE_OP_DEL;
+    else
+    if (change->operation == ZS_FILE_OP_REN) {
+        // Peers only know the file by its origin
+        char *origin = change->origin;
+        change->origin = NULL;
+        s_change_drop (self, path);
+        s_change_drop (self, origin);
+        s_change_new (self, origin, ZS_FILE_OP_DEL);
+        free (origin);
+    }
+}
+
+// A file has been moved inside the tree
+static void
+s_rename (zsync_watcher_t *self, const char *from, const char *to)
+{
+    s_change_drop (self, to);
+    s_change_t *change = (s_change_t *) zhash_lookup (self->changes, from);
+    if (change && change->operation == ZS_FILE_OP_UPD) {
+        // Peers may not have the new content under the old name
+        s_remove (self, from);
+        s_touch (self, to);
+        return;
+    }
+    char *origin = strdup (from);
+    bool modified = false;
+    if (change && change->operation == ZS_FILE_OP_REN) {
+        // Renamed again, peers still know the first name
+        free (origin);
+        origin = strdup (change->origin);
+        modified = change->modified;
+    }
+    s_change_drop (self, from);
+    change = s_change_new (self, to, ZS_FILE_OP_REN);
+    change->origin = origin;
+    change->modified = modified;
+}
+
+// Calls fn for every file below the directory at path, relative to root
+static void
+s_walk_files (zsync_watcher_t *self, const char *path,
+              void (*fn) (zsync_watcher_t *, const char *, void *), void *arg)
+{
+    char *full_path = s_path_join (self->root, path);
+    DIR *dir = opendir (full_path);
+    free (full_path);
+    if (!dir)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir (dir)) != NULL) {
+        if (streq (ent->d_name, ".") || streq (ent->d_name, ".."))
+            continue;
+        struct stat st;
+        if (fstatat (dirfd (dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+        char *child = s_path_join (path, ent->d_name);
+        if (S_ISDIR (st.st_mode)) {
+            // Private state is never synced
+            if (strneq (child, ZSYNC_STATE_DIR))
+                s_walk_files (self, child, fn, arg);
+        }
+        else
+        if (S_ISREG (st.st_mode))
+            fn (self, child, arg);
+        free (child);
+    }
+    closedir (dir);
+}
+
+#ifdef HAVE_INOTIFY
+
+// Watches the directory at path and all directories below it
+static void
+s_watch_dir (zsync_watcher_t *self, const char *path)
+{
+    char *full_path = s_path_join (self->root, path);
+    int wd = inotify_add_watch (self->fd, full_path, WATCHER_MASK | IN_ONLYDIR);
+    DIR *dir = wd == -1? NULL: opendir (full_path);
+    free (full_path);
+    if (!dir)
+        return;
+    char key [16];
+    sprintf (key, "%d", wd);
+    zhash_update (self->watches, key, (void *) path);
+
+    struct dirent *ent;
+    while ((ent = readdir (dir)) != NULL) {
+        if (streq (ent->d_name, ".") || streq (ent->d_name, ".."))
+            continue;
+        struct stat st;
+        if (fstatat (dirfd (dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+        &&  S_ISDIR (st.st_mode)) {
+            char *child = s_path_join (path, ent->d_name);
+            if (strneq (child, ZSYNC_STATE_DIR))
+                s_watch_dir (self, child);
+            free (child);
+        }
+    }
+    closedir (dir);
+}
+
+#endif
+
+static void
+s_touch_fn (zsync_watcher_t *self, const char *path, void *arg)
+{
+    s_touch (self, path);
+}
+
+// Renames a file below a renamed directory, arg is the old directory
+static void
+s_rename_fn (zsync_watcher_t *self, const char *path, void *arg)
+{
+    char *to_dir = ((char **) arg) [0];
+    char *from_dir = ((char **) arg) [1];
+    char *from = s_path_join (from_dir, path + strlen (to_dir) + 1);
+    s_rename (self, from, path);
+    free (from);
+}
+
+// Points the watches of a moved directory and its subdirectories to the
+// new path
+static void
+s_move_watches (zsync_watcher_t *self, const char *from, const char *to)
+{
+    size_t from_size = strlen (from);
+    zlist_t *keys = zhash_keys (self->watches);
+    char *key = (char *) zlist_first (keys);
+    while (key) {
+        char *path = (char *) zhash_lookup (self->watches, key);
+        if (strncmp (path, from, from_size) == 0
+        && (path [from_size] == 0 || path [from_size] == '/')) {
+            char *moved = (char *) malloc (strlen (to) + strlen (path) - from_size + 1);
+            sprintf (moved, "%s%s", to, path + from_size);
+            zhash_update (self->watches, key, moved);
+            free (moved);
+        }
+        key = (char *) zlist_next (keys);
+    }
+    zlist_destroy (&keys);
+}
+
+#ifdef HAVE_INOTIFY
+
+// Applies an event to the pending changes
+static void
+s_handle_event (zsync_watcher_t *self, struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW) {
+        self->overflowed = true;
+        return;
+    }
+    char key [16];
+    sprintf (key, "%d", event->wd);
+    if (event->mask & IN_IGNORED) {
+        zhash_delete (self->watches, key);
+        return;
+    }
+    char *dir = (char *) zhash_lookup (self->watches, key);
+    if (!dir || event->len == 0)
+        return;
+    char *path = s_path_join (dir, event->name);
+    if (streq (path, ZSYNC_STATE_DIR)) {
+        // Private state is never synced
+        free (path);
+        return;
+    }
+    bool is_dir = (event->mask & IN_ISDIR) != 0;
+
+    if (event->mask & IN_MOVED_FROM) {
+        s_move_t *move = (s_move_t *) zmalloc (sizeof (s_move_t));
+        move->path = path;
+        move->dir = is_dir;
+        sprintf (key, "%u", event->cookie);
+        zhash_update (self->moves, key, move);
+        zhash_freefn (self->moves, key, s_move_free);
+        return;
+    }
+    if (event->mask & IN_MOVED_TO) {
+        sprintf (key, "%u", event->cookie);
+        s_move_t *move = (s_move_t *) zhash_lookup (self->moves, key);
+        if (move && is_dir) {
+            s_move_watches (self, move->path, path);
+            char *dirs [2] = { path, move->path };
+            s_walk_files (self, path, s_rename_fn, dirs);
+        }
+        else
+        if (move)
+            s_rename (self, move->path, path);
+        else
+        if (is_dir) {
+            // Moved into the tree
+            s_watch_dir (self, path);
+            s_walk_files (self, path, s_touch_fn, NULL);
+        }
+        else
+            s_touch (self, path);
+        if (move)
+            zhash_delete (self->moves, key);
+    }
+    else
+    if (is_dir) {
+        // Files may have been created before the watch was added
+        if (event->mask & IN_CREATE) {
+            s_watch_dir (self, path);
+            s_walk_files (self, path, s_touch_fn, NULL);
+        }
+    }
+    else
+    if (event->mask & IN_DELETE)
+        s_remove (self, path);
+    else
+        s_touch (self, path);
+    free (path);
+}
+
+// Reads and applies all waiting events
+static void
+s_read_events (zsync_watcher_t *self)
+{
+    char buffer [WATCHER_BUFFER_SIZE]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    while (true) {
+        ssize_t size = read (self->fd, buffer, sizeof (buffer));
+        if (size <= 0)
+            break;
+        char *needle = buffer;
+        while (needle < buffer + size) {
+            struct inotify_event *event = (struct inotify_event *) needle;
+            s_handle_event (self, event);
+            needle += sizeof (struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Waits up to timeout ms for events, returns true if there are any
+static bool
+s_wait (zsync_watcher_t *self, int timeout)
+{
+    struct pollfd item = { self->fd, POLLIN, 0 };
+    return poll (&item, 1, timeout) > 0;
+}
+
+#endif
+
+// Resolves moves whose destination is outside of the tree
+static void
+s_resolve_moves (zsync_watcher_t *self)
+{
+    zlist_t *keys = zhash_keys (self->moves);
+    char *key = (char *) zlist_first (keys);
+    while (key) {
+        s_move_t *move = (s_move_t *) zhash_lookup (self->moves, key);
+        if (move->dir)
+            self->overflowed = true;
+        else
+            s_remove (self, move->path);
+        zhash_delete (self->moves, key);
+        key = (char *) zlist_next (keys);
+    }
+    zlist_destroy (&keys);
+}
+
+// Turns the pending changes into file meta data
+static zlist_t *
+s_collect (zsync_watcher_t *self)
+{
+    zlist_t *fmetadata_list = zlist_new ();
+    s_change_t *change = (s_change_t *) zlist_pop (self->order);
+    while (change) {
+        zs_fmetadata_t *fmetadata = NULL;
+        if (!change->dropped && change->operation == ZS_FILE_OP_REN) {
+            fmetadata = zs_fmetadata_new ();
+            zs_fmetadata_set_path (fmetadata, "%s", change->origin);
+            zs_fmetadata_set_renamed_path (fmetadata, "%s", change->path);
+            zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_REN);
+            zlist_append (fmetadata_list, fmetadata);
+            fmetadata = NULL;
+        }
+        if (!change->dropped && change->operation == ZS_FILE_OP_DEL) {
+            fmetadata = zs_fmetadata_new ();
+            zs_fmetadata_set_path (fmetadata, "%s", change->path);
+            zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_DEL);
+        }
+        if (!change->dropped
+        && (change->operation == ZS_FILE_OP_UPD || change->modified)) {
+            char *full_path = s_path_join (self->root, change->path);
+            struct stat st;
+            if (lstat (full_path, &st) == 0 && S_ISREG (st.st_mode)) {
+                fmetadata = zs_fmetadata_new ();
+                zs_fmetadata_set_path (fmetadata, "%s", change->path);
+                zs_fmetadata_set_operation (fmetadata, ZS_FILE_OP_UPD);
+                zs_fmetadata_set_size (fmetadata, st.st_size);
+                zs_fmetadata_set_timestamp (fmetadata, st.st_mtime);
+            }
+            free (full_path);
+        }
+        if (fmetadata)
+            zlist_append (fmetadata_list, fmetadata);
+        s_change_free (change);
+        change = (s_change_t *) zlist_pop (self->order);
+    }
+    zhash_destroy (&self->changes);
+    self->changes = zhash_new ();
+
+    if (zlist_size (fmetadata_list) == 0) {
+        zlist_destroy (&fmetadata_list);
+        return NULL;
+    }
+    zsync_hash_fmetadata (self->root, fmetadata_list, WATCHER_HASH_THREADS);
+    return fmetadata_list;
+}
+
+
+// --------------------------------------------------------------------------
+// Watches the tree below root for changes. Returns NULL if the platform
+// can't watch files.
+
+zsync_watcher_t *
+zsync_watcher_new (const char *root)
+{
+    assert (root);
+#ifdef HAVE_INOTIFY
+    int fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    zsync_watcher_t *self = (zsync_watcher_t *) zmalloc (sizeof (zsync_watcher_t));
+    self->root = strdup (root);
+    self->fd = fd;
+    self->debounce = WATCHER_DEBOUNCE;
+    self->watches = zhash_new ();
+    zhash_autofree (self->watches);
+    self->changes = zhash_new ();
+    self->order = zlist_new ();
+    self->moves = zhash_new ();
+    s_watch_dir (self, "");
+    if (zhash_size (self->watches) == 0)
+        zsync_watcher_destroy (&self);
+    return self;
+#else
+    return NULL;
+#endif
+}
+
+
+// --------------------------------------------------------------------------
+// Stops watching and destroys the watcher
+
+void
+zsync_watcher_destroy (zsync_watcher_t **self_p)
+{
+    assert (self_p);
+
+    if (*self_p) {
+        zsync_watcher_t *self = *self_p;
+        close (self->fd);
+        s_change_t *change = (s_change_t *) zlist_pop (self->order);
+        while (change) {
+            s_change_free (change);
+            change = (s_change_t *) zlist_pop (self->order);
+        }
+        zlist_destroy (&self->order);
+        zhash_destroy (&self->changes);
+        zhash_destroy (&self->moves);
+        zhash_destroy (&self->watches);
+        free (self->root);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+// --------------------------------------------------------------------------
+// Sets the time in ms a batch waits for further changes
+
+void
+zsync_watcher_set_debounce (zsync_watcher_t *self, int debounce)
+{
+    assert (self);
+    self->debounce = debounce > 0? debounce: 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Returns a file descriptor which is readable when changes are waiting
+
+int
+zsync_watcher_fd (zsync_watcher_t *self)
+{
+    assert (self);
+    return self->fd;
+}
+
+
+// --------------------------------------------------------------------------
+// Waits up to timeout ms for changes and returns them coalesced, or NULL
+// if nothing changed. Caller owns list and entries.
+
+zlist_t *
+zsync_watcher_changes (zsync_watcher_t *self, int timeout)
+{
+    assert (self);
+#ifdef HAVE_INOTIFY
+    if (!s_wait (self, timeout))
+        return NULL;
+    int64_t deadline = zclock_time () + WATCHER_BATCH_FACTOR * self->debounce;
+    do {
+        s_read_events (self);
+    } while (zclock_time () < deadline && s_wait (self, self->debounce));
+    s_resolve_moves (self);
+#endif
+    return s_collect (self);
+}
+
+
+// --------------------------------------------------------------------------
+// Returns true once if changes were lost, the tree has to be scanned again
+
+bool
+zsync_watcher_overflowed (zsync_watcher_t *self)
+{
+    assert (self);
+    bool overflowed = self->overflowed;
+    self->overflowed = false;
+    return overflowed;
+}
+
+
+// --------------------------------------------------------------------------
+// Selftest
+
+#define TEST_ROOT ".zsync_watcher_test"
+
+static void
+s_test_write (char *path, char *content)
+{
+    FILE *file = fopen (path, "w");
+    assert (file);
+    fputs (content, file);
+    fclose (file);
+}
+
+static zs_fmetadata_t *
+s_test_find (zlist_t *list, char *path, int operation)
+{
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_first (list);
+    while (fmetadata) {
+        if (streq (zs_fmetadata_path_ref (fmetadata), path)
+        &&  zs_fmetadata_operation (fmetadata) == operation)
+            return fmetadata;
+        fmetadata = (zs_fmetadata_t *) zlist_next (list);
+    }
+    return NULL;
+}
+
+static void
+s_test_destroy_list (zlist_t **list_p)
+{
+    zs_fmetadata_t *fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    while (fmetadata) {
+        zs_fmetadata_destroy (&fmetadata);
+        fmetadata = (zs_fmetadata_t *) zlist_pop (*list_p);
+    }
+    zlist_destroy (list_p);
+}
+
+void
+zsync_watcher_test ()
+{
+    printf (" * zsync_watcher: ");
+    zsys_dir_create (TEST_ROOT);
+    zsync_watcher_t *watcher = zsync_watcher_new (TEST_ROOT);
+#ifdef HAVE_INOTIFY
+    assert (watcher);
+    zsync_watcher_set_debounce (watcher, 20);
+    assert (zsync_watcher_changes (watcher, 0) == NULL);
+
+    // Bursts of writes are coalesced, files are hashed
+    s_test_write (TEST_ROOT "/a", "a");
+    s_test_write (TEST_ROOT "/a", "aa");
+    s_test_write (TEST_ROOT "/a", "aaa");
+    zlist_t *changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 1);
+    zs_fmetadata_t *fmetadata = s_test_find (changes, "a", ZS_FILE_OP_UPD);
+    assert (fmetadata);
+    assert (zs_fmetadata_size (fmetadata) == 3);
+    assert (zs_fmetadata_checksum (fmetadata) == zsync_hash_xxh64 ("aaa", 3, 0));
+    s_test_destroy_list (&changes);
+
+    // Files in new directories are found
+    zsys_dir_create (TEST_ROOT "/dir");
+    s_test_write (TEST_ROOT "/dir/b", "bb");
+    changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 1);
+    assert (s_test_find (changes, "dir/b", ZS_FILE_OP_UPD));
+    s_test_destroy_list (&changes);
+
+    // Moves become renames, also of the files in moved directories
+    rename (TEST_ROOT "/a", TEST_ROOT "/c");
+    rename (TEST_ROOT "/dir", TEST_ROOT "/sub");
+    changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 2);
+    fmetadata = s_test_find (changes, "a", ZS_FILE_OP_REN);
+    assert (streq (zs_fmetadata_renamed_path_ref (fmetadata), "c"));
+    fmetadata = s_test_find (changes, "dir/b", ZS_FILE_OP_REN);
+    assert (streq (zs_fmetadata_renamed_path_ref (fmetadata), "sub/b"));
+    s_test_destroy_list (&changes);
+
+    // Watches follow the moved directory
+    s_test_write (TEST_ROOT "/sub/b", "bbb");
+    changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 1);
+    assert (s_test_find (changes, "sub/b", ZS_FILE_OP_UPD));
+    s_test_destroy_list (&changes);
+
+    // A renamed and deleted file is deleted under its old name
+    rename (TEST_ROOT "/c", TEST_ROOT "/d");
+    zsys_file_delete (TEST_ROOT "/d");
+    zsys_file_delete (TEST_ROOT "/sub/b");
+    changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 2);
+    assert (s_test_find (changes, "c", ZS_FILE_OP_DEL));
+    assert (s_test_find (changes, "sub/b", ZS_FILE_OP_DEL));
+    s_test_destroy_list (&changes);
+
+    // Private state is never synced, files moved out of it are created
+    zsys_dir_create (TEST_ROOT "/" ZSYNC_STATE_DIR);
+    s_test_write (TEST_ROOT "/" ZSYNC_STATE_DIR "/e", "e");
+    assert (zsync_watcher_changes (watcher, 100) == NULL);
+    rename (TEST_ROOT "/" ZSYNC_STATE_DIR "/e", TEST_ROOT "/e");
+    changes = zsync_watcher_changes (watcher, 1000);
+    assert (zlist_size (changes) == 1);
+    assert (s_test_find (changes, "e", ZS_FILE_OP_UPD));
+    s_test_destroy_list (&changes);
+    zsys_file_delete (TEST_ROOT "/e");
+    rmdir (TEST_ROOT "/" ZSYNC_STATE_DIR);
+    changes = zsync_watcher_changes (watcher, 1000);
+    if (changes)
+        s_test_destroy_list (&changes);
+    assert (!zsync_watcher_overflowed (watcher));
+    zsync_watcher_destroy (&watcher);
+    rmdir (TEST_ROOT "/sub");
+#else
+    assert (watcher == NULL);
+#endif
+    rmdir (TEST_ROOT);
+    printf ("OK\n");
+}